@@ -0,0 +1,63 @@
+#ifndef CONFIGBUS_H
+#define CONFIGBUS_H
+
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "Doppelganger/json.h"
+
+namespace Doppelganger
+{
+	////
+	// changes of config delivered to a subscriber of ConfigBus (at most one event per merge, i.e. batched)
+	////
+	struct ConfigChange
+	{
+		// whole config (e.g. on setup). pointers is empty
+		bool all = false;
+		// JSON pointers (e.g. "/plugin/reInstall") of changed values that overlap the subscribed prefixes
+		//   a value added/replaced/removed as a whole is reported once (e.g. "/server" for {"server": null})
+		std::vector<std::string> pointers;
+
+		// true if the value at pointer, its descendants or its ancestors are changed
+		bool touches(const std::string &pointer) const;
+	};
+
+	////
+	// observer bus of config (e.g. Room::config, Core::config)
+	//   components subscribe to JSON pointer prefixes (e.g. "/log", "/server/certificate")
+	//   publishAll(): every subscriber (e.g. on setup)
+	//   merge(config, patch): merges patch (RFC 7386) into config, then notifies subscribers of changed values once
+	//     values patched with what they already are are not changes (i.e. reactions run only when their inputs change)
+	//   subscribers are notified in the order of subscription.
+	//   a subscriber returning false stops the following ones (e.g. "active": false -> shutdown)
+	////
+	class ConfigBus
+	{
+	public:
+		using Subscriber = std::function<bool(const ConfigChange &)>;
+
+		void subscribe(std::initializer_list<const char *> prefixes, const Subscriber &subscriber);
+
+		// false if a subscriber stopped the following ones
+		bool publishAll() const;
+		bool merge(json &config, const json &patch) const;
+
+		// values in config changed by merging patch (config is not modified)
+		static ConfigChange diff(const json &config, const json &patch);
+
+	private:
+		bool publish(const ConfigChange &change) const;
+
+		struct subscription
+		{
+			std::vector<std::string> prefixes;
+			Subscriber subscriber;
+		};
+		std::vector<subscription> subscriptions_;
+	};
+}
+
+#endif
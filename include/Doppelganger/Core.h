@@ -3,10 +3,13 @@
 
 #include "Doppelganger/Util/filesystem.h"
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <mutex>
+#include <vector>
 
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
@@ -21,9 +24,13 @@
 #include <boost/make_unique.hpp>
 #include <boost/optional.hpp>
 
-#include <nlohmann/json.hpp>
+#include "Doppelganger/json.h"
+#include "Doppelganger/ConfigBus.h"
 #include "Doppelganger/Plugin.h"
-#include "Doppelganger/Util/log.h"
+#include "Doppelganger/Logger.h"
+#include "Doppelganger/RoomRegistry.h"
+#include "Doppelganger/IOContextPool.h"
+#include "Doppelganger/RoomScheduler.h"
 
 namespace Doppelganger
 {
@@ -33,8 +40,7 @@ namespace Doppelganger
 	class Core : public std::enable_shared_from_this<Core>
 	{
 	public:
-		Core(boost::asio::io_context &ioc,
-			 boost::asio::ssl::context &ctx);
+		explicit Core(IOContextPool &ioContextPool);
 
 		void setup();
 		void run();
@@ -48,23 +54,98 @@ namespace Doppelganger
 		// void to_json(nlohmann::json &json, const nlohmann::json &ptrStrArray) const;
 		// void to_json(nlohmann::json &json, const nlohmann::json_pointer &ptr) const;
 		// void from_json(const nlohmann::json &json);
+		// all of config (e.g. on setup)
 		void applyCurrentConfig(const bool firstTime = false);
+		// merges the patch into config, and notifies subscribers of changed values only (see ConfigBus)
+		void applyConfigPatch(const json &patch);
 		void storeCurrentConfig() const;
 
 	public:
-		nlohmann::json config;
+		// written only on setup()/run() (before io_context threads start) and under applyConfigPatch()
+		//   i.e. io_context threads never read it directly (see configSnapshot())
+		json config;
+		// immutable copy of config, republished after every applyCurrentConfig()/applyConfigPatch()
+		std::shared_ptr<const json> configSnapshot() const
+		{
+			return std::atomic_load(&configSnapshot_);
+		}
+		// config.at("log") as bit flags (see Logger::levelMask())
+		std::atomic<std::uint32_t> logLevels_;
+		// same as config.at("dataDir") (set once on setup, i.e. read without locks, e.g. by DOPPELGANGER_LOG)
+		std::string dataDir_;
+		// config.at("server").at("pipelineLimit"/"idleTimeout") for new HTTP sessions
+		std::atomic<std::uint32_t> pipelineLimit_;
+		std::atomic<std::uint32_t> idleTimeout_;
+		// "/metrics" and "/spans" (config.at("server").at("diagnostics"))
+		//   they list room UUIDs (i.e. they grant access to every room), so they are only for
+		//   loopback clients and/or clients sending "Authorization: Bearer <token>"
+		bool diagnosticsAllowed(const boost::asio::ip::address &remote, const boost::beast::string_view authorization) const;
 
 		////
 		// parameters **NOT** stored in nlohmann::json
-		std::unordered_map<std::string, std::shared_ptr<Doppelganger::Room>> rooms_;
+		// accessed from all io_context threads
+		Doppelganger::RoomRegistry rooms_;
+		Doppelganger::IOContextPool &ioContextPool_;
+		// home contexts of rooms
+		Doppelganger::RoomScheduler roomScheduler_;
+
+		// context for new TLS connections (replaced when the certificate is reloaded)
+		std::shared_ptr<boost::asio::ssl::context> sslContext() const
+		{
+			return std::atomic_load(&sslContext_);
+		}
 
 	private:
-		void loadServerCertificate(const fs::path &certificatePath, const fs::path &privateKeyPath);
-		std::shared_ptr<Listener> listener_;
+		// (re)load config.at("server").at("certificate") (see serverSettings_) if the files differ from the loaded ones
+		//   returns false if they cannot be loaded (the current context is kept)
+		bool loadServerCertificate();
+		// periodically hibernate idle rooms (see Room::hibernate()) and rebalance rooms (see RoomScheduler)
+		void scheduleIdleCheck();
+		void checkIdleRooms();
+		// one listener per io_context in "perCore" mode
+		std::vector<std::shared_ptr<Listener>> listeners_;
+		void subscribeConfig();
+		// inactive rooms and "forceReload" (after every applyCurrentConfig()/applyConfigPatch())
+		void applyRooms(const bool firstTime);
+		// subscribers of applyCurrentConfig()/applyConfigPatch() per JSON pointer prefix
+		ConfigBus configBus_;
+		// serializes applyConfigPatch() (patches from plugins arrive on any io_context thread)
+		std::mutex mutexConfig_;
+		// accessed with std::atomic_load/atomic_store
+		std::shared_ptr<const json> configSnapshot_;
+		void publishConfig();
 
 	private:
+		// context 0 of ioContextPool_
 		boost::asio::io_context &ioc_;
-		boost::asio::ssl::context &ctx_;
+		// accessed with std::atomic_load/atomic_store
+		std::shared_ptr<boost::asio::ssl::context> sslContext_;
+		std::mutex mutexCertificate_;
+		// PEM of the loaded certificate/key and config.at("server").at("tls"), i.e. the context is rebuilt if any of them is changed
+		std::string certificateKey_;
+		// hash of the key that failed to load (logged once, and not retried until it is changed)
+		std::size_t failedCertificateHash_;
+		boost::asio::steady_timer idleTimer_;
+		// config.at("server").at("diagnostics") (token_ is accessed with std::atomic_load/atomic_store)
+		std::atomic<bool> diagnosticsLoopbackOnly_;
+		std::shared_ptr<const std::string> diagnosticsToken_;
+		// config.at("server") read outside ConfigBus subscribers (e.g. by idleTimer_ on context 0)
+		//   config is patched on any io_context thread (e.g. by plugins), i.e. we never read it from the timer
+		//   copied by subscribers, and accessed with std::atomic_load/atomic_store
+		struct ServerSettings
+		{
+			std::string protocol;
+			std::string certificateFilePath;
+			std::string privateKeyFilePath;
+			json tls;
+			double rebalanceSkew = 0.0;
+		};
+		std::shared_ptr<const ServerSettings> serverSettings_;
+		// called by subscribers (i.e. config is consistent)
+		void storeServerSettings();
+		// config.at("room").at("checkInterval"/"hibernateAfter") for idleTimer_
+		std::atomic<int> idleCheckInterval_;
+		std::atomic<int> hibernateAfter_;
 	};
 }
 
@@ -0,0 +1,103 @@
+#ifndef HTTP2SESSION_H
+#define HTTP2SESSION_H
+
+// HTTP/2 (only with DOPPELGANGER_HTTP2, see CMakeLists.txt)
+//   TLS: "h2" is negotiated with ALPN (see enableHTTP2)
+//   plain: h2c with prior knowledge (i.e. the connection preface, see HTTPSession::onRead)
+// frames are handled by nghttp2 (without its I/O, i.e. bytes are passed from/to the beast stream)
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+
+struct nghttp2_session;
+
+namespace Doppelganger
+{
+	class Core;
+
+	namespace beast = boost::beast;	  // from <boost/beast.hpp>
+	namespace http = beast::http;	  // from <boost/beast/http.hpp>
+	namespace ssl = boost::asio::ssl; // from <boost/asio/ssl.hpp>
+
+	template <class Stream>
+	class HTTP2Session : public std::enable_shared_from_this<HTTP2Session<Stream>>
+	{
+	public:
+		// buffer: bytes already read (must start with the connection preface)
+		HTTP2Session(
+			const std::weak_ptr<Core> &core,
+			Stream &&stream,
+			beast::flat_buffer &&buffer);
+		~HTTP2Session();
+
+		void run();
+
+		// called from nghttp2 callbacks
+		void onBeginHeaders(const std::int32_t streamId);
+		void onHeader(const std::int32_t streamId, const beast::string_view name, const beast::string_view value);
+		void onData(const std::int32_t streamId, const std::uint8_t *data, const std::size_t size);
+		void onRequest(const std::int32_t streamId);
+		void onStreamClose(const std::int32_t streamId);
+		// copies the response body to buf (at most length bytes). eof is set for the last chunk
+		std::size_t readBody(const std::int32_t streamId, std::uint8_t *buf, const std::size_t length, bool &eof);
+
+	private:
+		void doRead();
+		void onRead(beast::error_code ec, std::size_t bytes_transferred);
+		void doWrite();
+		void onWrite(beast::error_code ec, std::size_t bytes_transferred);
+		void submitResponse(const std::int32_t streamId, http::response<http::string_body> &&res);
+		void fail(beast::error_code ec, char const *what);
+
+		struct stream
+		{
+			http::request<http::string_body> request;
+			// response body (headers are copied by nghttp2)
+			std::string body;
+			std::size_t offset = 0;
+		};
+
+		const std::weak_ptr<Core> core_;
+		Stream stream_;
+		beast::flat_buffer buffer_;
+		nghttp2_session *session_;
+		std::unordered_map<std::int32_t, stream> streams_;
+		// frames being written (at most one async_write at a time)
+		std::string writeBuffer_;
+		bool writing_;
+		// config.at("server").at("idleTimeout") (only while no stream is open)
+		std::chrono::seconds idleTimeout_;
+	};
+
+	// responses are converted to string_body (e.g. file_body) and sent with send
+	//   defined in HTTPSession.cpp (i.e. the same routing as HTTP/1.1 except for websocket)
+	void handleHTTP2Request(
+		const std::shared_ptr<Core> &core,
+		http::request<http::string_body> &&req,
+		const boost::asio::ip::address &remote,
+		const std::function<void(http::response<http::string_body> &&)> &send);
+
+	// ALPN: "h2" is preferred over "http/1.1"
+	void enableHTTP2(ssl::context &ctx);
+
+	void makeHTTP2Session(
+		const std::weak_ptr<Core> &core,
+		beast::tcp_stream &&stream,
+		beast::flat_buffer &&buffer);
+
+	void makeHTTP2Session(
+		const std::weak_ptr<Core> &core,
+		beast::ssl_stream<beast::tcp_stream> &&stream,
+		beast::flat_buffer &&buffer);
+}
+
+#endif
@@ -4,6 +4,7 @@
 // see
 // https://www.boost.org/doc/libs/develop/libs/beast/example/advanced/server-flex/advanced_server_flex.cpp
 
+#include <chrono>
 #include <memory>
 #include <vector>
 
@@ -11,12 +12,15 @@
 #include <boost/beast/http.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/asio/bind_executor.hpp>
-#include <boost/make_unique.hpp>
 #include <boost/optional.hpp>
 
+#include "Doppelganger/RingArena.h"
+#include "Doppelganger/MonotonicArena.h"
+
 namespace Doppelganger
 {
 	class Core;
+	class Room;
 
 	namespace beast = boost::beast;	  // from <boost/beast.hpp>
 	namespace http = beast::http;	  // from <boost/beast/http.hpp>
@@ -28,6 +32,9 @@ namespace Doppelganger
 	class HTTPSession
 	{
 	public:
+		// fields (and target) of requests are placed in arena_
+		using Request = http::request<http::string_body, http::basic_fields<ArenaAllocator<char>>>;
+
 		HTTPSession(
 			const std::weak_ptr<Core> &core,
 			beast::flat_buffer buffer);
@@ -38,36 +45,77 @@ namespace Doppelganger
 
 	protected:
 		beast::flat_buffer buffer_;
+		const std::weak_ptr<Core> core_;
 		void fail(boost::system::error_code ec, char const *what);
 
 	private:
 		Derived &derived();
-
+		// on the home context of the room if any (see Room::homeContext_)
+		//   a slot of queue_ is reserved in request order, and filled when the response is posted back
+		//   (i.e. following requests are read and pipelined meanwhile)
+		void handleRoomRequest(const std::shared_ptr<Core> &core, const std::shared_ptr<Room> &room, const std::chrono::system_clock::time_point receivedAt);
+#if defined(DOPPELGANGER_HTTP2)
+		// h2c with prior knowledge (the connection is handed over to HTTP2Session)
+		void runHTTP2();
+#endif
+
+		////
+		// responses waiting to be written (HTTP/1.1 pipelining)
+		//   fixed-capacity ring of type-erased responses. responses are written (and destroyed) in the
+		//   order they are queued, i.e. they are placed in a RingArena (heap is used only if it's exhausted)
+		//   a request is read only while the ring is not full and each request gets one response, i.e. at most limit_ responses are queued
+		//   responses computed elsewhere (e.g. on the home context of a room) reserve their slot when the request is read,
+		//   and are written once every response before them is written. the ones filled out of order are placed on the heap
+		//   (RingArena is released in allocation order)
+		////
 		class queue
 		{
 		private:
-			enum
-			{
-				// Maximum number of responses we will queue
-				limit = 64
-			};
-
 			struct work
 			{
 				virtual ~work() = default;
 				virtual void operator()() = 0;
 			};
 
+			struct slot
+			{
+				work *item;
+				bool onHeap;
+			};
+
 			HTTPSession &self_;
-			std::vector<std::unique_ptr<work>> items_;
+			RingArena arena_;
+			// ring (capacity == limit_). item is nullptr for reserved slots
+			std::vector<slot> items_;
+			std::size_t front_;
+			std::size_t size_;
+			// Maximum number of responses we will queue (config.at("server").at("pipelineLimit"))
+			std::size_t limit_;
+			// number of slots reserved so far (i.e. ticket of the next slot). ticket of the front is reserved_ - size_
+			std::size_t reserved_;
+			// ticket + 1 of the newest slot placed in arena_
+			std::size_t arenaEnd_;
+
+			void fill(const std::size_t ticket, work *item, const bool onHeap);
+			void destroyFront();
 
 		public:
 			explicit queue(HTTPSession &self);
+			~queue();
 
+			// must be called before the first response
+			void setLimit(const std::size_t limit);
 			bool isFull() const;
 			bool onWrite();
+			// returns the ticket of the slot for fill()
+			std::size_t reserve();
 			template <bool isRequest, class Body, class Fields>
 			void operator()(http::message<isRequest, Body, Fields> &&msg)
+			{
+				fill(reserve(), std::move(msg));
+			}
+			template <bool isRequest, class Body, class Fields>
+			void fill(const std::size_t ticket, http::message<isRequest, Body, Fields> &&msg)
 			{
 				struct workImpl : work
 				{
@@ -93,19 +141,29 @@ namespace Doppelganger
 					}
 				};
 
-				items_.push_back(
-					boost::make_unique<workImpl>(self_, std::move(msg)));
-
-				if (items_.size() == 1)
+				// newer slots placed in arena_ would be released before this one
+				void *memory = (ticket >= arenaEnd_) ? arena_.allocate(sizeof(workImpl), alignof(workImpl)) : nullptr;
+				const bool onHeap = (memory == nullptr);
+				if (!onHeap)
 				{
-					(*items_.front())();
+					arenaEnd_ = ticket + 1;
 				}
+				fill(ticket, onHeap ? new workImpl(self_, std::move(msg)) : new (memory) workImpl(self_, std::move(msg)), onHeap);
 			}
 		};
 
+		enum
+		{
+			// bytes for requests (fields and target, enough for usual browsers). the arena grows if needed
+			requestArenaSize = 4096
+		};
+		// requests being parsed or handled (rewound in doRead() if all of them are released, e.g. not pipelined)
+		//   declared before parser_ and queue_, i.e. destroyed after them
+		MonotonicArena arena_;
 		queue queue_;
-		boost::optional<http::request_parser<http::string_body>> parser_;
-		const std::weak_ptr<Core> core_;
+		boost::optional<http::request_parser<http::string_body, ArenaAllocator<char>>> parser_;
+		// config.at("server").at("idleTimeout")
+		std::chrono::seconds idleTimeout_;
 	};
 
 	//------------------------------------------------------------------------------
@@ -139,7 +197,7 @@ namespace Doppelganger
 		SSLHTTPSession(
 			const std::weak_ptr<Core> &core,
 			beast::tcp_stream &&stream,
-			ssl::context &ctx,
+			const std::shared_ptr<ssl::context> &ctx,
 			beast::flat_buffer &&buffer);
 
 		void run();
@@ -148,7 +206,11 @@ namespace Doppelganger
 		void doEof();
 
 	private:
+		// keeps the context alive (i.e. a reloaded certificate doesn't affect this session)
+		const std::shared_ptr<ssl::context> ctx_;
 		beast::ssl_stream<beast::tcp_stream> stream_;
+		// for Metrics::TLSMetrics
+		std::chrono::steady_clock::time_point handshakeStart_;
 
 	private:
 		void onHandshake(
@@ -0,0 +1,89 @@
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include "Doppelganger/Util/filesystem.h"
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Doppelganger/json.h"
+
+namespace Doppelganger
+{
+	////
+	// Undo/redo history of a room, kept outside of Room::config
+	//   config.at("history").at("diffFromPrev") / config.at("history").at("diffFromNext") are moved into this store
+	//   (config keeps "index" and "extension") and materialized only for plugins requesting "/history".
+	//   each diff is stored as zlib-compressed CBOR in an append-only log
+	//     <dataDir>/history/history.bin : "DGHIST01" + record*
+	//       record : u8 array (0: diffFromPrev, 1: diffFromNext), u8 kind (0: entry, 1: truncate), u32 slot,
+	//                [entry only] u32 rawSize, u32 size, u64 hash, bytes    (little endian)
+	//   recently written diffs are cached in memory up to memoryBudget bytes, others are read from the log on demand.
+	////
+	class HistoryStore
+	{
+	public:
+		HistoryStore();
+
+		// open (create) the log in dir. existing log is replayed (e.g. recovery)
+		void open(const fs::path &dir, const std::size_t memoryBudget);
+		void close();
+		void remove();
+		bool isOpen() const
+		{
+			return log_.is_open();
+		}
+
+		// move diff arrays of configRoom.at("history") (if any) into the store
+		void absorb(json &configRoom);
+		// add diff arrays into history (i.e. configRoom.at("history") as before)
+		void materialize(json &history) const;
+		// drop cached diffs from memory (they are in the log)
+		void releaseMemory();
+
+		// compressed bytes cached in memory
+		std::size_t memoryUsage() const
+		{
+			return cachedBytes_;
+		}
+
+	private:
+		enum Array
+		{
+			DIFF_FROM_PREV = 0,
+			DIFF_FROM_NEXT = 1,
+			ARRAY_COUNT
+		};
+		struct Entry
+		{
+			std::uint64_t hash;
+			// position of the compressed bytes in the log
+			std::uint64_t offset;
+			std::uint32_t rawSize;
+			std::uint32_t size;
+			// compressed bytes (nullptr if not cached)
+			std::shared_ptr<const std::string> data;
+		};
+
+		void absorbArray(const Array array, const json &diffs);
+		void writeTruncate(const Array array, const std::uint32_t slot);
+		void writeEntry(const Array array, const std::uint32_t slot, const std::vector<std::uint8_t> &cbor, const std::uint64_t hash);
+		void replay();
+		void evict();
+		void compactLog();
+		fs::path logPath() const;
+
+		fs::path dir_;
+		std::ofstream log_;
+		std::uint64_t logSize_;
+		std::size_t memoryBudget_;
+		std::size_t cachedBytes_;
+		std::array<std::vector<Entry>, ARRAY_COUNT> entries_;
+	};
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef IOCONTEXTPOOL_H
+#define IOCONTEXTPOOL_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+namespace Doppelganger
+{
+	////
+	// io_contexts and their threads (see config.at("server").at("ioMode"))
+	//   "shared" : one io_context run by all threads (handlers may run on any thread)
+	//   "perCore": one io_context per thread (each thread is pinned to a core on Linux/Windows).
+	//              each context has its own acceptor (SO_REUSEPORT, see Listener) and each room has
+	//              a home context where its API calls and broadcasts are processed (see RoomScheduler)
+	////
+	class IOContextPool
+	{
+	public:
+		// context 0 exists from the beginning (e.g. for timers of Core)
+		IOContextPool();
+		IOContextPool(const IOContextPool &) = delete;
+		IOContextPool &operator=(const IOContextPool &) = delete;
+
+		// must be called before run()
+		//   threadCount == 0: std::thread::hardware_concurrency()
+		void configure(const bool perCore, const unsigned int threadCount);
+		// run all threads (the calling thread runs context 0) and block until stop()
+		void run();
+		void stop();
+
+		bool perCore() const
+		{
+			return perCore_;
+		}
+		std::size_t size() const
+		{
+			return contexts_.size();
+		}
+		boost::asio::io_context &at(const std::size_t index)
+		{
+			return *contexts_.at(index);
+		}
+		// size() if context is not in this pool (e.g. nullptr)
+		std::size_t index(const boost::asio::io_context *context) const;
+		// round robin (e.g. contexts of accepted sockets)
+		boost::asio::io_context &next();
+
+	private:
+		using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+		std::vector<std::unique_ptr<boost::asio::io_context>> contexts_;
+		std::vector<WorkGuard> workGuards_;
+		bool perCore_;
+		unsigned int threadCount_;
+		std::atomic<std::size_t> next_;
+	};
+}
+
+#endif
@@ -21,8 +21,10 @@
 #include <boost/optional.hpp>
 
 #include "Doppelganger/Core.h"
+#include "Doppelganger/IOContextPool.h"
 #include "Doppelganger/SSLDetector.h"
-#include "Doppelganger/Util/log.h"
+#include "Doppelganger/Logger.h"
+#include "Doppelganger/Tracing.h"
 
 namespace Doppelganger
 {
@@ -37,8 +39,12 @@ namespace Doppelganger
 	{
 	private:
 		const std::weak_ptr<Core> core_;
+		IOContextPool &ioContextPool_;
 		net::io_context &ioc_;
-		ssl::context &ctx_;
+		// other acceptors share the port (i.e. accepted connections stay on ioc_)
+		const bool reusePort_;
+		// acceptor_ is opened, bound and listening (see isBound())
+		bool bound_;
 
 		void fail(boost::system::error_code ec, char const *what)
 		{
@@ -47,11 +53,7 @@ namespace Doppelganger
 				return;
 			}
 
-			{
-				std::stringstream ss;
-				ss << what << ": " << ec.message();
-				Util::log(ss.str(), "ERROR", core_.lock()->config);
-			}
+			DOPPELGANGER_LOG(core_.lock(), ERROR, what << ": " << ec.message());
 		}
 
 	public:
@@ -59,10 +61,11 @@ namespace Doppelganger
 
 		Listener(
 			const std::weak_ptr<Core> &core,
+			IOContextPool &ioContextPool,
 			net::io_context &ioc,
-			ssl::context &ctx,
-			tcp::endpoint &endpoint)
-			: core_(core), ioc_(ioc), ctx_(ctx), acceptor_(net::make_strand(ioc))
+			tcp::endpoint &endpoint,
+			const bool reusePort)
+			: core_(core), ioContextPool_(ioContextPool), ioc_(ioc), reusePort_(reusePort), bound_(false), acceptor_(net::make_strand(ioc))
 		{
 			beast::error_code ec;
 
@@ -82,6 +85,21 @@ namespace Doppelganger
 				return;
 			}
 
+#if defined(_WIN64)
+#elif defined(__APPLE__)
+#elif defined(__linux__)
+			// Allow other acceptors (on other io_contexts) to bind the same port
+			if (reusePort_)
+			{
+				acceptor_.set_option(net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true), ec);
+				if (ec)
+				{
+					fail(ec, "set_option (Listener)");
+					return;
+				}
+			}
+#endif
+
 			// Bind to the server address
 			acceptor_.bind(endpoint, ec);
 			if (ec)
@@ -98,6 +116,31 @@ namespace Doppelganger
 				fail(ec, "listen (Listener)");
 				return;
 			}
+			bound_ = true;
+		}
+
+		// false if open/bind/listen failed (errors are logged), i.e. the listener must not be run
+		bool isBound() const
+		{
+			return bound_;
+		}
+
+		// true if nothing listens on endpoint, i.e. it can be bound without SO_REUSEPORT
+		//   (with SO_REUSEPORT, another instance of ours listening on the port would silently share it)
+		static bool isAvailable(net::io_context &ioc, const tcp::endpoint &endpoint)
+		{
+			beast::error_code ec;
+			tcp::acceptor probe(ioc);
+			probe.open(endpoint.protocol(), ec);
+			if (!ec)
+			{
+				probe.set_option(net::socket_base::reuse_address(true), ec);
+			}
+			if (!ec)
+			{
+				probe.bind(endpoint, ec);
+			}
+			return !ec;
 		}
 
 		// Start accepting incoming connections
@@ -110,8 +153,10 @@ namespace Doppelganger
 		void doAccept()
 		{
 			// The new connection gets its own strand
+			//   "perCore" without SO_REUSEPORT: connections are distributed to io_contexts
+			net::io_context &ioc = (reusePort_ || !ioContextPool_.perCore()) ? ioc_ : ioContextPool_.next();
 			acceptor_.async_accept(
-				net::make_strand(ioc_),
+				net::make_strand(ioc),
 				beast::bind_front_handler(
 					&Listener::onAccept,
 					shared_from_this()));
@@ -119,17 +164,21 @@ namespace Doppelganger
 
 		void onAccept(beast::error_code ec, tcp::socket socket)
 		{
+			DOPPELGANGER_TRACE_SPAN("Listener::onAccept");
 			if (ec)
 			{
 				fail(ec, "accept (Listener)");
 			}
 			else
 			{
+				// pipelined responses are written back to back (i.e. Nagle would delay them until ACK)
+				beast::error_code noDelayEc;
+				socket.set_option(tcp::no_delay(true), noDelayEc);
+
 				// Create the detector http_session and run it
 				std::make_shared<SSLDetector>(
 					core_,
-					std::move(socket),
-					ctx_)
+					std::move(socket))
 					->run();
 			}
 
@@ -0,0 +1,167 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "Doppelganger/Util/filesystem.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Doppelganger/json.h"
+
+namespace Doppelganger
+{
+	////
+	// Asynchronous logger
+	//   - producers (io threads) push into a bounded lock-free MPSC ring
+	//   - a background thread formats and writes messages in batches
+	//     (writev on POSIX) to STDOUT and/or <dataDir>/log/log.txt
+	//   - when the ring is full, messages are dropped and counted
+	////
+	class Logger
+	{
+	public:
+		// bit flags cached from config.at("log") (see levelMask())
+		enum Level : std::uint32_t
+		{
+			LEVEL_SYSTEM = 1u << 0,
+			LEVEL_APICALL = 1u << 1,
+			LEVEL_WSCALL = 1u << 2,
+			LEVEL_ERROR = 1u << 3,
+			LEVEL_MISC = 1u << 4,
+			LEVEL_DEBUG = 1u << 5,
+			LEVEL_ALL = (1u << 6) - 1u,
+			TYPE_STDOUT = 1u << 16,
+			TYPE_FILE = 1u << 17
+		};
+
+		static Logger &getInstance();
+
+		void start();
+		void stop();
+		// block until every message pushed so far is written
+		void flush();
+		// flush and close the file for <dataDir>/log (e.g. before the directory is removed)
+		//   reopen: the file is opened again by the next message (e.g. "FILE" is disabled). otherwise messages for dataDir are discarded
+		void closeSink(const std::string &dataDir, const bool reopen = false);
+
+		std::uint64_t droppedCount() const;
+
+		// replacement of Util::log (usually called through DOPPELGANGER_LOG)
+		//   mask: levels and types enabled for the target (see levelMask()), i.e. config is never read here
+		//   dataDir: <dataDir>/log/log.txt for "FILE" (empty: STDOUT only)
+		static void log(
+			std::string content,
+			const Level level,
+			const std::uint32_t mask,
+			const std::string &dataDir);
+
+		// levels and types enabled in config.at("log") as bit flags
+		static std::uint32_t levelMask(const json &config);
+
+	private:
+		Logger();
+		~Logger();
+		Logger(const Logger &) = delete;
+		Logger &operator=(const Logger &) = delete;
+
+		struct Entry
+		{
+			std::chrono::system_clock::time_point timestamp;
+			const char *level;
+			std::string content;
+			// empty if "FILE" is disabled
+			std::string dataDir;
+			bool toStdout;
+		};
+
+		struct Slot
+		{
+			std::atomic<std::size_t> sequence;
+			Entry entry;
+		};
+
+		bool push(Entry &&entry);
+		bool pop(Entry &entry);
+		void flusherLoop();
+		void writeBatch(std::vector<Entry> &batch);
+		// called by flusher_ at most once per pruneIntervalMs
+		void pruneSinks();
+
+		enum
+		{
+			// Maximum number of messages we will keep in the ring (must be power of 2)
+			capacity = 8192,
+			// Maximum number of messages we will write at once
+			batchSize = 512,
+			// Interval of dropping sinks whose log directory is removed (stat for each closed sink)
+			pruneIntervalMs = 1000
+		};
+
+		std::unique_ptr<Slot[]> slots_;
+		alignas(64) std::atomic<std::size_t> enqueuePos_;
+		alignas(64) std::size_t dequeuePos_;
+		std::atomic<std::size_t> processed_;
+		std::atomic<std::uint64_t> dropped_;
+		std::uint64_t droppedReported_;
+
+		std::thread flusher_;
+		std::atomic<bool> running_;
+		std::mutex mutexWake_;
+		std::condition_variable wake_;
+		std::condition_variable flushed_;
+
+		// file descriptors (or streams) for each log file. guarded by mutexSink_
+		struct Sink;
+		std::unordered_map<std::string, std::unique_ptr<Sink>> sinks_;
+		std::mutex mutexSink_;
+	};
+}
+
+////
+// Lazy logging
+//   DOPPELGANGER_LOG(target, LEVEL, message << ...);
+//     target: pointer to an object with "dataDir_" and "logLevels_" (i.e. Core or Room)
+//       config of target is NOT read (e.g. Room::config is swapped by hibernation without the lock of loggers)
+//     LEVEL : SYSTEM|APICALL|WSCALL|ERROR|MISC|DEBUG
+//   message is formatted only when the level is enabled both at compile time and in config
+////
+// levels compiled into the binary. by default, release builds strip DEBUG (see CMakeLists.txt)
+#if !defined(DOPPELGANGER_LOG_COMPILED_LEVELS)
+#if defined(DOPPELGANGER_LOG_STRIP_DEBUG)
+#define DOPPELGANGER_LOG_COMPILED_LEVELS (Doppelganger::Logger::LEVEL_ALL & ~Doppelganger::Logger::LEVEL_DEBUG)
+#else
+#define DOPPELGANGER_LOG_COMPILED_LEVELS (Doppelganger::Logger::LEVEL_ALL)
+#endif
+#endif
+
+#define DOPPELGANGER_LOG(target, level, ...)                                                   \
+	do                                                                                         \
+	{                                                                                          \
+		if ((Doppelganger::Logger::LEVEL_##level & (DOPPELGANGER_LOG_COMPILED_LEVELS)) != 0u) \
+		{                                                                                      \
+			const auto &logTarget_ = (target);                                                 \
+			const std::uint32_t logMask_ = logTarget_->logLevels_.load(std::memory_order_relaxed); \
+			if ((logMask_ & Doppelganger::Logger::LEVEL_##level) != 0u)                        \
+			{                                                                                  \
+				std::stringstream logContent_;                                                 \
+				logContent_ << __VA_ARGS__;                                                    \
+				Doppelganger::Logger::log(                                                     \
+					logContent_.str(),                                                         \
+					Doppelganger::Logger::LEVEL_##level,                                       \
+					logMask_,                                                                  \
+					logTarget_->dataDir_);                                                     \
+			}                                                                                  \
+		}                                                                                      \
+	} while (false)
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef MESHARENA_H
+#define MESHARENA_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace Doppelganger
+{
+	////
+	// Memory for mesh buffers (see MeshStore)
+	//   on Linux, buffers are placed in one shared memory file (memfd) mapped at a fixed (reserved) address range,
+	//   so they can be described by (offset, length) and mapped by others (e.g. a plugin host process) through fd().
+	//   blocks are 64-byte aligned. memory of large freed blocks (and of all blocks after the last allocated one) is returned to the OS.
+	//   otherwise (or if the reserved range is exhausted), buffers are allocated from the heap.
+	////
+	class MeshArena
+	{
+	public:
+		static const std::size_t alignment = 64;
+		// offset of buffers not in the shared memory
+		static const std::uint64_t invalidOffset = ~static_cast<std::uint64_t>(0);
+
+		// shared == false: heap only
+		explicit MeshArena(const bool shared = true);
+		~MeshArena();
+		MeshArena(const MeshArena &) = delete;
+		MeshArena &operator=(const MeshArena &) = delete;
+
+		// heap only (e.g. for buffers not owned by a room)
+		static MeshArena &heap();
+
+		// bytes of the address range reserved for the shared memory (i.e. upper limit of buffers in the shared memory)
+		//   takes effect if called before the first allocation
+		void reserve(const std::uint64_t capacity);
+
+		// unmap the shared memory and close fd() once no block is allocated in it (e.g. while the room is hibernated)
+		//   it's created again by the next allocate()
+		void release();
+
+		// throws std::bad_alloc
+		void *allocate(const std::size_t bytes);
+		void deallocate(void *ptr, const std::size_t bytes);
+
+		// position of ptr in the shared memory (invalidOffset if ptr is not in the shared memory)
+		std::uint64_t offset(const void *ptr) const;
+		// file descriptor of the shared memory (-1 if not available)
+		int fd() const
+		{
+			return fd_;
+		}
+		// bytes mapped (i.e. size of the file)
+		std::uint64_t mappedSize() const;
+
+	private:
+		bool initialize();
+		void unmap();
+		bool grow(const std::uint64_t size);
+		void *allocateHeap(const std::size_t bytes);
+		void deallocateHeap(void *ptr);
+
+		const bool shared_;
+		bool initialized_;
+		int fd_;
+		char *base_;
+		// requested by reserve()
+		std::uint64_t reservation_;
+		// reserved address range
+		std::uint64_t capacity_;
+		std::uint64_t mapped_;
+		// end of the last allocated block
+		std::uint64_t used_;
+		// offset -> length
+		std::map<std::uint64_t, std::uint64_t> freeBlocks_;
+		// release() is called while blocks are still allocated (e.g. referenced by a snapshot being written)
+		bool releasePending_;
+		mutable std::mutex mutex_;
+	};
+}
+
+#endif
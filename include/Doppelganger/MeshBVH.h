@@ -0,0 +1,95 @@
+#ifndef MESHBVH_H
+#define MESHBVH_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Doppelganger/MeshStore.h"
+
+namespace Doppelganger
+{
+	////
+	// Bounding volume hierarchy (AABB tree) over faces of a mesh version
+	//   built with binned SAH. the tree only depends on faces (topology), i.e. when only vertices move,
+	//   bounds are refit in O(#F) instead of rebuilding. vertices are given to each query.
+	//   see MeshStore::bvh() for the lifetime (built lazily, refit on deformation, rebuilt on topology change)
+	////
+	class MeshBVH
+	{
+	public:
+		struct RayHit
+		{
+			float t;
+			std::uint32_t face;
+			// hit point = (1 - u - v) * V0 + u * V1 + v * V2
+			float u;
+			float v;
+		};
+
+		struct ClosestPoint
+		{
+			float point[3];
+			float distance;
+			std::uint32_t face;
+		};
+
+		// faces of the tree are kept (i.e. writing into F creates a new block, see MeshStore)
+		explicit MeshBVH(const std::shared_ptr<AlignedMatrix<std::int32_t>> &F);
+
+		void build(const AlignedMatrix<float> &V);
+		// V must have the same number of rows as in build()
+		void refit(const AlignedMatrix<float> &V);
+
+		// closest hit within [0, maxT]
+		bool raycast(const AlignedMatrix<float> &V, const float origin[3], const float direction[3], const float maxT, RayHit &hit) const;
+		// closest point within maxDistance
+		bool closestPoint(const AlignedMatrix<float> &V, const float point[3], const float maxDistance, ClosestPoint &result) const;
+		// faces whose bounds overlap the box
+		void overlap(const AlignedMatrix<float> &V, const float boxMin[3], const float boxMax[3], std::vector<std::uint32_t> &faces) const;
+
+		const std::shared_ptr<AlignedMatrix<std::int32_t>> &faces() const
+		{
+			return F_;
+		}
+		std::uint32_t vertexCount() const
+		{
+			return vertexCount_;
+		}
+		// vertices may have been written in place since the last build/refit
+		bool stale() const
+		{
+			return stale_;
+		}
+		void markStale()
+		{
+			stale_ = true;
+		}
+		std::size_t bytes() const
+		{
+			return nodes_.capacity() * sizeof(Node) + order_.capacity() * sizeof(std::uint32_t);
+		}
+
+	private:
+		struct Node
+		{
+			float min[3];
+			float max[3];
+			// leaf: first index in order_. inner: index of the left child (the right child is next to it)
+			std::uint32_t first;
+			// leaf: #faces. inner: 0
+			std::uint32_t count;
+		};
+
+		void faceBounds(const AlignedMatrix<float> &V, const std::uint32_t face, float min[3], float max[3]) const;
+
+		std::shared_ptr<AlignedMatrix<std::int32_t>> F_;
+		std::vector<Node> nodes_;
+		// faces in leaf order (faces with invalid indices are excluded)
+		std::vector<std::uint32_t> order_;
+		std::uint32_t vertexCount_;
+		bool stale_;
+	};
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef MESHENCODER_H
+#define MESHENCODER_H
+
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Doppelganger/MeshStore.h"
+
+namespace Doppelganger
+{
+	////
+	// Compact encoding of meshes for clients (served as /<roomUUID>/mesh/<meshUUID>/<version>)
+	//   "DGMESH01"
+	//   u32 vertexCount, u32 faceCount, u32 flags (bit 0: normals)
+	//   f32 min[3], f32 max[3] (bounds of vertices)
+	//   u32 rawSize, u32 compressedSize, zlib(payload)                        (little endian)
+	//     payload : positions, [normals], indices
+	//       positions : per vertex, x, y, z quantized to u16 within bounds, delta from the previous vertex (zigzag varint)
+	//       normals   : per vertex, x, y, z as snorm8
+	//       indices   : per index, (next new vertex - index) as varint (i.e. 0 for a vertex not seen yet)
+	//   triangles are reordered for vertex cache (Forsyth) and vertices are reordered by first use.
+	//   i.e. vertex order is NOT preserved (this is for display).
+	//
+	// encoded meshes are cached (LRU, up to cacheLimit bytes). each version is encoded only once.
+	//   large meshes are encoded in the background (see MeshLOD::post()), i.e. io_context threads never wait for encoding.
+	////
+	class MeshEncoder
+	{
+	public:
+		enum
+		{
+			// meshes with fewer faces are encoded by the requesting thread (faster than the round trip of the client)
+			inlineFaceLimit = 16384
+		};
+
+		MeshEncoder();
+
+		// encoded mesh (nullptr while the version is being encoded)
+		//   start is set to true for the first request of the version, i.e. the caller must call encode() for it (e.g. in the background)
+		std::shared_ptr<const std::string> encoded(const std::string &meshUUID, const std::uint64_t version, bool &start);
+		// encode the version started by encoded() and cache it
+		//   mesh is a copy of the version in MeshStore (i.e. buffers are not modified while encoding)
+		//   throws if encoding fails (e.g. invalid vertex index). the version is started again by the next request
+		std::shared_ptr<const std::string> encode(const std::string &meshUUID, const std::uint64_t version, const MeshStore::Mesh &mesh);
+		// encoded level of detail (see MeshLOD), served as /<roomUUID>/mesh/<meshUUID>/<version>/<level>
+		void store(const std::string &meshUUID, const std::uint64_t version, const std::uint32_t level, const std::shared_ptr<const std::string> &blob);
+		// nullptr if not computed (yet) or evicted
+		std::shared_ptr<const std::string> lookup(const std::string &meshUUID, const std::uint64_t version, const std::uint32_t level);
+		void setCacheLimit(const std::size_t cacheLimit);
+		// bytes of cached meshes
+		std::size_t memoryUsage() const;
+
+		static std::string encode(const MeshStore::Mesh &mesh);
+
+	private:
+		struct Entry
+		{
+			std::shared_future<std::shared_ptr<const std::string>> encoded;
+			// set while the version is being encoded (see encode())
+			std::shared_ptr<std::promise<std::shared_ptr<const std::string>>> pending;
+			std::size_t bytes;
+			// position in lru_
+			std::list<std::string>::iterator lru;
+		};
+		void evict();
+
+		mutable std::mutex mutex_;
+		// <meshUUID>/<version> or <meshUUID>/<version>/<level>
+		std::unordered_map<std::string, Entry> cache_;
+		// most recently used first
+		std::list<std::string> lru_;
+		std::size_t cacheLimit_;
+		std::size_t cachedBytes_;
+	};
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef MESHLOD_H
+#define MESHLOD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Doppelganger/MeshStore.h"
+
+namespace Doppelganger
+{
+	class Room;
+
+	////
+	// Level of detail for large meshes
+	//   each version with many faces is decimated (quadric error metrics, igl::qslim) in the background,
+	//   by a factor of 4 per level (level 0 is the coarsest). levels are encoded (see MeshEncoder),
+	//   stored in Room::meshEncoder_ and announced to WS sessions from coarse to fine (see Room::announceMeshLevels()).
+	//   jobs for an older version of the same mesh are replaced by the newer one.
+	//   the workers also run other heavy work on meshes (see post(), e.g. encoding for MeshEncoder).
+	////
+	class MeshLOD
+	{
+	public:
+		struct Level
+		{
+			std::uint32_t faceCount;
+			std::size_t bytes;
+		};
+
+		static MeshLOD &getInstance();
+
+		// mesh is a copy of the version in Room::meshes_ (room is kept alive while buffers are referenced)
+		//   transferBudget: seconds. refinements taking longer for a session are not announced to it
+		void submit(const std::shared_ptr<Room> &room, const std::string &meshUUID, const std::uint64_t version, const MeshStore::Mesh &mesh, const double transferBudget);
+		// run task on a worker (task must keep what it refers to alive, e.g. the room)
+		void post(std::function<void()> &&task);
+		void stop();
+
+	private:
+		struct Job
+		{
+			std::shared_ptr<Room> room;
+			std::string meshUUID;
+			std::uint64_t version;
+			MeshStore::Mesh mesh;
+			double transferBudget;
+			// see post() (the other members are not used)
+			std::function<void()> task;
+		};
+
+		MeshLOD();
+		~MeshLOD();
+		MeshLOD(const MeshLOD &) = delete;
+		MeshLOD &operator=(const MeshLOD &) = delete;
+
+		void startWorkers();
+		void workerLoop();
+		void process(Job &job);
+
+		std::vector<std::thread> workers_;
+		std::atomic<bool> running_;
+		std::deque<Job> jobs_;
+		std::mutex mutexJobs_;
+		std::condition_variable wake_;
+	};
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef MESHSTORE_H
+#define MESHSTORE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include "Doppelganger/json.h"
+#include "Doppelganger/PluginABI.h"
+#include "Doppelganger/MeshArena.h"
+
+namespace Doppelganger
+{
+	class MeshBVH;
+
+	////
+	// Dense matrix in structure-of-arrays layout (column-major)
+	//   each column starts at a 64-byte boundary (columns are padded up to the alignment)
+	//   memory is allocated from arena (MeshArena::heap() if nullptr)
+	//   map() can be passed to libigl functions taking Eigen::MatrixBase (e.g. igl::per_vertex_normals),
+	//   and results of libigl (e.g. Eigen::MatrixXd) can be stored by assign()
+	////
+	template <typename Scalar>
+	class AlignedMatrix
+	{
+	public:
+		static const std::size_t alignment = 64;
+		using Matrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor>;
+		using Map = Eigen::Map<Matrix, Eigen::Aligned64, Eigen::OuterStride<>>;
+		using ConstMap = Eigen::Map<const Matrix, Eigen::Aligned64, Eigen::OuterStride<>>;
+
+		explicit AlignedMatrix(MeshArena *arena = nullptr);
+
+		// contents are NOT preserved
+		void resize(const Eigen::Index rows, const Eigen::Index cols);
+		// copy contents of other (memory is allocated from our arena)
+		void assign(const AlignedMatrix &other);
+		// copy (and cast) a dense Eigen expression, e.g. #V x 3 Eigen::MatrixXd computed by libigl
+		template <typename Derived>
+		void assign(const Eigen::MatrixBase<Derived> &matrix)
+		{
+			resize(matrix.rows(), matrix.cols());
+			map() = matrix.template cast<Scalar>();
+		}
+		Map map();
+		ConstMap map() const;
+		Scalar *col(const Eigen::Index c);
+		const Scalar *col(const Eigen::Index c) const;
+
+		Eigen::Index rows() const
+		{
+			return rows_;
+		}
+		Eigen::Index cols() const
+		{
+			return cols_;
+		}
+		// elements between columns
+		Eigen::Index stride() const
+		{
+			return stride_;
+		}
+		// allocated bytes
+		std::size_t bytes() const
+		{
+			return static_cast<std::size_t>(stride_ * cols_) * sizeof(Scalar);
+		}
+		MeshArena *arena() const
+		{
+			return arena_;
+		}
+
+	private:
+		struct Free
+		{
+			MeshArena *arena;
+			std::size_t bytes;
+			void operator()(Scalar *ptr) const;
+		};
+
+		MeshArena *arena_;
+		Eigen::Index rows_;
+		Eigen::Index cols_;
+		Eigen::Index stride_;
+		std::unique_ptr<Scalar, Free> data_;
+	};
+
+	////
+	// Mesh buffers of a room, kept outside of Room::config
+	//   config.at("meshes").at(<meshUUID>).at("V" / "VN" / "F") (base64 of little-endian float32 / float32 / int32 triplets)
+	//   are decoded into this store, and only lightweight metadata (e.g. "name", "visibility") stays in config.
+	//   buffers are encoded again only for plugins requesting "/meshes" (or as raw bytes for snapshots/journal of the room, see RoomStore).
+	//   plugins can also access buffers by handle through DoppelgangerHostAPI (see PluginABI.h).
+	//   buffers are allocated from arena_ (i.e. shared memory on Linux) and can be read/written in place.
+	//
+	// Versions
+	//   each change of buffers creates a new version of the mesh (config.at("meshes").at(<meshUUID>).at("version")).
+	//   attributes (V/VN/F) are reference counted blocks shared between versions, and only modified blocks are copied.
+	//   setting "version" (e.g. by undo/redo with diffs {"meshes": {<meshUUID>: {"version": n}}}) swaps the buffers in O(1).
+	//   versions older than the last versionLimit changes (in this store) are discarded.
+	//   versions are kept in memory only (i.e. after recovery/hibernation, only the current version is available).
+	//   patches checking out versions not available (see findMissingVersion()) are rejected as a whole (e.g. undo/redo fails and history.index stays).
+	//
+	// Spatial index
+	//   plugins can query ray hits, closest points and overlapping faces through DoppelgangerHostAPI.
+	//   indices (see MeshBVH) persist between pluginProcess calls and are discarded with their versions.
+	////
+	class MeshStore
+	{
+	public:
+		// a version of a mesh
+		struct Mesh
+		{
+			// #V x 3
+			std::shared_ptr<AlignedMatrix<float>> V;
+			// #V x 3 (nullptr if absent)
+			std::shared_ptr<AlignedMatrix<float>> VN;
+			// #F x 3
+			std::shared_ptr<AlignedMatrix<std::int32_t>> F;
+		};
+
+		MeshStore();
+		// hostAPI_ refers to this
+		MeshStore(const MeshStore &) = delete;
+		MeshStore &operator=(const MeshStore &) = delete;
+
+		// move buffers in configRoom.at("meshes") into the store and check out "version"
+		//   (versions of meshes removed from config are kept, e.g. for undo)
+		//   buffers with invalid faces (see hasValidFaces()) are dropped, i.e. the current version stays (new meshes are removed from config)
+		void absorb(json &configRoom);
+		// true if every face refers to an existing vertex (meshes without faces are valid)
+		//   buffers written through DoppelgangerHostAPI are not checked on write, i.e. consumers check them again (see MeshLOD)
+		static bool hasValidFaces(const Mesh &mesh);
+		// true if configRoomPatch checks out a version that is not available (e.g. discarded, or created before recovery/hibernation)
+		bool findMissingVersion(const json &configRoomPatch, std::string &meshUUID, std::uint64_t &version) const;
+		// current versions of meshes listed in config (buffers are shared, i.e. not copied)
+		//   e.g. for materializing snapshots in the background (the room must be kept alive while buffers are referenced)
+		using Snapshot = std::vector<std::pair<std::string, Mesh>>;
+		Snapshot snapshot() const;
+		// add buffers into meshes (i.e. configRoom.at("meshes") as before)
+		//   binary: raw bytes (json::binary, e.g. for CBOR written by RoomStore) instead of base64. absorb() accepts both
+		void materialize(json &meshes) const;
+		static void materialize(json &meshes, const Snapshot &snapshot, const bool binary = false);
+		// patch ({"meshes": {<meshUUID>: {"version": n}}}) and buffers of meshes modified through DoppelgangerHostAPI since the last call (false if none)
+		//   buffers are shared (i.e. not encoded here). materialize() them into the patch where they are needed (e.g. in the background)
+		//   configRoom is absorbed first, and "version" of modified meshes in configRoom is updated
+		bool takeModified(json &configRoom, json &configRoomPatch, Snapshot &modified);
+		// versions created since the last call (e.g. for computing level of detail, see MeshLOD)
+		std::vector<std::pair<std::string, std::uint64_t>> takeCreated();
+		void clear();
+		// shared memory of buffers is released once every buffer is (see MeshArena::release())
+		void releaseArena()
+		{
+			arena_.release();
+		}
+		// versions older than the limit are discarded immediately
+		void setVersionLimit(const std::uint64_t versionLimit);
+		// bytes of buffers placed in the shared memory (see MeshArena::reserve()). takes effect before the first buffer is stored
+		void setArenaCapacity(const std::uint64_t capacity)
+		{
+			arena_.reserve(capacity);
+		}
+
+		// current version of the mesh (nullptr if not found)
+		const Mesh *find(const std::string &meshUUID) const;
+		// spatial index of the current version of the mesh (nullptr if not found or without faces)
+		//   built on the first query, refit when only vertices are changed (i.e. faces are shared with an indexed version),
+		//   and rebuilt when faces are changed
+		const MeshBVH *bvh(const std::string &meshUUID);
+		// the version of the mesh (nullptr if not found or discarded)
+		const Mesh *find(const std::string &meshUUID, const std::uint64_t version) const;
+		// bytes of buffers (blocks shared between versions are counted once)
+		std::size_t memoryUsage() const
+		{
+			return bytes_;
+		}
+		// valid while this store is alive
+		const DoppelgangerHostAPI *hostAPI()
+		{
+			return &hostAPI_;
+		}
+
+	private:
+		struct Record
+		{
+			Record()
+				: current(0), active(true)
+			{
+			}
+			std::map<std::uint64_t, Mesh> versions;
+			// spatial indices of versions (see bvh())
+			std::map<std::uint64_t, std::shared_ptr<MeshBVH>> bvhs;
+			std::uint64_t current;
+			// listed in config.at("meshes")
+			bool active;
+		};
+
+		static int getMesh(void *context, const char *meshUUID, DoppelgangerMeshView *view);
+		static int setMesh(void *context, const char *meshUUID, const DoppelgangerMeshView *view);
+		static int getArena(void *context, int *fd, std::uint64_t *size);
+		static int mapMesh(void *context, const char *meshUUID, int writable, DoppelgangerMeshBuffers *buffers);
+		static int resizeMesh(void *context, const char *meshUUID, std::uint32_t vertexCount, std::uint32_t faceCount, int withNormals, DoppelgangerMeshBuffers *buffers);
+		static int getMeshVersion(void *context, const char *meshUUID, std::uint64_t *version);
+		static int mapAttribute(void *context, const char *meshUUID, const char *attribute, int writable, DoppelgangerBufferDescriptor *descriptor);
+		static int raycast(void *context, const char *meshUUID, const float origin[3], const float direction[3], float maxDistance, DoppelgangerRayHit *hit);
+		static int closestPoint(void *context, const char *meshUUID, const float point[3], float maxDistance, DoppelgangerClosestPoint *result);
+		static int overlapBox(void *context, const char *meshUUID, const float boxMin[3], const float boxMax[3], std::uint32_t *faces, std::uint32_t capacity);
+		// new version of the mesh (once per pluginProcess) for modification through DoppelgangerHostAPI
+		Mesh &modify(const std::string &meshUUID);
+		// read-only (DoppelgangerBufferDescriptor::data)
+		static void describe(const Mesh &mesh, DoppelgangerMeshBuffers *buffers);
+		// writable (DoppelgangerBufferDescriptor::writableData), i.e. buffers must not be shared with other versions
+		static void describeWritable(Mesh &mesh, DoppelgangerMeshBuffers *buffers);
+		static void encode(const Mesh &mesh, json &meshJson, const bool binary);
+		void evict();
+		void updateBytes();
+
+		// declared before meshes_ (buffers are returned to the arena first)
+		MeshArena arena_;
+		std::unordered_map<std::string, Record> meshes_;
+		std::uint64_t lastVersion_;
+		std::uint64_t versionLimit_;
+		std::unordered_set<std::string> modified_;
+		std::vector<std::pair<std::string, std::uint64_t>> created_;
+		std::size_t bytes_;
+		DoppelgangerHostAPI hostAPI_;
+	};
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace Doppelganger
+{
+	class Core;
+
+	////
+	// HDR-style histogram
+	//   log-linear buckets (8 sub-buckets per power of 2, i.e. ~12.5% relative precision)
+	//   covering the whole uint64_t range. recording is lock-free.
+	////
+	class Histogram
+	{
+	public:
+		enum
+		{
+			subBucketBits = 3,
+			subBucketCount = 1 << subBucketBits,
+			bucketCount = (64 - subBucketBits + 1) * subBucketCount
+		};
+
+		Histogram();
+
+		void record(const std::uint64_t value);
+		std::uint64_t sum() const;
+		std::uint64_t max() const;
+		// snapshot of bucket counts (count() == sum of buckets)
+		void snapshot(std::array<std::uint64_t, bucketCount> &buckets) const;
+
+		static std::size_t bucketIndex(const std::uint64_t value);
+		static std::uint64_t bucketUpperBound(const std::size_t index);
+
+	private:
+		std::array<std::atomic<std::uint64_t>, bucketCount> buckets_;
+		std::atomic<std::uint64_t> sum_;
+		std::atomic<std::uint64_t> max_;
+	};
+
+	////
+	// Process-wide metrics, exported in Prometheus text format at "/metrics"
+	////
+	class Metrics
+	{
+	public:
+		// stages of an API call
+		enum Stage
+		{
+			// waiting for Room::mutexRoom_
+			LOCK_WAIT = 0,
+			// dlopen/dlsym for the plugin
+			PLUGIN_LOAD,
+			// building/serializing partial config and parameters
+			CONFIG_SERIALIZATION,
+			// pluginProcess() in the plugin
+			PLUGIN_EXECUTION,
+			// parsing patches, response and broadcast returned from the plugin
+			RESPONSE_PARSE,
+			// applyConfigPatch (merge_patch + subscribers of changed values)
+			CONFIG_APPLY,
+			// serializing and queueing broadcast messages (Room::broadcastWS)
+			BROADCAST,
+			STAGE_COUNT
+		};
+
+		struct APIMetrics
+		{
+			std::array<Histogram, STAGE_COUNT> duration;
+			// bytes queued by a broadcast (message size x recipients)
+			Histogram broadcastBytes;
+			std::atomic<std::uint64_t> calls;
+			std::atomic<std::uint64_t> errors;
+
+			APIMetrics() : calls(0), errors(0) {}
+		};
+
+		// broadcasts issued by the server itself (e.g. "isServerBusy", "meshLOD")
+		//   kept apart from APIMetrics so that they never share a series with a plugin
+		struct InternalMetrics
+		{
+			Histogram broadcastDuration;
+			Histogram broadcastBytes;
+		};
+
+		// handshakes of SSLHTTPSession (see TLSSessionCache)
+		struct TLSMetrics
+		{
+			Histogram handshakeDuration;
+			std::atomic<std::uint64_t> handshakes;
+			std::atomic<std::uint64_t> resumed;
+			std::atomic<std::uint64_t> errors;
+
+			TLSMetrics() : handshakes(0), resumed(0), errors(0) {}
+		};
+
+		static Metrics &getInstance();
+
+		// metrics for the API (plugin name)
+		//   returned reference is valid until the process exits
+		APIMetrics &api(const std::string &APIName);
+		// metrics for an internal operation (see InternalMetrics)
+		//   returned reference is valid until the process exits
+		InternalMetrics &internal(const std::string &operation);
+		TLSMetrics &tls()
+		{
+			return tls_;
+		}
+
+		void exportPrometheus(std::ostream &os, const std::shared_ptr<Core> &core);
+
+		static std::uint64_t elapsedNs(
+			const std::chrono::steady_clock::time_point &start,
+			const std::chrono::steady_clock::time_point &end)
+		{
+			return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+
+	private:
+		Metrics() = default;
+		Metrics(const Metrics &) = delete;
+		Metrics &operator=(const Metrics &) = delete;
+
+		std::mutex mutex_;
+		std::unordered_map<std::string, std::unique_ptr<APIMetrics>> APIs_;
+		std::unordered_map<std::string, std::unique_ptr<InternalMetrics>> internals_;
+		TLSMetrics tls_;
+	};
+}
+
+#endif
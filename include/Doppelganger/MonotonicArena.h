@@ -0,0 +1,101 @@
+#ifndef MONOTONICARENA_H
+#define MONOTONICARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace Doppelganger
+{
+	////
+	// Arena for objects released together (e.g. the fields of HTTP requests of a session)
+	//   allocate() bumps an offset in the current block (a larger block is chained if it's exhausted),
+	//   and deallocate() only counts. reset() rewinds the arena once everything is deallocated, and chained
+	//   blocks are merged into one (i.e. later requests fit in a single block).
+	//   allocate/reset: the owner thread only. deallocate: any thread (e.g. a request destroyed on the home context of a room)
+	////
+	class MonotonicArena
+	{
+	public:
+		explicit MonotonicArena(const std::size_t blockSize);
+		MonotonicArena(const MonotonicArena &) = delete;
+		MonotonicArena &operator=(const MonotonicArena &) = delete;
+
+		void *allocate(const std::size_t size, const std::size_t alignment);
+		void deallocate(void *pointer, const std::size_t size);
+		// false if some allocations are still alive (nothing is changed)
+		bool reset();
+
+	private:
+		struct block
+		{
+			std::unique_ptr<unsigned char[]> data;
+			std::size_t size;
+		};
+		// blocks are allocated on the first allocate() (e.g. sessions closed before any request)
+		std::vector<block> blocks_;
+		// size of the first block
+		std::size_t blockSize_;
+		// offset in blocks_.back()
+		std::size_t offset_;
+		std::atomic<std::size_t> live_;
+	};
+
+	////
+	// std::allocator compatible (e.g. http::basic_fields<ArenaAllocator<char>>)
+	//   the arena must outlive every object allocated with this allocator
+	////
+	template <class T>
+	class ArenaAllocator
+	{
+	public:
+		using value_type = T;
+		using propagate_on_container_copy_assignment = std::true_type;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::true_type;
+
+		explicit ArenaAllocator(MonotonicArena &arena) noexcept
+			: arena_(&arena)
+		{
+		}
+
+		template <class U>
+		ArenaAllocator(const ArenaAllocator<U> &other) noexcept
+			: arena_(other.arena())
+		{
+		}
+
+		T *allocate(const std::size_t n)
+		{
+			return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+		}
+
+		void deallocate(T *pointer, const std::size_t n) noexcept
+		{
+			arena_->deallocate(pointer, n * sizeof(T));
+		}
+
+		MonotonicArena *arena() const noexcept
+		{
+			return arena_;
+		}
+
+	private:
+		MonotonicArena *arena_;
+	};
+
+	template <class T, class U>
+	bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) noexcept
+	{
+		return a.arena() == b.arena();
+	}
+
+	template <class T, class U>
+	bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) noexcept
+	{
+		return a.arena() != b.arena();
+	}
+}
+
+#endif
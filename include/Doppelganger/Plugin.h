@@ -8,7 +8,7 @@
 #include <vector>
 #include <unordered_map>
 #include <fstream>
-#include <nlohmann/json.hpp>
+#include "Doppelganger/json.h"
 
 #include "Doppelganger/Util/download.h"
 
@@ -28,14 +28,14 @@ namespace Doppelganger
 		void pluginProcess(
 			const std::shared_ptr<Core> &core,
 			const std::shared_ptr<Room> &room,
-			const nlohmann::json &parameters,
-			nlohmann::json &response,
-			nlohmann::json &broadcast);
+			const json &parameters,
+			json &response,
+			json &broadcast);
 		void pluginProcess(
 			const std::shared_ptr<Room> &room,
-			const nlohmann::json &parameters,
-			nlohmann::json &response,
-			nlohmann::json &broadcast);
+			const json &parameters,
+			json &response,
+			json &broadcast);
 
 		struct InstalledVersionInfo
 		{
@@ -64,13 +64,23 @@ namespace Doppelganger
 		////
 		// parameters **NOT** stored in nlohmann::json
 		// note: all parameters are stored in nlohmann::json
+
+	private:
+		// shared by both pluginProcess() (core == nullptr for WS API, i.e. the plugin gets an empty configCore and its core patch is ignored)
+		//   calls the plugin, then applies/stores its patches and meshes modified through DoppelgangerHostAPI
+		void process(
+			const std::shared_ptr<Core> &core,
+			const std::shared_ptr<Room> &room,
+			const json &parameters,
+			json &response,
+			json &broadcast);
 	};
 
 	////
 	// nlohmann::json conversion
 	////
-	void to_json(nlohmann::json &json, const Plugin &plugin);
-	void from_json(const nlohmann::json &json, Plugin &plugin);
+	void to_json(json &pluginJson, const Plugin &plugin);
+	void from_json(const json &pluginJson, Plugin &plugin);
 }
 
 ////
@@ -0,0 +1,154 @@
+#ifndef PLUGINABI_H
+#define PLUGINABI_H
+
+#include <cstdint>
+
+////
+// Host API for plugins (optional)
+//   in addition to pluginProcess, plugins may export
+//     void setHostAPI(const DoppelgangerHostAPI *hostAPI)
+//   which is called right before each pluginProcess. hostAPI (and views obtained from it) are valid only until pluginProcess returns.
+//   with this API, plugins can access mesh data by handle instead of requesting "/meshes" (i.e. base64 in JSON).
+//   version 2: mesh buffers are described by DoppelgangerBufferDescriptor and can be written in place.
+//              (fields of version 1 are kept as they are. check hostAPI->version before using newer fields)
+//   version 3: meshes are versioned (copy-on-write). modification creates a new version once per pluginProcess,
+//              and attributes are copied only when they are written. see getMeshVersion.
+//   version 4: spatial queries (ray picking, closest point, overlapping faces) backed by a BVH kept per mesh version.
+//              the BVH is built on the first query and reused across pluginProcess calls.
+//   version 5: buffers mapped read-only are returned as const (DoppelgangerBufferDescriptor::data).
+//              write through DoppelgangerBufferDescriptor::writableData of buffers mapped writable. (the layout is unchanged)
+////
+
+#define DOPPELGANGER_HOST_API_VERSION 5
+
+extern "C"
+{
+	////
+	// mesh data in structure-of-arrays layout
+	//   each column (e.g. V[0] = x of all vertices) is contiguous and 64-byte aligned.
+	//   columns of the same attribute are separated by *Stride elements (i.e. V[1] == V[0] + VStride)
+	//   nullptr if the mesh doesn't have the attribute
+	////
+	struct DoppelgangerMeshView
+	{
+		std::uint32_t vertexCount;
+		std::uint32_t faceCount;
+		// vertices (#V x 3)
+		const float *V[3];
+		std::uint32_t VStride;
+		// vertex normals (#V x 3)
+		const float *VN[3];
+		std::uint32_t VNStride;
+		// faces (#F x 3, vertex indices)
+		const std::int32_t *F[3];
+		std::uint32_t FStride;
+	};
+
+	enum DoppelgangerDType
+	{
+		DOPPELGANGER_DTYPE_FLOAT32 = 0,
+		DOPPELGANGER_DTYPE_INT32 = 1
+	};
+
+	////
+	// a buffer (column-major matrix) in the mesh arena (see MeshArena.h)
+	//   column c starts at data + c * stride elements
+	////
+	struct DoppelgangerBufferDescriptor
+	{
+		// address in this process (nullptr if the mesh doesn't have the attribute)
+		//   writableData is the same address, and valid only for buffers mapped writable (mapMesh/mapAttribute with writable != 0, resizeMesh)
+		union
+		{
+			const void *data;
+			void *writableData;
+		};
+		// position in the shared memory of the arena (~0 if the buffer is not in the shared memory)
+		std::uint64_t offset;
+		// bytes
+		std::uint64_t length;
+		// DoppelgangerDType
+		std::uint32_t dtype;
+		// rows, cols
+		std::uint32_t shape[2];
+		// elements between columns
+		std::uint32_t stride;
+	};
+
+	struct DoppelgangerMeshBuffers
+	{
+		DoppelgangerBufferDescriptor V;
+		DoppelgangerBufferDescriptor VN;
+		DoppelgangerBufferDescriptor F;
+	};
+
+	struct DoppelgangerRayHit
+	{
+		// hit point = origin + t * direction
+		float t;
+		// index of the face
+		std::uint32_t face;
+		// hit point = (1 - u - v) * V0 + u * V1 + v * V2
+		float barycentric[2];
+	};
+
+	struct DoppelgangerClosestPoint
+	{
+		float point[3];
+		float distance;
+		// index of the face
+		std::uint32_t face;
+	};
+
+	struct DoppelgangerHostAPI
+	{
+		// DOPPELGANGER_HOST_API_VERSION
+		std::uint32_t version;
+		// passed as the first argument of functions below
+		void *context;
+		// returns 0 if the mesh is found
+		int (*getMesh)(void *context, const char *meshUUID, DoppelgangerMeshView *view);
+		// replace attributes of the mesh (data is copied). nullptr (e.g. V[0] == nullptr) keeps the current attribute.
+		//   if only the first column is given (e.g. V[1] == nullptr), columns are read at V[0] + c * VStride
+		//   meshes not listed in config.at("meshes") after pluginProcess are discarded (i.e. create the entry with configRoomPatch)
+		//   returns 0 on success
+		int (*setMesh)(void *context, const char *meshUUID, const DoppelgangerMeshView *view);
+
+		////
+		// version 2
+		////
+		// file descriptor of the shared memory of the arena (-1 if not available, e.g. non-Linux) and its current size
+		int (*getArena)(void *context, int *fd, std::uint64_t *size);
+		// descriptors of the buffers of the mesh. returns 0 if the mesh is found
+		//   writable != 0: the plugin may write into the buffers, and the mesh is stored (journaled) after pluginProcess
+		int (*mapMesh)(void *context, const char *meshUUID, int writable, DoppelgangerMeshBuffers *buffers);
+		// (re)allocate buffers of the mesh (contents are undefined) and return their descriptors (writable)
+		//   withNormals == 0 removes VN. returns 0 on success
+		int (*resizeMesh)(void *context, const char *meshUUID, std::uint32_t vertexCount, std::uint32_t faceCount, int withNormals, DoppelgangerMeshBuffers *buffers);
+
+		////
+		// version 3
+		////
+		// current version of the mesh (i.e. config.at("meshes").at(meshUUID).at("version") after pluginProcess)
+		//   for undo/redo, put {"meshes": {<meshUUID>: {"version": <version>}}} in history diffs instead of buffers
+		int (*getMeshVersion)(void *context, const char *meshUUID, std::uint64_t *version);
+		// same as mapMesh for one attribute ("V", "VN" or "F"). only this attribute is copied for writing
+		int (*mapAttribute)(void *context, const char *meshUUID, const char *attribute, int writable, DoppelgangerBufferDescriptor *descriptor);
+
+		////
+		// version 4
+		//   queries use the current version of the mesh. after writing into buffers mapped as writable,
+		//   map them (writable) again before querying so that the BVH is refit.
+		//   maxDistance can be INFINITY. returns 1 if found, 0 if not found and -1 on error (e.g. unknown mesh)
+		////
+		// closest intersection of the ray within maxDistance (in units of direction)
+		int (*raycast)(void *context, const char *meshUUID, const float origin[3], const float direction[3], float maxDistance, DoppelgangerRayHit *hit);
+		// closest point on the mesh within maxDistance
+		int (*closestPoint)(void *context, const char *meshUUID, const float point[3], float maxDistance, DoppelgangerClosestPoint *result);
+		// faces whose bounding boxes overlap the box (e.g. broad phase of collision detection)
+		//   up to capacity indices are written into faces. returns the number of overlapping faces (may exceed capacity), -1 on error
+		int (*overlapBox)(void *context, const char *meshUUID, const float boxMin[3], const float boxMax[3], std::uint32_t *faces, std::uint32_t capacity);
+	};
+}
+
+#endif
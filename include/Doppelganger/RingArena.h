@@ -0,0 +1,47 @@
+#ifndef RINGARENA_H
+#define RINGARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Doppelganger
+{
+	////
+	// Arena for objects released in the order they are allocated (e.g. queued HTTP responses)
+	//   blocks are placed one after another in a fixed buffer and the buffer wraps around,
+	//   i.e. allocate/release are a few additions (no free list, no heap allocation after the first one).
+	//   allocate() returns nullptr if there is no room (callers fall back to the heap).
+	//   not thread-safe (owned by one session)
+	////
+	class RingArena
+	{
+	public:
+		explicit RingArena(const std::size_t capacity);
+		RingArena(const RingArena &) = delete;
+		RingArena &operator=(const RingArena &) = delete;
+
+		// alignment must be <= alignof(std::max_align_t)
+		void *allocate(const std::size_t size, const std::size_t alignment);
+		// must be called in the same order as allocate()
+		void release(void *pointer);
+
+		bool owns(const void *pointer) const
+		{
+			return buffer_ && pointer >= buffer_.get() && pointer < buffer_.get() + capacity_;
+		}
+
+	private:
+		// buffer is allocated on the first allocate() (e.g. sessions closed before any response)
+		std::unique_ptr<unsigned char[]> buffer_;
+		std::size_t capacity_;
+		// live blocks: [tail_, head_) or, when wrapped_, [tail_, wrapEnd_) + [0, head_)
+		std::size_t head_;
+		std::size_t tail_;
+		std::size_t wrapEnd_;
+		bool wrapped_;
+		std::size_t count_;
+	};
+}
+
+#endif
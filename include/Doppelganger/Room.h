@@ -4,15 +4,27 @@
 #include "Doppelganger/Util/filesystem.h"
 #include "Doppelganger/Util/variant.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
-#include <nlohmann/json.hpp>
+#include <boost/asio/io_context.hpp>
+#include "Doppelganger/json.h"
+#include "Doppelganger/ConfigBus.h"
 #include "Doppelganger/Plugin.h"
-#include "Doppelganger/Util/log.h"
+#include "Doppelganger/Logger.h"
+#include "Doppelganger/RoomStore.h"
+#include "Doppelganger/HistoryStore.h"
+#include "Doppelganger/MeshStore.h"
+#include "Doppelganger/MeshEncoder.h"
+#include "Doppelganger/MeshLOD.h"
 
 namespace Doppelganger
 {
@@ -29,7 +41,7 @@ namespace Doppelganger
 		// we explicitly copy configCore
 		void setup(
 			const std::string &UUID,
-			const nlohmann::json &configCore);
+			const json &configCore);
 
 		void shutdown();
 
@@ -38,14 +50,51 @@ namespace Doppelganger
 		////
 		// void to_json(nlohmann::json &json) const;
 		// void from_json(const nlohmann::json &json);
+		// all of config (e.g. on setup)
 		void applyCurrentConfig();
+		// merges the patch into config, and notifies subscribers of changed values only (see ConfigBus)
+		//   returns false if the room is shut down by the patch (i.e. "active" is false)
+		bool applyConfigPatch(const json &patch);
 
 		void joinWS(const WSSession &session);
 		void leaveWS(const std::string &sessionUUID);
-		void broadcastWS(const std::string &APIName, const std::string &sourceUUID, const nlohmann::json &broadcast, const nlohmann::json &response);
+		// pluginAPI: APIName is a plugin (recorded in Metrics::api), otherwise an internal operation (Metrics::internal)
+		void broadcastWS(const std::string &APIName, const std::string &sourceUUID, const json &broadcast, const json &response, const bool pluginAPI);
+		// announce levels of detail of the mesh (level 0 first, see MeshLOD)
+		//   refinements are announced only to sessions that can receive them within transferBudget seconds
+		void announceMeshLevels(const std::string &meshUUID, const std::uint64_t version, const std::vector<MeshLOD::Level> &levels, const double transferBudget);
+		// number of WS sessions and messages queued for them (for metrics)
+		void sessionStats(std::size_t &sessionCount, std::size_t &queuedMessages);
+
+		// append merge patch (already applied to config) to the journal (see RoomStore)
+		//   buffers of meshes (see MeshStore::takeModified) are added to the patch in the background
+		void storePatch(const json &patch, const MeshStore::Snapshot &meshes = MeshStore::Snapshot());
+		// config with mesh buffers (i.e. config before meshes_ absorbs them), materialized when the returned function is called
+		//   config and references to buffers are captured now, e.g. for writing snapshots in the background (see RoomStore)
+		std::function<json()> capturedConfig();
+		// same as above for the given config (e.g. config moved out of this room by hibernate())
+		std::function<json()> capturedConfig(const std::shared_ptr<const json> &captured);
+		// compute levels of detail for new versions of large meshes in the background (see MeshLOD)
+		void scheduleMeshLOD();
+
+		////
+		// hibernation of idle rooms (see Core::checkIdleRooms())
+		//   config (except small entries, e.g. "UUID", "dataDir", "log") is written as a snapshot
+		//   into <dataDir>/state (in the background) and released. memory usage of config is estimated at the same time.
+		////
+		// returns true if the room is hibernated
+		//   non-positive idleFor only updates memoryUsage_
+		bool hibernate(const std::chrono::steady_clock::duration &idleFor);
+		// must be called with mutexRoom_ locked, before accessing config
+		//   returns false if config can't be restored (config is still stripped, i.e. the call must fail)
+		bool wakeUp();
+		// update the time of the last activity
+		void touch();
 
 	public:
-		nlohmann::json config;
+		json config;
+		// config.at("log") as bit flags (see Logger::levelMask())
+		std::atomic<std::uint32_t> logLevels_;
 
 		////
 		// parameters **NOT** stored in nlohmann::json
@@ -53,8 +102,42 @@ namespace Doppelganger
 		std::unordered_map<std::string, Doppelganger::Plugin> plugin_;
 
 		std::mutex mutexRoom_;
+		// API calls waiting for mutexRoom_
+		std::atomic<std::uint32_t> pendingAPICalls_;
+		// io_context where API calls of this room are processed (nullptr: any thread, see RoomScheduler)
+		std::atomic<boost::asio::io_context *> homeContext_;
+		// time spent in plugins since the last rebalance (nanoseconds, see RoomScheduler)
+		std::atomic<std::uint64_t> busyNs_;
+		// same as config.at("UUID") (readable while the room is hibernated)
+		std::string UUID_;
+		// same as config.at("dataDir") (set once on setup, i.e. readable without mutexRoom_, e.g. by DOPPELGANGER_LOG)
+		//   config is swapped by hibernate()/wakeUp(), so threads without mutexRoom_ read these members instead
+		std::string dataDir_;
+		// same as config.at("active")
+		std::atomic<bool> active_;
+		std::atomic<bool> hibernated_;
+		// steady_clock (nanoseconds)
+		std::atomic<std::int64_t> lastActivity_;
+		// estimated size of config, history_, meshes_ and meshEncoder_ in bytes
+		std::atomic<std::size_t> memoryUsage_;
+		// snapshot + journal of config (guarded by mutexRoom_)
+		RoomStore store_;
+		// config of hibernate() whose snapshot could not be written (restored by wakeUp() instead of the snapshot)
+		//   set in the background by store_, and read by wakeUp() after store_.flush()
+		json unsavedConfig_;
+		// config.at("history").at("diffFromPrev"/"diffFromNext") (guarded by mutexRoom_)
+		HistoryStore history_;
+		// config.at("meshes").at(<meshUUID>).at("V"/"VN"/"F") (guarded by mutexRoom_)
+		MeshStore meshes_;
+		// encoded meshes for clients (thread-safe, i.e. used without mutexRoom_)
+		MeshEncoder meshEncoder_;
 		std::unordered_map<std::string, WSSession> websocketSessions_;
 		std::mutex mutexWS_;
+
+	private:
+		void subscribeConfig();
+		// subscribers of applyCurrentConfig()/applyConfigPatch() per JSON pointer prefix
+		ConfigBus configBus_;
 	};
 }
 
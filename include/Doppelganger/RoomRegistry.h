@@ -0,0 +1,65 @@
+#ifndef ROOMREGISTRY_H
+#define ROOMREGISTRY_H
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Doppelganger
+{
+	class Room;
+
+	////
+	// Rooms shared by all io_context threads
+	//   lock-striped: UUIDs are distributed over shards, each guarded by its own mutex
+	//   rooms being created are placeholders (futures), i.e. Room::setup() never runs with a shard locked
+	////
+	class RoomRegistry
+	{
+	public:
+		RoomRegistry();
+
+		// nullptr if not found (or still being created)
+		std::shared_ptr<Room> find(const std::string &UUID) const;
+		// returns the existing room, or the room returned by createRoom (created == true)
+		//   createRoom is called at most once, without the shard locked
+		//   (i.e. two simultaneous first requests never create duplicate rooms)
+		//   nullptr if the room is being created by another request. we never wait for it (e.g. answer 503 and let the client retry)
+		//   exceptions from createRoom are thrown to the caller creating the room (and the next request tries again)
+		std::shared_ptr<Room> findOrCreate(
+			const std::string &UUID,
+			const std::function<std::shared_ptr<Room>()> &createRoom,
+			bool &created);
+		// returns false if not found
+		bool erase(const std::string &UUID);
+		std::size_t size() const;
+		// copy of all rooms (e.g. for iteration on shutdown). rooms being created are not included
+		std::vector<std::shared_ptr<Room>> snapshot() const;
+
+	private:
+		enum
+		{
+			shardCount = 16
+		};
+		struct Shard
+		{
+			mutable std::mutex mutex;
+			std::unordered_map<std::string, std::shared_future<std::shared_ptr<Room>>> rooms;
+		};
+		// nullptr if room is still being created
+		static std::shared_ptr<Room> ready(const std::shared_future<std::shared_ptr<Room>> &room);
+		Shard &shard(const std::string &UUID);
+		const Shard &shard(const std::string &UUID) const;
+
+		std::array<Shard, shardCount> shards_;
+		std::atomic<std::size_t> size_;
+	};
+}
+
+#endif
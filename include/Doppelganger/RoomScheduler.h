@@ -0,0 +1,43 @@
+#ifndef ROOMSCHEDULER_H
+#define ROOMSCHEDULER_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+
+#include "Doppelganger/IOContextPool.h"
+
+namespace Doppelganger
+{
+	class Room;
+
+	////
+	// Home contexts of rooms ("perCore" mode, see IOContextPool)
+	//   load of a room = time spent in plugins since the last rebalance (see Room::busyNs_)
+	//   new rooms go to the least loaded context. when the busiest context exceeds skew * average,
+	//   rooms are moved from the busiest to the least loaded context.
+	//   moved rooms keep their sessions: API calls are posted to the new home (see WebsocketSession::onRead)
+	////
+	class RoomScheduler
+	{
+	public:
+		explicit RoomScheduler(IOContextPool &ioContextPool);
+
+		// nullptr in "shared" mode
+		boost::asio::io_context *assign();
+		// skew <= 1.0 only updates the load (i.e. no room is moved)
+		void rebalance(const std::vector<std::shared_ptr<Room>> &rooms, const double skew);
+
+	private:
+		IOContextPool &ioContextPool_;
+		std::mutex mutex_;
+		// per context (nanoseconds and #rooms, as of the last rebalance + assign())
+		std::vector<std::uint64_t> load_;
+		std::vector<std::size_t> roomCount_;
+	};
+}
+
+#endif
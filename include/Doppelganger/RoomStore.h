@@ -0,0 +1,97 @@
+#ifndef ROOMSTORE_H
+#define ROOMSTORE_H
+
+#include "Doppelganger/Util/filesystem.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Doppelganger/json.h"
+
+namespace Doppelganger
+{
+	////
+	// Binary persistence of Room::config
+	//   <dataDir>/state/snapshot.cbor : "DGSNAP01" + CBOR(config)
+	//   <dataDir>/state/journal.bin   : "DGJRNL01" + record*
+	//     record : u32 length, u32 checksum (FNV-1a), CBOR(merge patch)    (little endian)
+	//   state = snapshot + merge patches in the journal (a torn record at the end is ignored)
+	//   saving a room only appends its patch. the snapshot is rewritten on compact().
+	//
+	// files are written in the background (one thread for all rooms), in the order they are requested.
+	//   i.e. callers (e.g. io_context threads holding Room::mutexRoom_) only queue the writes.
+	////
+	class RoomStore
+	{
+	public:
+		RoomStore();
+
+		// open (create) the journal in dir
+		void open(const fs::path &dir);
+		void close();
+		// open() is requested and close() is not (i.e. append() is accepted)
+		bool isOpen() const
+		{
+			return open_.load(std::memory_order_relaxed);
+		}
+		const fs::path &dir() const
+		{
+			return dir_;
+		}
+		// bytes of records appended since the last compact() (updated once they are written)
+		std::uint64_t journalSize() const
+		{
+			return state_->journalSize.load(std::memory_order_relaxed);
+		}
+
+		void append(const json &patch);
+		// append the patch returned by makePatch (called in the background, e.g. for encoding mesh buffers off the io_context thread)
+		void append(const std::function<json()> &makePatch);
+		// write snapshot of the config returned by makeConfig (called in the background) and truncate the journal
+		//   done (if any) is called in the background with false on failure
+		//   returns false if no directory is opened (nothing is queued)
+		bool compact(const std::function<json()> &makeConfig, const std::function<void(bool)> &done = nullptr);
+		// close and remove all files (after queued writes)
+		void remove();
+		// wait for writes queued so far
+		void flush();
+
+		// returns false if dir has no valid snapshot
+		static bool load(const fs::path &dir, json &config);
+		// latest <dataRootDir>/YYYYMMDDTHHMMSS-<UUID>/state with a snapshot (empty if not found)
+		static fs::path findLatest(const fs::path &dataRootDir, const std::string &UUID);
+
+	private:
+		// shared with queued writes (i.e. alive until they are done)
+		struct state
+		{
+			state()
+				: journalSize(0), generation(0), pending(0)
+			{
+			}
+			// accessed by the writer only
+			std::ofstream journal;
+			std::atomic<std::uint64_t> journalSize;
+			// incremented on compact() (i.e. records queued before it are not counted in journalSize)
+			std::atomic<std::uint64_t> generation;
+			// queued writes (see flush())
+			std::mutex mutex;
+			std::condition_variable idle;
+			std::size_t pending;
+		};
+		void submit(std::function<void()> &&write);
+		static void openJournal(state &s, const fs::path &dir, const bool truncate);
+
+		std::shared_ptr<state> state_;
+		fs::path dir_;
+		std::atomic<bool> open_;
+	};
+}
+
+#endif
@@ -24,7 +24,8 @@
 
 #include "Doppelganger/Core.h"
 #include "Doppelganger/HTTPSession.h"
-#include "Doppelganger/Util/log.h"
+#include "Doppelganger/Logger.h"
+#include "Doppelganger/Tracing.h"
 
 namespace Doppelganger
 {
@@ -40,7 +41,6 @@ namespace Doppelganger
 	private:
 		const std::weak_ptr<Core> core_;
 		beast::tcp_stream stream_;
-		ssl::context &ctx_;
 		beast::flat_buffer buffer_;
 
 		void fail(boost::system::error_code ec, char const *what)
@@ -50,19 +50,14 @@ namespace Doppelganger
 				return;
 			}
 
-			{
-				std::stringstream ss;
-				ss << what << ": " << ec.message();
-				Util::log(ss.str(), "ERROR", core_.lock()->config);
-			}
+			DOPPELGANGER_LOG(core_.lock(), ERROR, what << ": " << ec.message());
 		}
 
 	public:
 		explicit SSLDetector(
 			const std::weak_ptr<Core> &core,
-			tcp::socket &&socket,
-			ssl::context &ctx)
-			: core_(core), stream_(std::move(socket)), ctx_(ctx)
+			tcp::socket &&socket)
+			: core_(core), stream_(std::move(socket))
 		{
 		}
 
@@ -95,6 +90,7 @@ namespace Doppelganger
 
 		void onDetect(beast::error_code ec, bool result)
 		{
+			DOPPELGANGER_TRACE_SPAN("SSLDetector::onDetect");
 			if (ec)
 			{
 				return fail(ec, "detect (SSL detector)");
@@ -102,11 +98,17 @@ namespace Doppelganger
 
 			if (result)
 			{
-				// Launch SSL session
+				const std::shared_ptr<Core> core = core_.lock();
+				if (!core)
+				{
+					return;
+				}
+
+				// Launch SSL session (with the certificate loaded at this moment)
 				std::make_shared<SSLHTTPSession>(
 					core_,
 					std::move(stream_),
-					ctx_,
+					core->sslContext(),
 					std::move(buffer_))
 					->run();
 			}
@@ -0,0 +1,54 @@
+#ifndef TLSSESSIONCACHE_H
+#define TLSSESSIONCACHE_H
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio/ssl.hpp>
+#include "Doppelganger/json.h"
+
+namespace Doppelganger
+{
+	////
+	// TLS session resumption (see config.at("server").at("tls"))
+	//   session cache: sessions are kept in the ssl::context (shared by all io_context threads)
+	//   session tickets: sessions are encrypted into tickets held by clients.
+	//     ticket keys are rotated every ticketKeyLifetime seconds, and tickets encrypted with
+	//     the previous key are still accepted (and renewed). i.e. a ticket is valid for 1-2 lifetimes.
+	////
+	class TLSSessionCache
+	{
+	public:
+		static TLSSessionCache &getInstance();
+
+		// must be called before the first handshake with ctx (e.g. for each reloaded certificate)
+		void configure(boost::asio::ssl::context &ctx, const json &tlsConfig);
+
+		struct TicketKey
+		{
+			std::array<unsigned char, 16> name;
+			std::array<unsigned char, 32> AESKey;
+			std::array<unsigned char, 32> HMACKey;
+			std::chrono::steady_clock::time_point createdAt;
+		};
+
+		// current key for new tickets (rotated if expired). false on failure of RAND_bytes
+		bool currentKey(TicketKey &key);
+		// key for decrypting a ticket. false if the key has been discarded (i.e. full handshake)
+		bool findKey(const unsigned char name[16], TicketKey &key, bool &isCurrent);
+
+	private:
+		TLSSessionCache();
+		TLSSessionCache(const TLSSessionCache &) = delete;
+		TLSSessionCache &operator=(const TLSSessionCache &) = delete;
+
+		std::mutex mutex_;
+		// current key first, then the previous key
+		std::vector<TicketKey> keys_;
+		std::chrono::seconds keyLifetime_;
+	};
+}
+
+#endif
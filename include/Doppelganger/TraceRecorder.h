@@ -0,0 +1,134 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include "Doppelganger/Util/filesystem.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Doppelganger/json.h"
+
+namespace Doppelganger
+{
+	////
+	// One API call (HTTP or WS) dispatched to a plugin
+	////
+	struct TraceRecord
+	{
+		enum Transport : std::uint8_t
+		{
+			HTTP = 0,
+			WS = 1
+		};
+
+		// nanoseconds since epoch (system_clock) when the call is read (i.e. before it waits for the room)
+		std::uint64_t timestamp = 0;
+		std::uint8_t transport = HTTP;
+		std::string roomUUID;
+		std::string sessionUUID;
+		std::string APIName;
+		// HTTP: request body, WS: payload (as is)
+		std::string parameters;
+		// nanoseconds spent in Plugin::pluginProcess
+		std::uint64_t duration = 0;
+		// size of the serialized response
+		std::uint32_t responseSize = 0;
+		// 1 if the call is rejected or throws (e.g. invalid parameters, room can't be restored)
+		std::uint8_t failed = 0;
+
+		////
+		// binary format (little endian)
+		////
+		// file   : "DGTRACE2" record*
+		// record : u32 length (excluding this field)
+		//          u64 timestamp
+		//          u8  transport
+		//          u16 length + bytes (roomUUID)
+		//          u16 length + bytes (sessionUUID)
+		//          u16 length + bytes (APIName)
+		//          u32 length + bytes (parameters)
+		//          u64 duration
+		//          u32 responseSize
+		//          u8  failed
+		static const char magic[8];
+
+		void encode(std::string &out) const;
+		// returns false for files not written by TraceRecorder
+		static bool readHeader(std::istream &is);
+		// returns false at the end of stream (or for broken record)
+		bool decode(std::istream &is);
+	};
+
+	////
+	// Append-only recorder with size-based rotation
+	//   records are encoded by the caller (io threads) and written by a background thread
+	//     (records beyond maxQueuedBytes are dropped and counted, i.e. io threads never wait for the disk)
+	//   <Core dataDir>/trace/trace.0.bin (current), trace.1.bin, ... trace.<maxFiles-1>.bin
+	//   configured by config.at("trace") of Core
+	//     "enabled": false,
+	//     "maxFileSize": 67108864,
+	//     "maxFiles": 4
+	////
+	class TraceRecorder
+	{
+	public:
+		static TraceRecorder &getInstance();
+
+		void configure(const json &configCore);
+		bool isEnabled() const
+		{
+			return enabled_.load(std::memory_order_relaxed);
+		}
+		void record(const TraceRecord &record);
+
+	private:
+		TraceRecorder();
+		~TraceRecorder();
+		TraceRecorder(const TraceRecorder &) = delete;
+		TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+		void writerLoop();
+		// called by writer_ with mutex_
+		void write(const std::vector<std::string> &batch);
+		void open();
+		void rotate();
+
+		enum
+		{
+			// Maximum bytes of encoded records waiting for writer_
+			maxQueuedBytes = 16 * 1024 * 1024
+		};
+
+		std::atomic<bool> enabled_;
+
+		// records waiting for writer_. guarded by mutexQueue_
+		std::mutex mutexQueue_;
+		std::condition_variable wake_;
+		std::vector<std::string> queue_;
+		std::size_t queuedBytes_;
+		std::uint64_t dropped_;
+		// started by the first configure() that enables tracing
+		std::thread writer_;
+		bool running_;
+
+		// files. guarded by mutex_
+		std::mutex mutex_;
+		fs::path dir_;
+		std::uint64_t maxFileSize_;
+		int maxFiles_;
+		std::ofstream ofs_;
+		std::uint64_t currentSize_;
+		// for errors of open/rotate (copied from config of Core)
+		std::uint32_t logLevels_;
+		std::string dataDir_;
+	};
+}
+
+#endif
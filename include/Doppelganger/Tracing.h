@@ -0,0 +1,103 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "Doppelganger/json.h"
+
+namespace Doppelganger
+{
+	////
+	// Scoped spans recorded into per-thread ring buffers
+	//   dumped in Chrome trace event format (about:tracing, https://ui.perfetto.dev) at "/spans"
+	//   configured by config.at("spans") of Core
+	//     "enabled": false,
+	//     "eventsPerThread": 65536
+	//   when disabled, a span costs one relaxed atomic load
+	////
+	class Tracer
+	{
+	public:
+		struct Event
+		{
+			// must be a string literal (we only store the pointer)
+			const char *name;
+			// nanoseconds (steady_clock)
+			std::uint64_t start;
+			std::uint64_t end;
+		};
+
+		static Tracer &getInstance();
+
+		void configure(const json &configCore);
+		static bool isEnabled()
+		{
+			return enabled_.load(std::memory_order_relaxed);
+		}
+		static std::uint64_t now()
+		{
+			return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+		void record(const char *name, const std::uint64_t start, const std::uint64_t end);
+
+		void exportChromeTrace(std::ostream &os);
+
+	private:
+		Tracer();
+		Tracer(const Tracer &) = delete;
+		Tracer &operator=(const Tracer &) = delete;
+
+		struct ThreadBuffer
+		{
+			// only contended while exporting
+			std::mutex mutex;
+			std::uint32_t threadId;
+			std::vector<Event> events;
+			// total number of recorded events (events.at(recorded % events.size()) is the next slot)
+			std::uint64_t recorded;
+		};
+		ThreadBuffer &threadBuffer();
+
+		static std::atomic<bool> enabled_;
+		std::atomic<std::size_t> eventsPerThread_;
+		std::mutex mutex_;
+		std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+	};
+
+	class TraceSpan
+	{
+	public:
+		explicit TraceSpan(const char *name)
+			: name_(Tracer::isEnabled() ? name : nullptr), start_(name_ ? Tracer::now() : 0)
+		{
+		}
+		~TraceSpan()
+		{
+			if (name_)
+			{
+				Tracer::getInstance().record(name_, start_, Tracer::now());
+			}
+		}
+
+	private:
+		TraceSpan(const TraceSpan &) = delete;
+		TraceSpan &operator=(const TraceSpan &) = delete;
+
+		const char *const name_;
+		const std::uint64_t start_;
+	};
+}
+
+#define DOPPELGANGER_TRACE_CONCAT_(a, b) a##b
+#define DOPPELGANGER_TRACE_CONCAT(a, b) DOPPELGANGER_TRACE_CONCAT_(a, b)
+// e.g. DOPPELGANGER_TRACE_SPAN("Room::broadcastWS");
+#define DOPPELGANGER_TRACE_SPAN(name) \
+	const Doppelganger::TraceSpan DOPPELGANGER_TRACE_CONCAT(traceSpan_, __LINE__)(name)
+
+#endif
@@ -4,6 +4,9 @@
 // see
 // https://www.boost.org/doc/libs/develop/libs/beast/example/advanced/server-flex/advanced_server_flex.cpp
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -16,6 +19,7 @@
 #include <boost/beast/websocket.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
 
 namespace Doppelganger
 {
@@ -62,6 +66,10 @@ namespace Doppelganger
 		void onRead(
 			beast::error_code ec,
 			std::size_t bytes_transferred);
+		// API call (on the home context of the room, see Room::homeContext_)
+		// receivedAt: when the message is read (e.g. for TraceRecorder)
+		void process(const std::shared_ptr<Room> &room, const std::string &payload, const std::chrono::system_clock::time_point receivedAt);
+		void onSend(const std::shared_ptr<const std::string> &ss);
 		void doWrite();
 		void onWrite(
 			beast::error_code ec,
@@ -72,6 +80,12 @@ namespace Doppelganger
 		beast::flat_buffer buffer_;
 		const std::weak_ptr<Room> room_;
 		std::vector<std::shared_ptr<const std::string>> queue_;
+		// queue_.size() readable from other threads (for metrics)
+		std::atomic<std::size_t> queueDepth_;
+		// start of the current write (for bandwidth_)
+		std::chrono::steady_clock::time_point writeStart_;
+		// estimated bytes per second (0 if not measured yet)
+		std::atomic<std::uint64_t> bandwidth_;
 
 	public:
 		WebsocketSession(
@@ -84,11 +98,26 @@ namespace Doppelganger
 			doAccept(std::move(req));
 		}
 
+		// thread-safe (the message is queued on the executor of this session)
 		void send(const std::shared_ptr<const std::string> &ss);
+		std::size_t queueDepth() const
+		{
+			return queueDepth_.load(std::memory_order_relaxed);
+		}
+		// estimated from large writes (e.g. for choosing level of detail, see MeshLOD)
+		std::uint64_t bandwidth() const
+		{
+			return bandwidth_.load(std::memory_order_relaxed);
+		}
 
 		void close(const websocket::close_code &code)
 		{
-			derived().ws().async_close(code, [](const beast::error_code &ec) {});
+			net::post(
+				derived().ws().get_executor(),
+				[self = derived().shared_from_this(), code]()
+				{
+					self->ws().async_close(code, [](const beast::error_code &ec) {});
+				});
 		}
 
 	public:
@@ -135,6 +164,11 @@ namespace Doppelganger
 
 	//------------------------------------------------------------------------------
 
+	// move the socket onto the home context of the room (see RoomScheduler)
+	//   the stream is returned as is if the room has no home context or the platform cannot release sockets (e.g. Windows)
+	//   the returned stream is closed if the socket cannot be assigned to the home context (i.e. the connection is dropped)
+	beast::tcp_stream moveToHomeContext(beast::tcp_stream &&stream, const std::weak_ptr<Room> &room);
+
 	template <class Body, class Allocator>
 	void makeWebsocketSession(
 		beast::tcp_stream stream,
@@ -142,13 +176,19 @@ namespace Doppelganger
 		const std::string &UUID,
 		http::request<Body, http::basic_fields<Allocator>> req)
 	{
+		beast::tcp_stream moved = moveToHomeContext(std::move(stream), room);
+		if (!moved.socket().is_open())
+		{
+			return;
+		}
 		std::make_shared<PlainWebsocketSession>(
 			room,
 			UUID,
-			std::move(stream))
+			std::move(moved))
 			->run(std::move(req));
 	}
 
+	// TLS state cannot be moved (API calls are posted to the home context instead, see WebsocketSession::onRead)
 	template <class Body, class Allocator>
 	void makeWebsocketSession(
 		beast::ssl_stream<beast::tcp_stream> stream,
@@ -0,0 +1,29 @@
+#ifndef FS_ERROR_CODE_H
+#define FS_ERROR_CODE_H
+
+#include "Doppelganger/Util/filesystem.h"
+
+#if defined(_WIN64)
+#include <system_error>
+#elif defined(__APPLE__)
+#include <boost/system/error_code.hpp>
+#elif defined(__linux__)
+#include <system_error>
+#endif
+
+namespace Doppelganger
+{
+	////
+	// error code for non-throwing overloads of fs:: (e.g. fs::exists(path, ec))
+	//   fs is boost::filesystem on macOS (C++14), which only accepts boost::system::error_code
+	////
+#if defined(_WIN64)
+	using fs_error_code = std::error_code;
+#elif defined(__APPLE__)
+	using fs_error_code = boost::system::error_code;
+#elif defined(__linux__)
+	using fs_error_code = std::error_code;
+#endif
+}
+
+#endif
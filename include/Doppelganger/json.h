@@ -0,0 +1,24 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <boost/container/flat_map.hpp>
+#include <nlohmann/json.hpp>
+
+namespace Doppelganger
+{
+	////
+	// json used in Doppelganger (e.g. Core::config, Room::config, patches, API parameters)
+	//   objects are sorted vectors (boost::container::flat_map) instead of std::map
+	//     - keys are in the same order as nlohmann::json (i.e. dump() is unchanged)
+	//     - one allocation per object instead of one per key. copy/destruction walk contiguous memory
+	//     - insertion/erasure of a key moves the following keys, i.e. references to values of
+	//       the *same* object are invalidated (values of nested objects are not moved)
+	//   plugins are not affected (config, patches, etc. are exchanged as strings, see Plugin.cpp)
+	////
+	template <class Key, class T, class Compare, class Allocator>
+	using JSONObject = boost::container::flat_map<Key, T, Compare, Allocator>;
+
+	using json = nlohmann::basic_json<JSONObject>;
+}
+
+#endif
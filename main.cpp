@@ -1,43 +1,28 @@
 #include "Doppelganger/Core.h"
+#include "Doppelganger/IOContextPool.h"
 
 #include <boost/asio/signal_set.hpp>
 #include <thread>
 
 int main(int argv, char *argc[])
 {
-	const int threads = std::max<int>(1, std::thread::hardware_concurrency());
-
-	boost::asio::io_context ioc{threads};
-	boost::asio::ssl::context ctx{boost::asio::ssl::context::tlsv12};
-
-	std::shared_ptr<Doppelganger::Core> core = std::make_shared<Doppelganger::Core>(ioc, ctx);
+	// threads and io_contexts are configured by Core::setup() (see config.at("server").at("ioMode"))
+	Doppelganger::IOContextPool ioContextPool;
+	// ssl::context is managed by Core (see Core::loadServerCertificate())
+	std::shared_ptr<Doppelganger::Core> core = std::make_shared<Doppelganger::Core>(ioContextPool);
 	core->setup();
 	core->run();
 
-	boost::asio::signal_set signals(ioc, SIGINT, SIGTERM);
+	boost::asio::signal_set signals(ioContextPool.at(0), SIGINT, SIGTERM);
 	signals.async_wait(
-		[&ioc](boost::system::error_code const &, int)
+		[&ioContextPool](boost::system::error_code const &, int)
 		{
-			ioc.stop();
+			ioContextPool.stop();
 		});
 
-	std::vector<std::thread> v;
-	v.reserve(threads - 1);
-	for (auto i = threads - 1; i > 0; --i)
-		v.emplace_back(
-			[&ioc]
-			{
-				ioc.run();
-			});
-	ioc.run();
+	ioContextPool.run();
 
 	// (If we get here, it means we got a SIGINT or SIGTERM)
 
-	// Block until all the threads exit
-	for (auto &t : v)
-	{
-		t.join();
-	}
-
 	return 0;
 }
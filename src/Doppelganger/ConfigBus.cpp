@@ -0,0 +1,159 @@
+#ifndef CONFIGBUS_CPP
+#define CONFIGBUS_CPP
+
+#include "Doppelganger/ConfigBus.h"
+
+#include <algorithm>
+
+namespace
+{
+	// one is the other or its ancestor (e.g. "/server" and "/server/certificate", "" and anything)
+	bool overlaps(const std::string &a, const std::string &b)
+	{
+		const std::string &shorter = (a.size() <= b.size()) ? a : b;
+		const std::string &longer = (a.size() <= b.size()) ? b : a;
+		return longer.compare(0, shorter.size(), shorter) == 0 &&
+			   (longer.size() == shorter.size() || longer.at(shorter.size()) == '/');
+	}
+
+	// reference token of JSON pointer ("~" -> "~0", "/" -> "~1")
+	void appendToken(std::string &pointer, const std::string &key)
+	{
+		pointer += '/';
+		for (const char c : key)
+		{
+			if (c == '~')
+			{
+				pointer += "~0";
+			}
+			else if (c == '/')
+			{
+				pointer += "~1";
+			}
+			else
+			{
+				pointer += c;
+			}
+		}
+	}
+
+	// same recursion as json::merge_patch
+	void collectChanges(const Doppelganger::json &target, const Doppelganger::json &patch, std::string &pointer, std::vector<std::string> &pointers)
+	{
+		for (auto it = patch.begin(); it != patch.end(); ++it)
+		{
+			const std::size_t length = pointer.size();
+			appendToken(pointer, it.key());
+
+			const Doppelganger::json *current = nullptr;
+			if (target.is_object())
+			{
+				const auto found = target.find(it.key());
+				if (found != target.end())
+				{
+					current = &(*found);
+				}
+			}
+
+			if (it.value().is_object() && current != nullptr && current->is_object())
+			{
+				collectChanges(*current, it.value(), pointer, pointers);
+			}
+			else if (it.value().is_null() ? (current != nullptr) : (current == nullptr || *current != it.value()))
+			{
+				pointers.push_back(pointer);
+			}
+			pointer.resize(length);
+		}
+	}
+}
+
+namespace Doppelganger
+{
+	bool ConfigChange::touches(const std::string &pointer) const
+	{
+		return all || std::any_of(
+						  pointers.begin(), pointers.end(),
+						  [&pointer](const std::string &changed)
+						  {
+							  return overlaps(pointer, changed);
+						  });
+	}
+
+	void ConfigBus::subscribe(std::initializer_list<const char *> prefixes, const Subscriber &subscriber)
+	{
+		subscription s;
+		s.prefixes.assign(prefixes.begin(), prefixes.end());
+		s.subscriber = subscriber;
+		subscriptions_.push_back(std::move(s));
+	}
+
+	bool ConfigBus::publishAll() const
+	{
+		ConfigChange change;
+		change.all = true;
+		return publish(change);
+	}
+
+	bool ConfigBus::merge(json &config, const json &patch) const
+	{
+		const ConfigChange change = diff(config, patch);
+		config.merge_patch(patch);
+		return publish(change);
+	}
+
+	ConfigChange ConfigBus::diff(const json &config, const json &patch)
+	{
+		ConfigChange change;
+		// a patch other than an object replaces the whole config
+		if (!patch.is_object())
+		{
+			change.all = true;
+			return change;
+		}
+		std::string pointer;
+		collectChanges(config, patch, pointer, change.pointers);
+		return change;
+	}
+
+	bool ConfigBus::publish(const ConfigChange &change) const
+	{
+		if (!change.all && change.pointers.empty())
+		{
+			return true;
+		}
+
+		for (const auto &s : subscriptions_)
+		{
+			// changes for this subscriber only
+			ConfigChange event;
+			event.all = change.all;
+			if (!change.all)
+			{
+				for (const std::string &pointer : change.pointers)
+				{
+					if (std::any_of(
+							s.prefixes.begin(), s.prefixes.end(),
+							[&pointer](const std::string &prefix)
+							{
+								return overlaps(prefix, pointer);
+							}))
+					{
+						event.pointers.push_back(pointer);
+					}
+				}
+				if (event.pointers.empty())
+				{
+					continue;
+				}
+			}
+			if (!s.subscriber(event))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+#endif
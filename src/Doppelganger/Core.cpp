@@ -6,19 +6,27 @@
 #include "Doppelganger/HTTPSession.h"
 #include "Doppelganger/Plugin.h"
 #include "Doppelganger/Listener.h"
+#include "Doppelganger/TLSSessionCache.h"
+#if defined(DOPPELGANGER_HTTP2)
+#include "Doppelganger/HTTP2Session.h"
+#endif
+#include "Doppelganger/TraceRecorder.h"
+#include "Doppelganger/Tracing.h"
 #include "Doppelganger/Util/getCurrentTimestampAsString.h"
 #include "Doppelganger/Util/getPluginCatalogue.h"
-#include "Doppelganger/Util/log.h"
+#include "Doppelganger/Logger.h"
 
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/ssl/context.hpp>
+#include <algorithm>
 #include <cstddef>
+#include <functional>
 #include <memory>
 
 #include <fstream>
 #include <sstream>
 #include <iostream>
-#include <nlohmann/json.hpp>
+#include "Doppelganger/json.h"
 
 #if defined(_WIN64)
 #include <shlobj_core.h>
@@ -58,17 +66,37 @@ namespace
 
 // https://github.com/boostorg/beast/blob/develop/example/http/server/async/http_server_async.cpp
 
+namespace
+{
+	// false if the file doesn't exist or is empty
+	bool readFile(const fs::path &path, std::string &content)
+	{
+		std::ifstream ifs(path.string(), std::ios::binary);
+		if (!ifs)
+		{
+			return false;
+		}
+		std::stringstream ss;
+		ss << ifs.rdbuf();
+		content = ss.str();
+		return !content.empty();
+	}
+}
+
 namespace Doppelganger
 {
-	Core::Core(boost::asio::io_context &ioc,
-			   boost::asio::ssl::context &ctx)
-		: ioc_(ioc), ctx_(ctx)
+	Core::Core(IOContextPool &ioContextPool)
+		: logLevels_(Logger::LEVEL_ALL | Logger::TYPE_STDOUT), pipelineLimit_(64), idleTimeout_(30), ioContextPool_(ioContextPool), roomScheduler_(ioContextPool), ioc_(ioContextPool.at(0)), sslContext_(std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::tls_server)), failedCertificateHash_(0), idleTimer_(ioContextPool.at(0)), diagnosticsLoopbackOnly_(true), diagnosticsToken_(std::make_shared<const std::string>()), configSnapshot_(std::make_shared<const json>(json::object())), serverSettings_(std::make_shared<const ServerSettings>()), idleCheckInterval_(60), hibernateAfter_(0)
 	{
+		subscribeConfig();
 	}
 
 	void Core::setup()
 	{
-		config = nlohmann::json::object();
+		// asynchronous logger (messages before this are kept in the ring buffer)
+		Logger::getInstance().start();
+
+		config = json::object();
 
 		// path for DoppelgangerRoot
 		{
@@ -123,42 +151,92 @@ namespace Doppelganger
 			// force reload
 			config["forceReload"] = false;
 			// browser
-			config["browser"] = nlohmann::json::object();
+			config["browser"] = json::object();
 			config.at("browser")["type"] = "default";
 			config.at("browser")["openMode"] = "default";
 			config.at("browser")["openOnStartup"] = true;
 			// log
-			config["log"] = nlohmann::json::object();
-			config.at("log")["level"] = nlohmann::json::object();
+			config["log"] = json::object();
+			config.at("log")["level"] = json::object();
 			config.at("log").at("level")["SYSTEM"] = true;
 			config.at("log").at("level")["APICALL"] = true;
 			config.at("log").at("level")["WSCALL"] = true;
 			config.at("log").at("level")["ERROR"] = true;
 			config.at("log").at("level")["MISC"] = true;
 			config.at("log").at("level")["DEBUG"] = true;
-			config.at("log")["type"] = nlohmann::json::object();
+			config.at("log")["type"] = json::object();
 			config.at("log").at("type")["STDOUT"] = true;
 			config.at("log").at("type")["FILE"] = true;
 			// output
-			config["output"] = nlohmann::json::object();
+			config["output"] = json::object();
 			config.at("output")["type"] = "storage";
 			// plugin
-			config["plugin"] = nlohmann::json::object();
+			config["plugin"] = json::object();
 			config.at("plugin")["reInstall"] = true;
-			config.at("plugin")["installed"] = nlohmann::json::array();
-			config.at("plugin")["listURL"] = nlohmann::json::array();
+			config.at("plugin")["installed"] = json::array();
+			config.at("plugin")["listURL"] = json::array();
 			config.at("plugin").at("listURL").push_back(std::string("https://github.com/n-taka/Doppelganger_TORIDE/releases/download/pluginList/pluginList_Essential.json"));
 			config.at("plugin").at("listURL").push_back(std::string("https://github.com/n-taka/Doppelganger_TORIDE/releases/download/pluginList/pluginList_Basic.json"));
 			// server
-			config["server"] = nlohmann::json::object();
-			config.at("server")["certificate"] = nlohmann::json::object();
+			config["server"] = json::object();
+			config.at("server")["certificate"] = json::object();
 			config.at("server").at("certificate")["certificateFilePath"] = "";
 			config.at("server").at("certificate")["privateKeyFilePath"] = "";
 			config.at("server")["protocol"] = "http";
 			config.at("server")["host"] = "127.0.0.1";
 			config.at("server")["port"] = 0;
+			//   "shared": one io_context for all threads, "perCore": one io_context (and acceptor) per thread (see IOContextPool)
+			config.at("server")["ioMode"] = "shared";
+			//   0: std::thread::hardware_concurrency()
+			config.at("server")["threads"] = 0;
+			//   "perCore": rooms are moved when the busiest io_context exceeds rebalanceSkew * average (see RoomScheduler). 0 disables.
+			config.at("server")["rebalanceSkew"] = 1.5;
+			//   HTTP/1.1 keep-alive: responses queued per connection (pipelined requests), seconds until an idle connection is closed
+			config.at("server")["pipelineLimit"] = 64;
+			config.at("server")["idleTimeout"] = 30;
+			//   "/metrics" and "/spans": clients on this machine only (loopbackOnly), and clients sending "Authorization: Bearer <token>" ("" disables)
+			config.at("server")["diagnostics"] = json::object();
+			config.at("server").at("diagnostics")["loopbackOnly"] = true;
+			config.at("server").at("diagnostics")["token"] = "";
+			//   "https": session resumption (see TLSSessionCache)
+			config.at("server")["tls"] = json::object();
+			config.at("server").at("tls")["minVersion"] = "1.2";
+			config.at("server").at("tls")["sessionTimeout"] = 7200;
+			config.at("server").at("tls")["sessionCacheSize"] = 20480;
+			config.at("server").at("tls")["sessionTickets"] = true;
+			config.at("server").at("tls")["ticketKeyLifetime"] = 3600;
+			// trace (binary API-call trace for doppelganger-replay)
+			config["trace"] = json::object();
+			config.at("trace")["enabled"] = false;
+			config.at("trace")["maxFileSize"] = 64 * 1024 * 1024;
+			config.at("trace")["maxFiles"] = 4;
+			// spans (Chrome trace format at "/spans")
+			config["spans"] = json::object();
+			config.at("spans")["enabled"] = false;
+			config.at("spans")["eventsPerThread"] = 65536;
+			// room
+			//   idle rooms (no WS session for hibernateAfter seconds) are hibernated to disk. 0 disables.
+			config["room"] = json::object();
+			config.at("room")["hibernateAfter"] = 600;
+			config.at("room")["checkInterval"] = 60;
+			//   config of rooms is persisted as snapshot + journal of merge patches (see RoomStore)
+			//   and recovered when the room is requested again (e.g. after crash)
+			config.at("room")["persist"] = true;
+			config.at("room")["journalLimit"] = 64 * 1024 * 1024;
+			//   undo/redo diffs are kept compressed in memory up to historyMemoryBudget bytes (others are read from disk)
+			config.at("room")["historyMemoryBudget"] = 16 * 1024 * 1024;
+			//   mesh buffers of the last meshVersionLimit changes are kept for undo/redo (see MeshStore)
+			config.at("room")["meshVersionLimit"] = 256;
+			//   address range reserved for mesh buffers of a room (buffers exceeding it are allocated from the heap, see MeshArena)
+			config.at("room")["meshArenaCapacity"] = 4ull * 1024 * 1024 * 1024;
+			//   meshes encoded for clients are cached up to meshCacheSize bytes (see MeshEncoder)
+			config.at("room")["meshCacheSize"] = 64 * 1024 * 1024;
+			//   levels of detail are computed for meshes with lodMinFaces faces or more (see MeshLOD)
+			config.at("room")["lodMinFaces"] = 100000;
+			//   refinements are announced to a session only if they can be received within lodTransferBudget seconds
+			config.at("room")["lodTransferBudget"] = 2.0;
 			// extension
-			config["extension"] = nlohmann::json::object();
+			config["extension"] = json::object();
 		}
 
 		// if config.json exist, we load it
@@ -167,10 +245,15 @@ namespace Doppelganger
 		if (fs::exists(configPath))
 		{
 			std::ifstream ifs(configPath.string());
-			config.merge_patch(nlohmann::json::parse(ifs));
+			config.merge_patch(json::parse(ifs));
 			ifs.close();
 		}
 
+		// io_contexts (for changing this, we require reboot)
+		ioContextPool_.configure(
+			config.at("server").at("ioMode").get<std::string>() == "perCore",
+			config.at("server").at("threads").get<unsigned int>());
+
 		// apply
 		applyCurrentConfig(true);
 
@@ -180,6 +263,14 @@ namespace Doppelganger
 
 	void Core::run()
 	{
+		if (listeners_.empty())
+		{
+			// e.g. the port is in use. ioContextPool_.run() returns immediately
+			DOPPELGANGER_LOG(this, ERROR, "No listener is available. We stop here.");
+			ioContextPool_.stop();
+			return;
+		}
+
 		std::string completeURL("");
 		{
 			completeURL += config.at("server").at("protocol").get<std::string>();
@@ -190,13 +281,14 @@ namespace Doppelganger
 		}
 
 		{
-			listener_->run();
+			for (const auto &listener : listeners_)
 			{
-				std::stringstream ss;
-				ss << "Listening for requests at : " << completeURL;
-				Util::log(ss.str(), "SYSTEM", config);
+				listener->run();
 			}
+			DOPPELGANGER_LOG(this, SYSTEM, "Listening for requests at : " << completeURL);
 		}
+
+		scheduleIdleCheck();
 		////
 		// open browser
 		// "openOnStartup" = true|false
@@ -387,10 +479,12 @@ namespace Doppelganger
 					cmd << " &";
 				}
 #endif
-				Util::log(cmd.str(), "SYSTEM", config);
+				DOPPELGANGER_LOG(this, SYSTEM, cmd.str());
 				system(cmd.str().c_str());
 			}
 		}
+		// e.g. "browser"/"path" (io_context threads are not running yet)
+		publishConfig();
 	}
 
 	void Core::shutdown()
@@ -398,6 +492,8 @@ namespace Doppelganger
 		// erase directories when we perform graceful shutdonw
 		// log: Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/log
 		{
+			// write pending messages and release the file before removal
+			Logger::getInstance().closeSink(config.at("dataDir").get<std::string>());
 			fs::path logDir(config.at("dataDir").get<std::string>());
 			logDir.append("log");
 			fs::remove_all(logDir);
@@ -432,201 +528,391 @@ namespace Doppelganger
 		}
 
 		storeCurrentConfig();
-		ioc_.stop();
+		ioContextPool_.stop();
 	}
 
-	void Core::applyCurrentConfig(const bool firstTime)
+	void Core::scheduleIdleCheck()
 	{
-		// DoppelgangerRootDir is ignored
-		//   note: DoppelgangerRootDir is automatically specified depending on the type of OS
+		const int checkInterval = std::max(1, idleCheckInterval_.load());
 
-		// dataDir: Doppelganger/data/YYYYMMDDTHHMMSS-Core/
-		//   note: dataDir is NOT changed.
-		if (!config.contains("dataDir"))
-		{
-			fs::path dataDir_(config.at("DoppelgangerRootDir").get<std::string>());
-			dataDir_.append("data");
-			std::string dirName("");
-			dirName += Util::getCurrentTimestampAsString(false);
-			dirName += "-Core";
-			dataDir_.append(dirName);
-			config["dataDir"] = dataDir_.string();
-			fs::create_directories(dataDir_);
-		}
+#if defined(_WIN64)
+		const std::weak_ptr<Core> weakCore = weak_from_this();
+#elif defined(__APPLE__)
+		const std::weak_ptr<Core> weakCore(shared_from_this());
+#elif defined(__linux__)
+		const std::weak_ptr<Core> weakCore = weak_from_this();
+#endif
+		idleTimer_.expires_after(std::chrono::seconds(checkInterval));
+		idleTimer_.async_wait(
+			[weakCore](const boost::system::error_code &ec)
+			{
+				const std::shared_ptr<Core> core = weakCore.lock();
+				if (!ec && core)
+				{
+					core->checkIdleRooms();
+					const std::shared_ptr<const ServerSettings> settings = std::atomic_load(&core->serverSettings_);
+					// e.g. certificate renewed by certbot
+					if (settings->protocol == "https")
+					{
+						core->loadServerCertificate();
+					}
+					core->roomScheduler_.rebalance(core->rooms_.snapshot(), settings->rebalanceSkew);
+					core->scheduleIdleCheck();
+				}
+			});
+	}
 
-		// log: Doppelganger/data/YYYYMMDDTHHMMSS-Core/log
+	void Core::checkIdleRooms()
+	{
+		const int hibernateAfter = hibernateAfter_.load();
+
+		// busy rooms are skipped (and checked again later)
+		for (const auto &room : rooms_.snapshot())
 		{
-			fs::path logDir(config.at("dataDir").get<std::string>());
-			logDir.append("log");
-			fs::create_directories(logDir);
+			room->hibernate(std::chrono::seconds(hibernateAfter));
 		}
+	}
 
-		// output: Doppelganger/data/YYYYMMDDTHHMMSS-Core/output
+	void Core::applyCurrentConfig(const bool firstTime)
+	{
+		std::lock_guard<std::mutex> lock(mutexConfig_);
+		if (configBus_.publishAll())
 		{
-			fs::path outputDir(config.at("dataDir").get<std::string>());
-			outputDir.append("output");
-			fs::create_directories(outputDir);
+			applyRooms(firstTime);
 		}
+		publishConfig();
+	}
 
-		// plugin: Doppelganger/plugin
-		//     note: actual installation is called in rooms
+	void Core::applyConfigPatch(const json &patch)
+	{
+		std::lock_guard<std::mutex> lock(mutexConfig_);
+		if (configBus_.merge(config, patch))
 		{
-			fs::path pluginDir(config.at("DoppelgangerRootDir").get<std::string>());
-			pluginDir.append("plugin");
-			fs::create_directories(pluginDir);
+			applyRooms(false);
 		}
-		if (config.contains("plugin"))
-		{
-			if (config.at("plugin").contains("reInstall") && config.at("plugin").at("reInstall").get<bool>())
+		publishConfig();
+	}
+
+	void Core::publishConfig()
+	{
+		std::atomic_store(&configSnapshot_, std::shared_ptr<const json>(std::make_shared<const json>(config)));
+	}
+
+	void Core::subscribeConfig()
+	{
+		// log: cache enabled levels
+		configBus_.subscribe(
+			{"/log"},
+			[this](const ConfigChange &change)
 			{
-				config.at("plugin").at("reInstall") = false;
-				if (config.at("plugin").contains("listURL"))
+				logLevels_.store(Logger::levelMask(config));
+				// close the file once "FILE" is disabled (it's reopened on the next message after "FILE" is enabled again)
+				if (!change.all && change.touches("/log/type") && (logLevels_.load() & Logger::TYPE_FILE) == 0u && config.contains("dataDir"))
 				{
-					// get plugin catalogue
-					fs::path pluginDir(config.at("DoppelgangerRootDir").get<std::string>());
-					pluginDir.append("plugin");
-					nlohmann::json catalogue;
-					Util::getPluginCatalogue(pluginDir, config.at("plugin").at("listURL"), catalogue);
+					Logger::getInstance().closeSink(config.at("dataDir").get<std::string>(), true);
+				}
+				return true;
+			});
 
-					// For Core, we only maintain installedPlugin_
-					// i.e. we *don't* perform install in Core
-					std::unordered_map<std::string, nlohmann::json> plugins;
+		// server: for new HTTP sessions
+		configBus_.subscribe(
+			{"/server/pipelineLimit", "/server/idleTimeout"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("server"))
+				{
+					pipelineLimit_.store(std::max(1u, config.at("server").at("pipelineLimit").get<std::uint32_t>()));
+					idleTimeout_.store(std::max(1u, config.at("server").at("idleTimeout").get<std::uint32_t>()));
+				}
+				return true;
+			});
+		// server: for idleTimer_ (must be before the subscribers loading the certificate)
+		configBus_.subscribe(
+			{"/server/protocol", "/server/certificate", "/server/tls", "/server/rebalanceSkew"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("server"))
+				{
+					storeServerSettings();
+				}
+				return true;
+			});
+		// room: for idleTimer_
+		configBus_.subscribe(
+			{"/room/checkInterval", "/room/hibernateAfter"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("room"))
+				{
+					idleCheckInterval_.store(config.at("room").value("checkInterval", 60));
+					hibernateAfter_.store(config.at("room").value("hibernateAfter", 0));
+				}
+				return true;
+			});
+		// server: "/metrics" and "/spans"
+		configBus_.subscribe(
+			{"/server/diagnostics"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("server") && config.at("server").contains("diagnostics"))
+				{
+					const json &diagnostics = config.at("server").at("diagnostics");
+					diagnosticsLoopbackOnly_.store(diagnostics.value("loopbackOnly", true));
+					std::atomic_store(&diagnosticsToken_, std::make_shared<const std::string>(diagnostics.value("token", std::string(""))));
+				}
+				return true;
+			});
 
-					// initialize Doppelganger::Plugin instances
-					for (const auto &pluginEntry : catalogue)
-					{
-						const std::string name = pluginEntry.at("name").get<std::string>();
-						plugins[name] = pluginEntry;
-					}
+		// DoppelgangerRootDir is ignored
+		//   note: DoppelgangerRootDir is automatically specified depending on the type of OS
+
+		// dataDir: Doppelganger/data/YYYYMMDDTHHMMSS-Core/
+		//   note: dataDir is NOT changed.
+		configBus_.subscribe(
+			{"/dataDir"},
+			[this](const ConfigChange &)
+			{
+				if (!config.contains("dataDir"))
+				{
+					fs::path dataDirPath(config.at("DoppelgangerRootDir").get<std::string>());
+					dataDirPath.append("data");
+					std::string dirName("");
+					dirName += Util::getCurrentTimestampAsString(false);
+					dirName += "-Core";
+					dataDirPath.append(dirName);
+					config["dataDir"] = dataDirPath.string();
+					fs::create_directories(dataDirPath);
+				}
+				// the first one is kept (see dataDir_)
+				if (dataDir_.empty())
+				{
+					dataDir_ = config.at("dataDir").get<std::string>();
+				}
+				return true;
+			});
+
+		// log: Doppelganger/data/YYYYMMDDTHHMMSS-Core/log
+		configBus_.subscribe(
+			{"/dataDir", "/log/type"},
+			[this](const ConfigChange &)
+			{
+				fs::path logDir(config.at("dataDir").get<std::string>());
+				logDir.append("log");
+				fs::create_directories(logDir);
+				return true;
+			});
+
+		// output: Doppelganger/data/YYYYMMDDTHHMMSS-Core/output
+		configBus_.subscribe(
+			{"/dataDir", "/output"},
+			[this](const ConfigChange &)
+			{
+				fs::path outputDir(config.at("dataDir").get<std::string>());
+				outputDir.append("output");
+				fs::create_directories(outputDir);
+				return true;
+			});
+
+		// trace: Doppelganger/data/YYYYMMDDTHHMMSS-Core/trace
+		configBus_.subscribe(
+			{"/dataDir", "/trace"},
+			[this](const ConfigChange &)
+			{
+				TraceRecorder::getInstance().configure(config);
+				return true;
+			});
+		// spans: kept in memory
+		configBus_.subscribe(
+			{"/spans"},
+			[this](const ConfigChange &)
+			{
+				Tracer::getInstance().configure(config);
+				return true;
+			});
 
-					// mark installed plugins as "installed"
+		// plugin: Doppelganger/plugin
+		//     note: actual installation is called in rooms
+		configBus_.subscribe(
+			{"/DoppelgangerRootDir"},
+			[this](const ConfigChange &)
+			{
+				fs::path pluginDir(config.at("DoppelgangerRootDir").get<std::string>());
+				pluginDir.append("plugin");
+				fs::create_directories(pluginDir);
+				return true;
+			});
+		// catalogue is fetched again only if "reInstall" is changed (i.e. set to true)
+		configBus_.subscribe(
+			{"/plugin/reInstall"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("plugin"))
+				{
+					if (config.at("plugin").contains("reInstall") && config.at("plugin").at("reInstall").get<bool>())
 					{
-						for (const auto &installedPlugin : config.at("plugin").at("installed"))
+						config.at("plugin").at("reInstall") = false;
+						if (config.at("plugin").contains("listURL"))
 						{
-							const std::string name = installedPlugin.at("name").get<std::string>();
-							const std::string version = installedPlugin.at("version").get<std::string>();
+							// get plugin catalogue
+							fs::path pluginDir(config.at("DoppelgangerRootDir").get<std::string>());
+							pluginDir.append("plugin");
+							// Util::getPluginCatalogue uses nlohmann::json (small, i.e. conversion is cheap)
+							nlohmann::json catalogueUtil;
+							Util::getPluginCatalogue(pluginDir, nlohmann::json(config.at("plugin").at("listURL")), catalogueUtil);
+							const json catalogue(catalogueUtil);
+
+							// For Core, we only maintain installedPlugin_
+							// i.e. we *don't* perform install in Core
+							std::unordered_map<std::string, json> plugins;
 
-							if (plugins.find(name) != plugins.end() && version.length() > 0)
+							// initialize Doppelganger::Plugin instances
+							for (const auto &pluginEntry : catalogue)
 							{
-								// here we don't check validity/availability of the specified version...
-								plugins.at(name)["installedVersion"] = version;
+								const std::string name = pluginEntry.at("name").get<std::string>();
+								plugins[name] = pluginEntry;
 							}
-							else
+
+							// mark installed plugins as "installed"
 							{
-								std::stringstream ss;
-								ss << "Plugin \"" << name << "\" (" << version << ")"
-								   << " is NOT found in the catalogue.";
-								Util::log(ss.str(), "ERROR", config);
+								for (const auto &installedPlugin : config.at("plugin").at("installed"))
+								{
+									const std::string name = installedPlugin.at("name").get<std::string>();
+									const std::string version = installedPlugin.at("version").get<std::string>();
+
+									if (plugins.find(name) != plugins.end() && version.length() > 0)
+									{
+										// here we don't check validity/availability of the specified version...
+										plugins.at(name)["installedVersion"] = version;
+									}
+									else
+									{
+										DOPPELGANGER_LOG(this, ERROR, "Plugin \"" << name << "\" (" << version << ")"
+																				   << " is NOT found in the catalogue.");
+									}
+								}
 							}
-						}
-					}
 
-					// add non-optional plugins to installedPlugin
-					for (const auto &name_plugin : plugins)
-					{
-						const std::string &name = name_plugin.first;
-						const nlohmann::json &plugin = name_plugin.second;
-						if (!plugin.at("optional").get<bool>() &&
-							(!plugin.contains("installedVersion")))
-						{
-							nlohmann::json installedPlugin = nlohmann::json::object();
-							installedPlugin["name"] = name;
-							installedPlugin["version"] = std::string("latest");
-							config.at("plugin").at("installed").push_back(installedPlugin);
+							// add non-optional plugins to installedPlugin
+							for (const auto &name_plugin : plugins)
+							{
+								const std::string &name = name_plugin.first;
+								const json &plugin = name_plugin.second;
+								if (!plugin.at("optional").get<bool>() &&
+									(!plugin.contains("installedVersion")))
+								{
+									json installedPlugin = json::object();
+									installedPlugin["name"] = name;
+									installedPlugin["version"] = std::string("latest");
+									config.at("plugin").at("installed").push_back(installedPlugin);
+								}
+							}
 						}
 					}
 				}
-			}
-		}
+				return true;
+			});
 
-		// for changing server configuration, we require reboot
-		if (config.contains("server") && !listener_)
-		{
-			boost::system::error_code ec;
-
-			boost::asio::ip::tcp::resolver resolver(ioc_);
-			boost::asio::ip::tcp::resolver::results_type endpointIterator = resolver.resolve(
-				config.at("server").at("host").get<std::string>(),
-				std::to_string(config.at("server").at("port").get<int>()),
-				ec);
-			if (ec)
+		// certificate can be replaced without reboot (e.g. patch of "certificate" by a plugin)
+		//   new connections use the new certificate, and existing sessions keep the old one
+		configBus_.subscribe(
+			{"/server/certificate", "/server/protocol", "/server/tls"},
+			[this](const ConfigChange &)
 			{
+				if (config.contains("server") && !listeners_.empty() && config.at("server").at("protocol").get<std::string>() == "https")
 				{
-					std::stringstream ss;
-					ss << "Fail to resolve hostname \"" << config.at("server").at("host").get<std::string>() << "\"";
-					Util::log(ss.str(), "ERROR", config);
+					loadServerCertificate();
 				}
-				{
-					std::stringstream ss;
-					ss << ec.message();
-					Util::log(ss.str(), "ERROR", config);
-				}
-				return;
-			}
-
-			boost::asio::ip::tcp::endpoint endpoint = endpointIterator->endpoint();
+				return true;
+			});
 
-			if (config.at("server").at("protocol").get<std::string>() == "https")
+		// for changing other server configuration, we require reboot
+		configBus_.subscribe(
+			{"/server"},
+			[this](const ConfigChange &)
 			{
-				fs::path certificateFilePath(config.at("server").at("certificate").at("certificateFilePath").get<std::string>());
-				fs::path privateKeyFilePath(config.at("server").at("certificate").at("privateKeyFilePath").get<std::string>());
-				if (fs::exists(certificateFilePath) && fs::exists(privateKeyFilePath))
+				if (config.contains("server") && listeners_.empty())
 				{
-					loadServerCertificate(
-						certificateFilePath,
-						privateKeyFilePath);
-				}
-				else
-				{
-					{
-						std::stringstream ss;
-						ss << "Protocol \"https\" is specified, but no valid certificate is found. We switch to \"http\".";
-						Util::log(ss.str(), "ERROR", config);
-					}
+					boost::system::error_code ec;
+
+					boost::asio::ip::tcp::resolver resolver(ioc_);
+					boost::asio::ip::tcp::resolver::results_type endpointIterator = resolver.resolve(
+						config.at("server").at("host").get<std::string>(),
+						std::to_string(config.at("server").at("port").get<int>()),
+						ec);
+					if (ec)
 					{
-						std::stringstream ss;
-						ss << "    certificate: ";
-						ss << certificateFilePath.string();
-						Util::log(ss.str(), "ERROR", config);
+						DOPPELGANGER_LOG(this, ERROR, "Fail to resolve hostname \"" << config.at("server").at("host").get<std::string>() << "\"");
+						DOPPELGANGER_LOG(this, ERROR, ec.message());
+						return false;
 					}
+
+					boost::asio::ip::tcp::endpoint endpoint = endpointIterator->endpoint();
+
+					if (config.at("server").at("protocol").get<std::string>() == "https" && !loadServerCertificate())
 					{
-						std::stringstream ss;
-						ss << "    privateKey: ";
-						ss << privateKeyFilePath.string();
-						Util::log(ss.str(), "ERROR", config);
+						DOPPELGANGER_LOG(this, ERROR, "Protocol \"https\" is specified, but no valid certificate is found. We switch to \"http\".");
+						DOPPELGANGER_LOG(this, ERROR, "    certificate: " << config.at("server").at("certificate").at("certificateFilePath").get<std::string>());
+						DOPPELGANGER_LOG(this, ERROR, "    privateKey: " << config.at("server").at("certificate").at("privateKeyFilePath").get<std::string>());
+						config.at("server").at("protocol") = std::string("http");
+						storeServerSettings();
 					}
-					config.at("server").at("protocol") = std::string("http");
-				}
-			}
 
-			// listener
+					// listener
+					//   "perCore": one acceptor per io_context with SO_REUSEPORT (i.e. the kernel distributes connections)
+					//   where SO_REUSEPORT doesn't balance connections, one acceptor distributes them to io_contexts (see Listener)
 #if defined(_WIN64)
-			listener_ = std::make_shared<Listener>(weak_from_this(), ioc_, ctx_, endpoint);
+					const bool reusePort = false;
+					const std::weak_ptr<Core> weakCore = weak_from_this();
 #elif defined(__APPLE__)
-			listener_ = std::make_shared<Listener>(std::weak_ptr<Core>(shared_from_this()), ioc_, ctx_, endpoint);
+					const bool reusePort = false;
+					const std::weak_ptr<Core> weakCore = std::weak_ptr<Core>(shared_from_this());
 #elif defined(__linux__)
-			listener_ = std::make_shared<Listener>(weak_from_this(), ioc_, ctx_, endpoint);
+					const bool reusePort = ioContextPool_.perCore();
+					const std::weak_ptr<Core> weakCore = weak_from_this();
 #endif
-			config.at("server")["portUsed"] = listener_->acceptor_.local_endpoint().port();
-		}
+					if (reusePort && endpoint.port() != 0 && !Listener::isAvailable(ioc_, endpoint))
+					{
+						DOPPELGANGER_LOG(this, ERROR, "Port " << endpoint.port() << " is already in use (e.g. by another instance).");
+						return false;
+					}
+					const std::size_t listenerCount = reusePort ? ioContextPool_.size() : 1;
+					for (std::size_t l = 0; l < listenerCount; ++l)
+					{
+						const std::shared_ptr<Listener> listener = std::make_shared<Listener>(weakCore, ioContextPool_, ioContextPool_.at(l), endpoint, reusePort);
+						if (!listener->isBound())
+						{
+							// e.g. another process took the port after isAvailable(). we keep the acceptors bound so far (if any)
+							DOPPELGANGER_LOG(this, ERROR, "Fail to listen on port " << endpoint.port() << " (" << listeners_.size() << "/" << listenerCount << " acceptors are ready).");
+							break;
+						}
+						listeners_.push_back(listener);
+						// e.g. port 0 is given. others share the port used by the first one
+						boost::system::error_code portEc;
+						endpoint.port(listeners_.front()->acceptor_.local_endpoint(portEc).port());
+					}
+					if (listeners_.empty())
+					{
+						// see run()
+						return false;
+					}
+					boost::system::error_code portEc;
+					config.at("server")["portUsed"] = listeners_.front()->acceptor_.local_endpoint(portEc).port();
+				}
+				return true;
+			});
+	}
 
+	void Core::applyRooms(const bool firstTime)
+	{
 		// filter inactive rooms
-		std::unordered_set<std::string> uuidToBeRemoved;
-		for (const auto &uuid_room : rooms_)
+		for (const auto &room : rooms_.snapshot())
 		{
-			const std::string &uuid = uuid_room.first;
-			const std::shared_ptr<Doppelganger::Room> &room = uuid_room.second;
-			if (!room->config.at("active").get<bool>())
+			if (!room->active_.load())
 			{
-				uuidToBeRemoved.insert(uuid);
+				// room->shutdown();
+				rooms_.erase(room->UUID_);
 			}
 		}
-		for (const auto &uuid : uuidToBeRemoved)
-		{
-			std::shared_ptr<Doppelganger::Room> room = rooms_.at(uuid);
-			// room->shutdown();
-			rooms_.erase(uuid);
-		}
 		if (rooms_.size() == 0 && !firstTime)
 		{
 			shutdown();
@@ -636,11 +922,10 @@ namespace Doppelganger
 		if (config.contains("forceReload") && config.at("forceReload").get<bool>())
 		{
 			config.at("forceReload") = false;
-			for (const auto &uuid_room : rooms_)
+			for (const auto &room : rooms_.snapshot())
 			{
-				const std::shared_ptr<Room> room = uuid_room.second;
 				// reload
-				room->broadcastWS(std::string("forceReload"), std::string(""), nlohmann::json::object(), nlohmann::json(nullptr));
+				room->broadcastWS(std::string("forceReload"), std::string(""), json::object(), json(nullptr), false);
 			}
 		}
 	}
@@ -652,7 +937,7 @@ namespace Doppelganger
 		std::ofstream ofs(configPath.string());
 		if (ofs)
 		{
-			nlohmann::json configToBeStored = config;
+			json configToBeStored = config;
 			// remove unused
 			configToBeStored.erase("active");
 			configToBeStored.erase("forceReload");
@@ -667,8 +952,74 @@ namespace Doppelganger
 		ofs.close();
 	}
 
-	void Core::loadServerCertificate(const fs::path &certificatePath, const fs::path &privateKeyPath)
+	bool Core::diagnosticsAllowed(const boost::asio::ip::address &remote, const boost::beast::string_view authorization) const
 	{
+		// e.g. "::ffff:127.0.0.1" for dual-stack sockets
+		const bool loopback = remote.is_loopback() ||
+							  (remote.is_v6() && remote.to_v6().is_v4_mapped() &&
+							   boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, remote.to_v6()).is_loopback());
+		if (loopback || !diagnosticsLoopbackOnly_.load(std::memory_order_relaxed))
+		{
+			return true;
+		}
+
+		const std::shared_ptr<const std::string> token = std::atomic_load(&diagnosticsToken_);
+		static const boost::beast::string_view scheme("Bearer ");
+		if (token->empty() || authorization.size() != scheme.size() + token->size() || authorization.substr(0, scheme.size()) != scheme)
+		{
+			return false;
+		}
+		// constant time (i.e. the token can't be guessed from response times)
+		unsigned char diff = 0;
+		for (std::size_t c = 0; c < token->size(); ++c)
+		{
+			diff |= static_cast<unsigned char>(authorization[scheme.size() + c] ^ token->at(c));
+		}
+		return (diff == 0);
+	}
+
+	void Core::storeServerSettings()
+	{
+		const json &server = config.at("server");
+		const std::shared_ptr<ServerSettings> settings = std::make_shared<ServerSettings>();
+		settings->protocol = server.at("protocol").get<std::string>();
+		settings->certificateFilePath = server.at("certificate").at("certificateFilePath").get<std::string>();
+		settings->privateKeyFilePath = server.at("certificate").at("privateKeyFilePath").get<std::string>();
+		settings->tls = server.at("tls");
+		settings->rebalanceSkew = server.at("rebalanceSkew").get<double>();
+		std::atomic_store(&serverSettings_, std::shared_ptr<const ServerSettings>(settings));
+	}
+
+	bool Core::loadServerCertificate()
+	{
+		// we never read config here (called by idleTimer_ while config may be patched)
+		const std::shared_ptr<const ServerSettings> settings = std::atomic_load(&serverSettings_);
+		const fs::path certificatePath(settings->certificateFilePath);
+		const fs::path privateKeyPath(settings->privateKeyFilePath);
+		std::string certificatePEM, privateKeyPEM;
+		if (!readFile(certificatePath, certificatePEM) || !readFile(privateKeyPath, privateKeyPEM))
+		{
+			return false;
+		}
+
+		std::string key = certificatePEM;
+		key += '\0';
+		key += privateKeyPEM;
+		key += '\0';
+		key += settings->tls.dump();
+		const std::size_t hash = std::hash<std::string>()(key);
+
+		std::lock_guard<std::mutex> lock(mutexCertificate_);
+		if (key == certificateKey_)
+		{
+			// already loaded
+			return true;
+		}
+		if (hash == failedCertificateHash_)
+		{
+			// already reported (e.g. polled by scheduleIdleCheck())
+			return false;
+		}
 
 		const std::string dh =
 			"-----BEGIN DH PARAMETERS-----\n"
@@ -680,28 +1031,55 @@ namespace Doppelganger
 			"JoiGl/8+RNpL1HlmZXwNXVv4zUIHirskCwIBAg==\n"
 			"-----END DH PARAMETERS-----";
 
-		ctx_.set_password_callback(
-			[](std::size_t,
-			   boost::asio::ssl::context_base::password_purpose)
-			{
-				return "test";
-			});
+		// existing sessions keep the context they were created with
+		const std::shared_ptr<boost::asio::ssl::context> ctx = std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::tls_server);
+		try
+		{
+			ctx->set_password_callback(
+				[](std::size_t,
+				   boost::asio::ssl::context_base::password_purpose)
+				{
+					return "test";
+				});
+
+			// we only support TLS
+			// we always generate dh params every time
+			ctx->set_options(
+				boost::asio::ssl::context::default_workarounds |
+				boost::asio::ssl::context::no_sslv2 |
+				boost::asio::ssl::context::no_sslv3 |
+				boost::asio::ssl::context::single_dh_use);
 
-		// we only support TLS
-		// we always generate dh params every time
-		ctx_.set_options(
-			boost::asio::ssl::context::default_workarounds |
-			boost::asio::ssl::context::no_sslv2 |
-			boost::asio::ssl::context::no_sslv3 |
-			boost::asio::ssl::context::single_dh_use);
+			ctx->use_certificate_chain(
+				boost::asio::buffer(certificatePEM.data(), certificatePEM.size()));
 
-		ctx_.use_certificate_chain_file(certificatePath.string());
+			ctx->use_private_key(
+				boost::asio::buffer(privateKeyPEM.data(), privateKeyPEM.size()),
+				boost::asio::ssl::context::file_format::pem);
 
-		ctx_.use_private_key_file(privateKeyPath.string(), boost::asio::ssl::context::file_format::pem);
+			// we always generate dh params every time
+			ctx->use_tmp_dh(
+				boost::asio::buffer(dh.data(), dh.size()));
+		}
+		catch (const boost::system::system_error &e)
+		{
+			// e.g. the certificate is written but the key is not yet
+			DOPPELGANGER_LOG(this, ERROR, "Fail to load certificate \"" << certificatePath.string() << "\": " << e.what());
+			failedCertificateHash_ = hash;
+			return false;
+		}
+
+		// session cache/tickets and protocol versions
+		TLSSessionCache::getInstance().configure(*ctx, settings->tls);
+#if defined(DOPPELGANGER_HTTP2)
+		enableHTTP2(*ctx);
+#endif
 
-		// we always generate dh params every time
-		ctx_.use_tmp_dh(
-			boost::asio::buffer(dh.data(), dh.size()));
+		std::atomic_store(&sslContext_, ctx);
+		certificateKey_.swap(key);
+		failedCertificateHash_ = 0;
+		DOPPELGANGER_LOG(this, SYSTEM, "Certificate \"" << certificatePath.string() << "\" is loaded.");
+		return true;
 	}
 
 }
@@ -0,0 +1,533 @@
+#ifndef HTTP2SESSION_CPP
+#define HTTP2SESSION_CPP
+
+#include "Doppelganger/HTTP2Session.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+#include <openssl/ssl.h>
+#include <nghttp2/nghttp2.h>
+
+#include "Doppelganger/Core.h"
+#include "Doppelganger/Tracing.h"
+#include "Doppelganger/Logger.h"
+
+namespace
+{
+	namespace beast = boost::beast;	  // from <boost/beast.hpp>
+	namespace http = beast::http;	  // from <boost/beast/http.hpp>
+	namespace net = boost::asio;	  // from <boost/asio.hpp>
+	using tcp = boost::asio::ip::tcp; // from <boost/asio/ip/tcp.hpp>
+
+	const std::size_t readSize = 16 * 1024;
+	// frames are written in chunks of (about) this size, i.e. a response that becomes ready while a
+	// large response is written (e.g. an API call vs. static files) is scheduled before the rest of it
+	const std::size_t maxWriteSize = 64 * 1024;
+
+	////
+	// stream priority (RFC 9218, smaller urgency is sent first)
+	//   API calls > others (e.g. redirect, metrics) > encoded meshes > static files
+	//   responses with the same urgency are interleaved if incremental (i.e. large bodies don't block each other)
+	////
+	nghttp2_extpri priority(const http::request<http::string_body> &req)
+	{
+		nghttp2_extpri pri;
+		pri.urgency = NGHTTP2_EXTPRI_DEFAULT_URGENCY;
+		pri.inc = 0;
+
+		// "/<roomUUID>/<component>/..."
+		const beast::string_view target = req.target();
+		const std::size_t begin = target.find('/', 1);
+		beast::string_view component = (begin == beast::string_view::npos) ? beast::string_view() : target.substr(begin + 1);
+		component = component.substr(0, component.find_first_of("/?"));
+
+		if (component == "css" || component == "html" || component == "icon" || component == "js" || component == "plugin")
+		{
+			pri.urgency = 5;
+			pri.inc = 1;
+		}
+		else if (component == "mesh")
+		{
+			pri.urgency = 4;
+			pri.inc = 1;
+		}
+		else if (req.method() == http::verb::post)
+		{
+			pri.urgency = 1;
+		}
+		return pri;
+	}
+
+	// headers that are not allowed in HTTP/2 (RFC 9113, 8.2.2)
+	bool isConnectionSpecific(const std::string &name)
+	{
+		return (name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding" || name == "upgrade");
+	}
+
+	nghttp2_nv makeNV(const std::string &name, const std::string &value)
+	{
+		nghttp2_nv nv;
+		nv.name = reinterpret_cast<std::uint8_t *>(const_cast<char *>(name.data()));
+		nv.value = reinterpret_cast<std::uint8_t *>(const_cast<char *>(value.data()));
+		nv.namelen = name.size();
+		nv.valuelen = value.size();
+		nv.flags = NGHTTP2_NV_FLAG_NONE;
+		return nv;
+	}
+
+	beast::string_view toStringView(const std::uint8_t *data, const std::size_t size)
+	{
+		return beast::string_view(reinterpret_cast<const char *>(data), size);
+	}
+
+	////
+	// nghttp2 callbacks (userData is the session)
+	////
+	template <class Session>
+	int onBeginHeadersCallback(nghttp2_session *session, const nghttp2_frame *frame, void *userData)
+	{
+		(void)session;
+		if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST)
+		{
+			static_cast<Session *>(userData)->onBeginHeaders(frame->hd.stream_id);
+		}
+		return 0;
+	}
+
+	template <class Session>
+	int onHeaderCallback(nghttp2_session *session, const nghttp2_frame *frame, const std::uint8_t *name, std::size_t namelen, const std::uint8_t *value, std::size_t valuelen, std::uint8_t flags, void *userData)
+	{
+		(void)session;
+		(void)flags;
+		if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST)
+		{
+			static_cast<Session *>(userData)->onHeader(frame->hd.stream_id, toStringView(name, namelen), toStringView(value, valuelen));
+		}
+		return 0;
+	}
+
+	template <class Session>
+	int onDataChunkRecvCallback(nghttp2_session *session, std::uint8_t flags, std::int32_t streamId, const std::uint8_t *data, std::size_t len, void *userData)
+	{
+		(void)session;
+		(void)flags;
+		static_cast<Session *>(userData)->onData(streamId, data, len);
+		return 0;
+	}
+
+	template <class Session>
+	int onFrameRecvCallback(nghttp2_session *session, const nghttp2_frame *frame, void *userData)
+	{
+		(void)session;
+		// the request is complete with END_STREAM (on HEADERS without body, or on the last DATA)
+		if ((frame->hd.type == NGHTTP2_HEADERS || frame->hd.type == NGHTTP2_DATA) && (frame->hd.flags & NGHTTP2_FLAG_END_STREAM))
+		{
+			static_cast<Session *>(userData)->onRequest(frame->hd.stream_id);
+		}
+		return 0;
+	}
+
+	template <class Session>
+	int onStreamCloseCallback(nghttp2_session *session, std::int32_t streamId, std::uint32_t errorCode, void *userData)
+	{
+		(void)session;
+		(void)errorCode;
+		static_cast<Session *>(userData)->onStreamClose(streamId);
+		return 0;
+	}
+
+	template <class Session>
+	ssize_t readBodyCallback(nghttp2_session *session, std::int32_t streamId, std::uint8_t *buf, std::size_t length, std::uint32_t *dataFlags, nghttp2_data_source *source, void *userData)
+	{
+		(void)session;
+		(void)source;
+		bool eof = false;
+		const std::size_t size = static_cast<Session *>(userData)->readBody(streamId, buf, length, eof);
+		if (eof)
+		{
+			*dataFlags |= NGHTTP2_DATA_FLAG_EOF;
+		}
+		return static_cast<ssize_t>(size);
+	}
+
+	////
+	// ALPN (see SSL_CTX_set_alpn_select_cb(3))
+	////
+	int selectProtocol(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg)
+	{
+		(void)ssl;
+		(void)arg;
+		// in the order of preference
+		static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+		unsigned char *selected;
+		if (SSL_select_next_proto(&selected, outlen, protocols, sizeof(protocols) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+		{
+			// no ALPN (i.e. HTTP/1.1)
+			return SSL_TLSEXT_ERR_NOACK;
+		}
+		*out = selected;
+		return SSL_TLSEXT_ERR_OK;
+	}
+}
+
+namespace Doppelganger
+{
+	namespace net = boost::asio;	  // from <boost/asio.hpp>
+	using tcp = boost::asio::ip::tcp; // from <boost/asio/ip/tcp.hpp>
+
+	////
+	// HTTP2Session
+	////
+	template <class Stream>
+	HTTP2Session<Stream>::HTTP2Session(
+		const std::weak_ptr<Core> &core,
+		Stream &&stream,
+		beast::flat_buffer &&buffer)
+		: core_(core), stream_(std::move(stream)), buffer_(std::move(buffer)), session_(nullptr), writing_(false), idleTimeout_(30)
+	{
+		nghttp2_session_callbacks *callbacks;
+		nghttp2_session_callbacks_new(&callbacks);
+		nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, onBeginHeadersCallback<HTTP2Session>);
+		nghttp2_session_callbacks_set_on_header_callback(callbacks, onHeaderCallback<HTTP2Session>);
+		nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, onDataChunkRecvCallback<HTTP2Session>);
+		nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, onFrameRecvCallback<HTTP2Session>);
+		nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, onStreamCloseCallback<HTTP2Session>);
+		nghttp2_session_server_new(&session_, callbacks, this);
+		nghttp2_session_callbacks_del(callbacks);
+	}
+
+	template <class Stream>
+	HTTP2Session<Stream>::~HTTP2Session()
+	{
+		nghttp2_session_del(session_);
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::run()
+	{
+		// the same limit as HTTP/1.1 pipelining (config.at("server").at("pipelineLimit"))
+		std::uint32_t maxConcurrentStreams = 64;
+		const std::shared_ptr<Core> core = core_.lock();
+		if (core)
+		{
+			maxConcurrentStreams = core->pipelineLimit_.load(std::memory_order_relaxed);
+			idleTimeout_ = std::chrono::seconds(core->idleTimeout_.load(std::memory_order_relaxed));
+		}
+
+		// RFC 9218 priorities (i.e. we decide the urgency, see priority())
+		const nghttp2_settings_entry settings[] = {
+			{NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, maxConcurrentStreams},
+			{NGHTTP2_SETTINGS_NO_RFC7540_PRIORITIES, 1}};
+		nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0]));
+
+		// bytes read before we know the protocol (e.g. the connection preface)
+		if (buffer_.size() > 0)
+		{
+			beast::error_code ec;
+			return onRead(ec, 0);
+		}
+		doWrite();
+		doRead();
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::onBeginHeaders(const std::int32_t streamId)
+	{
+		streams_[streamId];
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::onHeader(const std::int32_t streamId, const beast::string_view name, const beast::string_view value)
+	{
+		const auto it = streams_.find(streamId);
+		if (it == streams_.end())
+		{
+			return;
+		}
+		http::request<http::string_body> &req = it->second.request;
+		if (name == ":method")
+		{
+			req.method_string(value);
+		}
+		else if (name == ":path")
+		{
+			req.target(value);
+		}
+		else if (name == ":authority")
+		{
+			req.set(http::field::host, value);
+		}
+		else if (name.empty() || name.front() != ':')
+		{
+			req.insert(name, value);
+		}
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::onData(const std::int32_t streamId, const std::uint8_t *data, const std::size_t size)
+	{
+		const auto it = streams_.find(streamId);
+		if (it != streams_.end())
+		{
+			it->second.request.body().append(reinterpret_cast<const char *>(data), size);
+		}
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::onRequest(const std::int32_t streamId)
+	{
+		DOPPELGANGER_TRACE_SPAN("HTTP2Session::onRequest");
+		const auto it = streams_.find(streamId);
+		const std::shared_ptr<Core> core = core_.lock();
+		if (it == streams_.end() || !core)
+		{
+			return;
+		}
+
+		const nghttp2_extpri pri = priority(it->second.request);
+		nghttp2_session_change_extpri_stream_priority(session_, streamId, &pri, 1);
+
+		// handlers are written for HTTP/1.1 (e.g. keep_alive() of responses)
+		http::request<http::string_body> req = std::move(it->second.request);
+		req.version(11);
+		beast::error_code ec;
+		const net::ip::address remote = beast::get_lowest_layer(stream_).socket().remote_endpoint(ec).address();
+		handleHTTP2Request(
+			core,
+			std::move(req),
+			remote,
+			[self = this->shared_from_this(), streamId](http::response<http::string_body> &&res)
+			{
+				// responses are submitted from the executor of this session (and not in nghttp2 callbacks)
+				const std::shared_ptr<http::response<http::string_body>> response = std::make_shared<http::response<http::string_body>>(std::move(res));
+				net::post(
+					self->stream_.get_executor(),
+					[self, streamId, response]()
+					{
+						self->submitResponse(streamId, std::move(*response));
+					});
+			});
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::onStreamClose(const std::int32_t streamId)
+	{
+		streams_.erase(streamId);
+		if (streams_.empty())
+		{
+			beast::get_lowest_layer(stream_).expires_after(idleTimeout_);
+		}
+	}
+
+	template <class Stream>
+	std::size_t HTTP2Session<Stream>::readBody(const std::int32_t streamId, std::uint8_t *buf, const std::size_t length, bool &eof)
+	{
+		const auto it = streams_.find(streamId);
+		if (it == streams_.end())
+		{
+			eof = true;
+			return 0;
+		}
+		stream &s = it->second;
+		const std::size_t size = std::min(length, s.body.size() - s.offset);
+		std::memcpy(buf, s.body.data() + s.offset, size);
+		s.offset += size;
+		eof = (s.offset == s.body.size());
+		return size;
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::submitResponse(const std::int32_t streamId, http::response<http::string_body> &&res)
+	{
+		const auto it = streams_.find(streamId);
+		if (it == streams_.end())
+		{
+			// e.g. reset by the client
+			return;
+		}
+
+		// lower-case names without connection-specific headers (nghttp2 copies them)
+		std::vector<std::string> names;
+		std::vector<std::string> values;
+		names.push_back(":status");
+		values.push_back(std::to_string(res.result_int()));
+		for (const auto &field : res)
+		{
+			std::string name = field.name_string().to_string();
+			std::transform(name.begin(), name.end(), name.begin(), [](const unsigned char c)
+						   { return static_cast<char>(std::tolower(c)); });
+			if (!isConnectionSpecific(name))
+			{
+				names.push_back(std::move(name));
+				values.push_back(field.value().to_string());
+			}
+		}
+		std::vector<nghttp2_nv> nva;
+		for (std::size_t h = 0; h < names.size(); ++h)
+		{
+			nva.push_back(makeNV(names.at(h), values.at(h)));
+		}
+
+		it->second.body = std::move(res.body());
+		it->second.offset = 0;
+		if (it->second.body.empty())
+		{
+			nghttp2_submit_response(session_, streamId, nva.data(), nva.size(), nullptr);
+		}
+		else
+		{
+			nghttp2_data_provider provider;
+			provider.source.ptr = nullptr;
+			provider.read_callback = readBodyCallback<HTTP2Session>;
+			nghttp2_submit_response(session_, streamId, nva.data(), nva.size(), &provider);
+		}
+		doWrite();
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::doRead()
+	{
+		// no timeout while requests are processed (e.g. API calls that take long)
+		if (streams_.empty())
+		{
+			beast::get_lowest_layer(stream_).expires_after(idleTimeout_);
+		}
+		else
+		{
+			beast::get_lowest_layer(stream_).expires_never();
+		}
+
+		stream_.async_read_some(
+			buffer_.prepare(readSize),
+			beast::bind_front_handler(
+				&HTTP2Session::onRead,
+				this->shared_from_this()));
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::onRead(beast::error_code ec, std::size_t bytes_transferred)
+	{
+		DOPPELGANGER_TRACE_SPAN("HTTP2Session::onRead");
+		if (ec)
+		{
+			// responses being written are completed (the connection is closed when this session is destroyed)
+			if (ec != net::error::eof && ec != beast::error::timeout)
+			{
+				fail(ec, "read (HTTP/2)");
+			}
+			return;
+		}
+		buffer_.commit(bytes_transferred);
+
+		const ssize_t rv = nghttp2_session_mem_recv(session_, static_cast<const std::uint8_t *>(buffer_.data().data()), buffer_.size());
+		buffer_.consume(buffer_.size());
+		if (rv < 0)
+		{
+			DOPPELGANGER_LOG(core_.lock(), ERROR, "HTTP/2: " << nghttp2_strerror(static_cast<int>(rv)));
+			// e.g. GOAWAY
+			return doWrite();
+		}
+
+		doWrite();
+		if (nghttp2_session_want_read(session_))
+		{
+			doRead();
+		}
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::doWrite()
+	{
+		if (writing_)
+		{
+			return;
+		}
+
+		writeBuffer_.clear();
+		while (writeBuffer_.size() < maxWriteSize)
+		{
+			const std::uint8_t *data;
+			const ssize_t size = nghttp2_session_mem_send(session_, &data);
+			if (size < 0)
+			{
+				DOPPELGANGER_LOG(core_.lock(), ERROR, "HTTP/2: " << nghttp2_strerror(static_cast<int>(size)));
+				return;
+			}
+			if (size == 0)
+			{
+				break;
+			}
+			writeBuffer_.append(reinterpret_cast<const char *>(data), static_cast<std::size_t>(size));
+		}
+
+		if (writeBuffer_.empty())
+		{
+			if (!nghttp2_session_want_read(session_) && !nghttp2_session_want_write(session_))
+			{
+				// GOAWAY has been sent
+				beast::error_code ec;
+				beast::get_lowest_layer(stream_).socket().shutdown(tcp::socket::shutdown_send, ec);
+			}
+			return;
+		}
+
+		writing_ = true;
+		net::async_write(
+			stream_,
+			net::buffer(writeBuffer_),
+			beast::bind_front_handler(
+				&HTTP2Session::onWrite,
+				this->shared_from_this()));
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::onWrite(beast::error_code ec, std::size_t bytes_transferred)
+	{
+		boost::ignore_unused(bytes_transferred);
+		writing_ = false;
+		if (ec)
+		{
+			return fail(ec, "write (HTTP/2)");
+		}
+		doWrite();
+	}
+
+	template <class Stream>
+	void HTTP2Session<Stream>::fail(beast::error_code ec, char const *what)
+	{
+		if (ec == net::ssl::error::stream_truncated || ec == net::error::operation_aborted)
+		{
+			return;
+		}
+
+		DOPPELGANGER_LOG(core_.lock(), ERROR, what << ": " << ec.message());
+	}
+
+	void enableHTTP2(ssl::context &ctx)
+	{
+		SSL_CTX_set_alpn_select_cb(ctx.native_handle(), selectProtocol, nullptr);
+	}
+
+	void makeHTTP2Session(
+		const std::weak_ptr<Core> &core,
+		beast::tcp_stream &&stream,
+		beast::flat_buffer &&buffer)
+	{
+		std::make_shared<HTTP2Session<beast::tcp_stream>>(core, std::move(stream), std::move(buffer))->run();
+	}
+
+	void makeHTTP2Session(
+		const std::weak_ptr<Core> &core,
+		beast::ssl_stream<beast::tcp_stream> &&stream,
+		beast::flat_buffer &&buffer)
+	{
+		std::make_shared<HTTP2Session<beast::ssl_stream<beast::tcp_stream>>>(core, std::move(stream), std::move(buffer))->run();
+	}
+}
+
+#endif
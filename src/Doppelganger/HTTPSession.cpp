@@ -1,8 +1,14 @@
 #ifndef HTTPSESSION_CPP
 #define HTTPSESSION_CPP
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <sstream>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <boost/beast/core.hpp>
@@ -11,6 +17,8 @@
 #include <boost/beast/websocket.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/container/small_vector.hpp>
 #include <boost/optional.hpp>
 
 #include "Doppelganger/Util/filesystem.h"
@@ -19,9 +27,15 @@
 #include "Doppelganger/Room.h"
 #include "Doppelganger/HTTPSession.h"
 #include "Doppelganger/WebsocketSession.h"
+#if defined(DOPPELGANGER_HTTP2)
+#include "Doppelganger/HTTP2Session.h"
+#endif
 #include "Doppelganger/Plugin.h"
+#include "Doppelganger/TraceRecorder.h"
+#include "Doppelganger/Metrics.h"
+#include "Doppelganger/Tracing.h"
 #include "Doppelganger/Util/uuid.h"
-#include "Doppelganger/Util/log.h"
+#include "Doppelganger/Logger.h"
 
 namespace
 {
@@ -79,6 +93,83 @@ namespace
 		return "application/text";
 	}
 
+	////
+	// segments of request-target, e.g. "/room-ABC/html/" -> {"/", "room-ABC", "html", ""} (the same as iterating fs::path)
+	//   segments refer to the target, i.e. no allocation for usual targets
+	////
+	using PathSegments = boost::container::small_vector<beast::string_view, 8>;
+
+	PathSegments splitTarget(const beast::string_view target)
+	{
+		PathSegments segments;
+		std::size_t begin = 0;
+		if (!target.empty() && target.front() == '/')
+		{
+			segments.push_back(target.substr(0, 1));
+			begin = target.find_first_not_of('/');
+		}
+		while (begin != beast::string_view::npos && begin < target.size())
+		{
+			const std::size_t end = target.find('/', begin);
+			segments.push_back(target.substr(begin, end - begin));
+			if (end == beast::string_view::npos)
+			{
+				break;
+			}
+			begin = target.find_first_not_of('/', end);
+			if (begin == beast::string_view::npos)
+			{
+				// trailing separator
+				segments.push_back(beast::string_view());
+			}
+		}
+		return segments;
+	}
+
+	////
+	// body referring to a shared buffer (e.g. encoded meshes cached in MeshEncoder), i.e. the buffer is not copied
+	//   nullptr is an empty body (e.g. HEAD)
+	////
+	struct SharedStringBody
+	{
+		using value_type = std::shared_ptr<const std::string>;
+
+		static std::uint64_t size(const value_type &body)
+		{
+			return body ? body->size() : 0;
+		}
+
+		class writer
+		{
+		public:
+			using const_buffers_type = net::const_buffer;
+
+			template <bool isRequest, class Fields>
+			writer(const http::header<isRequest, Fields> &, const value_type &body)
+				: body_(body)
+			{
+			}
+
+			void init(beast::error_code &ec)
+			{
+				ec = {};
+			}
+
+			boost::optional<std::pair<const_buffers_type, bool>> get(beast::error_code &ec)
+			{
+				ec = {};
+				if (!body_ || body_->empty())
+				{
+					return boost::none;
+				}
+				return {{net::const_buffer(body_->data(), body_->size()), false}};
+			}
+
+		private:
+			const value_type &body_;
+		};
+	};
+
 	template <class Body, class Allocator>
 	http::response<http::string_body> badRequest(
 		http::request<Body, http::basic_fields<Allocator>> &&req,
@@ -109,6 +200,36 @@ namespace
 		return res;
 	}
 
+	template <class Body, class Allocator>
+	http::response<http::string_body> forbidden(
+		http::request<Body, http::basic_fields<Allocator>> &&req,
+		beast::string_view target)
+	{
+		// Returns a forbidden response
+		http::response<http::string_body> res{http::status::forbidden, req.version()};
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "text/html");
+		res.keep_alive(req.keep_alive());
+		res.body() = "The resource '" + target.to_string() + "' is forbidden.";
+		res.prepare_payload();
+		return res;
+	}
+
+	template <class Body, class Allocator>
+	http::response<http::string_body> serviceUnavailable(
+		http::request<Body, http::basic_fields<Allocator>> &&req,
+		beast::string_view what)
+	{
+		// Returns a service unavailable response
+		http::response<http::string_body> res{http::status::service_unavailable, req.version()};
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "text/html");
+		res.keep_alive(req.keep_alive());
+		res.body() = "The service is unavailable: '" + what.to_string() + "'";
+		res.prepare_payload();
+		return res;
+	}
+
 	template <class Body, class Allocator>
 	http::response<http::string_body> serverError(
 		http::request<Body, http::basic_fields<Allocator>> &&req,
@@ -192,10 +313,184 @@ namespace
 		}
 	}
 
+	template <class Body, class Allocator, class Send>
+	void handleMetricsRequest(const std::shared_ptr<Doppelganger::Core> &core,
+							  http::request<Body, http::basic_fields<Allocator>> &&req,
+							  Send &&send)
+	{
+		if (req.method() != http::verb::get && req.method() != http::verb::head)
+		{
+			return send(badRequest(std::move(req), "Illegal request"));
+		}
+
+		// Prometheus text format
+		std::stringstream ss;
+		Doppelganger::Metrics::getInstance().exportPrometheus(ss, core);
+		const std::string body = ss.str();
+
+		http::response<http::string_body> res{http::status::ok, req.version()};
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "text/plain; version=0.0.4");
+		res.keep_alive(req.keep_alive());
+		if (req.method() == http::verb::get)
+		{
+			res.body() = body;
+		}
+		res.prepare_payload();
+		if (req.method() == http::verb::head)
+		{
+			res.content_length(body.size());
+		}
+		return send(std::move(res));
+	}
+
+	template <class Body, class Allocator, class Send>
+	void handleSpansRequest(http::request<Body, http::basic_fields<Allocator>> &&req,
+							Send &&send)
+	{
+		if (req.method() != http::verb::get)
+		{
+			return send(badRequest(std::move(req), "Illegal request"));
+		}
+
+		// Chrome trace event format
+		std::stringstream ss;
+		Doppelganger::Tracer::getInstance().exportChromeTrace(ss);
+
+		http::response<http::string_body> res{http::status::ok, req.version()};
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "application/json");
+		res.keep_alive(req.keep_alive());
+		res.body() = ss.str();
+		res.prepare_payload();
+		return send(std::move(res));
+	}
+
+	template <class Body, class Allocator, class Send>
+	void handleMeshRequest(const std::shared_ptr<Doppelganger::Room> &room,
+						   const std::string &meshUUID,
+						   const std::string &versionStr,
+						   const std::string &levelStr,
+						   http::request<Body, http::basic_fields<Allocator>> &&req,
+						   Send &&send)
+	{
+		if (req.method() != http::verb::get && req.method() != http::verb::head)
+		{
+			return send(badRequest(std::move(req), "Illegal request"));
+		}
+
+		std::uint64_t version;
+		// level of detail (see MeshLOD). the original mesh if empty
+		std::uint32_t level = 0;
+		try
+		{
+			version = std::stoull(versionStr);
+			if (!levelStr.empty())
+			{
+				level = static_cast<std::uint32_t>(std::stoul(levelStr));
+			}
+		}
+		catch (...)
+		{
+			return send(badRequest(std::move(req), "Illegal request-target"));
+		}
+
+		// each version is immutable, i.e. clients can cache it forever
+		const std::string etag = "\"" + meshUUID + "-" + versionStr + (levelStr.empty() ? std::string("") : "-" + levelStr) + "\"";
+		if (req[http::field::if_none_match] == etag)
+		{
+			http::response<http::empty_body> res{http::status::not_modified, req.version()};
+			res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+			res.set(http::field::etag, etag);
+			res.keep_alive(req.keep_alive());
+			return send(std::move(res));
+		}
+
+		std::shared_ptr<const std::string> blob;
+		if (!levelStr.empty())
+		{
+			// computed in the background
+			blob = room->meshEncoder_.lookup(meshUUID, version, level);
+			if (!blob)
+			{
+				return send(notFound(std::move(req), req.target()));
+			}
+		}
+		else
+		{
+			// we copy references to buffers and encode them without mutexRoom_
+			Doppelganger::MeshStore::Mesh mesh;
+			{
+				std::lock_guard<std::mutex> lock(room->mutexRoom_);
+				if (!room->wakeUp())
+				{
+					return send(serviceUnavailable(std::move(req), "The room can't be restored."));
+				}
+				const Doppelganger::MeshStore::Mesh *found = room->meshes_.find(meshUUID, version);
+				// e.g. a patch only with "VN" (nothing to display)
+				if (found == nullptr || !found->V)
+				{
+					return send(notFound(std::move(req), req.target()));
+				}
+				mesh = *found;
+			}
+
+			bool start = false;
+			try
+			{
+				blob = room->meshEncoder_.encoded(meshUUID, version, start);
+				if (start && (!mesh.F || mesh.F->rows() < Doppelganger::MeshEncoder::inlineFaceLimit))
+				{
+					blob = room->meshEncoder_.encode(meshUUID, version, mesh);
+				}
+			}
+			catch (const std::exception &e)
+			{
+				return send(serverError(std::move(req), e.what()));
+			}
+			if (!blob)
+			{
+				if (start)
+				{
+					// we never encode large meshes on io_context threads (i.e. other rooms on this thread don't wait)
+					//   failures are not reported here (the next request starts again and gets the error)
+					Doppelganger::MeshLOD::getInstance().post(
+						[room, meshUUID, version, mesh]()
+						{
+							room->meshEncoder_.encode(meshUUID, version, mesh);
+						});
+				}
+				http::response<http::string_body> res = serviceUnavailable(std::move(req), "The mesh is being encoded.");
+				res.set(http::field::retry_after, "1");
+				return send(std::move(res));
+			}
+		}
+
+		http::response<SharedStringBody> res{http::status::ok, req.version()};
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "application/octet-stream");
+		res.set(http::field::etag, etag);
+		res.set(http::field::cache_control, "public, max-age=31536000, immutable");
+		res.keep_alive(req.keep_alive());
+		if (req.method() == http::verb::get)
+		{
+			// the cached buffer is written as is
+			res.body() = blob;
+		}
+		res.prepare_payload();
+		if (req.method() == http::verb::head)
+		{
+			res.content_length(blob->size());
+		}
+		return send(std::move(res));
+	}
+
+	// receivedAt: when the request is read (e.g. for TraceRecorder)
 	template <class Body, class Allocator, class Send>
 	void handleRequest(const std::shared_ptr<Doppelganger::Core> &core,
 					   const std::shared_ptr<Doppelganger::Room> &room,
 					   http::request<Body, http::basic_fields<Allocator>> &&req,
+					   const std::chrono::system_clock::time_point receivedAt,
 					   Send &&send)
 	{
 		// Make sure we can handle the method
@@ -220,15 +515,11 @@ namespace
 		// http://example.com/<roomUUID>/<APIName>
 		// API (module.js)
 		// http://example.com/<roomUUID>/plugin/APIName_version/module.js
-		fs::path reqPath(req.target().to_string());
-		reqPath.make_preferred();
+		// encoded mesh (level of detail)
+		// http://example.com/<roomUUID>/mesh/<meshUUID>/<version>[/<level>]
 		// reqPathVec
 		// {"/", "<roomUUID>", "<APIName>", ... }
-		std::vector<std::string> reqPathVec;
-		for (const auto &p : reqPath)
-		{
-			reqPathVec.push_back(p.string());
-		}
+		const PathSegments reqPathVec = splitTarget(req.target());
 
 		if (reqPathVec.size() >= 2)
 		{
@@ -242,7 +533,7 @@ namespace
 						fs::path completePath(room->plugin_.at("assets").dir_);
 						for (int pIdx = 2; pIdx < reqPathVec.size(); ++pIdx)
 						{
-							completePath.append(reqPathVec.at(pIdx));
+							completePath.append(reqPathVec.at(pIdx).to_string());
 						}
 
 						openAndSendResource(completePath, std::move(req), send);
@@ -250,73 +541,123 @@ namespace
 					else if (reqPathVec.at(2) == "plugin")
 					{
 						// resource
-						fs::path completePath(room->config.at("dataDir").get<std::string>());
+						fs::path completePath(room->dataDir_);
 						for (int pIdx = 2; pIdx < reqPathVec.size(); ++pIdx)
 						{
-							completePath.append(reqPathVec.at(pIdx));
+							completePath.append(reqPathVec.at(pIdx).to_string());
 						}
 
 						openAndSendResource(completePath, std::move(req), send);
 					}
+					else if (reqPathVec.at(2) == "mesh" && (reqPathVec.size() == 5 || reqPathVec.size() == 6))
+					{
+						// encoded mesh (see MeshEncoder)
+						handleMeshRequest(room, reqPathVec.at(3).to_string(), reqPathVec.at(4).to_string(), (reqPathVec.size() == 6) ? reqPathVec.at(5).to_string() : std::string(""), std::move(req), send);
+					}
 					else
 					{
 						// API
+						const std::string APIName = reqPathVec.at(2).to_string();
+						std::string sessionUUID;
+						std::uint64_t pluginNs = 0;
+						std::uint32_t responseSize = 0;
+						// failed calls are recorded, too (with "failed")
+						const auto trace = [&room, &req, &receivedAt, &APIName, &sessionUUID, &pluginNs, &responseSize](const bool failed)
+						{
+							if (Doppelganger::TraceRecorder::getInstance().isEnabled())
+							{
+								Doppelganger::TraceRecord record;
+								record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(receivedAt.time_since_epoch()).count();
+								record.transport = Doppelganger::TraceRecord::HTTP;
+								record.roomUUID = room->UUID_;
+								record.sessionUUID = sessionUUID;
+								record.APIName = APIName;
+								record.parameters = req.body();
+								record.duration = pluginNs;
+								record.responseSize = responseSize;
+								record.failed = failed ? 1 : 0;
+								Doppelganger::TraceRecorder::getInstance().record(record);
+							}
+						};
+
+						const std::chrono::steady_clock::time_point lockStart = std::chrono::steady_clock::now();
+						room->pendingAPICalls_.fetch_add(1, std::memory_order_relaxed);
 						std::lock_guard<std::mutex> lock(room->mutexRoom_);
+						room->pendingAPICalls_.fetch_sub(1, std::memory_order_relaxed);
+						const std::uint64_t lockWait = Doppelganger::Metrics::elapsedNs(lockStart, std::chrono::steady_clock::now());
+						// plugins must not see (and persist) config stripped by hibernation
+						if (!room->wakeUp())
+						{
+							trace(true);
+							return send(serviceUnavailable(std::move(req), "The room can't be restored."));
+						}
+						// we only create metrics for existing plugins (reqPathVec.at(2) is given by the client)
+						Doppelganger::Metrics::APIMetrics *metrics = nullptr;
+						if (room->plugin_.find(APIName) != room->plugin_.end())
+						{
+							metrics = &(Doppelganger::Metrics::getInstance().api(APIName));
+							metrics->duration.at(Doppelganger::Metrics::LOCK_WAIT).record(lockWait);
+						}
+						std::chrono::steady_clock::time_point pluginStart;
+						bool pluginStarted = false;
 						try
 						{
 							{
-								nlohmann::json serverBusyBroadcast = nlohmann::json::object();
+								Doppelganger::json serverBusyBroadcast = Doppelganger::json::object();
 								serverBusyBroadcast["isBusy"] = true;
-								room->broadcastWS("isServerBusy", std::string(""), serverBusyBroadcast, nlohmann::json(nullptr));
+								room->broadcastWS("isServerBusy", std::string(""), serverBusyBroadcast, Doppelganger::json(nullptr), false);
 							}
 
-							const std::string &APIName = reqPathVec.at(2);
-
-							nlohmann::json parameters = nlohmann::json::object();
+							// parameters are not placed in the arena of the session: AllocatorType of nlohmann::basic_json is
+							// default-constructed (i.e. it can't refer to a per-session arena). plugins receive them as a string
+							Doppelganger::json parameters = Doppelganger::json::object();
 							boost::optional<std::uint64_t> size = req.payload_size();
 							if (size && *size > 0)
 							{
-								parameters = nlohmann::json::parse(req.body());
+								parameters = Doppelganger::json::parse(req.body());
 							}
+							if (parameters.contains("sessionUUID") && parameters.at("sessionUUID").is_string())
 							{
-								std::stringstream logContent;
-								logContent << req.method_string();
-								logContent << " ";
-								logContent << req.target().to_string();
-								logContent << " ";
-								logContent << "(";
-								// In some cases, sessionUUID could be NULL (we need to handle the order of initialization...)
-								// logContent << parameters.at("sessionUUID").get<std::string>();
-								logContent << parameters.at("sessionUUID");
-								logContent << ")";
-								Doppelganger::Util::log(logContent.str(), "APICALL", room->config);
+								sessionUUID = parameters.at("sessionUUID").get<std::string>();
 							}
+							// In some cases, sessionUUID could be NULL (we need to handle the order of initialization...)
+							// i.e. we don't use parameters.at("sessionUUID").get<std::string>();
+							DOPPELGANGER_LOG(room, APICALL, req.method_string() << " " << req.target() << " (" << parameters.at("sessionUUID") << ")");
 
-							nlohmann::json response, broadcast;
+							Doppelganger::json response, broadcast;
 							// for HTTP, we return response by default
-							response = nlohmann::json::object();
+							response = Doppelganger::json::object();
 
+							pluginStart = std::chrono::steady_clock::now();
+							pluginStarted = true;
 							room->plugin_.at(APIName).pluginProcess(
 								core,
 								room,
 								parameters.at("parameters"),
 								response,
 								broadcast);
+							const std::chrono::steady_clock::time_point pluginEnd = std::chrono::steady_clock::now();
+							pluginNs = Doppelganger::Metrics::elapsedNs(pluginStart, pluginEnd);
+							pluginStarted = false;
+							room->busyNs_.fetch_add(pluginNs, std::memory_order_relaxed);
 
 							{
-								nlohmann::json serverBusyBroadcast = nlohmann::json::object();
+								Doppelganger::json serverBusyBroadcast = Doppelganger::json::object();
 								serverBusyBroadcast["isBusy"] = false;
-								room->broadcastWS("isServerBusy", std::string(""), serverBusyBroadcast, nlohmann::json(nullptr));
+								room->broadcastWS("isServerBusy", std::string(""), serverBusyBroadcast, Doppelganger::json(nullptr), false);
 							}
 
 							// broadcast
 							if (!broadcast.is_null())
 							{
-								room->broadcastWS(APIName, std::string(""), broadcast, response);
+								room->broadcastWS(APIName, std::string(""), broadcast, response, true);
 							}
 
 							// response
 							const std::string responseStr = response.dump();
+							responseSize = static_cast<std::uint32_t>(responseStr.size());
+							trace(false);
+
 							http::string_body::value_type payloadBody = responseStr;
 							http::response<http::string_body> res{
 								std::piecewise_construct,
@@ -331,6 +672,16 @@ namespace
 						}
 						catch (...)
 						{
+							if (pluginStarted)
+							{
+								pluginNs = Doppelganger::Metrics::elapsedNs(pluginStart, std::chrono::steady_clock::now());
+								room->busyNs_.fetch_add(pluginNs, std::memory_order_relaxed);
+							}
+							if (metrics != nullptr)
+							{
+								metrics->errors.fetch_add(1, std::memory_order_relaxed);
+							}
+							trace(true);
 							return send(badRequest(std::move(req), "Invalid API call."));
 						}
 					}
@@ -340,16 +691,17 @@ namespace
 					// return 301 (moved permanently)
 					std::string completeURL("");
 					{
-						completeURL += core->config.at("server").at("protocol").get<std::string>();
+						const std::shared_ptr<const Doppelganger::json> configCore = core->configSnapshot();
+						completeURL += configCore->at("server").at("protocol").get<std::string>();
 						completeURL += "://";
-						completeURL += core->config.at("server").at("host").get<std::string>();
+						completeURL += configCore->at("server").at("host").get<std::string>();
 						completeURL += ":";
-						completeURL += std::to_string(core->config.at("server").at("portUsed").get<int>());
+						completeURL += std::to_string(configCore->at("server").at("portUsed").get<int>());
 					}
 
 					std::string location = completeURL;
 					location += "/";
-					location += room->config.at("UUID").get<std::string>();
+					location += room->UUID_;
 					location += "/html/index.html";
 					return send(movedPermanently(std::move(req), location));
 				}
@@ -359,16 +711,17 @@ namespace
 				// return 301 (moved permanently)
 				std::string completeURL("");
 				{
-					completeURL += core->config.at("server").at("protocol").get<std::string>();
+					const std::shared_ptr<const Doppelganger::json> configCore = core->configSnapshot();
+					completeURL += configCore->at("server").at("protocol").get<std::string>();
 					completeURL += "://";
-					completeURL += core->config.at("server").at("host").get<std::string>();
+					completeURL += configCore->at("server").at("host").get<std::string>();
 					completeURL += ":";
-					completeURL += std::to_string(core->config.at("server").at("portUsed").get<int>());
+					completeURL += std::to_string(configCore->at("server").at("portUsed").get<int>());
 				}
 
 				std::string location = completeURL;
 				location += "/";
-				location += room->config.at("UUID").get<std::string>();
+				location += room->UUID_;
 				location += "/html/index.html";
 				return send(movedPermanently(std::move(req), location));
 			}
@@ -378,20 +731,155 @@ namespace
 			// return 301 (moved permanently)
 			std::string completeURL("");
 			{
-				completeURL += core->config.at("server").at("protocol").get<std::string>();
+				const std::shared_ptr<const Doppelganger::json> configCore = core->configSnapshot();
+				completeURL += configCore->at("server").at("protocol").get<std::string>();
 				completeURL += "://";
-				completeURL += core->config.at("server").at("host").get<std::string>();
+				completeURL += configCore->at("server").at("host").get<std::string>();
 				completeURL += ":";
-				completeURL += std::to_string(core->config.at("server").at("portUsed").get<int>());
+				completeURL += std::to_string(configCore->at("server").at("portUsed").get<int>());
 			}
 
 			std::string location = completeURL;
 			location += "/";
-			location += room->config.at("UUID").get<std::string>();
+			location += room->UUID_;
 			location += "/html/index.html";
 			return send(movedPermanently(std::move(req), location));
 		}
 	}
+
+	////
+	// routing shared by HTTP/1.1 (HTTPSession::onRead) and HTTP/2 (handleHTTP2Request)
+	//   remote: address of the client (see Core::diagnosticsAllowed())
+	//   ANSWERED: the response is sent with send
+	//   IGNORED: no response (e.g. favicon.ico, API call without creating rooms)
+	//   ROOM: the request is for room (see handleRequest). existing is false for a room created by this request
+	////
+	enum class Route
+	{
+		ANSWERED,
+		IGNORED,
+		ROOM
+	};
+
+	template <class Allocator, class Send>
+	Route route(const std::shared_ptr<Doppelganger::Core> &core,
+				http::request<http::string_body, http::basic_fields<Allocator>> &req,
+				const net::ip::address &remote,
+				Send &&send,
+				std::shared_ptr<Doppelganger::Room> &room,
+				bool &existing)
+	{
+		const PathSegments reqPathVec = splitTarget(req.target());
+
+		std::string roomUUID = (reqPathVec.size() >= 2) ? reqPathVec.at(1).to_string() : std::string("");
+		room = core->rooms_.find(roomUUID);
+		existing = (room != nullptr);
+		if (roomUUID == "favicon.ico")
+		{
+			// do nothing
+			// TODO: prepare favion.ico
+			return Route::IGNORED;
+		}
+		else if (roomUUID == "metrics" || roomUUID == "spans")
+		{
+			if (!core->diagnosticsAllowed(remote, req[http::field::authorization]))
+			{
+				send(forbidden(std::move(req), req.target()));
+			}
+			else if (roomUUID == "metrics")
+			{
+				// e.g. http://127.0.0.1:34568/metrics
+				handleMetricsRequest(core, std::move(req), send);
+			}
+			else
+			{
+				// e.g. http://127.0.0.1:34568/spans
+				handleSpansRequest(std::move(req), send);
+			}
+			return Route::ANSWERED;
+		}
+		else if (!existing && reqPathVec.size() > 2 && reqPathVec.at(2) != "" && reqPathVec.at(2) != "html")
+		{
+			// do nothing
+			//   e.g. API call without creating rooms
+			//   but, we accept "/room-ABC/html/index.html" because chrome somehow append previously visited URL...
+			return Route::IGNORED;
+		}
+		else if (roomUUID.size() <= 0 || !existing)
+		{
+			// create new room
+			if (roomUUID.size() <= 0)
+			{
+				// e.g. http://127.0.0.1:34568/
+				roomUUID = Doppelganger::Util::uuid("room-");
+			}
+			else
+			{
+				// e.g. http://127.0.0.1:34568/<UUID>
+				// add prefix
+				if (roomUUID.substr(0, 5) != "room-")
+				{
+					roomUUID = "room-" + roomUUID;
+				}
+			}
+			// another session may create the same room simultaneously
+			bool created;
+			room = core->rooms_.findOrCreate(
+				roomUUID,
+				[&core, &roomUUID]()
+				{
+					const std::shared_ptr<Doppelganger::Room> newRoom = std::make_shared<Doppelganger::Room>();
+					newRoom->homeContext_.store(core->roomScheduler_.assign());
+					newRoom->setup(roomUUID, *core->configSnapshot());
+					// we log this message to Core
+					DOPPELGANGER_LOG(core, SYSTEM, "New room \"" << newRoom->UUID_ << "\" is created.");
+					return newRoom;
+				},
+				created);
+			if (!room)
+			{
+				// another request is creating the room (e.g. downloading plugins). we never wait on io_context threads
+				http::response<http::string_body> res = serviceUnavailable(std::move(req), "The room is being created.");
+				res.set(http::field::retry_after, "1");
+				send(std::move(res));
+				return Route::ANSWERED;
+			}
+		}
+		return Route::ROOM;
+	}
+
+#if defined(DOPPELGANGER_HTTP2)
+	// body of any type (e.g. file_body) is read into memory
+	template <class Body, class Fields>
+	http::response<http::string_body> toStringResponse(http::response<Body, Fields> &&msg)
+	{
+		std::string body;
+		beast::error_code ec;
+		typename Body::writer writer(msg.base(), msg.body());
+		writer.init(ec);
+		while (!ec)
+		{
+			const auto buffers = writer.get(ec);
+			if (ec || !buffers)
+			{
+				break;
+			}
+			for (auto it = net::buffer_sequence_begin(buffers->first); it != net::buffer_sequence_end(buffers->first); ++it)
+			{
+				const net::const_buffer buffer = *it;
+				body.append(static_cast<const char *>(buffer.data()), buffer.size());
+			}
+			if (!buffers->second)
+			{
+				break;
+			}
+		}
+
+		http::response<http::string_body> res(std::move(msg.base()));
+		res.body() = std::move(body);
+		return res;
+	}
+#endif
 }
 
 namespace Doppelganger
@@ -415,25 +903,29 @@ namespace Doppelganger
 			return;
 		}
 
-		{
-			std::stringstream ss;
-			ss << what << ": " << ec.message();
-			Util::log(ss.str(), "ERROR", core_.lock()->config);
-		}
+		DOPPELGANGER_LOG(core_.lock(), ERROR, what << ": " << ec.message());
 	}
 
 	template <class Derived>
 	HTTPSession<Derived>::HTTPSession(
 		const std::weak_ptr<Core> &core,
 		beast::flat_buffer buffer)
-		: buffer_(std::move(buffer)), queue_(*this), core_(core)
+		: buffer_(std::move(buffer)), core_(core), arena_(requestArenaSize), queue_(*this), idleTimeout_(30)
 	{
+		const std::shared_ptr<Core> c = core_.lock();
+		if (c)
+		{
+			queue_.setLimit(c->pipelineLimit_.load(std::memory_order_relaxed));
+			idleTimeout_ = std::chrono::seconds(c->idleTimeout_.load(std::memory_order_relaxed));
+		}
 	}
 
 	template <class Derived>
 	void HTTPSession<Derived>::doRead()
 	{
-		parser_.emplace();
+		parser_.reset();
+		arena_.reset();
+		parser_.emplace(std::piecewise_construct, std::make_tuple(), std::make_tuple(ArenaAllocator<char>(arena_)));
 		// disable parser body_limit
 		// this is not the best practice, but works
 		parser_->body_limit(boost::none);
@@ -441,7 +933,7 @@ namespace Doppelganger
 		// Set the timeout.
 		beast::get_lowest_layer(
 			derived().stream())
-			.expires_after(std::chrono::seconds(30));
+			.expires_after(idleTimeout_);
 
 		http::async_read(
 			derived().stream(),
@@ -455,6 +947,7 @@ namespace Doppelganger
 	template <class Derived>
 	void HTTPSession<Derived>::onRead(beast::error_code ec, std::size_t bytes_transferred)
 	{
+		DOPPELGANGER_TRACE_SPAN("HTTPSession::onRead");
 		const std::shared_ptr<Core> core = core_.lock();
 
 		if (core)
@@ -469,64 +962,31 @@ namespace Doppelganger
 
 			if (ec)
 			{
+#if defined(DOPPELGANGER_HTTP2)
+				// h2c with prior knowledge
+				//   the connection preface ("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n") is rejected by the parser and left in buffer_
+				static const std::string preface("PRI * HTTP/2.0");
+				if (ec == http::error::bad_version && buffer_.size() >= preface.size() &&
+					std::memcmp(buffer_.data().data(), preface.data(), preface.size()) == 0)
+				{
+					return runHTTP2();
+				}
+#endif
 				return fail(ec, "read (HTTP)");
 			}
 
-			{
-				std::stringstream ss;
-				ss << "Request received: \"" << parser_->get().target().to_string() << "\"";
-				Util::log(ss.str(), "SYSTEM", core->config);
-			}
+			const std::chrono::system_clock::time_point receivedAt = std::chrono::system_clock::now();
+			DOPPELGANGER_LOG(core, SYSTEM, "Request received: \"" << parser_->get().target() << "\"");
 
-			std::vector<std::string> reqPathVec;
-			{
-				fs::path reqPath(parser_->get().target().to_string());
-				reqPath.make_preferred();
-				for (const auto &p : reqPath)
-				{
-					reqPathVec.push_back(p.string());
-				}
-			}
+			beast::error_code remoteEc;
+			const net::ip::address remote = beast::get_lowest_layer(derived().stream()).socket().remote_endpoint(remoteEc).address();
 
-			std::string roomUUID = (reqPathVec.size() >= 2) ? reqPathVec.at(1) : std::string("");
-			if (roomUUID == "favicon.ico")
-			{
-				// do nothing
-				// TODO: prepare favion.ico
-			}
-			else if (core->rooms_.find(roomUUID) == core->rooms_.end() && reqPathVec.size() > 2 && reqPathVec.at(2) != "" && reqPathVec.at(2) != "html")
-			{
-				// do nothing
-				//   e.g. API call without creating rooms
-				//   but, we accept "/room-ABC/html/index.html" because chrome somehow append previously visited URL...
-			}
-			else if (roomUUID.size() <= 0 || core->rooms_.find(roomUUID) == core->rooms_.end())
-			{
-				// create new room
-				if (roomUUID.size() <= 0)
-				{
-					// e.g. http://127.0.0.1:34568/
-					roomUUID = Util::uuid("room-");
-				}
-				else
-				{
-					// e.g. http://127.0.0.1:34568/<UUID>
-					// add prefix
-					if (roomUUID.substr(0, 5) != "room-")
-					{
-						roomUUID = "room-" + roomUUID;
-					}
-				}
-				const std::shared_ptr<Room> room = std::make_shared<Room>();
-				room->setup(roomUUID, core->config);
-				core->rooms_[roomUUID] = room;
-				handleRequest(core, room, parser_->release(), queue_);
-			}
-			else
+			std::shared_ptr<Room> room;
+			bool existing;
+			if (route(core, parser_->get(), remote, queue_, room, existing) == Route::ROOM)
 			{
-				const std::shared_ptr<Room> &room = core->rooms_.at(roomUUID);
 				// See if it is a WebSocket Upgrade
-				if (boost::beast::websocket::is_upgrade(parser_->get()))
+				if (existing && boost::beast::websocket::is_upgrade(parser_->get()))
 				{
 					// Disable the timeout.
 					// The websocket::stream uses its own timeout settings.
@@ -538,11 +998,15 @@ namespace Doppelganger
 					makeWebsocketSession(derived().release_stream(), room, sessionUUID, parser_->release());
 					return;
 				}
+
+				// Send the response
+				if (room->homeContext_ != nullptr)
+				{
+					handleRoomRequest(core, room, receivedAt);
+				}
 				else
 				{
-					// Send the response
-					handleRequest(core, room, parser_->release(), queue_);
-					return;
+					handleRequest(core, room, parser_->release(), receivedAt, queue_);
 				}
 			}
 
@@ -553,6 +1017,93 @@ namespace Doppelganger
 		}
 	}
 
+	template <class Derived>
+	void HTTPSession<Derived>::handleRoomRequest(const std::shared_ptr<Core> &core, const std::shared_ptr<Room> &room, const std::chrono::system_clock::time_point receivedAt)
+	{
+		// the request is destroyed before the session (i.e. before arena_)
+		struct roomRequest
+		{
+			std::shared_ptr<Derived> self;
+			Request req;
+		};
+		const std::shared_ptr<roomRequest> request = std::make_shared<roomRequest>(roomRequest{derived().shared_from_this(), parser_->release()});
+		// the response keeps the order of requests even if following ones (e.g. static assets) are answered first
+		const std::size_t ticket = queue_.reserve();
+		net::post(
+			*(room->homeContext_.load()),
+			[core, room, request, receivedAt, ticket]()
+			{
+				const std::shared_ptr<Derived> &self = request->self;
+				handleRequest(
+					core,
+					room,
+					std::move(request->req),
+					receivedAt,
+					[&self, ticket](auto &&msg)
+					{
+						// responses are written from the executor of this session
+						//   (reading is not resumed here. onRead keeps reading while queue_ is not full, and onWrite resumes it)
+						using Message = typename std::decay<decltype(msg)>::type;
+						const std::shared_ptr<Message> response = std::make_shared<Message>(std::move(msg));
+						net::post(
+							self->stream().get_executor(),
+							[self, response, ticket]()
+							{
+								self->queue_.fill(ticket, std::move(*response));
+							});
+					});
+			});
+	}
+
+#if defined(DOPPELGANGER_HTTP2)
+	template <class Derived>
+	void HTTPSession<Derived>::runHTTP2()
+	{
+		beast::get_lowest_layer(derived().stream()).expires_never();
+		makeHTTP2Session(core_, derived().release_stream(), std::move(buffer_));
+	}
+
+	void handleHTTP2Request(
+		const std::shared_ptr<Core> &core,
+		http::request<http::string_body> &&req,
+		const net::ip::address &remote,
+		const std::function<void(http::response<http::string_body> &&)> &send)
+	{
+		const std::chrono::system_clock::time_point receivedAt = std::chrono::system_clock::now();
+		DOPPELGANGER_LOG(core, SYSTEM, "Request received (HTTP/2): \"" << req.target() << "\"");
+
+		const auto sendAny = [send](auto &&msg)
+		{
+			send(toStringResponse(std::move(msg)));
+		};
+
+		std::shared_ptr<Room> room;
+		bool existing;
+		const Route r = route(core, req, remote, sendAny, room, existing);
+		if (r == Route::IGNORED)
+		{
+			// each stream needs a response
+			return sendAny(notFound(std::move(req), req.target()));
+		}
+		if (r == Route::ANSWERED)
+		{
+			return;
+		}
+
+		// never handled inline: we are in nghttp2 callbacks of the session (i.e. other streams of the connection would wait)
+		//   "shared" ioMode (no home context): any thread of the shared io_context
+		net::io_context *homeContext = room->homeContext_.load();
+		net::io_context &context = (homeContext != nullptr) ? *homeContext : core->ioContextPool_.at(0);
+		const std::shared_ptr<http::request<http::string_body>> request = std::make_shared<http::request<http::string_body>>(std::move(req));
+		net::post(
+			context,
+			[core, room, request, receivedAt, sendAny]()
+			{
+				handleRequest(core, room, std::move(*request), receivedAt, sendAny);
+			});
+	}
+#endif
+
 	template <class Derived>
 	void HTTPSession<Derived>::onWrite(bool close, beast::error_code ec, std::size_t bytes_transferred)
 	{
@@ -579,31 +1130,99 @@ namespace Doppelganger
 	// HTTPSession::queue
 	template <class Derived>
 	HTTPSession<Derived>::queue::queue(HTTPSession<Derived> &self)
-		: self_(self)
+		: self_(self), arena_(requestArenaSize), front_(0), size_(0), limit_(64), reserved_(0), arenaEnd_(0)
+	{
+		items_.resize(limit_);
+	}
+
+	template <class Derived>
+	HTTPSession<Derived>::queue::~queue()
+	{
+		while (size_ > 0)
+		{
+			destroyFront();
+		}
+	}
+
+	template <class Derived>
+	void HTTPSession<Derived>::queue::setLimit(const std::size_t limit)
 	{
-		static_assert(limit > 0, "queue limit must be positive");
-		items_.reserve(limit);
+		BOOST_ASSERT(size_ == 0);
+		limit_ = std::max<std::size_t>(1, limit);
+		items_.assign(limit_, slot());
+		front_ = 0;
 	}
 
 	template <class Derived>
 	bool HTTPSession<Derived>::queue::isFull() const
 	{
-		return (items_.size() >= limit);
+		return (size_ >= limit_);
 	}
 
 	template <class Derived>
 	bool HTTPSession<Derived>::queue::onWrite()
 	{
-		BOOST_ASSERT(!items_.empty());
+		BOOST_ASSERT(size_ > 0);
 		auto const wasFull = isFull();
-		items_.erase(items_.begin());
-		if (!items_.empty())
+		destroyFront();
+		if (size_ > 0 && items_.at(front_).item != nullptr)
 		{
-			(*items_.front())();
+			(*items_.at(front_).item)();
 		}
 		return wasFull;
 	}
 
+	template <class Derived>
+	std::size_t HTTPSession<Derived>::queue::reserve()
+	{
+		// we stop reading at limit_ (see onRead), and each request reserves one slot
+		BOOST_ASSERT(size_ < limit_);
+		slot s;
+		s.item = nullptr;
+		s.onHeap = false;
+		items_.at((front_ + size_) % items_.size()) = s;
+		++size_;
+		return reserved_++;
+	}
+
+	template <class Derived>
+	void HTTPSession<Derived>::queue::fill(const std::size_t ticket, work *item, const bool onHeap)
+	{
+		const std::size_t frontTicket = reserved_ - size_;
+		BOOST_ASSERT(ticket >= frontTicket && ticket < reserved_);
+		slot &s = items_.at((front_ + (ticket - frontTicket)) % items_.size());
+		BOOST_ASSERT(s.item == nullptr);
+		s.item = item;
+		s.onHeap = onHeap;
+
+		// responses before this one are written first (the write of the front starts here or in onWrite())
+		if (ticket == frontTicket)
+		{
+			(*s.item)();
+		}
+	}
+
+	template <class Derived>
+	void HTTPSession<Derived>::queue::destroyFront()
+	{
+		const slot s = items_.at(front_);
+		if (s.item == nullptr)
+		{
+			// reserved (e.g. the session is closed before the response is posted back)
+		}
+		else if (s.onHeap)
+		{
+			delete s.item;
+		}
+		else
+		{
+			s.item->~work();
+			arena_.release(s.item);
+		}
+		front_ = (front_ + 1) % items_.size();
+		--size_;
+	}
+
 	template PlainHTTPSession &HTTPSession<PlainHTTPSession>::derived();
 	template void HTTPSession<PlainHTTPSession>::fail(boost::system::error_code, char const *);
 	template HTTPSession<PlainHTTPSession>::HTTPSession(const std::weak_ptr<Core> &, beast::flat_buffer);
@@ -613,6 +1232,14 @@ namespace Doppelganger
 	template HTTPSession<PlainHTTPSession>::queue::queue(HTTPSession<PlainHTTPSession> &self);
 	template bool HTTPSession<PlainHTTPSession>::queue::isFull() const;
 	template bool HTTPSession<PlainHTTPSession>::queue::onWrite();
+	template HTTPSession<PlainHTTPSession>::queue::~queue();
+	template void HTTPSession<PlainHTTPSession>::queue::setLimit(const std::size_t);
+	template std::size_t HTTPSession<PlainHTTPSession>::queue::reserve();
+	template void HTTPSession<PlainHTTPSession>::queue::fill(const std::size_t, work *, const bool);
+	template void HTTPSession<PlainHTTPSession>::queue::destroyFront();
+#if defined(DOPPELGANGER_HTTP2)
+	template void HTTPSession<PlainHTTPSession>::runHTTP2();
+#endif
 
 	template Doppelganger::SSLHTTPSession &Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::derived();
 	template void Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::fail(boost::system::error_code, char const *);
@@ -623,6 +1250,14 @@ namespace Doppelganger
 	template Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::queue::queue(Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession> &self);
 	template bool Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::queue::isFull() const;
 	template bool Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::queue::onWrite();
+	template Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::queue::~queue();
+	template void Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::queue::setLimit(const std::size_t);
+	template std::size_t Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::queue::reserve();
+	template void Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::queue::fill(const std::size_t, work *, const bool);
+	template void Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::queue::destroyFront();
+#if defined(DOPPELGANGER_HTTP2)
+	template void Doppelganger::HTTPSession<Doppelganger::SSLHTTPSession>::runHTTP2();
+#endif
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,432 @@
+#ifndef HISTORYSTORE_CPP
+#define HISTORYSTORE_CPP
+
+#include "Doppelganger/HistoryStore.h"
+#include "Doppelganger/fs_error_code.h"
+
+#include <cstring>
+#include <zlib.h>
+
+namespace
+{
+	const char historyMagic[8] = {'D', 'G', 'H', 'I', 'S', 'T', '0', '1'};
+	const char *arrayNames[] = {"diffFromPrev", "diffFromNext"};
+	// u8 array, u8 kind, u32 slot
+	const std::size_t recordHeaderSize = 1 + 1 + 4;
+	// u32 rawSize, u32 size, u64 hash
+	const std::size_t entryHeaderSize = 4 + 4 + 8;
+
+	enum RecordKind : std::uint8_t
+	{
+		ENTRY = 0,
+		TRUNCATE = 1
+	};
+
+	std::uint64_t hashBytes(const std::vector<std::uint8_t> &bytes)
+	{
+		// FNV-1a
+		std::uint64_t hash = 14695981039346656037ull;
+		for (const std::uint8_t b : bytes)
+		{
+			hash ^= b;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	template <typename T>
+	void putUInt(std::string &out, const T value)
+	{
+		for (std::size_t b = 0; b < sizeof(T); ++b)
+		{
+			out.push_back(static_cast<char>((static_cast<std::uint64_t>(value) >> (8 * b)) & 0xff));
+		}
+	}
+
+	template <typename T>
+	bool getUInt(std::istream &is, T &value)
+	{
+		unsigned char bytes[sizeof(T)];
+		if (!is.read(reinterpret_cast<char *>(bytes), sizeof(T)))
+		{
+			return false;
+		}
+		std::uint64_t v = 0;
+		for (std::size_t b = 0; b < sizeof(T); ++b)
+		{
+			v |= (static_cast<std::uint64_t>(bytes[b]) << (8 * b));
+		}
+		value = static_cast<T>(v);
+		return true;
+	}
+
+	std::string compress(const std::vector<std::uint8_t> &raw)
+	{
+		uLongf size = compressBound(static_cast<uLong>(raw.size()));
+		std::string compressed(size, '\0');
+		// history is written on every edit. we prefer speed.
+		compress2(reinterpret_cast<Bytef *>(&compressed[0]), &size, raw.data(), static_cast<uLong>(raw.size()), Z_BEST_SPEED);
+		compressed.resize(size);
+		return compressed;
+	}
+
+	std::vector<std::uint8_t> uncompress(const std::string &compressed, const std::uint32_t rawSize)
+	{
+		std::vector<std::uint8_t> raw(rawSize);
+		uLongf size = rawSize;
+		if (::uncompress(raw.data(), &size, reinterpret_cast<const Bytef *>(compressed.data()), static_cast<uLong>(compressed.size())) != Z_OK || size != rawSize)
+		{
+			raw.clear();
+		}
+		return raw;
+	}
+}
+
+namespace Doppelganger
+{
+	HistoryStore::HistoryStore()
+		: logSize_(0), memoryBudget_(0), cachedBytes_(0)
+	{
+	}
+
+	void HistoryStore::open(const fs::path &dir, const std::size_t memoryBudget)
+	{
+		close();
+		dir_ = dir;
+		memoryBudget_ = memoryBudget;
+		fs::create_directories(dir_);
+		replay();
+		if (logSize_ == 0)
+		{
+			log_.open(logPath().string(), std::ios::out | std::ios::binary | std::ios::trunc);
+			log_.write(historyMagic, sizeof(historyMagic));
+			log_.flush();
+			logSize_ = sizeof(historyMagic);
+		}
+		else
+		{
+			log_.open(logPath().string(), std::ios::out | std::ios::binary | std::ios::app);
+		}
+	}
+
+	void HistoryStore::close()
+	{
+		if (log_.is_open())
+		{
+			log_.close();
+		}
+		for (auto &entries : entries_)
+		{
+			entries.clear();
+		}
+		cachedBytes_ = 0;
+		logSize_ = 0;
+	}
+
+	void HistoryStore::remove()
+	{
+		close();
+		if (!dir_.empty())
+		{
+			fs_error_code ec;
+			fs::remove_all(dir_, ec);
+		}
+	}
+
+	void HistoryStore::absorb(json &configRoom)
+	{
+		if (!isOpen() || !configRoom.contains("history") || !configRoom.at("history").is_object())
+		{
+			return;
+		}
+
+		json &history = configRoom.at("history");
+		bool absorbed = false;
+		for (int array = 0; array < ARRAY_COUNT; ++array)
+		{
+			if (history.contains(arrayNames[array]) && history.at(arrayNames[array]).is_array())
+			{
+				absorbArray(static_cast<Array>(array), history.at(arrayNames[array]));
+				history.erase(arrayNames[array]);
+				absorbed = true;
+			}
+		}
+		if (!absorbed)
+		{
+			return;
+		}
+		log_.flush();
+		evict();
+
+		// rewrite the log if it mostly consists of truncated entries
+		std::uint64_t liveSize = sizeof(historyMagic);
+		for (const auto &entries : entries_)
+		{
+			for (const auto &entry : entries)
+			{
+				liveSize += recordHeaderSize + entryHeaderSize + entry.size;
+			}
+		}
+		if (logSize_ > 2 * liveSize + 1024 * 1024)
+		{
+			compactLog();
+		}
+	}
+
+	void HistoryStore::materialize(json &history) const
+	{
+		std::ifstream ifs;
+		for (int array = 0; array < ARRAY_COUNT; ++array)
+		{
+			json diffs = json::array();
+			for (const auto &entry : entries_.at(array))
+			{
+				std::vector<std::uint8_t> raw;
+				if (entry.data)
+				{
+					raw = uncompress(*entry.data, entry.rawSize);
+				}
+				else
+				{
+					if (!ifs.is_open())
+					{
+						ifs.open(logPath().string(), std::ios::in | std::ios::binary);
+					}
+					std::string compressed(entry.size, '\0');
+					ifs.seekg(static_cast<std::streamoff>(entry.offset));
+					ifs.read(&compressed[0], entry.size);
+					raw = uncompress(compressed, entry.rawSize);
+				}
+				diffs.push_back(raw.empty() ? json(nullptr) : json::from_cbor(raw));
+			}
+			history[arrayNames[array]] = std::move(diffs);
+		}
+	}
+
+	void HistoryStore::releaseMemory()
+	{
+		for (auto &entries : entries_)
+		{
+			for (auto &entry : entries)
+			{
+				entry.data.reset();
+			}
+		}
+		cachedBytes_ = 0;
+	}
+
+	void HistoryStore::absorbArray(const Array array, const json &diffs)
+	{
+		std::vector<Entry> &entries = entries_.at(array);
+		const std::size_t count = diffs.size();
+
+		// diffs are usually "previous diffs (unchanged) + new diff". we keep the common prefix.
+		std::size_t slot = 0;
+		std::vector<std::uint8_t> cbor;
+		std::uint64_t hash = 0;
+		bool pending = false;
+		for (; slot < count; ++slot)
+		{
+			cbor = json::to_cbor(diffs.at(slot));
+			hash = hashBytes(cbor);
+			if (slot >= entries.size() || entries.at(slot).hash != hash)
+			{
+				pending = true;
+				break;
+			}
+		}
+		if (slot < entries.size())
+		{
+			writeTruncate(array, static_cast<std::uint32_t>(slot));
+		}
+		for (; slot < count; ++slot)
+		{
+			if (!pending)
+			{
+				cbor = json::to_cbor(diffs.at(slot));
+				hash = hashBytes(cbor);
+			}
+			pending = false;
+			writeEntry(array, static_cast<std::uint32_t>(slot), cbor, hash);
+		}
+	}
+
+	void HistoryStore::writeTruncate(const Array array, const std::uint32_t slot)
+	{
+		std::vector<Entry> &entries = entries_.at(array);
+		for (std::size_t eIdx = slot; eIdx < entries.size(); ++eIdx)
+		{
+			if (entries.at(eIdx).data)
+			{
+				cachedBytes_ -= entries.at(eIdx).size;
+			}
+		}
+		entries.resize(slot);
+
+		std::string record;
+		putUInt<std::uint8_t>(record, static_cast<std::uint8_t>(array));
+		putUInt<std::uint8_t>(record, TRUNCATE);
+		putUInt<std::uint32_t>(record, slot);
+		log_.write(record.data(), record.size());
+		logSize_ += record.size();
+	}
+
+	void HistoryStore::writeEntry(const Array array, const std::uint32_t slot, const std::vector<std::uint8_t> &cbor, const std::uint64_t hash)
+	{
+		const std::shared_ptr<const std::string> compressed = std::make_shared<const std::string>(compress(cbor));
+
+		std::string record;
+		putUInt<std::uint8_t>(record, static_cast<std::uint8_t>(array));
+		putUInt<std::uint8_t>(record, ENTRY);
+		putUInt<std::uint32_t>(record, slot);
+		putUInt<std::uint32_t>(record, static_cast<std::uint32_t>(cbor.size()));
+		putUInt<std::uint32_t>(record, static_cast<std::uint32_t>(compressed->size()));
+		putUInt<std::uint64_t>(record, hash);
+		log_.write(record.data(), record.size());
+		log_.write(compressed->data(), compressed->size());
+
+		Entry entry;
+		entry.hash = hash;
+		entry.offset = logSize_ + record.size();
+		entry.rawSize = static_cast<std::uint32_t>(cbor.size());
+		entry.size = static_cast<std::uint32_t>(compressed->size());
+		entry.data = compressed;
+		entries_.at(array).push_back(entry);
+
+		logSize_ += record.size() + compressed->size();
+		cachedBytes_ += compressed->size();
+	}
+
+	void HistoryStore::replay()
+	{
+		logSize_ = 0;
+		std::ifstream ifs(logPath().string(), std::ios::in | std::ios::binary);
+		char header[sizeof(historyMagic)];
+		if (!ifs || !ifs.read(header, sizeof(header)) || std::memcmp(header, historyMagic, sizeof(historyMagic)) != 0)
+		{
+			return;
+		}
+
+		const std::uint64_t fileSize = static_cast<std::uint64_t>(fs::file_size(logPath()));
+		std::uint64_t validSize = sizeof(historyMagic);
+		while (true)
+		{
+			std::uint8_t array, kind;
+			std::uint32_t slot;
+			if (!getUInt(ifs, array) || !getUInt(ifs, kind) || !getUInt(ifs, slot) || array >= ARRAY_COUNT)
+			{
+				break;
+			}
+			std::vector<Entry> &entries = entries_.at(array);
+			if (kind == TRUNCATE)
+			{
+				if (slot < entries.size())
+				{
+					entries.resize(slot);
+				}
+				validSize += recordHeaderSize;
+				continue;
+			}
+
+			Entry entry;
+			if (!getUInt(ifs, entry.rawSize) || !getUInt(ifs, entry.size) || !getUInt(ifs, entry.hash) || slot > entries.size())
+			{
+				break;
+			}
+			entry.offset = validSize + recordHeaderSize + entryHeaderSize;
+			if (entry.offset + entry.size > fileSize)
+			{
+				// torn write
+				break;
+			}
+			ifs.seekg(static_cast<std::streamoff>(entry.offset + entry.size));
+			entries.resize(slot);
+			entries.push_back(entry);
+			validSize = entry.offset + entry.size;
+		}
+		ifs.close();
+
+		// drop torn record (if any) so that we can append
+		if (fileSize != validSize)
+		{
+			fs::resize_file(logPath(), validSize);
+		}
+		logSize_ = validSize;
+	}
+
+	void HistoryStore::evict()
+	{
+		// oldest diffs first
+		for (auto &entries : entries_)
+		{
+			for (auto &entry : entries)
+			{
+				if (cachedBytes_ <= memoryBudget_)
+				{
+					return;
+				}
+				if (entry.data)
+				{
+					cachedBytes_ -= entry.size;
+					entry.data.reset();
+				}
+			}
+		}
+	}
+
+	void HistoryStore::compactLog()
+	{
+		log_.close();
+		fs::path tmpPath(logPath());
+		tmpPath += ".tmp";
+		{
+			std::ifstream ifs(logPath().string(), std::ios::in | std::ios::binary);
+			std::ofstream ofs(tmpPath.string(), std::ios::out | std::ios::binary | std::ios::trunc);
+			ofs.write(historyMagic, sizeof(historyMagic));
+			std::uint64_t size = sizeof(historyMagic);
+			for (int array = 0; array < ARRAY_COUNT; ++array)
+			{
+				std::vector<Entry> &entries = entries_.at(array);
+				for (std::size_t slot = 0; slot < entries.size(); ++slot)
+				{
+					Entry &entry = entries.at(slot);
+					std::string compressed;
+					if (entry.data)
+					{
+						compressed = *entry.data;
+					}
+					else
+					{
+						compressed.resize(entry.size);
+						ifs.seekg(static_cast<std::streamoff>(entry.offset));
+						ifs.read(&compressed[0], entry.size);
+					}
+
+					std::string record;
+					putUInt<std::uint8_t>(record, static_cast<std::uint8_t>(array));
+					putUInt<std::uint8_t>(record, ENTRY);
+					putUInt<std::uint32_t>(record, static_cast<std::uint32_t>(slot));
+					putUInt<std::uint32_t>(record, entry.rawSize);
+					putUInt<std::uint32_t>(record, entry.size);
+					putUInt<std::uint64_t>(record, entry.hash);
+					ofs.write(record.data(), record.size());
+					ofs.write(compressed.data(), compressed.size());
+					entry.offset = size + record.size();
+					size += record.size() + compressed.size();
+				}
+			}
+			logSize_ = size;
+		}
+		fs::rename(tmpPath, logPath());
+		log_.open(logPath().string(), std::ios::out | std::ios::binary | std::ios::app);
+	}
+
+	fs::path HistoryStore::logPath() const
+	{
+		fs::path path(dir_);
+		path.append("history.bin");
+		return path;
+	}
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef IOCONTEXTPOOL_CPP
+#define IOCONTEXTPOOL_CPP
+
+#include "Doppelganger/IOContextPool.h"
+
+#include <algorithm>
+#include <vector>
+#if defined(_WIN64)
+#include "windows.h"
+#elif defined(__APPLE__)
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+	// CPUs this process may run on (e.g. restricted by taskset or cpuset of cgroups). empty if unknown
+	std::vector<unsigned int> allowedCores()
+	{
+		std::vector<unsigned int> cores;
+#if defined(_WIN64)
+		DWORD_PTR processMask, systemMask;
+		if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+		{
+			for (unsigned int c = 0; c < sizeof(DWORD_PTR) * 8; ++c)
+			{
+				if (processMask & (static_cast<DWORD_PTR>(1) << c))
+				{
+					cores.push_back(c);
+				}
+			}
+		}
+#elif defined(__APPLE__)
+#elif defined(__linux__)
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0)
+		{
+			for (unsigned int c = 0; c < CPU_SETSIZE; ++c)
+			{
+				if (CPU_ISSET(c, &cpuSet))
+				{
+					cores.push_back(c);
+				}
+			}
+		}
+#endif
+		return cores;
+	}
+
+	// pin to the index-th allowed CPU (round robin)
+	void pinCurrentThread(const std::vector<unsigned int> &cores, const unsigned int index)
+	{
+		if (cores.empty())
+		{
+			return;
+		}
+		const unsigned int core = cores.at(index % cores.size());
+#if defined(_WIN64)
+		SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << core);
+#elif defined(__APPLE__)
+		// macOS has no API for pinning threads (affinity tags are only hints)
+		(void)core;
+#elif defined(__linux__)
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		CPU_SET(core, &cpuSet);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+	}
+}
+
+namespace Doppelganger
+{
+	IOContextPool::IOContextPool()
+		: perCore_(false), threadCount_(std::max(1u, std::thread::hardware_concurrency())), next_(0)
+	{
+		contexts_.push_back(std::unique_ptr<boost::asio::io_context>(new boost::asio::io_context(static_cast<int>(threadCount_))));
+	}
+
+	void IOContextPool::configure(const bool perCore, const unsigned int threadCount)
+	{
+		perCore_ = perCore;
+		threadCount_ = (threadCount > 0) ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+		if (perCore_)
+		{
+			// each context is run by one thread (i.e. no locking inside io_context)
+			while (contexts_.size() < threadCount_)
+			{
+				contexts_.push_back(std::unique_ptr<boost::asio::io_context>(new boost::asio::io_context(1)));
+			}
+		}
+	}
+
+	void IOContextPool::run()
+	{
+		// threads keep running until stop() even if there is no work
+		for (const auto &context : contexts_)
+		{
+			workGuards_.push_back(boost::asio::make_work_guard(*context));
+		}
+
+		// before any thread is pinned (threads inherit the affinity of this thread)
+		const std::vector<unsigned int> cores = perCore_ ? allowedCores() : std::vector<unsigned int>();
+		std::vector<std::thread> threads;
+		threads.reserve(threadCount_ - 1);
+		for (unsigned int t = 1; t < threadCount_; ++t)
+		{
+			boost::asio::io_context &context = perCore_ ? *contexts_.at(t) : *contexts_.at(0);
+			const bool pin = perCore_;
+			threads.emplace_back(
+				[&context, &cores, pin, t]()
+				{
+					if (pin)
+					{
+						pinCurrentThread(cores, t);
+					}
+					context.run();
+				});
+		}
+		if (perCore_)
+		{
+			pinCurrentThread(cores, 0);
+		}
+		contexts_.at(0)->run();
+
+		// Block until all the threads exit
+		for (auto &thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	void IOContextPool::stop()
+	{
+		for (auto &workGuard : workGuards_)
+		{
+			workGuard.reset();
+		}
+		for (const auto &context : contexts_)
+		{
+			context->stop();
+		}
+	}
+
+	std::size_t IOContextPool::index(const boost::asio::io_context *context) const
+	{
+		for (std::size_t c = 0; c < contexts_.size(); ++c)
+		{
+			if (contexts_.at(c).get() == context)
+			{
+				return c;
+			}
+		}
+		return contexts_.size();
+	}
+
+	boost::asio::io_context &IOContextPool::next()
+	{
+		return *contexts_.at(next_.fetch_add(1, std::memory_order_relaxed) % contexts_.size());
+	}
+}
+
+#endif
@@ -0,0 +1,585 @@
+#ifndef LOGGER_CPP
+#define LOGGER_CPP
+
+#include "Doppelganger/Logger.h"
+#include "Doppelganger/fs_error_code.h"
+
+#include <array>
+#include <ctime>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#if defined(_WIN64)
+#elif defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// order must match Doppelganger::Logger::Level
+	const std::array<const char *, 6> levelNames = {{"SYSTEM", "APICALL", "WSCALL", "ERROR", "MISC", "DEBUG"}};
+
+	std::string formatTimestamp(const std::chrono::system_clock::time_point &timestamp)
+	{
+		const std::time_t t = std::chrono::system_clock::to_time_t(timestamp);
+		const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+								 timestamp.time_since_epoch())
+								 .count() %
+							 1000;
+		std::tm tm;
+#if defined(_WIN64)
+		localtime_s(&tm, &t);
+#elif defined(__APPLE__)
+		localtime_r(&t, &tm);
+#elif defined(__linux__)
+		localtime_r(&t, &tm);
+#endif
+		std::stringstream ss;
+		ss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
+		ss << "." << std::setfill('0') << std::setw(3) << ms;
+		return ss.str();
+	}
+
+	// <dataDir>/log
+	fs::path logDirectory(const std::string &dataDir)
+	{
+		fs::path logDir(dataDir);
+		logDir.append("log");
+		return logDir;
+	}
+
+#if defined(_WIN64)
+#elif defined(__APPLE__) || defined(__linux__)
+	// write all of iov (short writes are continued). false on errors
+	//   we are on the flusher thread, i.e. we may wait for fd (e.g. non-blocking STDOUT connected to a full pipe)
+	bool writeAll(const int fd, struct iovec *iov, int count)
+	{
+		while (count > 0)
+		{
+			const ssize_t written = ::writev(fd, iov, count);
+			if (written < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+				{
+					struct pollfd p;
+					p.fd = fd;
+					p.events = POLLOUT;
+					p.revents = 0;
+					// we give up if fd is not writable for a while (messages are lost rather than blocking the ring)
+					if (::poll(&p, 1, 1000) > 0 || errno == EINTR)
+					{
+						continue;
+					}
+				}
+				return false;
+			}
+			if (written == 0)
+			{
+				return false;
+			}
+
+			std::size_t rest = static_cast<std::size_t>(written);
+			while (count > 0 && rest >= iov->iov_len)
+			{
+				rest -= iov->iov_len;
+				++iov;
+				--count;
+			}
+			if (count > 0)
+			{
+				iov->iov_base = static_cast<char *>(iov->iov_base) + rest;
+				iov->iov_len -= rest;
+			}
+		}
+		return true;
+	}
+#endif
+}
+
+namespace Doppelganger
+{
+	struct Logger::Sink
+	{
+#if defined(_WIN64)
+		std::ofstream ofs;
+#elif defined(__APPLE__)
+		int fd = -1;
+#elif defined(__linux__)
+		int fd = -1;
+#endif
+		std::vector<const std::string *> lines;
+		// closed by closeSink(), i.e. never reopened (dropped once <dataDir>/log is removed)
+		bool closed = false;
+		// open failed (e.g. <dataDir>/log is removed). not retried until the next pruneSinks()
+		bool failed = false;
+	};
+
+	Logger &Logger::getInstance()
+	{
+		static Logger logger;
+		return logger;
+	}
+
+	Logger::Logger()
+		: slots_(new Slot[capacity]),
+		  enqueuePos_(0),
+		  dequeuePos_(0),
+		  processed_(0),
+		  dropped_(0),
+		  droppedReported_(0),
+		  running_(false)
+	{
+		static_assert((capacity & (capacity - 1)) == 0, "capacity must be power of 2");
+		for (std::size_t i = 0; i < capacity; ++i)
+		{
+			slots_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	Logger::~Logger()
+	{
+		stop();
+
+		std::lock_guard<std::mutex> lock(mutexSink_);
+		for (auto &path_sink : sinks_)
+		{
+#if defined(_WIN64)
+			path_sink.second->ofs.close();
+#elif defined(__APPLE__)
+			::close(path_sink.second->fd);
+#elif defined(__linux__)
+			::close(path_sink.second->fd);
+#endif
+		}
+		sinks_.clear();
+	}
+
+	void Logger::start()
+	{
+		bool expected = false;
+		if (running_.compare_exchange_strong(expected, true))
+		{
+			flusher_ = std::thread(&Logger::flusherLoop, this);
+		}
+	}
+
+	void Logger::stop()
+	{
+		bool expected = true;
+		if (running_.compare_exchange_strong(expected, false))
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutexWake_);
+			}
+			wake_.notify_one();
+			flusher_.join();
+		}
+	}
+
+	void Logger::flush()
+	{
+		const std::size_t target = enqueuePos_.load(std::memory_order_acquire);
+		std::unique_lock<std::mutex> lock(mutexWake_);
+		if (!running_.load())
+		{
+			return;
+		}
+		wake_.notify_one();
+		flushed_.wait(
+			lock,
+			[this, target]()
+			{ return processed_.load(std::memory_order_acquire) >= target || !running_.load(); });
+	}
+
+	void Logger::closeSink(const std::string &dataDir, const bool reopen)
+	{
+		flush();
+
+		std::lock_guard<std::mutex> lock(mutexSink_);
+		std::unique_ptr<Sink> &sink = sinks_[dataDir];
+		if (!sink)
+		{
+			sink.reset(new Sink());
+		}
+#if defined(_WIN64)
+		sink->ofs.close();
+#elif defined(__APPLE__)
+		if (sink->fd >= 0)
+		{
+			::close(sink->fd);
+			sink->fd = -1;
+		}
+#elif defined(__linux__)
+		if (sink->fd >= 0)
+		{
+			::close(sink->fd);
+			sink->fd = -1;
+		}
+#endif
+		if (reopen)
+		{
+			sinks_.erase(dataDir);
+		}
+		else
+		{
+			// messages still queued for this directory (e.g. from sessions being closed) must not recreate the file
+			sink->closed = true;
+		}
+	}
+
+	std::uint64_t Logger::droppedCount() const
+	{
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+	void Logger::log(
+		std::string content,
+		const Level level,
+		const std::uint32_t mask,
+		const std::string &dataDir)
+	{
+		const bool toStdout = ((mask & TYPE_STDOUT) != 0u);
+		const bool toFile = ((mask & TYPE_FILE) != 0u) && !dataDir.empty();
+		if (!toStdout && !toFile)
+		{
+			return;
+		}
+
+		std::size_t lIdx = 0;
+		while (lIdx + 1 < levelNames.size() && ((1u << lIdx) & level) == 0u)
+		{
+			++lIdx;
+		}
+
+		Entry entry;
+		entry.timestamp = std::chrono::system_clock::now();
+		entry.level = levelNames.at(lIdx);
+		entry.content = std::move(content);
+		if (toFile)
+		{
+			entry.dataDir = dataDir;
+		}
+		entry.toStdout = toStdout;
+
+		Logger &logger = getInstance();
+		if (!logger.push(std::move(entry)))
+		{
+			logger.dropped_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	std::uint32_t Logger::levelMask(const json &config)
+	{
+		std::uint32_t mask = 0u;
+		if (config.contains("log"))
+		{
+			const json &logConfig = config.at("log");
+			if (logConfig.contains("level"))
+			{
+				const json &levelConfig = logConfig.at("level");
+				for (std::size_t lIdx = 0; lIdx < levelNames.size(); ++lIdx)
+				{
+					const auto it = levelConfig.find(levelNames.at(lIdx));
+					if (it != levelConfig.end() && it->get<bool>())
+					{
+						mask |= (1u << lIdx);
+					}
+				}
+			}
+			if (logConfig.contains("type"))
+			{
+				const json &typeConfig = logConfig.at("type");
+				if (typeConfig.contains("STDOUT") && typeConfig.at("STDOUT").get<bool>())
+				{
+					mask |= TYPE_STDOUT;
+				}
+				if (typeConfig.contains("FILE") && typeConfig.at("FILE").get<bool>())
+				{
+					mask |= TYPE_FILE;
+				}
+			}
+		}
+		return mask;
+	}
+
+	bool Logger::push(Entry &&entry)
+	{
+		std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		Slot *slot;
+		while (true)
+		{
+			slot = &slots_[pos & (capacity - 1)];
+			const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			const std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+			if (diff == 0)
+			{
+				if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				// ring is full
+				return false;
+			}
+			else
+			{
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+			}
+		}
+
+		slot->entry = std::move(entry);
+		slot->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Logger::pop(Entry &entry)
+	{
+		// we only have one consumer (flusher_)
+		Slot &slot = slots_[dequeuePos_ & (capacity - 1)];
+		const std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+		if (static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(dequeuePos_ + 1) < 0)
+		{
+			return false;
+		}
+
+		entry = std::move(slot.entry);
+		slot.sequence.store(dequeuePos_ + capacity, std::memory_order_release);
+		++dequeuePos_;
+		return true;
+	}
+
+	void Logger::flusherLoop()
+	{
+		std::vector<Entry> batch;
+		batch.reserve(batchSize);
+		std::chrono::steady_clock::time_point lastPrune = std::chrono::steady_clock::now();
+
+		while (true)
+		{
+			const bool running = running_.load();
+
+			Entry entry;
+			while (batch.size() < batchSize && pop(entry))
+			{
+				batch.push_back(std::move(entry));
+			}
+
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now - lastPrune >= std::chrono::milliseconds(pruneIntervalMs))
+			{
+				pruneSinks();
+				lastPrune = now;
+			}
+
+			if (!batch.empty())
+			{
+				writeBatch(batch);
+				processed_.fetch_add(batch.size(), std::memory_order_release);
+				batch.clear();
+				{
+					std::lock_guard<std::mutex> lock(mutexWake_);
+				}
+				flushed_.notify_all();
+				// there might be more messages
+				continue;
+			}
+
+			if (!running)
+			{
+				// every message is written
+				break;
+			}
+
+			std::unique_lock<std::mutex> lock(mutexWake_);
+			wake_.wait_for(lock, std::chrono::milliseconds(10));
+		}
+
+		flushed_.notify_all();
+	}
+
+	void Logger::pruneSinks()
+	{
+		std::lock_guard<std::mutex> lock(mutexSink_);
+		// drop sinks without a file whose log directory is removed (e.g. rooms removed or closed by closeSink())
+		//   the others may be opened again by the next message
+		for (auto it = sinks_.begin(); it != sinks_.end();)
+		{
+#if defined(_WIN64)
+			const bool isOpen = it->second->ofs.is_open();
+#elif defined(__APPLE__)
+			const bool isOpen = (it->second->fd >= 0);
+#elif defined(__linux__)
+			const bool isOpen = (it->second->fd >= 0);
+#endif
+			fs_error_code ec;
+			if (!isOpen && !fs::exists(logDirectory(it->first), ec))
+			{
+				it = sinks_.erase(it);
+			}
+			else
+			{
+				it->second->failed = false;
+				++it;
+			}
+		}
+	}
+
+	void Logger::writeBatch(std::vector<Entry> &batch)
+	{
+		std::vector<std::string> lines;
+		lines.reserve(batch.size() + 1);
+		for (const auto &entry : batch)
+		{
+			std::string line("[");
+			line += formatTimestamp(entry.timestamp);
+			line += "] [";
+			line += entry.level;
+			line += "] ";
+			line += entry.content;
+			line += "\n";
+			lines.push_back(std::move(line));
+		}
+
+		const std::uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+		const bool reportDropped = (dropped != droppedReported_);
+		if (reportDropped)
+		{
+			std::stringstream ss;
+			ss << "[" << formatTimestamp(std::chrono::system_clock::now()) << "] [ERROR] "
+			   << (dropped - droppedReported_) << " log message(s) are dropped (ring buffer overflow).\n";
+			lines.push_back(ss.str());
+			droppedReported_ = dropped;
+		}
+
+		std::lock_guard<std::mutex> lock(mutexSink_);
+
+		// group lines by destination
+		std::vector<const std::string *> stdoutLines;
+		for (std::size_t i = 0; i < batch.size(); ++i)
+		{
+			const Entry &entry = batch.at(i);
+			if (entry.toStdout)
+			{
+				stdoutLines.push_back(&lines.at(i));
+			}
+			if (!entry.dataDir.empty())
+			{
+				std::unique_ptr<Sink> &sink = sinks_[entry.dataDir];
+				if (!sink)
+				{
+					sink.reset(new Sink());
+				}
+				if (sink->closed || sink->failed)
+				{
+					continue;
+				}
+#if defined(_WIN64)
+				if (!sink->ofs.is_open())
+#elif defined(__APPLE__)
+				if (sink->fd < 0)
+#elif defined(__linux__)
+				if (sink->fd < 0)
+#endif
+				{
+					// (re)open. log directory might be created after the first message
+					fs::path logPath = logDirectory(entry.dataDir);
+					logPath.append("log.txt");
+#if defined(_WIN64)
+					sink->ofs.open(logPath.string(), std::ios::out | std::ios::app | std::ios::binary);
+#elif defined(__APPLE__)
+					sink->fd = ::open(logPath.string().c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#elif defined(__linux__)
+					sink->fd = ::open(logPath.string().c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+#if defined(_WIN64)
+					sink->failed = !sink->ofs.is_open();
+#elif defined(__APPLE__)
+					sink->failed = (sink->fd < 0);
+#elif defined(__linux__)
+					sink->failed = (sink->fd < 0);
+#endif
+					if (sink->failed)
+					{
+						continue;
+					}
+				}
+				sink->lines.push_back(&lines.at(i));
+			}
+		}
+		if (reportDropped)
+		{
+			stdoutLines.push_back(&lines.back());
+		}
+
+#if defined(_WIN64)
+		for (const std::string *line : stdoutLines)
+		{
+			std::cout << *line;
+		}
+		std::cout.flush();
+		for (auto &path_sink : sinks_)
+		{
+			Sink &sink = *(path_sink.second);
+			for (const std::string *line : sink.lines)
+			{
+				sink.ofs << *line;
+			}
+			sink.ofs.flush();
+			sink.lines.clear();
+		}
+#elif defined(__APPLE__) || defined(__linux__)
+		const auto writeLines = [](int fd, std::vector<const std::string *> &lines_)
+		{
+			std::vector<struct iovec> iov;
+			iov.reserve(std::min<std::size_t>(lines_.size(), IOV_MAX));
+			std::size_t lIdx = 0;
+			while (lIdx < lines_.size())
+			{
+				iov.clear();
+				for (; lIdx < lines_.size() && iov.size() < IOV_MAX; ++lIdx)
+				{
+					struct iovec v;
+					v.iov_base = const_cast<char *>(lines_.at(lIdx)->data());
+					v.iov_len = lines_.at(lIdx)->size();
+					iov.push_back(v);
+				}
+				if (fd >= 0)
+				{
+					writeAll(fd, iov.data(), static_cast<int>(iov.size()));
+				}
+			}
+			lines_.clear();
+		};
+
+		writeLines(STDOUT_FILENO, stdoutLines);
+		for (auto &path_sink : sinks_)
+		{
+			Sink &sink = *(path_sink.second);
+			writeLines(sink.fd, sink.lines);
+		}
+#endif
+	}
+}
+
+#endif
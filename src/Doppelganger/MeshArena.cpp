@@ -0,0 +1,304 @@
+#ifndef MESHARENA_CPP
+#define MESHARENA_CPP
+
+#include "Doppelganger/MeshArena.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#if defined(_WIN64)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// address range reserved for the arena by default (only the mapped part consumes memory)
+	//   the reservation is per arena (i.e. per room). we keep it small enough for many rooms in the address space
+	const std::uint64_t defaultCapacity = 4ull * 1024ull * 1024ull * 1024ull;
+	// the file is extended by this size
+	const std::uint64_t growStep = 16ull * 1024ull * 1024ull;
+	// pages of freed blocks larger than this are returned to the OS
+	const std::uint64_t releaseThreshold = 2ull * 1024ull * 1024ull;
+	const std::uint64_t pageSize = 4096;
+
+	std::uint64_t roundUp(const std::uint64_t value, const std::uint64_t unit)
+	{
+		return ((value + unit - 1) / unit) * unit;
+	}
+}
+
+namespace Doppelganger
+{
+	MeshArena::MeshArena(const bool shared)
+		: shared_(shared), initialized_(false), fd_(-1), base_(nullptr), reservation_(defaultCapacity), capacity_(0), mapped_(0), used_(0), releasePending_(false)
+	{
+	}
+
+	MeshArena::~MeshArena()
+	{
+		unmap();
+	}
+
+	MeshArena &MeshArena::heap()
+	{
+		static MeshArena arena(false);
+		return arena;
+	}
+
+	void *MeshArena::allocate(const std::size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		// e.g. woken up before the snapshot is written
+		releasePending_ = false;
+		const std::uint64_t size = roundUp((bytes > 0) ? bytes : 1, alignment);
+		if (shared_ && (initialized_ || initialize()) && base_ != nullptr)
+		{
+			// first fit
+			for (auto it = freeBlocks_.begin(); it != freeBlocks_.end(); ++it)
+			{
+				if (it->second >= size)
+				{
+					const std::uint64_t offset = it->first;
+					const std::uint64_t remaining = it->second - size;
+					freeBlocks_.erase(it);
+					if (remaining > 0)
+					{
+						freeBlocks_[offset + size] = remaining;
+					}
+					return base_ + offset;
+				}
+			}
+			if (used_ + size <= capacity_ && (used_ + size <= mapped_ || grow(used_ + size)))
+			{
+				const std::uint64_t offset = used_;
+				used_ += size;
+				return base_ + offset;
+			}
+		}
+		return allocateHeap(bytes);
+	}
+
+	void MeshArena::deallocate(void *ptr, const std::size_t bytes)
+	{
+		if (ptr == nullptr)
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		const char *p = static_cast<const char *>(ptr);
+		if (base_ == nullptr || p < base_ || p >= base_ + used_)
+		{
+			deallocateHeap(ptr);
+			return;
+		}
+
+		std::uint64_t offset = static_cast<std::uint64_t>(p - base_);
+		std::uint64_t size = roundUp((bytes > 0) ? bytes : 1, alignment);
+		// coalesce with neighbours
+		auto next = freeBlocks_.lower_bound(offset);
+		if (next != freeBlocks_.end() && next->first == offset + size)
+		{
+			size += next->second;
+			next = freeBlocks_.erase(next);
+		}
+		if (next != freeBlocks_.begin())
+		{
+			auto prev = std::prev(next);
+			if (prev->first + prev->second == offset)
+			{
+				offset = prev->first;
+				size += prev->second;
+				freeBlocks_.erase(prev);
+			}
+		}
+		if (offset + size == used_)
+		{
+			used_ = offset;
+			if (used_ == 0 && releasePending_)
+			{
+				unmap();
+				return;
+			}
+#if defined(_WIN64)
+#elif defined(__APPLE__)
+#elif defined(__linux__)
+			// pages after the last allocated block are always returned to the OS (e.g. all buffers after MeshStore::clear())
+			const std::uint64_t begin = roundUp(offset, pageSize);
+			const std::uint64_t end = roundUp(offset + size, pageSize);
+			if (end > begin)
+			{
+				fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(begin), static_cast<off_t>(end - begin));
+			}
+#endif
+			return;
+		}
+		freeBlocks_[offset] = size;
+
+#if defined(_WIN64)
+#elif defined(__APPLE__)
+#elif defined(__linux__)
+		if (size >= releaseThreshold)
+		{
+			const std::uint64_t begin = roundUp(offset, pageSize);
+			const std::uint64_t end = ((offset + size) / pageSize) * pageSize;
+			if (end > begin)
+			{
+				fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(begin), static_cast<off_t>(end - begin));
+			}
+		}
+#endif
+	}
+
+	void MeshArena::release()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (used_ == 0)
+		{
+			unmap();
+		}
+		else
+		{
+			releasePending_ = true;
+		}
+	}
+
+	void MeshArena::reserve(const std::uint64_t capacity)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		reservation_ = roundUp(std::max(capacity, growStep), growStep);
+	}
+
+	std::uint64_t MeshArena::offset(const void *ptr) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const char *p = static_cast<const char *>(ptr);
+		if (base_ == nullptr || p < base_ || p >= base_ + used_)
+		{
+			return invalidOffset;
+		}
+		return static_cast<std::uint64_t>(p - base_);
+	}
+
+	std::uint64_t MeshArena::mappedSize() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return mapped_;
+	}
+
+	bool MeshArena::initialize()
+	{
+		initialized_ = true;
+#if defined(_WIN64)
+		return false;
+#elif defined(__APPLE__)
+		return false;
+#elif defined(__linux__)
+		fd_ = memfd_create("doppelganger-mesh", MFD_CLOEXEC);
+		if (fd_ < 0)
+		{
+			return false;
+		}
+		// reserve address range so that buffers never move when the file grows
+		void *base = mmap(nullptr, reservation_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (base == MAP_FAILED)
+		{
+			close(fd_);
+			fd_ = -1;
+			return false;
+		}
+		base_ = static_cast<char *>(base);
+		capacity_ = reservation_;
+		return true;
+#endif
+	}
+
+	void MeshArena::unmap()
+	{
+#if defined(_WIN64)
+#elif defined(__APPLE__)
+#elif defined(__linux__)
+		if (base_ != nullptr)
+		{
+			munmap(base_, capacity_);
+		}
+		if (fd_ >= 0)
+		{
+			close(fd_);
+		}
+#endif
+		initialized_ = false;
+		fd_ = -1;
+		base_ = nullptr;
+		capacity_ = 0;
+		mapped_ = 0;
+		used_ = 0;
+		freeBlocks_.clear();
+		releasePending_ = false;
+	}
+
+	bool MeshArena::grow(const std::uint64_t size)
+	{
+#if defined(_WIN64)
+		return false;
+#elif defined(__APPLE__)
+		return false;
+#elif defined(__linux__)
+		const std::uint64_t newMapped = std::min(roundUp(size, growStep), capacity_);
+		if (ftruncate(fd_, static_cast<off_t>(newMapped)) != 0)
+		{
+			return false;
+		}
+		void *mapped = mmap(base_ + mapped_, newMapped - mapped_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd_, static_cast<off_t>(mapped_));
+		if (mapped == MAP_FAILED)
+		{
+			return false;
+		}
+		mapped_ = newMapped;
+		return true;
+#endif
+	}
+
+	void *MeshArena::allocateHeap(const std::size_t bytes)
+	{
+		const std::size_t size = static_cast<std::size_t>(roundUp((bytes > 0) ? bytes : 1, alignment));
+		void *ptr = nullptr;
+#if defined(_WIN64)
+		ptr = _aligned_malloc(size, alignment);
+#elif defined(__APPLE__)
+		if (posix_memalign(&ptr, alignment, size) != 0)
+		{
+			ptr = nullptr;
+		}
+#elif defined(__linux__)
+		if (posix_memalign(&ptr, alignment, size) != 0)
+		{
+			ptr = nullptr;
+		}
+#endif
+		if (ptr == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+		return ptr;
+	}
+
+	void MeshArena::deallocateHeap(void *ptr)
+	{
+#if defined(_WIN64)
+		_aligned_free(ptr);
+#elif defined(__APPLE__)
+		std::free(ptr);
+#elif defined(__linux__)
+		std::free(ptr);
+#endif
+	}
+}
+
+#endif
@@ -0,0 +1,529 @@
+#ifndef MESHBVH_CPP
+#define MESHBVH_CPP
+
+#include "Doppelganger/MeshBVH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <Eigen/Geometry>
+
+namespace
+{
+	const std::uint32_t maxLeafFaces = 4;
+	const int binCount = 16;
+	// relative cost of traversing a node (the cost of intersecting a face is 1)
+	const float traversalCost = 1.0f;
+
+	using Vector = Eigen::Vector3f;
+
+	float surfaceArea(const float min[3], const float max[3])
+	{
+		const float dx = max[0] - min[0];
+		const float dy = max[1] - min[1];
+		const float dz = max[2] - min[2];
+		return 2.0f * (dx * dy + dy * dz + dz * dx);
+	}
+
+	void grow(float min[3], float max[3], const float otherMin[3], const float otherMax[3])
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			min[c] = std::min(min[c], otherMin[c]);
+			max[c] = std::max(max[c], otherMax[c]);
+		}
+	}
+
+	void reset(float min[3], float max[3])
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			min[c] = std::numeric_limits<float>::max();
+			max[c] = -std::numeric_limits<float>::max();
+		}
+	}
+
+	// entry distance of the ray (inf if missed)
+	float rayBox(const float min[3], const float max[3], const Vector &origin, const Vector &invDirection, const float maxT)
+	{
+		float tNear = 0.0f;
+		float tFar = maxT;
+		for (int c = 0; c < 3; ++c)
+		{
+			float t0 = (min[c] - origin[c]) * invDirection[c];
+			float t1 = (max[c] - origin[c]) * invDirection[c];
+			if (t0 > t1)
+			{
+				std::swap(t0, t1);
+			}
+			// NaN (0 * inf) doesn't narrow the interval
+			tNear = (t0 > tNear) ? t0 : tNear;
+			tFar = (t1 < tFar) ? t1 : tFar;
+		}
+		return (tNear <= tFar) ? tNear : std::numeric_limits<float>::infinity();
+	}
+
+	float boxDistance2(const float min[3], const float max[3], const Vector &point)
+	{
+		float distance2 = 0.0f;
+		for (int c = 0; c < 3; ++c)
+		{
+			const float d = std::max(std::max(min[c] - point[c], 0.0f), point[c] - max[c]);
+			distance2 += d * d;
+		}
+		return distance2;
+	}
+
+	// Moller-Trumbore
+	bool rayTriangle(const Vector &origin, const Vector &direction, const Vector &v0, const Vector &v1, const Vector &v2, float &t, float &u, float &v)
+	{
+		const Vector e1 = v1 - v0;
+		const Vector e2 = v2 - v0;
+		const Vector p = direction.cross(e2);
+		const float det = e1.dot(p);
+		if (std::abs(det) < std::numeric_limits<float>::min())
+		{
+			return false;
+		}
+		const float invDet = 1.0f / det;
+		const Vector s = origin - v0;
+		u = s.dot(p) * invDet;
+		if (u < 0.0f || u > 1.0f)
+		{
+			return false;
+		}
+		const Vector q = s.cross(e1);
+		v = direction.dot(q) * invDet;
+		if (v < 0.0f || u + v > 1.0f)
+		{
+			return false;
+		}
+		t = e2.dot(q) * invDet;
+		return true;
+	}
+
+	// Ericson, "Real-Time Collision Detection", 5.1.5
+	Vector closestOnTriangle(const Vector &p, const Vector &a, const Vector &b, const Vector &c)
+	{
+		const Vector ab = b - a;
+		const Vector ac = c - a;
+		const Vector ap = p - a;
+		const float d1 = ab.dot(ap);
+		const float d2 = ac.dot(ap);
+		if (d1 <= 0.0f && d2 <= 0.0f)
+		{
+			return a;
+		}
+		const Vector bp = p - b;
+		const float d3 = ab.dot(bp);
+		const float d4 = ac.dot(bp);
+		if (d3 >= 0.0f && d4 <= d3)
+		{
+			return b;
+		}
+		const float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		{
+			return a + ab * (d1 / (d1 - d3));
+		}
+		const Vector cp = p - c;
+		const float d5 = ab.dot(cp);
+		const float d6 = ac.dot(cp);
+		if (d6 >= 0.0f && d5 <= d6)
+		{
+			return c;
+		}
+		const float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		{
+			return a + ac * (d2 / (d2 - d6));
+		}
+		const float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		{
+			return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		}
+		const float denom = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denom) + ac * (vc * denom);
+	}
+}
+
+namespace Doppelganger
+{
+	MeshBVH::MeshBVH(const std::shared_ptr<AlignedMatrix<std::int32_t>> &F)
+		: F_(F), vertexCount_(0), stale_(false)
+	{
+	}
+
+	void MeshBVH::faceBounds(const AlignedMatrix<float> &V, const std::uint32_t face, float min[3], float max[3]) const
+	{
+		reset(min, max);
+		for (int k = 0; k < 3; ++k)
+		{
+			const std::int32_t vertex = F_->col(k)[face];
+			for (int c = 0; c < 3; ++c)
+			{
+				const float x = V.col(c)[vertex];
+				min[c] = std::min(min[c], x);
+				max[c] = std::max(max[c], x);
+			}
+		}
+	}
+
+	void MeshBVH::build(const AlignedMatrix<float> &V)
+	{
+		vertexCount_ = static_cast<std::uint32_t>(V.rows());
+		stale_ = false;
+		nodes_.clear();
+		order_.clear();
+		if (!F_ || F_->cols() != 3 || V.cols() != 3)
+		{
+			return;
+		}
+
+		// bounds and centroids of valid faces
+		const std::uint32_t faceCount = static_cast<std::uint32_t>(F_->rows());
+		std::vector<float> bounds(static_cast<std::size_t>(faceCount) * 6);
+		std::vector<float> centroids(static_cast<std::size_t>(faceCount) * 3);
+		order_.reserve(faceCount);
+		for (std::uint32_t f = 0; f < faceCount; ++f)
+		{
+			bool valid = true;
+			for (int k = 0; k < 3; ++k)
+			{
+				const std::int32_t vertex = F_->col(k)[f];
+				valid = valid && (vertex >= 0 && static_cast<std::uint32_t>(vertex) < vertexCount_);
+			}
+			if (!valid)
+			{
+				continue;
+			}
+			faceBounds(V, f, &bounds[f * 6], &bounds[f * 6 + 3]);
+			for (int c = 0; c < 3; ++c)
+			{
+				centroids[f * 3 + c] = 0.5f * (bounds[f * 6 + c] + bounds[f * 6 + 3 + c]);
+			}
+			order_.push_back(f);
+		}
+		if (order_.empty())
+		{
+			return;
+		}
+
+		nodes_.reserve(2 * (order_.size() / maxLeafFaces + 1));
+		nodes_.push_back(Node{{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, 0, static_cast<std::uint32_t>(order_.size())});
+		std::vector<std::uint32_t> stack(1, 0);
+		while (!stack.empty())
+		{
+			const std::uint32_t nodeIndex = stack.back();
+			stack.pop_back();
+			const std::uint32_t first = nodes_[nodeIndex].first;
+			const std::uint32_t count = nodes_[nodeIndex].count;
+
+			float centroidMin[3], centroidMax[3];
+			reset(nodes_[nodeIndex].min, nodes_[nodeIndex].max);
+			reset(centroidMin, centroidMax);
+			for (std::uint32_t i = first; i < first + count; ++i)
+			{
+				const std::uint32_t f = order_[i];
+				grow(nodes_[nodeIndex].min, nodes_[nodeIndex].max, &bounds[f * 6], &bounds[f * 6 + 3]);
+				grow(centroidMin, centroidMax, &centroids[f * 3], &centroids[f * 3]);
+			}
+			if (count <= maxLeafFaces)
+			{
+				continue;
+			}
+
+			// binned SAH
+			int bestAxis = -1;
+			int bestBin = 0;
+			float bestCost = static_cast<float>(count);
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const float extent = centroidMax[axis] - centroidMin[axis];
+				if (!(extent > 0.0f))
+				{
+					continue;
+				}
+				float binMin[binCount][3], binMax[binCount][3];
+				std::uint32_t binFaces[binCount] = {};
+				for (int b = 0; b < binCount; ++b)
+				{
+					reset(binMin[b], binMax[b]);
+				}
+				const float scale = static_cast<float>(binCount) / extent;
+				for (std::uint32_t i = first; i < first + count; ++i)
+				{
+					const std::uint32_t f = order_[i];
+					const int b = std::min(binCount - 1, static_cast<int>((centroids[f * 3 + axis] - centroidMin[axis]) * scale));
+					binFaces[b]++;
+					grow(binMin[b], binMax[b], &bounds[f * 6], &bounds[f * 6 + 3]);
+				}
+				// cost of splitting after bin b
+				float rightArea[binCount];
+				std::uint32_t rightFaces[binCount];
+				{
+					float accumulatedMin[3], accumulatedMax[3];
+					reset(accumulatedMin, accumulatedMax);
+					std::uint32_t accumulatedFaces = 0;
+					for (int b = binCount - 1; b > 0; --b)
+					{
+						grow(accumulatedMin, accumulatedMax, binMin[b], binMax[b]);
+						accumulatedFaces += binFaces[b];
+						rightArea[b] = (accumulatedFaces > 0) ? surfaceArea(accumulatedMin, accumulatedMax) : 0.0f;
+						rightFaces[b] = accumulatedFaces;
+					}
+				}
+				{
+					const float parentArea = surfaceArea(nodes_[nodeIndex].min, nodes_[nodeIndex].max);
+					float accumulatedMin[3], accumulatedMax[3];
+					reset(accumulatedMin, accumulatedMax);
+					std::uint32_t accumulatedFaces = 0;
+					for (int b = 0; b < binCount - 1; ++b)
+					{
+						grow(accumulatedMin, accumulatedMax, binMin[b], binMax[b]);
+						accumulatedFaces += binFaces[b];
+						if (accumulatedFaces == 0 || rightFaces[b + 1] == 0)
+						{
+							continue;
+						}
+						const float leftArea = surfaceArea(accumulatedMin, accumulatedMax);
+						const float cost = traversalCost + (leftArea * accumulatedFaces + rightArea[b + 1] * rightFaces[b + 1]) / std::max(parentArea, std::numeric_limits<float>::min());
+						if (cost < bestCost)
+						{
+							bestCost = cost;
+							bestAxis = axis;
+							bestBin = b;
+						}
+					}
+				}
+			}
+
+			std::uint32_t middle;
+			if (bestAxis >= 0)
+			{
+				const float scale = static_cast<float>(binCount) / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+				const auto it = std::partition(
+					order_.begin() + first,
+					order_.begin() + first + count,
+					[&](const std::uint32_t f)
+					{ return std::min(binCount - 1, static_cast<int>((centroids[f * 3 + bestAxis] - centroidMin[bestAxis]) * scale)) <= bestBin; });
+				middle = static_cast<std::uint32_t>(it - order_.begin());
+			}
+			else
+			{
+				// splitting doesn't pay off (or all centroids coincide)
+				continue;
+			}
+
+			const std::uint32_t left = static_cast<std::uint32_t>(nodes_.size());
+			nodes_.push_back(Node{{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, first, middle - first});
+			nodes_.push_back(Node{{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, middle, first + count - middle});
+			nodes_[nodeIndex].first = left;
+			nodes_[nodeIndex].count = 0;
+			stack.push_back(left);
+			stack.push_back(left + 1);
+		}
+	}
+
+	void MeshBVH::refit(const AlignedMatrix<float> &V)
+	{
+		stale_ = false;
+		// children are always stored after their parent
+		for (std::size_t n = nodes_.size(); n-- > 0;)
+		{
+			Node &node = nodes_[n];
+			reset(node.min, node.max);
+			if (node.count > 0)
+			{
+				for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					float min[3], max[3];
+					faceBounds(V, order_[i], min, max);
+					grow(node.min, node.max, min, max);
+				}
+			}
+			else
+			{
+				grow(node.min, node.max, nodes_[node.first].min, nodes_[node.first].max);
+				grow(node.min, node.max, nodes_[node.first + 1].min, nodes_[node.first + 1].max);
+			}
+		}
+	}
+
+	bool MeshBVH::raycast(const AlignedMatrix<float> &V, const float origin[3], const float direction[3], const float maxT, RayHit &hit) const
+	{
+		if (nodes_.empty())
+		{
+			return false;
+		}
+		const Vector o(origin[0], origin[1], origin[2]);
+		const Vector d(direction[0], direction[1], direction[2]);
+		const Vector invD(1.0f / d[0], 1.0f / d[1], 1.0f / d[2]);
+		const auto vertex = [&V, this](const std::uint32_t face, const int k)
+		{
+			const std::int32_t v = F_->col(k)[face];
+			return Vector(V.col(0)[v], V.col(1)[v], V.col(2)[v]);
+		};
+
+		bool found = false;
+		hit.t = maxT;
+		std::vector<std::uint32_t> stack;
+		stack.reserve(64);
+		stack.push_back(0);
+		while (!stack.empty())
+		{
+			const Node &node = nodes_[stack.back()];
+			stack.pop_back();
+			if (rayBox(node.min, node.max, o, invD, hit.t) == std::numeric_limits<float>::infinity())
+			{
+				continue;
+			}
+			if (node.count > 0)
+			{
+				for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					float t, u, v;
+					if (rayTriangle(o, d, vertex(order_[i], 0), vertex(order_[i], 1), vertex(order_[i], 2), t, u, v) && t >= 0.0f && t <= hit.t)
+					{
+						found = true;
+						hit.t = t;
+						hit.face = order_[i];
+						hit.u = u;
+						hit.v = v;
+					}
+				}
+			}
+			else
+			{
+				// nearer child first
+				const float tLeft = rayBox(nodes_[node.first].min, nodes_[node.first].max, o, invD, hit.t);
+				const float tRight = rayBox(nodes_[node.first + 1].min, nodes_[node.first + 1].max, o, invD, hit.t);
+				if (tLeft <= tRight)
+				{
+					stack.push_back(node.first + 1);
+					stack.push_back(node.first);
+				}
+				else
+				{
+					stack.push_back(node.first);
+					stack.push_back(node.first + 1);
+				}
+			}
+		}
+		return found;
+	}
+
+	bool MeshBVH::closestPoint(const AlignedMatrix<float> &V, const float point[3], const float maxDistance, ClosestPoint &result) const
+	{
+		if (nodes_.empty())
+		{
+			return false;
+		}
+		const Vector p(point[0], point[1], point[2]);
+		const auto vertex = [&V, this](const std::uint32_t face, const int k)
+		{
+			const std::int32_t v = F_->col(k)[face];
+			return Vector(V.col(0)[v], V.col(1)[v], V.col(2)[v]);
+		};
+
+		bool found = false;
+		float best2 = (maxDistance == std::numeric_limits<float>::infinity()) ? maxDistance : maxDistance * maxDistance;
+		std::vector<std::uint32_t> stack;
+		stack.reserve(64);
+		stack.push_back(0);
+		while (!stack.empty())
+		{
+			const Node &node = nodes_[stack.back()];
+			stack.pop_back();
+			if (boxDistance2(node.min, node.max, p) > best2)
+			{
+				continue;
+			}
+			if (node.count > 0)
+			{
+				for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					const Vector q = closestOnTriangle(p, vertex(order_[i], 0), vertex(order_[i], 1), vertex(order_[i], 2));
+					const float distance2 = (q - p).squaredNorm();
+					if (distance2 <= best2)
+					{
+						found = true;
+						best2 = distance2;
+						result.point[0] = q[0];
+						result.point[1] = q[1];
+						result.point[2] = q[2];
+						result.face = order_[i];
+					}
+				}
+			}
+			else
+			{
+				// nearer child first
+				const float dLeft = boxDistance2(nodes_[node.first].min, nodes_[node.first].max, p);
+				const float dRight = boxDistance2(nodes_[node.first + 1].min, nodes_[node.first + 1].max, p);
+				if (dLeft <= dRight)
+				{
+					stack.push_back(node.first + 1);
+					stack.push_back(node.first);
+				}
+				else
+				{
+					stack.push_back(node.first);
+					stack.push_back(node.first + 1);
+				}
+			}
+		}
+		if (found)
+		{
+			result.distance = std::sqrt(best2);
+		}
+		return found;
+	}
+
+	void MeshBVH::overlap(const AlignedMatrix<float> &V, const float boxMin[3], const float boxMax[3], std::vector<std::uint32_t> &faces) const
+	{
+		const auto overlaps = [boxMin, boxMax](const float min[3], const float max[3])
+		{
+			return min[0] <= boxMax[0] && max[0] >= boxMin[0] &&
+				   min[1] <= boxMax[1] && max[1] >= boxMin[1] &&
+				   min[2] <= boxMax[2] && max[2] >= boxMin[2];
+		};
+		if (nodes_.empty())
+		{
+			return;
+		}
+		std::vector<std::uint32_t> stack;
+		stack.reserve(64);
+		stack.push_back(0);
+		while (!stack.empty())
+		{
+			const Node &node = nodes_[stack.back()];
+			stack.pop_back();
+			if (!overlaps(node.min, node.max))
+			{
+				continue;
+			}
+			if (node.count > 0)
+			{
+				for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					float min[3], max[3];
+					faceBounds(V, order_[i], min, max);
+					if (overlaps(min, max))
+					{
+						faces.push_back(order_[i]);
+					}
+				}
+			}
+			else
+			{
+				stack.push_back(node.first);
+				stack.push_back(node.first + 1);
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,464 @@
+#ifndef MESHENCODER_CPP
+#define MESHENCODER_CPP
+
+#include "Doppelganger/MeshEncoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include <zlib.h>
+
+namespace
+{
+	const char meshMagic[8] = {'D', 'G', 'M', 'E', 'S', 'H', '0', '1'};
+
+	////
+	// vertex cache optimization (Tom Forsyth, "Linear-Speed Vertex Cache Optimisation")
+	////
+	const int cacheSize = 32;
+
+	float vertexScore(const int cachePosition, const std::uint32_t liveTriangles)
+	{
+		if (liveTriangles == 0)
+		{
+			// no triangle needs this vertex
+			return -1.0f;
+		}
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+			{
+				// used by the last triangle. we don't prefer to use it again immediately
+				score = 0.75f;
+			}
+			else
+			{
+				score = std::pow(1.0f - static_cast<float>(cachePosition - 3) / static_cast<float>(cacheSize - 3), 1.5f);
+			}
+		}
+		// boost vertices with few remaining triangles
+		score += 2.0f / std::sqrt(static_cast<float>(liveTriangles));
+		return score;
+	}
+
+	// returns order of triangles
+	std::vector<std::uint32_t> optimizeVertexCache(const std::vector<std::uint32_t> &indices, const std::uint32_t vertexCount)
+	{
+		const std::uint32_t faceCount = static_cast<std::uint32_t>(indices.size() / 3);
+		std::vector<std::uint32_t> order;
+		order.reserve(faceCount);
+
+		// triangles of each vertex (CSR). [triangleBegin[v], triangleBegin[v] + liveTriangles[v]) are not added yet
+		std::vector<std::uint32_t> liveTriangles(vertexCount, 0);
+		for (const std::uint32_t v : indices)
+		{
+			liveTriangles[v]++;
+		}
+		std::vector<std::uint32_t> triangleBegin(vertexCount + 1, 0);
+		for (std::uint32_t v = 0; v < vertexCount; ++v)
+		{
+			triangleBegin[v + 1] = triangleBegin[v] + liveTriangles[v];
+		}
+		std::vector<std::uint32_t> vertexTriangles(indices.size());
+		{
+			std::vector<std::uint32_t> filled(vertexCount, 0);
+			for (std::uint32_t f = 0; f < faceCount; ++f)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					const std::uint32_t v = indices[f * 3 + c];
+					vertexTriangles[triangleBegin[v] + filled[v]++] = f;
+				}
+			}
+		}
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> score(vertexCount);
+		for (std::uint32_t v = 0; v < vertexCount; ++v)
+		{
+			score[v] = vertexScore(-1, liveTriangles[v]);
+		}
+		std::vector<float> triangleScore(faceCount);
+		std::vector<bool> added(faceCount, false);
+		std::uint32_t best = 0;
+		for (std::uint32_t f = 0; f < faceCount; ++f)
+		{
+			triangleScore[f] = score[indices[f * 3]] + score[indices[f * 3 + 1]] + score[indices[f * 3 + 2]];
+			if (triangleScore[f] > triangleScore[best])
+			{
+				best = f;
+			}
+		}
+
+		std::vector<std::uint32_t> cache, newCache;
+		cache.reserve(cacheSize + 3);
+		newCache.reserve(cacheSize + 3);
+		std::uint32_t cursor = 0;
+		const std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+		while (order.size() < faceCount)
+		{
+			if (best == none)
+			{
+				// no candidate in the cache. we take the next triangle
+				while (added[cursor])
+				{
+					++cursor;
+				}
+				best = cursor;
+			}
+
+			added[best] = true;
+			order.push_back(best);
+
+			// update cache (vertices of best first)
+			newCache.clear();
+			for (int c = 0; c < 3; ++c)
+			{
+				const std::uint32_t v = indices[best * 3 + c];
+				newCache.push_back(v);
+				// remove best from live triangles of v
+				std::uint32_t *begin = &vertexTriangles[triangleBegin[v]];
+				std::uint32_t *end = begin + liveTriangles[v];
+				std::uint32_t *it = std::find(begin, end, best);
+				if (it != end)
+				{
+					std::swap(*it, *(end - 1));
+					liveTriangles[v]--;
+				}
+			}
+			for (const std::uint32_t v : cache)
+			{
+				if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+				{
+					newCache.push_back(v);
+				}
+			}
+			cache.swap(newCache);
+
+			// update scores of vertices in (or pushed out of) the cache
+			best = none;
+			float bestScore = -std::numeric_limits<float>::max();
+			for (std::size_t i = 0; i < cache.size(); ++i)
+			{
+				const std::uint32_t v = cache[i];
+				cachePosition[v] = (i < static_cast<std::size_t>(cacheSize)) ? static_cast<int>(i) : -1;
+				const float newScore = vertexScore(cachePosition[v], liveTriangles[v]);
+				const float delta = newScore - score[v];
+				score[v] = newScore;
+				for (std::uint32_t t = 0; t < liveTriangles[v]; ++t)
+				{
+					const std::uint32_t f = vertexTriangles[triangleBegin[v] + t];
+					triangleScore[f] += delta;
+					if (triangleScore[f] > bestScore)
+					{
+						bestScore = triangleScore[f];
+						best = f;
+					}
+				}
+			}
+			if (cache.size() > static_cast<std::size_t>(cacheSize))
+			{
+				cache.resize(cacheSize);
+			}
+		}
+		return order;
+	}
+
+	////
+	// varint / zigzag
+	////
+	void putVarint(std::string &out, std::uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	std::uint32_t zigzag(const std::int32_t value)
+	{
+		return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+	}
+
+	template <typename T>
+	void putLE(std::string &out, const T value)
+	{
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		// all supported platforms are little endian
+		out.append(bytes, sizeof(T));
+	}
+}
+
+namespace Doppelganger
+{
+	MeshEncoder::MeshEncoder()
+		: cacheLimit_(64 * 1024 * 1024), cachedBytes_(0)
+	{
+	}
+
+	std::shared_ptr<const std::string> MeshEncoder::encoded(const std::string &meshUUID, const std::uint64_t version, bool &start)
+	{
+		const std::string key = meshUUID + "/" + std::to_string(version);
+		std::lock_guard<std::mutex> lock(mutex_);
+		start = false;
+		const auto it = cache_.find(key);
+		if (it != cache_.end())
+		{
+			lru_.splice(lru_.begin(), lru_, it->second.lru);
+			if (it->second.pending)
+			{
+				// encoded by other request
+				return nullptr;
+			}
+			return it->second.encoded.get();
+		}
+
+		lru_.push_front(key);
+		Entry &entry = cache_[key];
+		entry.pending = std::make_shared<std::promise<std::shared_ptr<const std::string>>>();
+		entry.encoded = entry.pending->get_future().share();
+		entry.bytes = 0;
+		entry.lru = lru_.begin();
+		start = true;
+		return nullptr;
+	}
+
+	std::shared_ptr<const std::string> MeshEncoder::encode(const std::string &meshUUID, const std::uint64_t version, const MeshStore::Mesh &mesh)
+	{
+		const std::string key = meshUUID + "/" + std::to_string(version);
+		std::shared_ptr<const std::string> blob;
+		try
+		{
+			blob = std::make_shared<const std::string>(encode(mesh));
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			const auto it = cache_.find(key);
+			if (it != cache_.end() && it->second.pending)
+			{
+				lru_.erase(it->second.lru);
+				cache_.erase(it);
+			}
+			throw;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto it = cache_.find(key);
+		if (it != cache_.end() && it->second.pending)
+		{
+			it->second.pending->set_value(blob);
+			it->second.pending.reset();
+			it->second.bytes = blob->size();
+			cachedBytes_ += blob->size();
+			evict();
+		}
+		return blob;
+	}
+
+	void MeshEncoder::store(const std::string &meshUUID, const std::uint64_t version, const std::uint32_t level, const std::shared_ptr<const std::string> &blob)
+	{
+		const std::string key = meshUUID + "/" + std::to_string(version) + "/" + std::to_string(level);
+		std::promise<std::shared_ptr<const std::string>> promise;
+		promise.set_value(blob);
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto it = cache_.find(key);
+		if (it != cache_.end())
+		{
+			cachedBytes_ -= it->second.bytes;
+			lru_.erase(it->second.lru);
+			cache_.erase(it);
+		}
+		lru_.push_front(key);
+		Entry &entry = cache_[key];
+		entry.encoded = promise.get_future().share();
+		entry.bytes = blob->size();
+		entry.lru = lru_.begin();
+		cachedBytes_ += blob->size();
+		evict();
+	}
+
+	std::shared_ptr<const std::string> MeshEncoder::lookup(const std::string &meshUUID, const std::uint64_t version, const std::uint32_t level)
+	{
+		const std::string key = meshUUID + "/" + std::to_string(version) + "/" + std::to_string(level);
+		std::lock_guard<std::mutex> lock(mutex_);
+		const auto it = cache_.find(key);
+		if (it == cache_.end())
+		{
+			return nullptr;
+		}
+		lru_.splice(lru_.begin(), lru_, it->second.lru);
+		return it->second.encoded.get();
+	}
+
+	void MeshEncoder::setCacheLimit(const std::size_t cacheLimit)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		cacheLimit_ = cacheLimit;
+		evict();
+	}
+
+	std::size_t MeshEncoder::memoryUsage() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return cachedBytes_;
+	}
+
+	void MeshEncoder::evict()
+	{
+		// least recently used first. entries being encoded are kept
+		auto it = lru_.end();
+		while (cachedBytes_ > cacheLimit_ && it != lru_.begin())
+		{
+			--it;
+			Entry &entry = cache_.at(*it);
+			if (entry.pending)
+			{
+				continue;
+			}
+			cachedBytes_ -= entry.bytes;
+			cache_.erase(*it);
+			it = lru_.erase(it);
+		}
+	}
+
+	std::string MeshEncoder::encode(const MeshStore::Mesh &mesh)
+	{
+		const std::uint32_t vertexCount = mesh.V ? static_cast<std::uint32_t>(mesh.V->rows()) : 0;
+		const std::uint32_t faceCount = mesh.F ? static_cast<std::uint32_t>(mesh.F->rows()) : 0;
+		const bool hasNormals = (mesh.V && mesh.VN && mesh.VN->rows() == mesh.V->rows() && mesh.VN->cols() == 3);
+
+		// indices (interleaved)
+		std::vector<std::uint32_t> indices(static_cast<std::size_t>(faceCount) * 3);
+		for (int c = 0; c < 3 && faceCount > 0; ++c)
+		{
+			const std::int32_t *column = mesh.F->col(c);
+			for (std::uint32_t f = 0; f < faceCount; ++f)
+			{
+				if (column[f] < 0 || static_cast<std::uint32_t>(column[f]) >= vertexCount)
+				{
+					throw std::runtime_error("invalid vertex index");
+				}
+				indices[f * 3 + c] = static_cast<std::uint32_t>(column[f]);
+			}
+		}
+
+		// reorder triangles, then vertices by first use
+		const std::vector<std::uint32_t> order = optimizeVertexCache(indices, vertexCount);
+		const std::uint32_t unused = std::numeric_limits<std::uint32_t>::max();
+		std::vector<std::uint32_t> remap(vertexCount, unused);
+		std::vector<std::uint32_t> vertexOrder;
+		vertexOrder.reserve(vertexCount);
+		for (const std::uint32_t f : order)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				const std::uint32_t v = indices[f * 3 + c];
+				if (remap[v] == unused)
+				{
+					remap[v] = static_cast<std::uint32_t>(vertexOrder.size());
+					vertexOrder.push_back(v);
+				}
+			}
+		}
+		for (std::uint32_t v = 0; v < vertexCount; ++v)
+		{
+			if (remap[v] == unused)
+			{
+				remap[v] = static_cast<std::uint32_t>(vertexOrder.size());
+				vertexOrder.push_back(v);
+			}
+		}
+
+		// bounds
+		float bbMin[3] = {0.0f, 0.0f, 0.0f};
+		float bbMax[3] = {0.0f, 0.0f, 0.0f};
+		for (int c = 0; c < 3 && vertexCount > 0; ++c)
+		{
+			const float *column = mesh.V->col(c);
+			bbMin[c] = *std::min_element(column, column + vertexCount);
+			bbMax[c] = *std::max_element(column, column + vertexCount);
+		}
+
+		std::string payload;
+		payload.reserve(static_cast<std::size_t>(vertexCount) * (hasNormals ? 9 : 6) + indices.size() * 2);
+		// positions
+		{
+			std::int32_t previous[3] = {0, 0, 0};
+			for (const std::uint32_t v : vertexOrder)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					const float extent = bbMax[c] - bbMin[c];
+					const float normalized = (extent > 0.0f) ? (mesh.V->col(c)[v] - bbMin[c]) / extent : 0.0f;
+					const std::int32_t quantized = static_cast<std::int32_t>(std::lround(std::min(std::max(normalized, 0.0f), 1.0f) * 65535.0f));
+					putVarint(payload, zigzag(quantized - previous[c]));
+					previous[c] = quantized;
+				}
+			}
+		}
+		// normals
+		if (hasNormals)
+		{
+			for (const std::uint32_t v : vertexOrder)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					const float n = std::min(std::max(mesh.VN->col(c)[v], -1.0f), 1.0f);
+					payload.push_back(static_cast<char>(static_cast<std::int8_t>(std::lround(n * 127.0f))));
+				}
+			}
+		}
+		// indices
+		{
+			std::uint32_t next = 0;
+			for (const std::uint32_t f : order)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					const std::uint32_t index = remap[indices[f * 3 + c]];
+					putVarint(payload, next - index);
+					if (index == next)
+					{
+						++next;
+					}
+				}
+			}
+		}
+
+		// entropy coding
+		uLongf compressedSize = compressBound(static_cast<uLong>(payload.size()));
+		std::string compressed(compressedSize, '\0');
+		if (compress2(reinterpret_cast<Bytef *>(&compressed[0]), &compressedSize, reinterpret_cast<const Bytef *>(payload.data()), static_cast<uLong>(payload.size()), Z_DEFAULT_COMPRESSION) != Z_OK)
+		{
+			throw std::runtime_error("compression failed");
+		}
+		compressed.resize(compressedSize);
+
+		std::string blob(meshMagic, sizeof(meshMagic));
+		putLE(blob, vertexCount);
+		putLE(blob, faceCount);
+		putLE(blob, static_cast<std::uint32_t>(hasNormals ? 1 : 0));
+		for (int c = 0; c < 3; ++c)
+		{
+			putLE(blob, bbMin[c]);
+		}
+		for (int c = 0; c < 3; ++c)
+		{
+			putLE(blob, bbMax[c]);
+		}
+		putLE(blob, static_cast<std::uint32_t>(payload.size()));
+		putLE(blob, static_cast<std::uint32_t>(compressed.size()));
+		blob += compressed;
+		return blob;
+	}
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef MESHLOD_CPP
+#define MESHLOD_CPP
+
+#include "Doppelganger/MeshLOD.h"
+
+#include <algorithm>
+
+#include <igl/qslim.h>
+#include <igl/per_vertex_normals.h>
+
+#include "Doppelganger/Room.h"
+#include "Doppelganger/MeshEncoder.h"
+#include "Doppelganger/Tracing.h"
+
+namespace
+{
+	// #faces of a level = #faces of the next finer level / levelRatio
+	const Eigen::Index levelRatio = 4;
+	const std::size_t maxLevels = 3;
+	// we don't compute levels coarser than this
+	const Eigen::Index minLevelFaces = 4096;
+}
+
+namespace Doppelganger
+{
+	MeshLOD &MeshLOD::getInstance()
+	{
+		static MeshLOD meshLOD;
+		return meshLOD;
+	}
+
+	MeshLOD::MeshLOD()
+		: running_(false)
+	{
+	}
+
+	MeshLOD::~MeshLOD()
+	{
+		stop();
+	}
+
+	void MeshLOD::submit(const std::shared_ptr<Room> &room, const std::string &meshUUID, const std::uint64_t version, const MeshStore::Mesh &mesh, const double transferBudget)
+	{
+		std::lock_guard<std::mutex> lock(mutexJobs_);
+		startWorkers();
+
+		Job job;
+		job.room = room;
+		job.meshUUID = meshUUID;
+		job.version = version;
+		job.mesh = mesh;
+		job.transferBudget = transferBudget;
+		// the older version is no longer interesting
+		for (Job &queued : jobs_)
+		{
+			if (!queued.task && queued.room == room && queued.meshUUID == meshUUID)
+			{
+				queued = std::move(job);
+				return;
+			}
+		}
+		jobs_.push_back(std::move(job));
+		wake_.notify_one();
+	}
+
+	void MeshLOD::post(std::function<void()> &&task)
+	{
+		std::lock_guard<std::mutex> lock(mutexJobs_);
+		startWorkers();
+
+		Job job;
+		job.task = std::move(task);
+		jobs_.push_back(std::move(job));
+		wake_.notify_one();
+	}
+
+	void MeshLOD::startWorkers()
+	{
+		bool expected = false;
+		if (running_.compare_exchange_strong(expected, true))
+		{
+			// workers are started on the first job
+			const unsigned int workerCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+			for (unsigned int w = 0; w < workerCount; ++w)
+			{
+				workers_.emplace_back(&MeshLOD::workerLoop, this);
+			}
+		}
+	}
+
+	void MeshLOD::stop()
+	{
+		std::deque<Job> discarded;
+		{
+			std::lock_guard<std::mutex> lock(mutexJobs_);
+			bool expected = true;
+			if (!running_.compare_exchange_strong(expected, false))
+			{
+				return;
+			}
+			discarded.swap(jobs_);
+		}
+		wake_.notify_all();
+		for (std::thread &worker : workers_)
+		{
+			worker.join();
+		}
+		workers_.clear();
+	}
+
+	void MeshLOD::workerLoop()
+	{
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutexJobs_);
+				wake_.wait(
+					lock,
+					[this]()
+					{ return !running_.load() || !jobs_.empty(); });
+				if (!running_.load())
+				{
+					return;
+				}
+				job = std::move(jobs_.front());
+				jobs_.pop_front();
+			}
+			try
+			{
+				if (job.task)
+				{
+					job.task();
+				}
+				else
+				{
+					process(job);
+				}
+			}
+			catch (...)
+			{
+				// e.g. std::bad_alloc. clients still have the original mesh
+			}
+		}
+	}
+
+	void MeshLOD::process(Job &job)
+	{
+		DOPPELGANGER_TRACE_SPAN("MeshLOD::process");
+		// buffers written through DoppelgangerHostAPI are not validated (qslim and per_vertex_normals never check indices)
+		if (!job.mesh.V || !job.mesh.F || job.mesh.V->cols() != 3 || job.mesh.F->cols() != 3 || !MeshStore::hasValidFaces(job.mesh))
+		{
+			return;
+		}
+		Eigen::MatrixXd V = job.mesh.V->map().cast<double>();
+		Eigen::MatrixXi F = job.mesh.F->map().cast<int>();
+		const bool withNormals = static_cast<bool>(job.mesh.VN);
+		// buffers are no longer needed
+		job.mesh = MeshStore::Mesh();
+
+		// from fine to coarse (each level is decimated from the finer one)
+		std::vector<std::shared_ptr<const std::string>> blobs;
+		std::vector<Level> levels;
+		Eigen::Index targetFaces = F.rows() / levelRatio;
+		while (blobs.size() < maxLevels && targetFaces >= minLevelFaces)
+		{
+			Eigen::MatrixXd U;
+			Eigen::MatrixXi G;
+			Eigen::VectorXi J, I;
+			// fails for non edge-manifold meshes
+			if (!igl::qslim(V, F, static_cast<std::size_t>(targetFaces), U, G, J, I) || G.rows() == 0)
+			{
+				break;
+			}
+
+			MeshStore::Mesh level;
+			level.V = std::make_shared<AlignedMatrix<float>>();
+			level.V->assign(U);
+			if (withNormals)
+			{
+				Eigen::MatrixXd N;
+				igl::per_vertex_normals(U, G, N);
+				level.VN = std::make_shared<AlignedMatrix<float>>();
+				level.VN->assign(N);
+			}
+			level.F = std::make_shared<AlignedMatrix<std::int32_t>>();
+			level.F->assign(G);
+
+			blobs.push_back(std::make_shared<const std::string>(MeshEncoder::encode(level)));
+			levels.push_back(Level{static_cast<std::uint32_t>(G.rows()), blobs.back()->size()});
+			V.swap(U);
+			F.swap(G);
+			targetFaces /= levelRatio;
+		}
+		if (blobs.empty())
+		{
+			return;
+		}
+
+		// level 0 is the coarsest
+		std::reverse(blobs.begin(), blobs.end());
+		std::reverse(levels.begin(), levels.end());
+		for (std::size_t l = 0; l < blobs.size(); ++l)
+		{
+			job.room->meshEncoder_.store(job.meshUUID, job.version, static_cast<std::uint32_t>(l), blobs.at(l));
+		}
+		job.room->announceMeshLevels(job.meshUUID, job.version, levels, job.transferBudget);
+	}
+}
+
+#endif
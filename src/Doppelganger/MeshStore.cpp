@@ -0,0 +1,990 @@
+#ifndef MESHSTORE_CPP
+#define MESHSTORE_CPP
+
+#include "Doppelganger/MeshStore.h"
+#include "Doppelganger/MeshBVH.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace
+{
+	const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	std::string encodeBase64(const std::string &bytes)
+	{
+		std::string encoded;
+		encoded.reserve(((bytes.size() + 2) / 3) * 4);
+		std::size_t i = 0;
+		for (; i + 2 < bytes.size(); i += 3)
+		{
+			const std::uint32_t v = (static_cast<std::uint8_t>(bytes[i]) << 16) | (static_cast<std::uint8_t>(bytes[i + 1]) << 8) | static_cast<std::uint8_t>(bytes[i + 2]);
+			encoded.push_back(base64Chars[(v >> 18) & 0x3f]);
+			encoded.push_back(base64Chars[(v >> 12) & 0x3f]);
+			encoded.push_back(base64Chars[(v >> 6) & 0x3f]);
+			encoded.push_back(base64Chars[v & 0x3f]);
+		}
+		if (i < bytes.size())
+		{
+			std::uint32_t v = (static_cast<std::uint8_t>(bytes[i]) << 16);
+			if (i + 1 < bytes.size())
+			{
+				v |= (static_cast<std::uint8_t>(bytes[i + 1]) << 8);
+			}
+			encoded.push_back(base64Chars[(v >> 18) & 0x3f]);
+			encoded.push_back(base64Chars[(v >> 12) & 0x3f]);
+			encoded.push_back((i + 1 < bytes.size()) ? base64Chars[(v >> 6) & 0x3f] : '=');
+			encoded.push_back('=');
+		}
+		return encoded;
+	}
+
+	bool decodeBase64(const std::string &encoded, std::string &bytes)
+	{
+		static const std::vector<int> table = []()
+		{
+			std::vector<int> t(256, -1);
+			for (int c = 0; c < 64; ++c)
+			{
+				t[static_cast<unsigned char>(base64Chars[c])] = c;
+			}
+			return t;
+		}();
+
+		bytes.clear();
+		bytes.reserve((encoded.size() / 4) * 3);
+		std::uint32_t v = 0;
+		int bits = 0;
+		for (const char ch : encoded)
+		{
+			if (ch == '=')
+			{
+				break;
+			}
+			const int c = table[static_cast<unsigned char>(ch)];
+			if (c < 0)
+			{
+				return false;
+			}
+			v = (v << 6) | static_cast<std::uint32_t>(c);
+			bits += 6;
+			if (bits >= 8)
+			{
+				bits -= 8;
+				bytes.push_back(static_cast<char>((v >> bits) & 0xff));
+			}
+		}
+		return true;
+	}
+
+	// interleaved (row-major) triplets <-> structure-of-arrays
+	//   we don't convert byte order (all supported platforms are little endian)
+	//   block is replaced only if bytes are valid
+	template <typename Scalar>
+	bool unpackAttribute(const std::uint8_t *bytes, const std::size_t size, Doppelganger::MeshArena *arena, std::shared_ptr<Doppelganger::AlignedMatrix<Scalar>> &block)
+	{
+		if (size % (3 * sizeof(Scalar)) != 0)
+		{
+			return false;
+		}
+		const Eigen::Index rows = static_cast<Eigen::Index>(size / (3 * sizeof(Scalar)));
+		std::shared_ptr<Doppelganger::AlignedMatrix<Scalar>> matrix = std::make_shared<Doppelganger::AlignedMatrix<Scalar>>(arena);
+		matrix->resize(rows, 3);
+		for (Eigen::Index c = 0; c < 3; ++c)
+		{
+			Scalar *column = matrix->col(c);
+			for (Eigen::Index r = 0; r < rows; ++r)
+			{
+				std::memcpy(&column[r], &bytes[(r * 3 + c) * sizeof(Scalar)], sizeof(Scalar));
+			}
+		}
+		block = std::move(matrix);
+		return true;
+	}
+
+	template <typename Bytes, typename Scalar>
+	Bytes packAttribute(const Doppelganger::AlignedMatrix<Scalar> &matrix)
+	{
+		Bytes bytes(static_cast<std::size_t>(matrix.rows() * matrix.cols()) * sizeof(Scalar), 0);
+		for (Eigen::Index c = 0; c < matrix.cols(); ++c)
+		{
+			const Scalar *column = matrix.col(c);
+			for (Eigen::Index r = 0; r < matrix.rows(); ++r)
+			{
+				std::memcpy(&bytes[(r * matrix.cols() + c) * sizeof(Scalar)], &column[r], sizeof(Scalar));
+			}
+		}
+		return bytes;
+	}
+
+	// base64 string (e.g. from clients) or binary (e.g. from CBOR written by RoomStore)
+	template <typename Scalar>
+	bool decodeAttribute(const Doppelganger::json &encoded, Doppelganger::MeshArena *arena, std::shared_ptr<Doppelganger::AlignedMatrix<Scalar>> &block)
+	{
+		if (encoded.is_binary())
+		{
+			const Doppelganger::json::binary_t &bytes = encoded.get_binary();
+			return unpackAttribute(bytes.data(), bytes.size(), arena, block);
+		}
+		std::string bytes;
+		if (!encoded.is_string() || !decodeBase64(encoded.get_ref<const std::string &>(), bytes))
+		{
+			return false;
+		}
+		return unpackAttribute(reinterpret_cast<const std::uint8_t *>(bytes.data()), bytes.size(), arena, block);
+	}
+
+	template <typename Scalar>
+	Doppelganger::json encodeAttribute(const Doppelganger::AlignedMatrix<Scalar> &matrix, const bool binary)
+	{
+		if (binary)
+		{
+			return Doppelganger::json::binary(packAttribute<std::vector<std::uint8_t>>(matrix));
+		}
+		return encodeBase64(packAttribute<std::string>(matrix));
+	}
+
+	bool isAttribute(const Doppelganger::json &meshJson, const char *key)
+	{
+		return meshJson.contains(key) && (meshJson.at(key).is_string() || meshJson.at(key).is_binary());
+	}
+
+	// new block with the given columns
+	template <typename Scalar>
+	void copyColumns(const Scalar *const (&columns)[3], const std::uint32_t stride, const std::uint32_t rows, Doppelganger::MeshArena *arena, std::shared_ptr<Doppelganger::AlignedMatrix<Scalar>> &block)
+	{
+		std::shared_ptr<Doppelganger::AlignedMatrix<Scalar>> matrix = std::make_shared<Doppelganger::AlignedMatrix<Scalar>>(arena);
+		matrix->resize(rows, 3);
+		for (Eigen::Index c = 0; c < 3; ++c)
+		{
+			const Scalar *column = (columns[c] != nullptr) ? columns[c] : columns[0] + c * stride;
+			std::memcpy(matrix->col(c), column, rows * sizeof(Scalar));
+		}
+		block = std::move(matrix);
+	}
+
+	// copy on write: block shared with other versions is copied before modification
+	template <typename Scalar>
+	Doppelganger::AlignedMatrix<Scalar> &writable(Doppelganger::MeshArena *arena, std::shared_ptr<Doppelganger::AlignedMatrix<Scalar>> &block)
+	{
+		if (!block)
+		{
+			block = std::make_shared<Doppelganger::AlignedMatrix<Scalar>>(arena);
+		}
+		else if (block.use_count() > 1)
+		{
+			std::shared_ptr<Doppelganger::AlignedMatrix<Scalar>> copied = std::make_shared<Doppelganger::AlignedMatrix<Scalar>>(arena);
+			copied->assign(*block);
+			block = std::move(copied);
+		}
+		return *block;
+	}
+
+	template <typename Scalar>
+	void viewColumns(const std::shared_ptr<Doppelganger::AlignedMatrix<Scalar>> &block, const Scalar *(&columns)[3], std::uint32_t &stride)
+	{
+		for (Eigen::Index c = 0; c < 3; ++c)
+		{
+			columns[c] = (block && block->cols() == 3) ? block->col(c) : nullptr;
+		}
+		stride = block ? static_cast<std::uint32_t>(block->stride()) : 0;
+	}
+
+	template <typename Scalar>
+	void describeBuffer(const std::shared_ptr<const Doppelganger::AlignedMatrix<Scalar>> &block, const DoppelgangerDType dtype, DoppelgangerBufferDescriptor &descriptor)
+	{
+		descriptor.data = (block && block->cols() > 0) ? block->col(0) : nullptr;
+		descriptor.offset = (descriptor.data != nullptr) ? block->arena()->offset(descriptor.data) : Doppelganger::MeshArena::invalidOffset;
+		descriptor.length = block ? block->bytes() : 0;
+		descriptor.dtype = static_cast<std::uint32_t>(dtype);
+		descriptor.shape[0] = block ? static_cast<std::uint32_t>(block->rows()) : 0;
+		descriptor.shape[1] = block ? static_cast<std::uint32_t>(block->cols()) : 0;
+		descriptor.stride = block ? static_cast<std::uint32_t>(block->stride()) : 0;
+	}
+
+	// buffers are mutable through the descriptor (see DoppelgangerHostAPI::mapMesh)
+	template <typename Scalar>
+	void describeWritableBuffer(const std::shared_ptr<Doppelganger::AlignedMatrix<Scalar>> &block, const DoppelgangerDType dtype, DoppelgangerBufferDescriptor &descriptor)
+	{
+		describeBuffer(std::shared_ptr<const Doppelganger::AlignedMatrix<Scalar>>(block), dtype, descriptor);
+		descriptor.writableData = (block && block->cols() > 0) ? block->col(0) : nullptr;
+	}
+}
+
+namespace Doppelganger
+{
+	////
+	// AlignedMatrix
+	////
+	template <typename Scalar>
+	AlignedMatrix<Scalar>::AlignedMatrix(MeshArena *arena)
+		: arena_((arena != nullptr) ? arena : &MeshArena::heap()), rows_(0), cols_(0), stride_(0), data_(nullptr, Free{arena_, 0})
+	{
+	}
+
+	template <typename Scalar>
+	void AlignedMatrix<Scalar>::resize(const Eigen::Index rows, const Eigen::Index cols)
+	{
+		const Eigen::Index perAlignment = static_cast<Eigen::Index>(MeshArena::alignment / sizeof(Scalar));
+		const Eigen::Index stride = ((rows + perAlignment - 1) / perAlignment) * perAlignment;
+		if (stride * cols != stride_ * cols_)
+		{
+			data_.reset();
+			if (stride * cols > 0)
+			{
+				const std::size_t bytes = static_cast<std::size_t>(stride * cols) * sizeof(Scalar);
+				data_ = std::unique_ptr<Scalar, Free>(static_cast<Scalar *>(arena_->allocate(bytes)), Free{arena_, bytes});
+			}
+		}
+		rows_ = rows;
+		cols_ = cols;
+		stride_ = stride;
+	}
+
+	template <typename Scalar>
+	void AlignedMatrix<Scalar>::assign(const AlignedMatrix &other)
+	{
+		resize(other.rows_, other.cols_);
+		if (bytes() > 0)
+		{
+			std::memcpy(data_.get(), other.data_.get(), bytes());
+		}
+	}
+
+	template <typename Scalar>
+	typename AlignedMatrix<Scalar>::Map AlignedMatrix<Scalar>::map()
+	{
+		return Map(data_.get(), rows_, cols_, Eigen::OuterStride<>(stride_));
+	}
+
+	template <typename Scalar>
+	typename AlignedMatrix<Scalar>::ConstMap AlignedMatrix<Scalar>::map() const
+	{
+		return ConstMap(data_.get(), rows_, cols_, Eigen::OuterStride<>(stride_));
+	}
+
+	template <typename Scalar>
+	Scalar *AlignedMatrix<Scalar>::col(const Eigen::Index c)
+	{
+		return data_.get() + c * stride_;
+	}
+
+	template <typename Scalar>
+	const Scalar *AlignedMatrix<Scalar>::col(const Eigen::Index c) const
+	{
+		return data_.get() + c * stride_;
+	}
+
+	template <typename Scalar>
+	void AlignedMatrix<Scalar>::Free::operator()(Scalar *ptr) const
+	{
+		arena->deallocate(ptr, bytes);
+	}
+
+	template class AlignedMatrix<float>;
+	template class AlignedMatrix<std::int32_t>;
+
+	////
+	// MeshStore
+	////
+	MeshStore::MeshStore()
+		: lastVersion_(0), versionLimit_(256), bytes_(0)
+	{
+		hostAPI_.version = DOPPELGANGER_HOST_API_VERSION;
+		hostAPI_.context = this;
+		hostAPI_.getMesh = &MeshStore::getMesh;
+		hostAPI_.setMesh = &MeshStore::setMesh;
+		hostAPI_.getArena = &MeshStore::getArena;
+		hostAPI_.mapMesh = &MeshStore::mapMesh;
+		hostAPI_.resizeMesh = &MeshStore::resizeMesh;
+		hostAPI_.getMeshVersion = &MeshStore::getMeshVersion;
+		hostAPI_.mapAttribute = &MeshStore::mapAttribute;
+		hostAPI_.raycast = &MeshStore::raycast;
+		hostAPI_.closestPoint = &MeshStore::closestPoint;
+		hostAPI_.overlapBox = &MeshStore::overlapBox;
+	}
+
+	void MeshStore::absorb(json &configRoom)
+	{
+		if (!configRoom.contains("meshes") || !configRoom.at("meshes").is_object())
+		{
+			return;
+		}
+		json &meshes = configRoom.at("meshes");
+
+		// removed meshes (versions are kept for undo)
+		for (auto &uuid_record : meshes_)
+		{
+			if (!meshes.contains(uuid_record.first))
+			{
+				uuid_record.second.active = false;
+				modified_.erase(uuid_record.first);
+			}
+		}
+
+		// new meshes with invalid buffers
+		std::vector<std::string> rejected;
+		for (auto &item : meshes.items())
+		{
+			json &meshJson = item.value();
+			if (!meshJson.is_object())
+			{
+				continue;
+			}
+			const bool hasV = isAttribute(meshJson, "V");
+			const bool hasVN = isAttribute(meshJson, "VN");
+			const bool hasF = isAttribute(meshJson, "F");
+			const bool hasVersion = meshJson.contains("version") && meshJson.at("version").is_number_unsigned();
+			const auto it = meshes_.find(item.key());
+
+			if (hasV || hasVN || hasF)
+			{
+				// new version (config (i.e. configRoomPatch) wins over modification through DoppelgangerHostAPI)
+				Record &record = meshes_[item.key()];
+				Mesh mesh;
+				if (record.versions.count(record.current) > 0)
+				{
+					mesh = record.versions.at(record.current);
+				}
+				// buffers we can't decode stay in config
+				if (hasV && decodeAttribute(meshJson.at("V"), &arena_, mesh.V))
+				{
+					meshJson.erase("V");
+				}
+				if (hasVN && decodeAttribute(meshJson.at("VN"), &arena_, mesh.VN))
+				{
+					meshJson.erase("VN");
+				}
+				if (hasF && decodeAttribute(meshJson.at("F"), &arena_, mesh.F))
+				{
+					meshJson.erase("F");
+				}
+				// e.g. F refers to vertices that are not given. the patch is rejected and the current version (if any) stays
+				if (!hasValidFaces(mesh))
+				{
+					if (record.versions.empty())
+					{
+						meshes_.erase(item.key());
+						rejected.push_back(item.key());
+						continue;
+					}
+					meshJson.erase("V");
+					meshJson.erase("VN");
+					meshJson.erase("F");
+					record.active = true;
+					meshJson["version"] = record.current;
+					continue;
+				}
+				// always a new version (even if "version" is given, e.g. by recovery from a snapshot)
+				//   (uuid, version) is immutable for caches (e.g. ETag, MeshEncoder). numbers are never reused, also across recovery
+				if (hasVersion)
+				{
+					lastVersion_ = std::max(lastVersion_, meshJson.at("version").get<std::uint64_t>());
+				}
+				const std::uint64_t version = ++lastVersion_;
+				record.versions[version] = std::move(mesh);
+				record.current = version;
+				created_.emplace_back(item.key(), version);
+				record.active = true;
+				modified_.erase(item.key());
+			}
+			else if (it != meshes_.end())
+			{
+				Record &record = it->second;
+				record.active = true;
+				// check out the version (e.g. undo/redo)
+				if (hasVersion && modified_.count(item.key()) == 0)
+				{
+					const std::uint64_t version = meshJson.at("version").get<std::uint64_t>();
+					if (record.versions.count(version) > 0)
+					{
+						record.current = version;
+					}
+				}
+			}
+			else
+			{
+				continue;
+			}
+			meshJson["version"] = meshes_.at(item.key()).current;
+		}
+		for (const auto &meshUUID : rejected)
+		{
+			meshes.erase(meshUUID);
+		}
+		evict();
+		updateBytes();
+	}
+
+	bool MeshStore::hasValidFaces(const Mesh &mesh)
+	{
+		if (!mesh.F || mesh.F->rows() == 0)
+		{
+			return true;
+		}
+		if (mesh.F->cols() != 3 || !mesh.V || mesh.V->cols() != 3)
+		{
+			return false;
+		}
+		const std::int64_t vertexCount = static_cast<std::int64_t>(mesh.V->rows());
+		for (int c = 0; c < 3; ++c)
+		{
+			const std::int32_t *column = mesh.F->col(c);
+			for (Eigen::Index f = 0; f < mesh.F->rows(); ++f)
+			{
+				if (column[f] < 0 || column[f] >= vertexCount)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool MeshStore::findMissingVersion(const json &configRoomPatch, std::string &meshUUID, std::uint64_t &version) const
+	{
+		if (!configRoomPatch.contains("meshes") || !configRoomPatch.at("meshes").is_object())
+		{
+			return false;
+		}
+		for (const auto &item : configRoomPatch.at("meshes").items())
+		{
+			const json &meshJson = item.value();
+			// buffers in the patch (i.e. a new version) or modification through DoppelgangerHostAPI win over "version" (see absorb())
+			if (!meshJson.is_object() || !meshJson.contains("version") || !meshJson.at("version").is_number_unsigned() ||
+				isAttribute(meshJson, "V") || isAttribute(meshJson, "VN") || isAttribute(meshJson, "F") || modified_.count(item.key()) > 0)
+			{
+				continue;
+			}
+			const auto it = meshes_.find(item.key());
+			if (it == meshes_.end() || it->second.versions.count(meshJson.at("version").get<std::uint64_t>()) == 0)
+			{
+				meshUUID = item.key();
+				version = meshJson.at("version").get<std::uint64_t>();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	MeshStore::Snapshot MeshStore::snapshot() const
+	{
+		Snapshot snapshot;
+		for (const auto &uuid_record : meshes_)
+		{
+			const Mesh *mesh = find(uuid_record.first);
+			if (mesh != nullptr)
+			{
+				snapshot.emplace_back(uuid_record.first, *mesh);
+			}
+		}
+		return snapshot;
+	}
+
+	void MeshStore::materialize(json &meshes) const
+	{
+		materialize(meshes, snapshot());
+	}
+
+	void MeshStore::materialize(json &meshes, const Snapshot &snapshot, const bool binary)
+	{
+		for (const auto &uuid_mesh : snapshot)
+		{
+			if (meshes.contains(uuid_mesh.first) && meshes.at(uuid_mesh.first).is_object())
+			{
+				encode(uuid_mesh.second, meshes.at(uuid_mesh.first), binary);
+			}
+		}
+	}
+
+	bool MeshStore::takeModified(json &configRoom, json &configRoomPatch, Snapshot &modified)
+	{
+		absorb(configRoom);
+		if (modified_.empty())
+		{
+			return false;
+		}
+		configRoomPatch = json::object();
+		configRoomPatch["meshes"] = json::object();
+		modified.clear();
+		for (const std::string &meshUUID : modified_)
+		{
+			const Mesh *mesh = find(meshUUID);
+			if (mesh != nullptr)
+			{
+				configRoomPatch.at("meshes")[meshUUID]["version"] = meshes_.at(meshUUID).current;
+				modified.emplace_back(meshUUID, *mesh);
+			}
+		}
+		modified_.clear();
+		evict();
+		updateBytes();
+		return true;
+	}
+
+	void MeshStore::setVersionLimit(const std::uint64_t versionLimit)
+	{
+		if (versionLimit == versionLimit_)
+		{
+			return;
+		}
+		versionLimit_ = versionLimit;
+		evict();
+		updateBytes();
+	}
+
+	void MeshStore::clear()
+	{
+		meshes_.clear();
+		modified_.clear();
+		created_.clear();
+		bytes_ = 0;
+	}
+
+	std::vector<std::pair<std::string, std::uint64_t>> MeshStore::takeCreated()
+	{
+		std::vector<std::pair<std::string, std::uint64_t>> created;
+		created.swap(created_);
+		return created;
+	}
+
+	const MeshStore::Mesh *MeshStore::find(const std::string &meshUUID) const
+	{
+		const auto it = meshes_.find(meshUUID);
+		if (it == meshes_.end() || !it->second.active)
+		{
+			return nullptr;
+		}
+		const auto version = it->second.versions.find(it->second.current);
+		return (version != it->second.versions.end()) ? &(version->second) : nullptr;
+	}
+
+	const MeshStore::Mesh *MeshStore::find(const std::string &meshUUID, const std::uint64_t version) const
+	{
+		const auto it = meshes_.find(meshUUID);
+		if (it == meshes_.end())
+		{
+			return nullptr;
+		}
+		const auto versionIt = it->second.versions.find(version);
+		return (versionIt != it->second.versions.end()) ? &(versionIt->second) : nullptr;
+	}
+
+	const MeshBVH *MeshStore::bvh(const std::string &meshUUID)
+	{
+		const auto it = meshes_.find(meshUUID);
+		if (it == meshes_.end() || !it->second.active || it->second.versions.count(it->second.current) == 0)
+		{
+			return nullptr;
+		}
+		Record &record = it->second;
+		const Mesh &mesh = record.versions.at(record.current);
+		if (!mesh.V || !mesh.F || mesh.F->rows() == 0)
+		{
+			return nullptr;
+		}
+		const auto sameTopology = [&mesh](const std::shared_ptr<MeshBVH> &bvh)
+		{
+			return bvh && bvh->faces() == mesh.F && bvh->vertexCount() == static_cast<std::uint32_t>(mesh.V->rows());
+		};
+
+		std::shared_ptr<MeshBVH> &index = record.bvhs[record.current];
+		const std::size_t previousBytes = index ? index->bytes() : 0;
+		if (sameTopology(index))
+		{
+			if (index->stale())
+			{
+				index->refit(*mesh.V);
+			}
+			return index.get();
+		}
+		// e.g. deformation (new version sharing faces with an indexed version)
+		std::shared_ptr<MeshBVH> source;
+		for (auto version = record.bvhs.rbegin(); version != record.bvhs.rend(); ++version)
+		{
+			if (sameTopology(version->second))
+			{
+				source = version->second;
+				break;
+			}
+		}
+		if (source)
+		{
+			index = std::make_shared<MeshBVH>(*source);
+			index->refit(*mesh.V);
+		}
+		else
+		{
+			index = std::make_shared<MeshBVH>(mesh.F);
+			index->build(*mesh.V);
+		}
+		bytes_ = bytes_ - previousBytes + index->bytes();
+		return index.get();
+	}
+
+	MeshStore::Mesh &MeshStore::modify(const std::string &meshUUID)
+	{
+		Record &record = meshes_[meshUUID];
+		record.active = true;
+		if (modified_.count(meshUUID) == 0 || record.versions.count(record.current) == 0)
+		{
+			// blocks are shared with the previous version until they are written
+			Mesh mesh;
+			if (record.versions.count(record.current) > 0)
+			{
+				mesh = record.versions.at(record.current);
+			}
+			record.current = ++lastVersion_;
+			record.versions[record.current] = std::move(mesh);
+			modified_.insert(meshUUID);
+			created_.emplace_back(meshUUID, record.current);
+		}
+		// buffers may be written in place after this call
+		const auto index = record.bvhs.find(record.current);
+		if (index != record.bvhs.end() && index->second)
+		{
+			index->second->markStale();
+		}
+		return record.versions.at(record.current);
+	}
+
+	int MeshStore::getMesh(void *context, const char *meshUUID, DoppelgangerMeshView *view)
+	{
+		const MeshStore *store = static_cast<const MeshStore *>(context);
+		if (store == nullptr || meshUUID == nullptr || view == nullptr)
+		{
+			return -1;
+		}
+		const Mesh *mesh = store->find(meshUUID);
+		if (mesh == nullptr)
+		{
+			return -1;
+		}
+		view->vertexCount = mesh->V ? static_cast<std::uint32_t>(mesh->V->rows()) : 0;
+		view->faceCount = mesh->F ? static_cast<std::uint32_t>(mesh->F->rows()) : 0;
+		viewColumns(mesh->V, view->V, view->VStride);
+		viewColumns(mesh->VN, view->VN, view->VNStride);
+		viewColumns(mesh->F, view->F, view->FStride);
+		return 0;
+	}
+
+	int MeshStore::setMesh(void *context, const char *meshUUID, const DoppelgangerMeshView *view)
+	{
+		MeshStore *store = static_cast<MeshStore *>(context);
+		if (store == nullptr || meshUUID == nullptr || view == nullptr)
+		{
+			return -1;
+		}
+		Mesh &mesh = store->modify(meshUUID);
+		// given attributes are replaced with new blocks. others are shared with the previous version
+		if (view->V[0] != nullptr)
+		{
+			copyColumns(view->V, view->VStride, view->vertexCount, &store->arena_, mesh.V);
+		}
+		if (view->VN[0] != nullptr)
+		{
+			copyColumns(view->VN, view->VNStride, view->vertexCount, &store->arena_, mesh.VN);
+		}
+		if (view->F[0] != nullptr)
+		{
+			copyColumns(view->F, view->FStride, view->faceCount, &store->arena_, mesh.F);
+		}
+		store->updateBytes();
+		return 0;
+	}
+
+	int MeshStore::getArena(void *context, int *fd, std::uint64_t *size)
+	{
+		const MeshStore *store = static_cast<const MeshStore *>(context);
+		if (store == nullptr || fd == nullptr || size == nullptr)
+		{
+			return -1;
+		}
+		*fd = store->arena_.fd();
+		*size = store->arena_.mappedSize();
+		return 0;
+	}
+
+	int MeshStore::mapMesh(void *context, const char *meshUUID, int writable, DoppelgangerMeshBuffers *buffers)
+	{
+		MeshStore *store = static_cast<MeshStore *>(context);
+		if (store == nullptr || meshUUID == nullptr || buffers == nullptr || store->find(meshUUID) == nullptr)
+		{
+			return -1;
+		}
+		if (writable != 0)
+		{
+			Mesh &mesh = store->modify(meshUUID);
+			if (mesh.V)
+			{
+				::writable(&store->arena_, mesh.V);
+			}
+			if (mesh.VN)
+			{
+				::writable(&store->arena_, mesh.VN);
+			}
+			if (mesh.F)
+			{
+				::writable(&store->arena_, mesh.F);
+			}
+			store->describeWritable(mesh, buffers);
+			store->updateBytes();
+			return 0;
+		}
+		store->describe(*(store->find(meshUUID)), buffers);
+		return 0;
+	}
+
+	int MeshStore::resizeMesh(void *context, const char *meshUUID, std::uint32_t vertexCount, std::uint32_t faceCount, int withNormals, DoppelgangerMeshBuffers *buffers)
+	{
+		MeshStore *store = static_cast<MeshStore *>(context);
+		if (store == nullptr || meshUUID == nullptr || buffers == nullptr)
+		{
+			return -1;
+		}
+		Mesh &mesh = store->modify(meshUUID);
+		// contents are undefined. we don't copy
+		mesh.V = std::make_shared<AlignedMatrix<float>>(&store->arena_);
+		mesh.V->resize(vertexCount, 3);
+		mesh.VN.reset();
+		if (withNormals != 0)
+		{
+			mesh.VN = std::make_shared<AlignedMatrix<float>>(&store->arena_);
+			mesh.VN->resize(vertexCount, 3);
+		}
+		mesh.F = std::make_shared<AlignedMatrix<std::int32_t>>(&store->arena_);
+		mesh.F->resize(faceCount, 3);
+		describeWritable(mesh, buffers);
+		store->updateBytes();
+		return 0;
+	}
+
+	int MeshStore::getMeshVersion(void *context, const char *meshUUID, std::uint64_t *version)
+	{
+		const MeshStore *store = static_cast<const MeshStore *>(context);
+		if (store == nullptr || meshUUID == nullptr || version == nullptr || store->find(meshUUID) == nullptr)
+		{
+			return -1;
+		}
+		*version = store->meshes_.at(meshUUID).current;
+		return 0;
+	}
+
+	int MeshStore::mapAttribute(void *context, const char *meshUUID, const char *attribute, int writable, DoppelgangerBufferDescriptor *descriptor)
+	{
+		MeshStore *store = static_cast<MeshStore *>(context);
+		if (store == nullptr || meshUUID == nullptr || attribute == nullptr || descriptor == nullptr || store->find(meshUUID) == nullptr)
+		{
+			return -1;
+		}
+		const std::string name(attribute);
+		if (name != "V" && name != "VN" && name != "F")
+		{
+			return -1;
+		}
+		if (writable == 0)
+		{
+			const Mesh *mesh = store->find(meshUUID);
+			if (name == "V")
+			{
+				describeBuffer<float>(mesh->V, DOPPELGANGER_DTYPE_FLOAT32, *descriptor);
+			}
+			else if (name == "VN")
+			{
+				describeBuffer<float>(mesh->VN, DOPPELGANGER_DTYPE_FLOAT32, *descriptor);
+			}
+			else
+			{
+				describeBuffer<std::int32_t>(mesh->F, DOPPELGANGER_DTYPE_INT32, *descriptor);
+			}
+			return 0;
+		}
+		// only this attribute is copied
+		Mesh &mesh = store->modify(meshUUID);
+		if (name == "V")
+		{
+			if (mesh.V)
+			{
+				::writable(&store->arena_, mesh.V);
+			}
+			describeWritableBuffer(mesh.V, DOPPELGANGER_DTYPE_FLOAT32, *descriptor);
+		}
+		else if (name == "VN")
+		{
+			if (mesh.VN)
+			{
+				::writable(&store->arena_, mesh.VN);
+			}
+			describeWritableBuffer(mesh.VN, DOPPELGANGER_DTYPE_FLOAT32, *descriptor);
+		}
+		else
+		{
+			if (mesh.F)
+			{
+				::writable(&store->arena_, mesh.F);
+			}
+			describeWritableBuffer(mesh.F, DOPPELGANGER_DTYPE_INT32, *descriptor);
+		}
+		store->updateBytes();
+		return 0;
+	}
+
+	int MeshStore::raycast(void *context, const char *meshUUID, const float origin[3], const float direction[3], float maxDistance, DoppelgangerRayHit *hit)
+	{
+		MeshStore *store = static_cast<MeshStore *>(context);
+		if (store == nullptr || meshUUID == nullptr || origin == nullptr || direction == nullptr || hit == nullptr)
+		{
+			return -1;
+		}
+		const MeshBVH *bvh = store->bvh(meshUUID);
+		if (bvh == nullptr)
+		{
+			return -1;
+		}
+		MeshBVH::RayHit rayHit;
+		if (!bvh->raycast(*(store->find(meshUUID)->V), origin, direction, maxDistance, rayHit))
+		{
+			return 0;
+		}
+		hit->t = rayHit.t;
+		hit->face = rayHit.face;
+		hit->barycentric[0] = rayHit.u;
+		hit->barycentric[1] = rayHit.v;
+		return 1;
+	}
+
+	int MeshStore::closestPoint(void *context, const char *meshUUID, const float point[3], float maxDistance, DoppelgangerClosestPoint *result)
+	{
+		MeshStore *store = static_cast<MeshStore *>(context);
+		if (store == nullptr || meshUUID == nullptr || point == nullptr || result == nullptr)
+		{
+			return -1;
+		}
+		const MeshBVH *bvh = store->bvh(meshUUID);
+		if (bvh == nullptr)
+		{
+			return -1;
+		}
+		MeshBVH::ClosestPoint closest;
+		if (!bvh->closestPoint(*(store->find(meshUUID)->V), point, maxDistance, closest))
+		{
+			return 0;
+		}
+		for (int c = 0; c < 3; ++c)
+		{
+			result->point[c] = closest.point[c];
+		}
+		result->distance = closest.distance;
+		result->face = closest.face;
+		return 1;
+	}
+
+	int MeshStore::overlapBox(void *context, const char *meshUUID, const float boxMin[3], const float boxMax[3], std::uint32_t *faces, std::uint32_t capacity)
+	{
+		MeshStore *store = static_cast<MeshStore *>(context);
+		if (store == nullptr || meshUUID == nullptr || boxMin == nullptr || boxMax == nullptr || (faces == nullptr && capacity > 0))
+		{
+			return -1;
+		}
+		const MeshBVH *bvh = store->bvh(meshUUID);
+		if (bvh == nullptr)
+		{
+			return -1;
+		}
+		std::vector<std::uint32_t> found;
+		bvh->overlap(*(store->find(meshUUID)->V), boxMin, boxMax, found);
+		std::copy(found.begin(), found.begin() + std::min<std::size_t>(found.size(), capacity), faces);
+		return static_cast<int>(std::min<std::size_t>(found.size(), static_cast<std::size_t>(std::numeric_limits<int>::max())));
+	}
+
+	void MeshStore::describe(const Mesh &mesh, DoppelgangerMeshBuffers *buffers)
+	{
+		describeBuffer<float>(mesh.V, DOPPELGANGER_DTYPE_FLOAT32, buffers->V);
+		describeBuffer<float>(mesh.VN, DOPPELGANGER_DTYPE_FLOAT32, buffers->VN);
+		describeBuffer<std::int32_t>(mesh.F, DOPPELGANGER_DTYPE_INT32, buffers->F);
+	}
+
+	void MeshStore::describeWritable(Mesh &mesh, DoppelgangerMeshBuffers *buffers)
+	{
+		describeWritableBuffer(mesh.V, DOPPELGANGER_DTYPE_FLOAT32, buffers->V);
+		describeWritableBuffer(mesh.VN, DOPPELGANGER_DTYPE_FLOAT32, buffers->VN);
+		describeWritableBuffer(mesh.F, DOPPELGANGER_DTYPE_INT32, buffers->F);
+	}
+
+	void MeshStore::encode(const Mesh &mesh, json &meshJson, const bool binary)
+	{
+		if (mesh.V)
+		{
+			meshJson["V"] = encodeAttribute(*mesh.V, binary);
+		}
+		if (mesh.VN)
+		{
+			meshJson["VN"] = encodeAttribute(*mesh.VN, binary);
+		}
+		if (mesh.F)
+		{
+			meshJson["F"] = encodeAttribute(*mesh.F, binary);
+		}
+	}
+
+	void MeshStore::evict()
+	{
+		const std::uint64_t oldest = (lastVersion_ > versionLimit_) ? lastVersion_ - versionLimit_ : 0;
+		for (auto it = meshes_.begin(); it != meshes_.end();)
+		{
+			Record &record = it->second;
+			for (auto version = record.versions.begin(); version != record.versions.end() && version->first < oldest;)
+			{
+				// current version of meshes in config is never discarded
+				if (record.active && version->first == record.current)
+				{
+					++version;
+				}
+				else
+				{
+					record.bvhs.erase(version->first);
+					version = record.versions.erase(version);
+				}
+			}
+			if (record.versions.empty())
+			{
+				it = meshes_.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	void MeshStore::updateBytes()
+	{
+		std::unordered_set<const void *> counted;
+		bytes_ = 0;
+		const auto count = [&counted, this](const void *block, const std::size_t bytes)
+		{
+			if (block != nullptr && counted.insert(block).second)
+			{
+				bytes_ += bytes;
+			}
+		};
+		for (const auto &uuid_record : meshes_)
+		{
+			for (const auto &version_mesh : uuid_record.second.versions)
+			{
+				const Mesh &mesh = version_mesh.second;
+				count(mesh.V.get(), mesh.V ? mesh.V->bytes() : 0);
+				count(mesh.VN.get(), mesh.VN ? mesh.VN->bytes() : 0);
+				count(mesh.F.get(), mesh.F ? mesh.F->bytes() : 0);
+			}
+			for (const auto &version_bvh : uuid_record.second.bvhs)
+			{
+				count(version_bvh.second.get(), version_bvh.second ? version_bvh.second->bytes() : 0);
+			}
+		}
+	}
+}
+
+#endif
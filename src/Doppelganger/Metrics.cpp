@@ -0,0 +1,331 @@
+#ifndef METRICS_CPP
+#define METRICS_CPP
+
+#include "Doppelganger/Metrics.h"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include "Doppelganger/Core.h"
+#include "Doppelganger/Room.h"
+#include "Doppelganger/Logger.h"
+
+namespace
+{
+	const char *stageNames[Doppelganger::Metrics::STAGE_COUNT] = {
+		"lockWait",
+		"pluginLoad",
+		"configSerialization",
+		"pluginExecution",
+		"responseParse",
+		"configApply",
+		"broadcast"};
+
+	// escape label value for Prometheus text format
+	std::string escapeLabel(const std::string &value)
+	{
+		std::string escaped;
+		escaped.reserve(value.size());
+		for (const char c : value)
+		{
+			if (c == '\\' || c == '"')
+			{
+				escaped.push_back('\\');
+				escaped.push_back(c);
+			}
+			else if (c == '\n')
+			{
+				escaped += "\\n";
+			}
+			else
+			{
+				escaped.push_back(c);
+			}
+		}
+		return escaped;
+	}
+
+	// write one histogram
+	//   buckets of Histogram are too fine for Prometheus, we export cumulative counts at 2^exponent - 1
+	//   (bucket boundaries of Histogram are 2^k - 1, i.e. these counts are exact. le is the bound itself, e.g. le="63" for bytes)
+	void writeHistogram(
+		std::ostream &os,
+		const std::string &name,
+		const std::string &labels,
+		const Doppelganger::Histogram &histogram,
+		const int minExponent,
+		const int maxExponent,
+		const int stepExponent,
+		const double unit)
+	{
+		using Doppelganger::Histogram;
+		std::array<std::uint64_t, Histogram::bucketCount> buckets;
+		histogram.snapshot(buckets);
+
+		// labels may be empty (e.g. process-wide histograms)
+		const std::string bucketLabels = labels.empty() ? std::string("") : (labels + ",");
+		std::uint64_t cumulative = 0;
+		std::size_t bIdx = 0;
+		for (int exponent = minExponent; exponent <= maxExponent; exponent += stepExponent)
+		{
+			const std::uint64_t bound = (std::uint64_t(1) << exponent) - 1;
+			for (; bIdx < buckets.size() && Histogram::bucketUpperBound(bIdx) <= bound; ++bIdx)
+			{
+				cumulative += buckets.at(bIdx);
+			}
+			os << name << "_bucket{" << bucketLabels << "le=\"" << static_cast<double>(bound) * unit << "\"} " << cumulative << "\n";
+		}
+		for (; bIdx < buckets.size(); ++bIdx)
+		{
+			cumulative += buckets.at(bIdx);
+		}
+		os << name << "_bucket{" << bucketLabels << "le=\"+Inf\"} " << cumulative << "\n";
+		os << name << "_sum{" << labels << "} " << static_cast<double>(histogram.sum()) * unit << "\n";
+		os << name << "_count{" << labels << "} " << cumulative << "\n";
+	}
+}
+
+namespace Doppelganger
+{
+	////
+	// Histogram
+	////
+	Histogram::Histogram()
+		: sum_(0), max_(0)
+	{
+		for (auto &bucket : buckets_)
+		{
+			bucket.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void Histogram::record(const std::uint64_t value)
+	{
+		buckets_.at(bucketIndex(value)).fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(value, std::memory_order_relaxed);
+		std::uint64_t currentMax = max_.load(std::memory_order_relaxed);
+		while (value > currentMax && !max_.compare_exchange_weak(currentMax, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	std::uint64_t Histogram::sum() const
+	{
+		return sum_.load(std::memory_order_relaxed);
+	}
+
+	std::uint64_t Histogram::max() const
+	{
+		return max_.load(std::memory_order_relaxed);
+	}
+
+	void Histogram::snapshot(std::array<std::uint64_t, bucketCount> &buckets) const
+	{
+		for (std::size_t bIdx = 0; bIdx < buckets.size(); ++bIdx)
+		{
+			buckets.at(bIdx) = buckets_.at(bIdx).load(std::memory_order_relaxed);
+		}
+	}
+
+	std::size_t Histogram::bucketIndex(const std::uint64_t value)
+	{
+		if (value < subBucketCount)
+		{
+			// exact
+			return static_cast<std::size_t>(value);
+		}
+		// position of the most significant bit
+		int exponent = 63;
+		while (((value >> exponent) & 1) == 0)
+		{
+			--exponent;
+		}
+		const int shift = exponent - subBucketBits;
+		const std::size_t subBucket = static_cast<std::size_t>((value >> shift) & (subBucketCount - 1));
+		return static_cast<std::size_t>(shift + 1) * subBucketCount + subBucket;
+	}
+
+	std::uint64_t Histogram::bucketUpperBound(const std::size_t index)
+	{
+		if (index < subBucketCount)
+		{
+			return static_cast<std::uint64_t>(index);
+		}
+		const int shift = static_cast<int>(index / subBucketCount) - 1;
+		const std::uint64_t subBucket = static_cast<std::uint64_t>(index % subBucketCount);
+		// (subBucketCount + subBucket + 1) << shift could overflow for the last bucket
+		return ((subBucketCount + subBucket) << shift) + ((std::uint64_t(1) << shift) - 1);
+	}
+
+	////
+	// Metrics
+	////
+	Metrics &Metrics::getInstance()
+	{
+		static Metrics metrics;
+		return metrics;
+	}
+
+	Metrics::APIMetrics &Metrics::api(const std::string &APIName)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::unique_ptr<APIMetrics> &metrics = APIs_[APIName];
+		if (!metrics)
+		{
+			metrics = std::make_unique<APIMetrics>();
+		}
+		return *metrics;
+	}
+
+	Metrics::InternalMetrics &Metrics::internal(const std::string &operation)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::unique_ptr<InternalMetrics> &metrics = internals_[operation];
+		if (!metrics)
+		{
+			metrics = std::make_unique<InternalMetrics>();
+		}
+		return *metrics;
+	}
+
+	void Metrics::exportPrometheus(std::ostream &os, const std::shared_ptr<Core> &core)
+	{
+		std::vector<std::pair<std::string, const APIMetrics *>> APIs;
+		std::vector<std::pair<std::string, const InternalMetrics *>> internals;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (const auto &name_metrics : APIs_)
+			{
+				APIs.emplace_back(name_metrics.first, name_metrics.second.get());
+			}
+			for (const auto &name_metrics : internals_)
+			{
+				internals.emplace_back(name_metrics.first, name_metrics.second.get());
+			}
+		}
+		std::sort(APIs.begin(), APIs.end());
+		std::sort(internals.begin(), internals.end());
+
+		////
+		// per API
+		os << "# HELP doppelganger_api_calls_total Number of API calls dispatched to plugins.\n";
+		os << "# TYPE doppelganger_api_calls_total counter\n";
+		for (const auto &name_metrics : APIs)
+		{
+			os << "doppelganger_api_calls_total{api=\"" << escapeLabel(name_metrics.first) << "\"} " << name_metrics.second->calls.load(std::memory_order_relaxed) << "\n";
+		}
+		os << "# HELP doppelganger_api_errors_total Number of API calls that failed: the plugin could not be loaded, the call threw, or the returned patch was rejected.\n";
+		os << "# TYPE doppelganger_api_errors_total counter\n";
+		for (const auto &name_metrics : APIs)
+		{
+			os << "doppelganger_api_errors_total{api=\"" << escapeLabel(name_metrics.first) << "\"} " << name_metrics.second->errors.load(std::memory_order_relaxed) << "\n";
+		}
+
+		// 1us (2^10 ns) ... 68.7s (2^36 ns)
+		os << "# HELP doppelganger_api_stage_duration_seconds Time spent in each stage of an API call.\n";
+		os << "# TYPE doppelganger_api_stage_duration_seconds histogram\n";
+		for (const auto &name_metrics : APIs)
+		{
+			for (int stage = 0; stage < STAGE_COUNT; ++stage)
+			{
+				const std::string labels = "api=\"" + escapeLabel(name_metrics.first) + "\",stage=\"" + stageNames[stage] + "\"";
+				writeHistogram(os, "doppelganger_api_stage_duration_seconds", labels, name_metrics.second->duration.at(stage), 10, 36, 2, 1.0e-9);
+			}
+		}
+
+		// 64B (2^6) ... 64MB (2^26)
+		os << "# HELP doppelganger_api_broadcast_bytes Bytes queued for WS sessions by one broadcast.\n";
+		os << "# TYPE doppelganger_api_broadcast_bytes histogram\n";
+		for (const auto &name_metrics : APIs)
+		{
+			const std::string labels = "api=\"" + escapeLabel(name_metrics.first) + "\"";
+			writeHistogram(os, "doppelganger_api_broadcast_bytes", labels, name_metrics.second->broadcastBytes, 6, 26, 2, 1.0);
+		}
+
+		////
+		// internal operations
+		os << "# HELP doppelganger_internal_broadcast_duration_seconds Time spent serializing and queueing a broadcast issued by the server.\n";
+		os << "# TYPE doppelganger_internal_broadcast_duration_seconds histogram\n";
+		for (const auto &name_metrics : internals)
+		{
+			const std::string labels = "operation=\"" + escapeLabel(name_metrics.first) + "\"";
+			writeHistogram(os, "doppelganger_internal_broadcast_duration_seconds", labels, name_metrics.second->broadcastDuration, 10, 36, 2, 1.0e-9);
+		}
+		os << "# HELP doppelganger_internal_broadcast_bytes Bytes queued for WS sessions by one broadcast issued by the server.\n";
+		os << "# TYPE doppelganger_internal_broadcast_bytes histogram\n";
+		for (const auto &name_metrics : internals)
+		{
+			const std::string labels = "operation=\"" + escapeLabel(name_metrics.first) + "\"";
+			writeHistogram(os, "doppelganger_internal_broadcast_bytes", labels, name_metrics.second->broadcastBytes, 6, 26, 2, 1.0);
+		}
+
+		////
+		// per room
+		if (core)
+		{
+			const std::vector<std::shared_ptr<Room>> rooms = core->rooms_.snapshot();
+
+			std::stringstream sessions, queued, pending, memory, hibernated;
+			for (const auto &room : rooms)
+			{
+				std::size_t sessionCount, queuedMessages;
+				room->sessionStats(sessionCount, queuedMessages);
+				const std::string labels = "{room=\"" + escapeLabel(room->UUID_) + "\"} ";
+				sessions << "doppelganger_room_ws_sessions" << labels << sessionCount << "\n";
+				queued << "doppelganger_room_ws_queued_messages" << labels << queuedMessages << "\n";
+				pending << "doppelganger_room_pending_api_calls" << labels << room->pendingAPICalls_.load(std::memory_order_relaxed) << "\n";
+				memory << "doppelganger_room_memory_bytes" << labels << room->memoryUsage_.load(std::memory_order_relaxed) << "\n";
+				hibernated << "doppelganger_room_hibernated" << labels << (room->hibernated_.load(std::memory_order_relaxed) ? 1 : 0) << "\n";
+			}
+
+			os << "# HELP doppelganger_rooms Number of rooms.\n";
+			os << "# TYPE doppelganger_rooms gauge\n";
+			os << "doppelganger_rooms " << rooms.size() << "\n";
+			os << "# HELP doppelganger_room_ws_sessions Number of WS sessions in the room.\n";
+			os << "# TYPE doppelganger_room_ws_sessions gauge\n";
+			os << sessions.str();
+			os << "# HELP doppelganger_room_ws_queued_messages Number of messages waiting to be written to WS sessions in the room.\n";
+			os << "# TYPE doppelganger_room_ws_queued_messages gauge\n";
+			os << queued.str();
+			os << "# HELP doppelganger_room_pending_api_calls Number of API calls waiting for the room.\n";
+			os << "# TYPE doppelganger_room_pending_api_calls gauge\n";
+			os << pending.str();
+			os << "# HELP doppelganger_room_memory_bytes Estimated memory used by the room: config, edit history, mesh buffers and encoded mesh cache (updated by the idle check).\n";
+			os << "# TYPE doppelganger_room_memory_bytes gauge\n";
+			os << memory.str();
+			os << "# HELP doppelganger_room_hibernated Whether the room is hibernated to disk.\n";
+			os << "# TYPE doppelganger_room_hibernated gauge\n";
+			os << hibernated.str();
+		}
+
+		////
+		// TLS
+		{
+			const std::uint64_t handshakes = tls_.handshakes.load(std::memory_order_relaxed);
+			const std::uint64_t resumed = tls_.resumed.load(std::memory_order_relaxed);
+			os << "# HELP doppelganger_tls_handshakes_total Number of completed TLS handshakes.\n";
+			os << "# TYPE doppelganger_tls_handshakes_total counter\n";
+			os << "doppelganger_tls_handshakes_total{resumed=\"false\"} " << (handshakes - resumed) << "\n";
+			os << "doppelganger_tls_handshakes_total{resumed=\"true\"} " << resumed << "\n";
+			os << "# HELP doppelganger_tls_handshake_errors_total Number of failed TLS handshakes.\n";
+			os << "# TYPE doppelganger_tls_handshake_errors_total counter\n";
+			os << "doppelganger_tls_handshake_errors_total " << tls_.errors.load(std::memory_order_relaxed) << "\n";
+			os << "# HELP doppelganger_tls_resumption_ratio Ratio of resumed handshakes (session cache or ticket).\n";
+			os << "# TYPE doppelganger_tls_resumption_ratio gauge\n";
+			os << "doppelganger_tls_resumption_ratio " << ((handshakes > 0) ? static_cast<double>(resumed) / static_cast<double>(handshakes) : 0.0) << "\n";
+			// 16us (2^14 ns) ... 1.07s (2^30 ns)
+			os << "# HELP doppelganger_tls_handshake_duration_seconds Time spent in the TLS handshake.\n";
+			os << "# TYPE doppelganger_tls_handshake_duration_seconds histogram\n";
+			writeHistogram(os, "doppelganger_tls_handshake_duration_seconds", "", tls_.handshakeDuration, 14, 30, 2, 1.0e-9);
+		}
+
+		////
+		// logger
+		os << "# HELP doppelganger_log_dropped_total Number of log messages dropped because the log queue was full.\n";
+		os << "# TYPE doppelganger_log_dropped_total counter\n";
+		os << "doppelganger_log_dropped_total " << Logger::getInstance().droppedCount() << "\n";
+	}
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef MONOTONICARENA_CPP
+#define MONOTONICARENA_CPP
+
+#include "Doppelganger/MonotonicArena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include <boost/assert.hpp>
+
+namespace Doppelganger
+{
+	MonotonicArena::MonotonicArena(const std::size_t blockSize)
+		: blockSize_(std::max<std::size_t>(blockSize, alignof(std::max_align_t))), offset_(0), live_(0)
+	{
+	}
+
+	void *MonotonicArena::allocate(const std::size_t size, const std::size_t alignment)
+	{
+		if (!blocks_.empty())
+		{
+			block &current = blocks_.back();
+			const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(current.data.get());
+			const std::size_t aligned = static_cast<std::size_t>(((base + offset_ + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1)) - base);
+			if (aligned + size <= current.size)
+			{
+				offset_ = aligned + size;
+				live_.fetch_add(1, std::memory_order_relaxed);
+				return current.data.get() + aligned;
+			}
+		}
+
+		// new block (at least twice as large as the previous one)
+		block b;
+		b.size = std::max(blocks_.empty() ? blockSize_ : 2 * blocks_.back().size, size + alignment);
+		b.data.reset(new unsigned char[b.size]);
+		blocks_.push_back(std::move(b));
+		offset_ = 0;
+		return allocate(size, alignment);
+	}
+
+	void MonotonicArena::deallocate(void *pointer, const std::size_t size)
+	{
+		(void)pointer;
+		(void)size;
+		const std::size_t live = live_.fetch_sub(1, std::memory_order_release);
+		BOOST_ASSERT(live > 0);
+		(void)live;
+	}
+
+	bool MonotonicArena::reset()
+	{
+		if (live_.load(std::memory_order_acquire) != 0)
+		{
+			return false;
+		}
+
+		if (blocks_.size() > 1)
+		{
+			std::size_t total = 0;
+			for (const auto &b : blocks_)
+			{
+				total += b.size;
+			}
+			blocks_.clear();
+			blockSize_ = total;
+		}
+		offset_ = 0;
+		return true;
+	}
+}
+
+#endif
@@ -4,6 +4,9 @@
 #include "Doppelganger/Plugin.h"
 #include "Doppelganger/Core.h"
 #include "Doppelganger/Room.h"
+#include "Doppelganger/HistoryStore.h"
+#include "Doppelganger/MeshStore.h"
+#include "Doppelganger/PluginABI.h"
 
 #include <sstream>
 #if defined(_WIN64)
@@ -16,25 +19,27 @@
 #endif
 
 #include "Doppelganger/Util/unzip.h"
-#include "Doppelganger/Util/log.h"
+#include "Doppelganger/Logger.h"
+#include "Doppelganger/Metrics.h"
+#include "Doppelganger/Tracing.h"
 
 namespace
 {
-	void getPtrStrArrayForPartialConfig(
-		const fs::path &dllPath,
-		const char *parameterChar,
-		nlohmann::json &ptrStrArrayCore,
-		nlohmann::json &ptrStrArrayRoom);
+	// index-th reference token of JSON pointer ("" if not exists)
+	std::string referenceToken(const std::string &ptrStr, const std::size_t index);
 	void functionCall(
 		const fs::path &dllPath,
 		const std::string &functionName,
-		const nlohmann::json &configCore,
-		const nlohmann::json &configRoom,
-		const nlohmann::json &parameter,
-		nlohmann::json &configCorePatch,
-		nlohmann::json &configRoomPatch,
-		nlohmann::json &response,
-		nlohmann::json &broadcast);
+		const Doppelganger::json &configCore,
+		const Doppelganger::json &configRoom,
+		const Doppelganger::HistoryStore *historyRoom,
+		Doppelganger::MeshStore *meshRoom,
+		const Doppelganger::json &parameter,
+		Doppelganger::json &configCorePatch,
+		Doppelganger::json &configRoomPatch,
+		Doppelganger::json &response,
+		Doppelganger::json &broadcast,
+		Doppelganger::Metrics::APIMetrics &metrics);
 }
 
 namespace Doppelganger
@@ -84,15 +89,7 @@ namespace Doppelganger
 						else
 						{
 							// failure
-							std::stringstream ss;
-							ss << "Plugin \"" << name_ << "\" (";
-							if (version == "latest")
-							{
-								ss << "latest, ";
-							}
-							ss << actualVersion << ")"
-							   << " is NOT downloaded correctly. (Download)";
-							Util::log(ss.str(), "ERROR", room->config);
+							DOPPELGANGER_LOG(room, ERROR, "Plugin \"" << name_ << "\" (" << ((version == "latest") ? "latest, " : "") << actualVersion << ") is NOT downloaded correctly. (Download)");
 							// remove invalid dir_
 							dir_ = fs::path();
 							return;
@@ -103,15 +100,7 @@ namespace Doppelganger
 				if (!versionFound)
 				{
 					// failure
-					std::stringstream ss;
-					ss << "Plugin \"" << name_ << "\" (";
-					if (version == "latest")
-					{
-						ss << "latest, ";
-					}
-					ss << actualVersion << ")"
-					   << " is NOT loaded correctly. (No such version)";
-					Util::log(ss.str(), "ERROR", room->config);
+					DOPPELGANGER_LOG(room, ERROR, "Plugin \"" << name_ << "\" (" << ((version == "latest") ? "latest, " : "") << actualVersion << ") is NOT loaded correctly. (No such version)");
 					// remove invalid dir_
 					dir_ = fs::path();
 					return;
@@ -122,17 +111,7 @@ namespace Doppelganger
 			{
 				// copy cached plugin into room
 				fs::copy(cachedDir, dir_, fs::copy_options::recursive);
-				{
-					std::stringstream ss;
-					ss << "Plugin \"" << name_ << "\" (";
-					if (version == "latest")
-					{
-						ss << "latest, ";
-					}
-					ss << actualVersion << ")"
-					   << " is loaded.";
-					Util::log(ss.str(), "SYSTEM", room->config);
-				}
+				DOPPELGANGER_LOG(room, SYSTEM, "Plugin \"" << name_ << "\" (" << ((version == "latest") ? "latest, " : "") << actualVersion << ") is loaded.");
 			}
 
 			installedVersion_ = version;
@@ -142,46 +121,29 @@ namespace Doppelganger
 	void Plugin::pluginProcess(
 		const std::shared_ptr<Core> &core,
 		const std::shared_ptr<Room> &room,
-		const nlohmann::json &parameters,
-		nlohmann::json &response,
-		nlohmann::json &broadcast)
+		const json &parameters,
+		json &response,
+		json &broadcast)
 	{
-		fs::path dllPath(dir_);
-		std::string dllName(name_);
-#if defined(_WIN64)
-		dllPath.append("Windows");
-		dllName += ".dll";
-#elif defined(__APPLE__)
-		dllPath.append("Darwin");
-		dllName = "lib" + dllName + ".so";
-#elif defined(__linux__)
-		dllPath.append("Linux");
-		dllName = "lib" + dllName + ".so";
-#endif
-		dllPath.append(dllName);
-		// c++ functions (.dll/.so) (if exists)
-		if (fs::exists(dllPath))
-		{
-			nlohmann::json configCorePatch, configRoomPatch;
-			functionCall(dllPath, "pluginProcess", core->config, room->config, parameters, configCorePatch, configRoomPatch, response, broadcast);
-			if (!configRoomPatch.is_null())
-			{
-				room->config.merge_patch(configRoomPatch);
-				room->applyCurrentConfig();
-			}
-			if (!configCorePatch.is_null())
-			{
-				core->config.merge_patch(configCorePatch);
-				core->applyCurrentConfig();
-			}
-		}
+		process(core, room, parameters, response, broadcast);
 	}
 
 	void Plugin::pluginProcess(
 		const std::shared_ptr<Room> &room,
-		const nlohmann::json &parameters,
-		nlohmann::json &response,
-		nlohmann::json &broadcast)
+		const json &parameters,
+		json &response,
+		json &broadcast)
+	{
+		// for WS API, core == nullptr
+		process(nullptr, room, parameters, response, broadcast);
+	}
+
+	void Plugin::process(
+		const std::shared_ptr<Core> &core,
+		const std::shared_ptr<Room> &room,
+		const json &parameters,
+		json &response,
+		json &broadcast)
 	{
 		fs::path dllPath(dir_);
 		std::string dllName(name_);
@@ -199,78 +161,109 @@ namespace Doppelganger
 		// c++ functions (.dll/.so) (if exists)
 		if (fs::exists(dllPath))
 		{
-			nlohmann::json configCorePatch, configRoomPatch;
-			// for WS API, core == nullptr
-			const nlohmann::json emptyConfig = nlohmann::json::object();
-			functionCall(dllPath, "pluginProcess", emptyConfig, room->config, parameters, configCorePatch, configRoomPatch, response, broadcast);
-			if (!configRoomPatch.is_null())
+			Metrics::APIMetrics &metrics = Metrics::getInstance().api(name_);
+			metrics.calls.fetch_add(1, std::memory_order_relaxed);
+			json configCorePatch, configRoomPatch;
+			// config of Core may be patched by another room (i.e. we never read core->config here)
+			const std::shared_ptr<const json> configCore = core ? core->configSnapshot() : std::make_shared<const json>(json::object());
+			functionCall(dllPath, "pluginProcess", *configCore, room->config, &room->history_, &room->meshes_, parameters, configCorePatch, configRoomPatch, response, broadcast, metrics);
+			const std::chrono::steady_clock::time_point applyStart = std::chrono::steady_clock::now();
+			std::string missingMeshUUID;
+			std::uint64_t missingVersion = 0;
+			if (!configRoomPatch.is_null() && room->meshes_.findMissingVersion(configRoomPatch, missingMeshUUID, missingVersion))
 			{
-				room->config.merge_patch(configRoomPatch);
-				room->applyCurrentConfig();
+				// e.g. undo/redo to a version before recovery/hibernation. we don't apply the patch partially (i.e. history.index stays)
+				metrics.errors.fetch_add(1, std::memory_order_relaxed);
+				DOPPELGANGER_LOG(room, ERROR, "Plugin \"" << name_ << "\" refers to version " << missingVersion << " of mesh \"" << missingMeshUUID << "\" that is NOT available. The patch is NOT applied.");
+				configRoomPatch = json();
+				broadcast = json();
 			}
+			// the room is shut down (sessions are closed and its data is removed), i.e. nothing to persist or compute
+			const bool roomActive = configRoomPatch.is_null() ? room->active_.load() : room->applyConfigPatch(configRoomPatch);
+			if (roomActive)
+			{
+				if (!configRoomPatch.is_null())
+				{
+					room->storePatch(configRoomPatch);
+				}
+				// meshes modified through DoppelgangerHostAPI
+				json configMeshPatch;
+				MeshStore::Snapshot modifiedMeshes;
+				if (room->meshes_.takeModified(room->config, configMeshPatch, modifiedMeshes))
+				{
+					room->storePatch(configMeshPatch, modifiedMeshes);
+				}
+				room->scheduleMeshLOD();
+			}
+			// applied even if the room is shut down (Core removes inactive rooms here, see Core::applyRooms())
+			if (core && !configCorePatch.is_null())
+			{
+				core->applyConfigPatch(configCorePatch);
+			}
+			metrics.duration.at(Metrics::CONFIG_APPLY).record(Metrics::elapsedNs(applyStart, std::chrono::steady_clock::now()));
 		}
 	}
 
 	////
 	// nlohmann::json conversion
 	////
-	void to_json(nlohmann::json &json, const Plugin &plugin)
+	void to_json(json &pluginJson, const Plugin &plugin)
 	{
-		json = nlohmann::json::object();
-		json["name"] = plugin.name_;
-		json["description"] = nlohmann::json::object();
+		pluginJson = json::object();
+		pluginJson["name"] = plugin.name_;
+		pluginJson["description"] = json::object();
 		for (const auto &lang_description : plugin.description_)
 		{
 			const std::string &lang = lang_description.first;
 			const std::string &description = lang_description.second;
-			json["description"][lang] = description;
+			pluginJson["description"][lang] = description;
 		}
-		json["optional"] = plugin.optional_;
-		json["UIPosition"] = plugin.UIPosition_;
-		json["hasModuleJS"] = plugin.hasModuleJS_;
-		json["versions"] = nlohmann::json::array();
+		pluginJson["optional"] = plugin.optional_;
+		pluginJson["UIPosition"] = plugin.UIPosition_;
+		pluginJson["hasModuleJS"] = plugin.hasModuleJS_;
+		pluginJson["versions"] = json::array();
 		for (const auto &versionInfo : plugin.versions_)
 		{
-			nlohmann::json versionJson = nlohmann::json::object();
+			json versionJson = json::object();
 			versionJson["version"] = versionInfo.version;
 			versionJson["URL"] = versionInfo.URL;
-			json["versions"].push_back(versionJson);
+			pluginJson["versions"].push_back(versionJson);
 		}
-		json["installedVersion"] = plugin.installedVersion_;
-		json["dir"] = plugin.dir_.string();
+		pluginJson["installedVersion"] = plugin.installedVersion_;
+		pluginJson["dir"] = plugin.dir_.string();
 	}
 
-	void from_json(const nlohmann::json &json, Plugin &plugin)
+	void from_json(const json &pluginJson, Plugin &plugin)
 	{
-		plugin.name_ = json.at("name").get<std::string>();
+		plugin.name_ = pluginJson.at("name").get<std::string>();
 		plugin.description_.clear();
-		for (const auto &lang_description : json.at("description").items())
+		for (const auto &lang_description : pluginJson.at("description").items())
 		{
 			const std::string &lang = lang_description.key();
 			const std::string description = lang_description.value().get<std::string>();
 			plugin.description_[lang] = description;
 		}
-		plugin.optional_ = json.at("optional").get<bool>();
-		plugin.UIPosition_ = json.at("UIPosition").get<std::string>();
-		plugin.hasModuleJS_ = json.at("hasModuleJS").get<bool>();
+		plugin.optional_ = pluginJson.at("optional").get<bool>();
+		plugin.UIPosition_ = pluginJson.at("UIPosition").get<std::string>();
+		plugin.hasModuleJS_ = pluginJson.at("hasModuleJS").get<bool>();
 		plugin.versions_.clear();
-		for (const auto &versionInfo : json.at("versions"))
+		for (const auto &versionInfo : pluginJson.at("versions"))
 		{
 			const std::string version = versionInfo.at("version").get<std::string>();
 			const std::string URL = versionInfo.at("URL").get<std::string>();
 			plugin.versions_.push_back(Plugin::VersionResourceInfo({version, URL}));
 		}
-		if (json.contains("installedVersion"))
+		if (pluginJson.contains("installedVersion"))
 		{
-			plugin.installedVersion_ = json.at("installedVersion").get<std::string>();
+			plugin.installedVersion_ = pluginJson.at("installedVersion").get<std::string>();
 		}
 		else
 		{
 			plugin.installedVersion_ = std::string("");
 		}
-		if (json.contains("dir"))
+		if (pluginJson.contains("dir"))
 		{
-			plugin.dir_ = fs::path(json.at("dir").get<std::string>());
+			plugin.dir_ = fs::path(pluginJson.at("dir").get<std::string>());
 		}
 		else
 		{
@@ -281,6 +274,29 @@ namespace Doppelganger
 
 namespace
 {
+	std::string referenceToken(const std::string &ptrStr, const std::size_t index)
+	{
+		std::size_t begin = 0;
+		for (std::size_t i = 0; i <= index; ++i)
+		{
+			if (begin >= ptrStr.size() || ptrStr.at(begin) != '/')
+			{
+				return std::string();
+			}
+			begin += 1;
+			if (i < index)
+			{
+				begin = ptrStr.find('/', begin);
+				if (begin == std::string::npos)
+				{
+					return std::string();
+				}
+			}
+		}
+		const std::size_t end = ptrStr.find('/', begin);
+		return ptrStr.substr(begin, (end == std::string::npos) ? std::string::npos : end - begin);
+	}
+
 	void getPtrStrArrayForPartialConfig(
 #if defined(_WIN64)
 		HINSTANCE handle,
@@ -290,12 +306,12 @@ namespace
 		void *handle,
 #endif
 		const char *parameterChar,
-		nlohmann::json &ptrStrArrayCore,
-		nlohmann::json &ptrStrArrayRoom)
+		Doppelganger::json &ptrStrArrayCore,
+		Doppelganger::json &ptrStrArrayRoom)
 	{
 		// by default, we request all config (this setting would be overwritten below)
-		ptrStrArrayCore = nlohmann::json::array({""});
-		ptrStrArrayRoom = nlohmann::json::array({""});
+		ptrStrArrayCore = Doppelganger::json::array({""});
+		ptrStrArrayRoom = Doppelganger::json::array({""});
 
 #if defined(_WIN64)
 		FARPROC pluginFunc = GetProcAddress(handle, "getPtrStrArrayForPartialConfig");
@@ -323,11 +339,11 @@ namespace
 				ptrStrArrayRoomChar);
 			if (ptrStrArrayCoreChar != nullptr)
 			{
-				ptrStrArrayCore = nlohmann::json::parse(ptrStrArrayCoreChar);
+				ptrStrArrayCore = Doppelganger::json::parse(ptrStrArrayCoreChar);
 			}
 			if (ptrStrArrayRoomChar != nullptr)
 			{
-				ptrStrArrayRoom = nlohmann::json::parse(ptrStrArrayRoomChar);
+				ptrStrArrayRoom = Doppelganger::json::parse(ptrStrArrayRoomChar);
 			}
 		}
 	}
@@ -335,14 +351,27 @@ namespace
 	void functionCall(
 		const fs::path &dllPath,
 		const std::string &functionName,
-		const nlohmann::json &configCore,
-		const nlohmann::json &configRoom,
-		const nlohmann::json &parameter,
-		nlohmann::json &configCorePatch,
-		nlohmann::json &configRoomPatch,
-		nlohmann::json &response,
-		nlohmann::json &broadcast)
+		const Doppelganger::json &configCore,
+		const Doppelganger::json &configRoom,
+		const Doppelganger::HistoryStore *historyRoom,
+		Doppelganger::MeshStore *meshRoom,
+		const Doppelganger::json &parameter,
+		Doppelganger::json &configCorePatch,
+		Doppelganger::json &configRoomPatch,
+		Doppelganger::json &response,
+		Doppelganger::json &broadcast,
+		Doppelganger::Metrics::APIMetrics &metrics)
 	{
+		DOPPELGANGER_TRACE_SPAN("functionCall");
+		using Doppelganger::Metrics;
+		std::chrono::steady_clock::time_point stageStart = std::chrono::steady_clock::now();
+		const auto endStage = [&metrics, &stageStart](const Metrics::Stage stage)
+		{
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			metrics.duration.at(stage).record(Metrics::elapsedNs(stageStart, now));
+			stageStart = now;
+		};
+
 #if defined(_WIN64)
 		using APIPtr_t = void(__stdcall *)(const char *&, const char *&, const char *&, char *&, char *&, char *&, char *&);
 		using DeallocatePtr_t = void(__stdcall *)();
@@ -371,24 +400,25 @@ namespace
 			void *pluginFunc = dlsym(handle, functionName.c_str());
 			void *deallocateFunc = dlsym(handle, "deallocate");
 #endif
+			endStage(Metrics::PLUGIN_LOAD);
 			if (pluginFunc && deallocateFunc)
 			{
 				// setup buffers
 				const std::string parameterStr = parameter.dump(-1, ' ', true);
 				const char *parameterChar = parameterStr.c_str();
 
-				nlohmann::json ptrStrArrayCore, ptrStrArrayRoom;
+				Doppelganger::json ptrStrArrayCore, ptrStrArrayRoom;
 				getPtrStrArrayForPartialConfig(
 					handle,
 					parameterChar,
 					ptrStrArrayCore,
 					ptrStrArrayRoom);
 
-				nlohmann::json partialConfigCore, partialConfigRoom;
-				partialConfigCore = nlohmann::json::object();
+				Doppelganger::json partialConfigCore, partialConfigRoom;
+				partialConfigCore = Doppelganger::json::object();
 				for (const auto &ptrStrJson : ptrStrArrayCore)
 				{
-					const nlohmann::json::json_pointer ptr(ptrStrJson.get<std::string>());
+					const Doppelganger::json::json_pointer ptr(ptrStrJson.get<std::string>());
 					// we explicitly check by using .contains()
 					//     e.g. ptr == "/extension/plugin_A/...", but config.at("extension")("plugin_A") == null
 					if (configCore.contains(ptr))
@@ -396,11 +426,69 @@ namespace
 						partialConfigCore[ptr] = configCore.at(ptr);
 					}
 				}
-				partialConfigRoom = nlohmann::json::object();
+				partialConfigRoom = Doppelganger::json::object();
+				// diffs in history and mesh buffers are not in configRoom. we materialize them only if requested
+				Doppelganger::json configMaterialized = Doppelganger::json::object();
+				const auto materialized = [&historyRoom, &meshRoom, &configRoom, &configMaterialized](const std::string &key) -> const Doppelganger::json &
+				{
+					if (!configMaterialized.contains(key))
+					{
+						configMaterialized[key] = configRoom.at(key);
+						if (key == "history")
+						{
+							historyRoom->materialize(configMaterialized.at(key));
+						}
+						else
+						{
+							meshRoom->materialize(configMaterialized.at(key));
+						}
+					}
+					return configMaterialized.at(key);
+				};
+				const auto isMaterialized = [&historyRoom, &meshRoom, &configRoom](const std::string &ptrStr)
+				{
+					// e.g. "/meshes/<meshUUID>/V" -> "meshes", "V"
+					const std::string key = referenceToken(ptrStr, 0);
+					const std::string attribute = referenceToken(ptrStr, 2);
+					if (!configRoom.contains(key))
+					{
+						return false;
+					}
+					if (key == "history")
+					{
+						// only diffs live in HistoryStore. scalars (e.g. "/history/index") are in configRoom
+						const std::string field = referenceToken(ptrStr, 1);
+						return (historyRoom != nullptr &&
+								(field.empty() || field == "diffFromPrev" || field == "diffFromNext"));
+					}
+					// metadata (e.g. "/meshes/<meshUUID>/name") is in configRoom
+					return (key == "meshes" && meshRoom != nullptr &&
+							(attribute.empty() || attribute == "V" || attribute == "VN" || attribute == "F"));
+				};
 				for (const auto &ptrStrJson : ptrStrArrayRoom)
 				{
-					const nlohmann::json::json_pointer ptr(ptrStrJson.get<std::string>());
-					if (configRoom.contains(ptr))
+					const std::string ptrStr = ptrStrJson.get<std::string>();
+					const Doppelganger::json::json_pointer ptr(ptrStr);
+					if (ptrStr.empty())
+					{
+						partialConfigRoom = configRoom;
+						for (const std::string key : {"history", "meshes"})
+						{
+							if (isMaterialized("/" + key))
+							{
+								partialConfigRoom.at(key) = materialized(key);
+							}
+						}
+					}
+					else if (isMaterialized(ptrStr))
+					{
+						materialized(referenceToken(ptrStr, 0));
+						if (configMaterialized.contains(ptr))
+						{
+							partialConfigRoom[ptr] = configMaterialized.at(ptr);
+						}
+					}
+					else if (configRoom.contains(ptr))
 					{
 						partialConfigRoom[ptr] = configRoom.at(ptr);
 					}
@@ -414,6 +502,24 @@ namespace
 				char *configRoomPatchChar = nullptr;
 				char *responseChar = nullptr;
 				char *broadcastChar = nullptr;
+				endStage(Metrics::CONFIG_SERIALIZATION);
+				// setHostAPI (optional, see PluginABI.h)
+				{
+#if defined(_WIN64)
+					using SetHostAPIPtr_t = void(__stdcall *)(const DoppelgangerHostAPI *);
+					FARPROC setHostAPIFunc = GetProcAddress(handle, "setHostAPI");
+#elif defined(__APPLE__)
+					using SetHostAPIPtr_t = void (*)(const DoppelgangerHostAPI *);
+					void *setHostAPIFunc = dlsym(handle, "setHostAPI");
+#elif defined(__linux__)
+					using SetHostAPIPtr_t = void (*)(const DoppelgangerHostAPI *);
+					void *setHostAPIFunc = dlsym(handle, "setHostAPI");
+#endif
+					if (setHostAPIFunc && meshRoom != nullptr)
+					{
+						reinterpret_cast<SetHostAPIPtr_t>(setHostAPIFunc)(meshRoom->hostAPI());
+					}
+				}
 				// pluginFunc
 				reinterpret_cast<APIPtr_t>(pluginFunc)(
 					configCoreChar,
@@ -423,28 +529,34 @@ namespace
 					configRoomPatchChar,
 					responseChar,
 					broadcastChar);
+				endStage(Metrics::PLUGIN_EXECUTION);
 				if (configCorePatchChar != nullptr)
 				{
-					configCorePatch = nlohmann::json::parse(configCorePatchChar);
+					configCorePatch = Doppelganger::json::parse(configCorePatchChar);
 				}
 				if (configRoomPatchChar != nullptr)
 				{
-					configRoomPatch = nlohmann::json::parse(configRoomPatchChar);
+					configRoomPatch = Doppelganger::json::parse(configRoomPatchChar);
 				}
 				// response could be null
 				// if you want to ensure that somethins is returned, pass non-null value as argument
 				if (responseChar != nullptr)
 				{
-					response = nlohmann::json::parse(responseChar);
+					response = Doppelganger::json::parse(responseChar);
 				}
 				// broadcast could be null
 				if (broadcastChar != nullptr)
 				{
-					broadcast = nlohmann::json::parse(broadcastChar);
+					broadcast = Doppelganger::json::parse(broadcastChar);
 				}
 
 				// deallocate memory malloc-ed within dll
 				reinterpret_cast<DeallocatePtr_t>(deallocateFunc)();
+				endStage(Metrics::RESPONSE_PARSE);
+			}
+			else
+			{
+				metrics.errors.fetch_add(1, std::memory_order_relaxed);
 			}
 #if defined(_WIN64)
 			FreeLibrary(handle);
@@ -454,6 +566,10 @@ namespace
 			dlclose(handle);
 #endif
 		}
+		else
+		{
+			metrics.errors.fetch_add(1, std::memory_order_relaxed);
+		}
 	}
 }
 
@@ -0,0 +1,99 @@
+#ifndef RINGARENA_CPP
+#define RINGARENA_CPP
+
+#include "Doppelganger/RingArena.h"
+
+#include <cstring>
+
+#include <boost/assert.hpp>
+
+namespace
+{
+	// each block starts with its size (header is padded so that the object is aligned)
+	const std::size_t blockAlignment = alignof(std::max_align_t);
+	const std::size_t headerSize = blockAlignment;
+
+	std::size_t blockSize(const std::size_t size)
+	{
+		return headerSize + ((size + blockAlignment - 1) / blockAlignment) * blockAlignment;
+	}
+}
+
+namespace Doppelganger
+{
+	RingArena::RingArena(const std::size_t capacity)
+		: capacity_((capacity / blockAlignment) * blockAlignment), head_(0), tail_(0), wrapEnd_(0), wrapped_(false), count_(0)
+	{
+	}
+
+	void *RingArena::allocate(const std::size_t size, const std::size_t alignment)
+	{
+		if (alignment > blockAlignment || capacity_ == 0)
+		{
+			return nullptr;
+		}
+		if (!buffer_)
+		{
+			buffer_.reset(new unsigned char[capacity_]);
+		}
+
+		const std::size_t need = blockSize(size);
+		std::size_t offset;
+		if (!wrapped_)
+		{
+			if (head_ + need <= capacity_)
+			{
+				offset = head_;
+			}
+			else if (need < tail_)
+			{
+				// wrap around (strictly less: head_ == tail_ only means empty)
+				wrapEnd_ = head_;
+				wrapped_ = true;
+				offset = 0;
+			}
+			else
+			{
+				return nullptr;
+			}
+		}
+		else if (head_ + need < tail_)
+		{
+			offset = head_;
+		}
+		else
+		{
+			return nullptr;
+		}
+
+		std::memcpy(buffer_.get() + offset, &need, sizeof(need));
+		head_ = offset + need;
+		++count_;
+		return buffer_.get() + offset + headerSize;
+	}
+
+	void RingArena::release(void *pointer)
+	{
+		unsigned char *block = static_cast<unsigned char *>(pointer) - headerSize;
+		BOOST_ASSERT(owns(pointer));
+		BOOST_ASSERT(static_cast<std::size_t>(block - buffer_.get()) == tail_);
+
+		std::size_t size;
+		std::memcpy(&size, block, sizeof(size));
+		tail_ += size;
+		--count_;
+
+		if (count_ == 0)
+		{
+			head_ = tail_ = wrapEnd_ = 0;
+			wrapped_ = false;
+		}
+		else if (wrapped_ && tail_ == wrapEnd_)
+		{
+			tail_ = 0;
+			wrapped_ = false;
+		}
+	}
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define ROOM_CPP
 
 #include "Doppelganger/Room.h"
+#include "Doppelganger/fs_error_code.h"
 
 #include <fstream>
 #include <sstream>
@@ -10,17 +11,66 @@
 #include "Doppelganger/WebsocketSession.h"
 #include "Doppelganger/Util/getCurrentTimestampAsString.h"
 #include "Doppelganger/Util/getPluginCatalogue.h"
-#include "Doppelganger/Util/log.h"
+#include "Doppelganger/Logger.h"
+#include "Doppelganger/Metrics.h"
+#include "Doppelganger/Tracing.h"
+
+namespace
+{
+	// rough estimate of heap usage of json (flat_map, std::vector, std::string)
+	std::size_t estimateMemoryUsage(const Doppelganger::json &json)
+	{
+		std::size_t bytes = sizeof(Doppelganger::json);
+		if (json.is_object())
+		{
+			const Doppelganger::json::object_t &object = json.get_ref<const Doppelganger::json::object_t &>();
+			// flat_map + keys in its buffer (values are counted below)
+			bytes += sizeof(Doppelganger::json::object_t) + object.capacity() * sizeof(std::string);
+			for (const auto &item : object)
+			{
+				bytes += item.first.size();
+				bytes += estimateMemoryUsage(item.second);
+			}
+		}
+		else if (json.is_array())
+		{
+			for (const auto &element : json)
+			{
+				bytes += estimateMemoryUsage(element);
+			}
+		}
+		else if (json.is_string())
+		{
+			bytes += sizeof(std::string) + json.get_ref<const std::string &>().capacity();
+		}
+		else if (json.is_binary())
+		{
+			bytes += sizeof(Doppelganger::json::binary_t) + json.get_binary().size();
+		}
+		return bytes;
+	}
+
+	// entries kept in memory while the room is hibernated
+	const char *hibernationKeptKeys[] = {"UUID", "dataDir", "DoppelgangerRootDir", "active", "forceReload", "log", "output", "plugin", "room", "server"};
+
+	bool persistEnabled(const Doppelganger::json &config)
+	{
+		return config.contains("room") && config.at("room").contains("persist") && config.at("room").at("persist").get<bool>();
+	}
+}
 
 namespace Doppelganger
 {
 	Room::Room()
+		: logLevels_(Logger::LEVEL_ALL | Logger::TYPE_STDOUT), pendingAPICalls_(0), homeContext_(nullptr), busyNs_(0), active_(true), hibernated_(false), lastActivity_(0), memoryUsage_(0)
 	{
+		touch();
+		subscribeConfig();
 	}
 
 	void Room::setup(
 		const std::string &UUID,
-		const nlohmann::json &configCore)
+		const json &configCore)
 	{
 		// inherit from Core
 		config = configCore;
@@ -28,29 +78,105 @@ namespace Doppelganger
 		config.erase("dataDir");
 		// add room-specific contents
 		config["UUID"] = UUID;
-		config["meshes"] = nlohmann::json::object();
+		UUID_ = UUID;
+		config["meshes"] = json::object();
 		config.at("plugin").at("reInstall") = true;
-		config["history"] = nlohmann::json::object();
+		config["history"] = json::object();
 		config.at("history")["index"] = 0;
-		config.at("history")["diffFromPrev"] = nlohmann::json::array();
-		config.at("history").at("diffFromPrev").push_back(nlohmann::json::object());
-		config.at("history")["diffFromNext"] = nlohmann::json::array();
-		config.at("history")["extension"] = nlohmann::json::object();
+		config.at("history")["diffFromPrev"] = json::array();
+		config.at("history").at("diffFromPrev").push_back(json::object());
+		config.at("history")["diffFromNext"] = json::array();
+		config.at("history")["extension"] = json::object();
+
+		// recover the latest state of this room (e.g. after crash)
+		fs::path recoveredDir;
+		if (persistEnabled(config))
+		{
+			fs::path dataRootDir(config.at("DoppelgangerRootDir").get<std::string>());
+			dataRootDir.append("data");
+			recoveredDir = RoomStore::findLatest(dataRootDir, UUID);
+			json recoveredConfig;
+			if (!recoveredDir.empty() && RoomStore::load(recoveredDir, recoveredConfig))
+			{
+				// settings inherited from Core follow the current Core
+				for (const auto &item : configCore.items())
+				{
+					if (item.key() != "dataDir" && item.key() != "plugin" && item.key() != "extension")
+					{
+						recoveredConfig[item.key()] = item.value();
+					}
+				}
+				recoveredConfig.erase("dataDir");
+				recoveredConfig["UUID"] = UUID;
+				if (recoveredConfig.contains("plugin"))
+				{
+					recoveredConfig.at("plugin")["reInstall"] = true;
+				}
+				config = std::move(recoveredConfig);
+			}
+			else
+			{
+				recoveredDir.clear();
+			}
+		}
+
 		applyCurrentConfig();
 
-		// log
+		// history: Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/history
 		{
-			std::stringstream ss;
-			ss << "New room \"" << config.at("UUID").get<std::string>() << "\" is created.";
-			// we log this message to Core
-			Util::log(ss.str(), "SYSTEM", configCore);
+			fs::path historyDir(config.at("dataDir").get<std::string>());
+			historyDir.append("history");
+			if (!recoveredDir.empty())
+			{
+				// history of the recovered room
+				fs::path recoveredHistoryDir(recoveredDir.parent_path());
+				recoveredHistoryDir.append("history");
+				fs_error_code ec;
+				if (recoveredHistoryDir != historyDir && fs::exists(recoveredHistoryDir, ec) && !fs::exists(historyDir, ec))
+				{
+					fs::rename(recoveredHistoryDir, historyDir, ec);
+				}
+			}
+			std::size_t memoryBudget = 16 * 1024 * 1024;
+			if (config.contains("room") && config.at("room").contains("historyMemoryBudget"))
+			{
+				memoryBudget = config.at("room").at("historyMemoryBudget").get<std::size_t>();
+			}
+			history_.open(historyDir, memoryBudget);
+			// initial (or recovered) diffs
+			history_.absorb(config);
 		}
+
+		// Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/state
+		if (persistEnabled(config))
+		{
+			fs::path stateDir(config.at("dataDir").get<std::string>());
+			stateDir.append("state");
+			store_.open(stateDir);
+			store_.compact(
+				capturedConfig(),
+				[recoveredDir, stateDir](const bool written)
+				{
+					// e.g. restarted within the same second (same dataDir)
+					if (written && !recoveredDir.empty() && recoveredDir != stateDir)
+					{
+						fs_error_code ec;
+						fs::remove_all(recoveredDir, ec);
+					}
+				});
+			if (!recoveredDir.empty())
+			{
+				DOPPELGANGER_LOG(this, SYSTEM, "Room \"" << UUID << "\" is recovered from " << recoveredDir.string());
+			}
+		}
+		memoryUsage_.store(estimateMemoryUsage(config) + history_.memoryUsage() + meshes_.memoryUsage() + meshEncoder_.memoryUsage());
+		scheduleMeshLOD();
 	}
 
 	void Room::shutdown()
 	{
 		// for shutdown, we broadcast here.
-		broadcastWS(std::string("shutdown"), std::string(""), nlohmann::json::object(), nlohmann::json(nullptr));
+		broadcastWS(std::string("shutdown"), std::string(""), json::object(), json(nullptr), false);
 
 		for (auto &uuid_ws : websocketSessions_)
 		{
@@ -71,8 +197,15 @@ namespace Doppelganger
 		}
 
 		// erase directories when we perform graceful shutdonw
+		// state: Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/state
+		store_.remove();
+		// history: Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/history
+		history_.remove();
+
 		// log: Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/log
 		{
+			// write pending messages and release the file before removal
+			Logger::getInstance().closeSink(config.at("dataDir").get<std::string>());
 			fs::path logDir(config.at("dataDir").get<std::string>());
 			logDir.append("log");
 			fs::remove_all(logDir);
@@ -112,133 +245,250 @@ namespace Doppelganger
 
 	void Room::applyCurrentConfig()
 	{
+		configBus_.publishAll();
+	}
+
+	bool Room::applyConfigPatch(const json &patch)
+	{
+		return configBus_.merge(config, patch) && active_.load();
+	}
+
+	void Room::subscribeConfig()
+	{
+		// history: diffs are kept in history_ (not in config)
+		configBus_.subscribe(
+			{"/history"},
+			[this](const ConfigChange &)
+			{
+				history_.absorb(config);
+				return true;
+			});
+
+		// room: limits of meshes_ and meshEncoder_
+		configBus_.subscribe(
+			{"/room/meshArenaCapacity"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("room") && config.at("room").contains("meshArenaCapacity"))
+				{
+					meshes_.setArenaCapacity(config.at("room").at("meshArenaCapacity").get<std::uint64_t>());
+				}
+				return true;
+			});
+		configBus_.subscribe(
+			{"/room/meshVersionLimit"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("room") && config.at("room").contains("meshVersionLimit"))
+				{
+					meshes_.setVersionLimit(config.at("room").at("meshVersionLimit").get<std::uint64_t>());
+				}
+				return true;
+			});
+		configBus_.subscribe(
+			{"/room/meshCacheSize"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("room") && config.at("room").contains("meshCacheSize"))
+				{
+					meshEncoder_.setCacheLimit(config.at("room").at("meshCacheSize").get<std::size_t>());
+				}
+				return true;
+			});
+
+		// meshes: buffers are kept in meshes_ (not in config)
+		configBus_.subscribe(
+			{"/meshes"},
+			[this](const ConfigChange &)
+			{
+				meshes_.absorb(config);
+				return true;
+			});
+
+		// log: cache enabled levels
+		configBus_.subscribe(
+			{"/log"},
+			[this](const ConfigChange &change)
+			{
+				logLevels_.store(Logger::levelMask(config));
+				// close the file once "FILE" is disabled (it's reopened on the next message after "FILE" is enabled again)
+				if (!change.all && change.touches("/log/type") && (logLevels_.load() & Logger::TYPE_FILE) == 0u && config.contains("dataDir"))
+				{
+					Logger::getInstance().closeSink(config.at("dataDir").get<std::string>(), true);
+				}
+				return true;
+			});
+
 		// dataDir: Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/
-		fs::path dataDir_(config.at("DoppelgangerRootDir").get<std::string>());
-		if (!config.contains("dataDir"))
-		{
-			dataDir_.append("data");
-			std::string dirName("");
-			dirName += Util::getCurrentTimestampAsString(false);
-			dirName += "-";
-			dirName += config.at("UUID").get<std::string>();
-			dataDir_.append(dirName);
-			config["dataDir"] = dataDir_.string();
-			fs::create_directories(dataDir_);
-		}
+		configBus_.subscribe(
+			{"/dataDir"},
+			[this](const ConfigChange &)
+			{
+				if (!config.contains("dataDir"))
+				{
+					fs::path dataDirPath(config.at("DoppelgangerRootDir").get<std::string>());
+					dataDirPath.append("data");
+					std::string dirName("");
+					dirName += Util::getCurrentTimestampAsString(false);
+					dirName += "-";
+					dirName += config.at("UUID").get<std::string>();
+					dataDirPath.append(dirName);
+					config["dataDir"] = dataDirPath.string();
+					fs::create_directories(dataDirPath);
+				}
+				// the first one is kept (see dataDir_)
+				if (dataDir_.empty())
+				{
+					dataDir_ = config.at("dataDir").get<std::string>();
+				}
+				return true;
+			});
 
 		// log: Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/log
-		{
-			fs::path logDir(config.at("dataDir").get<std::string>());
-			logDir.append("log");
-			fs::create_directories(logDir);
-		}
+		configBus_.subscribe(
+			{"/dataDir", "/log/type"},
+			[this](const ConfigChange &)
+			{
+				fs::path logDir(config.at("dataDir").get<std::string>());
+				logDir.append("log");
+				fs::create_directories(logDir);
+				return true;
+			});
 
 		// output: Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/output
-		{
-			fs::path outputDir(config.at("dataDir").get<std::string>());
-			outputDir.append("output");
-			fs::create_directories(outputDir);
-		}
+		configBus_.subscribe(
+			{"/dataDir", "/output"},
+			[this](const ConfigChange &)
+			{
+				fs::path outputDir(config.at("dataDir").get<std::string>());
+				outputDir.append("output");
+				fs::create_directories(outputDir);
+				return true;
+			});
 
 		// plugin: Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/plugin
-		{
-			fs::path pluginDir(config.at("dataDir").get<std::string>());
-			pluginDir.append("plugin");
-			fs::create_directories(pluginDir);
-		}
-		if (config.contains("plugin"))
-		{
-			if (config.at("plugin").contains("reInstall") && config.at("plugin").at("reInstall").get<bool>())
+		configBus_.subscribe(
+			{"/dataDir", "/plugin/reInstall"},
+			[this](const ConfigChange &)
 			{
-				config.at("plugin").at("reInstall") = false;
-				if (config.at("plugin").contains("listURL"))
+				fs::path pluginDir(config.at("dataDir").get<std::string>());
+				pluginDir.append("plugin");
+				fs::create_directories(pluginDir);
+				return true;
+			});
+		// plugins are installed again only if "reInstall" is changed (i.e. set to true)
+		configBus_.subscribe(
+			{"/plugin/reInstall"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("plugin"))
 				{
-					// get plugin catalogue
-					fs::path pluginDir(config.at("DoppelgangerRootDir").get<std::string>());
-					pluginDir.append("plugin");
-					nlohmann::json catalogue;
-					Util::getPluginCatalogue(pluginDir, config.at("plugin").at("listURL"), catalogue);
-
-					// update plugins
+					if (config.at("plugin").contains("reInstall") && config.at("plugin").at("reInstall").get<bool>())
 					{
-						// remove old plugins
-						plugin_.clear();
-
-						// initialize Doppelganger::Plugin instances
-						for (const auto &pluginEntry : catalogue)
+						config.at("plugin").at("reInstall") = false;
+						if (config.at("plugin").contains("listURL"))
 						{
-							const Doppelganger::Plugin plugin = pluginEntry.get<Doppelganger::Plugin>();
-							plugin_[plugin.name_] = plugin;
-						}
+							// get plugin catalogue
+							fs::path pluginDir(config.at("DoppelgangerRootDir").get<std::string>());
+							pluginDir.append("plugin");
+							// Util::getPluginCatalogue uses nlohmann::json (small, i.e. conversion is cheap)
+							nlohmann::json catalogueUtil;
+							Util::getPluginCatalogue(pluginDir, nlohmann::json(config.at("plugin").at("listURL")), catalogueUtil);
+							const json catalogue(catalogueUtil);
 
-						// install plugins
-						{
-							for (const auto &installedPluginJson : config.at("plugin").at("installed"))
+							// update plugins
 							{
-								const std::string name = installedPluginJson.at("name").get<std::string>();
-								const std::string version = installedPluginJson.at("version").get<std::string>();
+								// remove old plugins
+								plugin_.clear();
 
-								if (plugin_.find(name) != plugin_.end() && version.length() > 0)
+								// initialize Doppelganger::Plugin instances
+								for (const auto &pluginEntry : catalogue)
 								{
+									const Doppelganger::Plugin plugin = pluginEntry.get<Doppelganger::Plugin>();
+									plugin_[plugin.name_] = plugin;
+								}
+
+								// install plugins
+								{
+									for (const auto &installedPluginJson : config.at("plugin").at("installed"))
+									{
+										const std::string name = installedPluginJson.at("name").get<std::string>();
+										const std::string version = installedPluginJson.at("version").get<std::string>();
+
+										if (plugin_.find(name) != plugin_.end() && version.length() > 0)
+										{
 #if defined(_WIN64)
-									plugin_.at(name).install(weak_from_this(), version);
+											plugin_.at(name).install(weak_from_this(), version);
 #elif defined(__APPLE__)
-									plugin_.at(name).install(std::weak_ptr<Room>(shared_from_this()), version);
+											plugin_.at(name).install(std::weak_ptr<Room>(shared_from_this()), version);
 #elif defined(__linux__)
-									plugin_.at(name).install(weak_from_this(), version);
+											plugin_.at(name).install(weak_from_this(), version);
 #endif
+										}
+										else
+										{
+											DOPPELGANGER_LOG(this, ERROR, "Plugin \"" << name << "\" (" << version << ")"
+																					   << " is NOT found in the catalogue.");
+										}
+									}
 								}
-								else
-								{
-									std::stringstream ss;
-									ss << "Plugin \"" << name << "\" (" << version << ")"
-									   << " is NOT found in the catalogue.";
-									Util::log(ss.str(), "ERROR", config);
-								}
-							}
-						}
 
-						// install non-optional plugins
-						for (auto &name_plugin : plugin_)
-						{
-							const std::string &name = name_plugin.first;
-							Plugin &plugin = name_plugin.second;
-							if (!plugin.optional_ && (plugin.installedVersion_.size() == 0))
-							{
+								// install non-optional plugins
+								for (auto &name_plugin : plugin_)
+								{
+									const std::string &name = name_plugin.first;
+									Plugin &plugin = name_plugin.second;
+									if (!plugin.optional_ && (plugin.installedVersion_.size() == 0))
+									{
 #if defined(_WIN64)
-								plugin.install(weak_from_this(), std::string("latest"));
+										plugin.install(weak_from_this(), std::string("latest"));
 #elif defined(__APPLE__)
-								plugin.install(std::weak_ptr<Room>(shared_from_this()), std::string("latest"));
+										plugin.install(std::weak_ptr<Room>(shared_from_this()), std::string("latest"));
 #elif defined(__linux__)
-								plugin.install(weak_from_this(), std::string("latest"));
+										plugin.install(weak_from_this(), std::string("latest"));
 #endif
-								nlohmann::json installedPluginJson = nlohmann::json::object();
-								installedPluginJson["name"] = name;
-								installedPluginJson["version"] = std::string("latest");
-								config.at("plugin").at("installed").push_back(installedPluginJson);
+										json installedPluginJson = json::object();
+										installedPluginJson["name"] = name;
+										installedPluginJson["version"] = std::string("latest");
+										config.at("plugin").at("installed").push_back(installedPluginJson);
+									}
+								}
 							}
 						}
 					}
 				}
-			}
-		}
+				return true;
+			});
 
 		// config.at("mesh") is maintained by using nlohmann::json::merge_patch
 		// config.at("history") is maintained by using nlohmann::json::merge_patch
 		// config.at("extension") is maintained by using nlohmann::json::merge_patch
 
 		// "active" and "forceReload" are very critical and we take care of them in the last
-		if (config.contains("active") && !config.at("active").get<bool>())
-		{
-			shutdown();
-			return;
-		}
+		configBus_.subscribe(
+			{"/active"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("active") && !config.at("active").get<bool>())
+				{
+					active_.store(false);
+					shutdown();
+					return false;
+				}
+				return true;
+			});
 
-		if (config.contains("forceReload") && config.at("forceReload").get<bool>())
-		{
-			config.at("forceReload") = false;
-			broadcastWS(std::string("forceReload"), std::string(""), nlohmann::json::object(), nlohmann::json(nullptr));
-		}
+		configBus_.subscribe(
+			{"/forceReload"},
+			[this](const ConfigChange &)
+			{
+				if (config.contains("forceReload") && config.at("forceReload").get<bool>())
+				{
+					config.at("forceReload") = false;
+					broadcastWS(std::string("forceReload"), std::string(""), json::object(), json(nullptr), false);
+				}
+				return true;
+			});
 	}
 
 	void Room::joinWS(const WSSession &session)
@@ -260,15 +510,19 @@ namespace Doppelganger
 	{
 		std::lock_guard<std::mutex> lock(mutexWS_);
 		websocketSessions_.erase(sessionUUID);
+		touch();
 		// todo?
 		// update cursors
 	}
 
-	void Room::broadcastWS(const std::string &APIName, const std::string &sourceUUID, const nlohmann::json &broadcast, const nlohmann::json &response)
+	void Room::broadcastWS(const std::string &APIName, const std::string &sourceUUID, const json &broadcast, const json &response, const bool pluginAPI)
 	{
+		DOPPELGANGER_TRACE_SPAN("Room::broadcastWS");
+		const std::chrono::steady_clock::time_point broadcastStart = std::chrono::steady_clock::now();
+		std::uint64_t queuedBytes = 0;
 		std::lock_guard<std::mutex> lock(mutexWS_);
-		nlohmann::json broadcastJson = nlohmann::json::object();
-		nlohmann::json responseJson = nlohmann::json::object();
+		json broadcastJson = json::object();
+		json responseJson = json::object();
 		if (!broadcast.is_null())
 		{
 			broadcastJson["API"] = APIName;
@@ -300,6 +554,7 @@ namespace Doppelganger
 						[&broadcastMessage](const auto &session_)
 						{ session_->send(broadcastMessage); },
 						session);
+					queuedBytes += broadcastMessage->size();
 				}
 			}
 			else
@@ -316,9 +571,340 @@ namespace Doppelganger
 						[&responseMessage](const auto &session_)
 						{ session_->send(responseMessage); },
 						session);
+					queuedBytes += responseMessage->size();
 				}
 			}
 		}
+
+		const std::uint64_t broadcastNs = Metrics::elapsedNs(broadcastStart, std::chrono::steady_clock::now());
+		if (pluginAPI)
+		{
+			Metrics::APIMetrics &metrics = Metrics::getInstance().api(APIName);
+			metrics.duration.at(Metrics::BROADCAST).record(broadcastNs);
+			metrics.broadcastBytes.record(queuedBytes);
+		}
+		else
+		{
+			Metrics::InternalMetrics &metrics = Metrics::getInstance().internal(APIName);
+			metrics.broadcastDuration.record(broadcastNs);
+			metrics.broadcastBytes.record(queuedBytes);
+		}
+	}
+
+	void Room::announceMeshLevels(const std::string &meshUUID, const std::uint64_t version, const std::vector<MeshLOD::Level> &levels, const double transferBudget)
+	{
+		DOPPELGANGER_TRACE_SPAN("Room::announceMeshLevels");
+		// coarse to fine, then the original mesh (/<roomUUID>/mesh/<meshUUID>/<version>)
+		std::vector<std::shared_ptr<const std::string>> messages;
+		for (std::size_t l = 0; l <= levels.size(); ++l)
+		{
+			json parameters = json::object();
+			parameters["meshUUID"] = meshUUID;
+			parameters["version"] = version;
+			parameters["level"] = l;
+			parameters["levelCount"] = levels.size() + 1;
+			std::string URL = "mesh/" + meshUUID + "/" + std::to_string(version);
+			if (l < levels.size())
+			{
+				parameters["faceCount"] = levels.at(l).faceCount;
+				parameters["bytes"] = levels.at(l).bytes;
+				URL += "/" + std::to_string(l);
+			}
+			parameters["URL"] = URL;
+			json messageJson = json::object();
+			messageJson["API"] = "meshLOD";
+			messageJson["parameters"] = parameters;
+			messages.push_back(std::make_shared<const std::string>(messageJson.dump(-1, ' ', true)));
+		}
+
+		std::uint64_t queuedBytes = 0;
+		std::lock_guard<std::mutex> lock(mutexWS_);
+		for (const auto &uuid_session : websocketSessions_)
+		{
+#if defined(_WIN64)
+			std::visit(
+#elif defined(__APPLE__)
+			boost::apply_visitor(
+#elif defined(__linux__)
+			std::visit(
+#endif
+				[&](const auto &session_)
+				{
+					const std::uint64_t bandwidth = session_->bandwidth();
+					for (std::size_t l = 0; l < messages.size(); ++l)
+					{
+						// the coarsest level and the original mesh are always announced
+						const bool refinement = (l > 0 && l < levels.size());
+						if (refinement && bandwidth > 0 && static_cast<double>(levels.at(l).bytes) > transferBudget * static_cast<double>(bandwidth))
+						{
+							continue;
+						}
+						session_->send(messages.at(l));
+						queuedBytes += messages.at(l)->size();
+					}
+				},
+				uuid_session.second);
+		}
+		Metrics::getInstance().internal("meshLOD").broadcastBytes.record(queuedBytes);
+	}
+
+	bool Room::hibernate(const std::chrono::steady_clock::duration &idleFor)
+	{
+		// busy room is not idle
+		std::unique_lock<std::mutex> lock(mutexRoom_, std::try_to_lock);
+		if (!lock.owns_lock() || hibernated_.load())
+		{
+			return false;
+		}
+
+		memoryUsage_.store(estimateMemoryUsage(config) + history_.memoryUsage() + meshes_.memoryUsage() + meshEncoder_.memoryUsage());
+
+		if (idleFor <= std::chrono::steady_clock::duration::zero() || pendingAPICalls_.load() > 0)
+		{
+			return false;
+		}
+		{
+			std::lock_guard<std::mutex> lockWS(mutexWS_);
+			if (!websocketSessions_.empty())
+			{
+				return false;
+			}
+		}
+		const std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		if (now - lastActivity_.load() < std::chrono::duration_cast<std::chrono::nanoseconds>(idleFor).count())
+		{
+			return false;
+		}
+
+		// Doppelganger/data/YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX/state
+		if (store_.dir().empty())
+		{
+			fs::path stateDir(config.at("dataDir").get<std::string>());
+			stateDir.append("state");
+			store_.open(stateDir);
+		}
+		// config is moved into the snapshot (i.e. not copied), and only small entries are kept
+		json keptConfig = json::object();
+		for (const char *key : hibernationKeptKeys)
+		{
+			if (config.contains(key))
+			{
+				keptConfig[key] = config.at(key);
+			}
+		}
+		// the snapshot is materialized and written in the background (i.e. not on this io_context thread)
+		//   if it fails, wakeUp() restores config from unsavedConfig_
+		const std::shared_ptr<Room> self = shared_from_this();
+		const std::function<json()> captured = capturedConfig(std::make_shared<const json>(std::move(config)));
+		config = std::move(keptConfig);
+		store_.compact(
+			captured,
+			[self, captured](const bool written)
+			{
+				// we don't log here (config is not guarded on this thread)
+				if (!written)
+				{
+					self->unsavedConfig_ = captured();
+				}
+			});
+		// release file while hibernated
+		store_.close();
+		// diffs are in <dataDir>/history/history.bin
+		history_.releaseMemory();
+		// mesh buffers are in the snapshot
+		meshes_.clear();
+		// memfd and its reserved address range (recreated by the first buffer after wakeUp())
+		meshes_.releaseArena();
+
+		hibernated_.store(true);
+		memoryUsage_.store(estimateMemoryUsage(config) + history_.memoryUsage() + meshes_.memoryUsage() + meshEncoder_.memoryUsage());
+
+		DOPPELGANGER_LOG(this, SYSTEM, "Room \"" << UUID_ << "\" is hibernated.");
+		return true;
+	}
+
+	bool Room::wakeUp()
+	{
+		touch();
+		if (!hibernated_.load())
+		{
+			return true;
+		}
+
+		// the snapshot may be being written
+		store_.flush();
+		json restoredConfig;
+		if (!unsavedConfig_.is_null())
+		{
+			DOPPELGANGER_LOG(this, ERROR, "Room \"" << UUID_ << "\" was NOT written while hibernated. (Write)");
+			restoredConfig = std::move(unsavedConfig_);
+			unsavedConfig_ = json();
+		}
+		else if (!RoomStore::load(store_.dir(), restoredConfig))
+		{
+			DOPPELGANGER_LOG(this, ERROR, "Room \"" << UUID_ << "\" is NOT restored. (Read)");
+			return false;
+		}
+		config = std::move(restoredConfig);
+		meshes_.absorb(config);
+		if (persistEnabled(config))
+		{
+			store_.open(store_.dir());
+		}
+		else
+		{
+			store_.remove();
+		}
+		hibernated_.store(false);
+		memoryUsage_.store(estimateMemoryUsage(config) + history_.memoryUsage() + meshes_.memoryUsage() + meshEncoder_.memoryUsage());
+
+		DOPPELGANGER_LOG(this, SYSTEM, "Room \"" << UUID_ << "\" is restored.");
+		return true;
+	}
+
+	void Room::storePatch(const json &patch, const MeshStore::Snapshot &meshes)
+	{
+		if (!store_.isOpen())
+		{
+			return;
+		}
+		// diffs are persisted by history_
+		json strippedPatch;
+		if (patch.contains("history") && patch.at("history").is_object() &&
+			(patch.at("history").contains("diffFromPrev") || patch.at("history").contains("diffFromNext")))
+		{
+			strippedPatch = json::object();
+			for (const auto &item : patch.items())
+			{
+				if (item.key() != "history")
+				{
+					strippedPatch[item.key()] = item.value();
+				}
+			}
+			strippedPatch["history"] = json::object();
+			for (const auto &item : patch.at("history").items())
+			{
+				if (item.key() != "diffFromPrev" && item.key() != "diffFromNext")
+				{
+					strippedPatch.at("history")[item.key()] = item.value();
+				}
+			}
+		}
+		else
+		{
+			strippedPatch = patch;
+		}
+
+		if (meshes.empty())
+		{
+			store_.append(strippedPatch);
+		}
+		else
+		{
+			// buffers are encoded (as raw bytes) in the background
+			//   buffers are returned to meshes_ (i.e. this room) when they are released
+			const std::shared_ptr<Room> self = shared_from_this();
+			const std::shared_ptr<const json> captured = std::make_shared<const json>(std::move(strippedPatch));
+			const std::shared_ptr<const MeshStore::Snapshot> snapshot = std::make_shared<const MeshStore::Snapshot>(meshes);
+			store_.append(
+				[self, captured, snapshot]()
+				{
+					json materialized = *captured;
+					if (materialized.contains("meshes"))
+					{
+						MeshStore::materialize(materialized.at("meshes"), *snapshot, true);
+					}
+					return materialized;
+				});
+		}
+
+		std::uint64_t journalLimit = 64ull * 1024ull * 1024ull;
+		if (config.contains("room") && config.at("room").contains("journalLimit"))
+		{
+			journalLimit = config.at("room").at("journalLimit").get<std::uint64_t>();
+		}
+		if (store_.journalSize() > journalLimit)
+		{
+			store_.compact(capturedConfig());
+		}
+	}
+
+	void Room::scheduleMeshLOD()
+	{
+		std::uint32_t minFaces = 100000;
+		double transferBudget = 2.0;
+		if (config.contains("room"))
+		{
+			if (config.at("room").contains("lodMinFaces"))
+			{
+				minFaces = config.at("room").at("lodMinFaces").get<std::uint32_t>();
+			}
+			if (config.at("room").contains("lodTransferBudget"))
+			{
+				transferBudget = config.at("room").at("lodTransferBudget").get<double>();
+			}
+		}
+		for (const auto &uuid_version : meshes_.takeCreated())
+		{
+			const MeshStore::Mesh *mesh = meshes_.find(uuid_version.first, uuid_version.second);
+			if (mesh == nullptr || !mesh->F || mesh->F->rows() < static_cast<Eigen::Index>(minFaces))
+			{
+				continue;
+			}
+			// e.g. restored after hibernation
+			if (meshEncoder_.lookup(uuid_version.first, uuid_version.second, 0))
+			{
+				continue;
+			}
+			MeshLOD::getInstance().submit(shared_from_this(), uuid_version.first, uuid_version.second, *mesh, transferBudget);
+		}
+	}
+
+	std::function<json()> Room::capturedConfig()
+	{
+		return capturedConfig(std::make_shared<const json>(config));
+	}
+
+	std::function<json()> Room::capturedConfig(const std::shared_ptr<const json> &captured)
+	{
+		// buffers are returned to meshes_ (i.e. this room) when they are released
+		const std::shared_ptr<Room> self = shared_from_this();
+		const std::shared_ptr<const MeshStore::Snapshot> snapshot = std::make_shared<const MeshStore::Snapshot>(meshes_.snapshot());
+		return [self, captured, snapshot]()
+		{
+			json materialized = *captured;
+			if (materialized.contains("meshes"))
+			{
+				MeshStore::materialize(materialized.at("meshes"), *snapshot, true);
+			}
+			return materialized;
+		};
+	}
+
+	void Room::touch()
+	{
+		lastActivity_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	void Room::sessionStats(std::size_t &sessionCount, std::size_t &queuedMessages)
+	{
+		std::lock_guard<std::mutex> lock(mutexWS_);
+		sessionCount = websocketSessions_.size();
+		queuedMessages = 0;
+		for (const auto &uuid_session : websocketSessions_)
+		{
+			const WSSession &session = uuid_session.second;
+#if defined(_WIN64)
+			queuedMessages += std::visit(
+#elif defined(__APPLE__)
+			queuedMessages += boost::apply_visitor(
+#elif defined(__linux__)
+			queuedMessages += std::visit(
+#endif
+				[](const auto &session_)
+				{ return session_->queueDepth(); },
+				session);
+		}
 	}
 }
 
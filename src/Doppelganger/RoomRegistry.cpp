@@ -0,0 +1,137 @@
+#ifndef ROOMREGISTRY_CPP
+#define ROOMREGISTRY_CPP
+
+#include "Doppelganger/RoomRegistry.h"
+
+#include <chrono>
+
+namespace Doppelganger
+{
+	RoomRegistry::RoomRegistry()
+		: size_(0)
+	{
+	}
+
+	std::shared_ptr<Room> RoomRegistry::find(const std::string &UUID) const
+	{
+		const Shard &s = shard(UUID);
+		std::lock_guard<std::mutex> lock(s.mutex);
+		const auto it = s.rooms.find(UUID);
+		return (it != s.rooms.end()) ? ready(it->second) : std::shared_ptr<Room>();
+	}
+
+	std::shared_ptr<Room> RoomRegistry::findOrCreate(
+		const std::string &UUID,
+		const std::function<std::shared_ptr<Room>()> &createRoom,
+		bool &created)
+	{
+		Shard &s = shard(UUID);
+		std::promise<std::shared_ptr<Room>> promise;
+		std::shared_future<std::shared_ptr<Room>> existing;
+		{
+			std::lock_guard<std::mutex> lock(s.mutex);
+			const auto it = s.rooms.find(UUID);
+			if (it != s.rooms.end())
+			{
+				existing = it->second;
+			}
+			else
+			{
+				// placeholder
+				s.rooms[UUID] = promise.get_future().share();
+				size_.fetch_add(1);
+			}
+		}
+		if (existing.valid())
+		{
+			// we never wait for the room being created (i.e. we never block io_context threads)
+			created = false;
+			if (existing.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				return std::shared_ptr<Room>();
+			}
+			try
+			{
+				return existing.get();
+			}
+			catch (...)
+			{
+				// creation failed after we found the placeholder. the next request tries again
+				return std::shared_ptr<Room>();
+			}
+		}
+
+		std::shared_ptr<Room> room;
+		try
+		{
+			room = createRoom();
+		}
+		catch (...)
+		{
+			{
+				std::lock_guard<std::mutex> lock(s.mutex);
+				s.rooms.erase(UUID);
+				size_.fetch_sub(1);
+			}
+			promise.set_exception(std::current_exception());
+			throw;
+		}
+		promise.set_value(room);
+		created = true;
+		return room;
+	}
+
+	bool RoomRegistry::erase(const std::string &UUID)
+	{
+		Shard &s = shard(UUID);
+		std::lock_guard<std::mutex> lock(s.mutex);
+		if (s.rooms.erase(UUID) > 0)
+		{
+			size_.fetch_sub(1);
+			return true;
+		}
+		return false;
+	}
+
+	std::size_t RoomRegistry::size() const
+	{
+		return size_.load();
+	}
+
+	std::vector<std::shared_ptr<Room>> RoomRegistry::snapshot() const
+	{
+		std::vector<std::shared_ptr<Room>> rooms;
+		rooms.reserve(size());
+		for (const Shard &s : shards_)
+		{
+			std::lock_guard<std::mutex> lock(s.mutex);
+			for (const auto &uuid_room : s.rooms)
+			{
+				const std::shared_ptr<Room> room = ready(uuid_room.second);
+				if (room)
+				{
+					rooms.push_back(room);
+				}
+			}
+		}
+		return rooms;
+	}
+
+	std::shared_ptr<Room> RoomRegistry::ready(const std::shared_future<std::shared_ptr<Room>> &room)
+	{
+		// placeholders are removed before they fail (i.e. ready futures hold rooms)
+		return (room.wait_for(std::chrono::seconds(0)) == std::future_status::ready) ? room.get() : std::shared_ptr<Room>();
+	}
+
+	RoomRegistry::Shard &RoomRegistry::shard(const std::string &UUID)
+	{
+		return shards_.at(std::hash<std::string>()(UUID) % shardCount);
+	}
+
+	const RoomRegistry::Shard &RoomRegistry::shard(const std::string &UUID) const
+	{
+		return shards_.at(std::hash<std::string>()(UUID) % shardCount);
+	}
+}
+
+#endif
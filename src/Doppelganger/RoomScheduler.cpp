@@ -0,0 +1,122 @@
+#ifndef ROOMSCHEDULER_CPP
+#define ROOMSCHEDULER_CPP
+
+#include "Doppelganger/RoomScheduler.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "Doppelganger/Room.h"
+#include "Doppelganger/Logger.h"
+
+namespace Doppelganger
+{
+	RoomScheduler::RoomScheduler(IOContextPool &ioContextPool)
+		: ioContextPool_(ioContextPool)
+	{
+	}
+
+	boost::asio::io_context *RoomScheduler::assign()
+	{
+		if (!ioContextPool_.perCore())
+		{
+			return nullptr;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		load_.resize(ioContextPool_.size(), 0);
+		roomCount_.resize(ioContextPool_.size(), 0);
+
+		// least loaded (ties: fewest rooms)
+		std::size_t target = 0;
+		for (std::size_t c = 1; c < load_.size(); ++c)
+		{
+			if (load_.at(c) < load_.at(target) ||
+				(load_.at(c) == load_.at(target) && roomCount_.at(c) < roomCount_.at(target)))
+			{
+				target = c;
+			}
+		}
+
+		// until the next rebalance, the new room is assumed to be an average room
+		//   (i.e. rooms created in a burst are spread over contexts)
+		const std::uint64_t totalLoad = std::accumulate(load_.begin(), load_.end(), std::uint64_t(0));
+		const std::size_t totalRooms = std::accumulate(roomCount_.begin(), roomCount_.end(), std::size_t(0));
+		load_.at(target) += (totalRooms > 0) ? (totalLoad / totalRooms) : 0;
+		roomCount_.at(target) += 1;
+
+		return &ioContextPool_.at(target);
+	}
+
+	void RoomScheduler::rebalance(const std::vector<std::shared_ptr<Room>> &rooms, const double skew)
+	{
+		if (!ioContextPool_.perCore())
+		{
+			return;
+		}
+
+		const std::size_t contextCount = ioContextPool_.size();
+		std::vector<std::uint64_t> load(contextCount, 0);
+		std::vector<std::size_t> roomCount(contextCount, 0);
+		// per room: context, load
+		std::vector<std::size_t> roomContext(rooms.size(), contextCount);
+		std::vector<std::uint64_t> roomLoad(rooms.size(), 0);
+		for (std::size_t r = 0; r < rooms.size(); ++r)
+		{
+			const std::size_t c = ioContextPool_.index(rooms.at(r)->homeContext_.load());
+			if (c < contextCount)
+			{
+				roomContext.at(r) = c;
+				roomLoad.at(r) = rooms.at(r)->busyNs_.exchange(0, std::memory_order_relaxed);
+				load.at(c) += roomLoad.at(r);
+				roomCount.at(c) += 1;
+			}
+		}
+
+		const std::uint64_t totalLoad = std::accumulate(load.begin(), load.end(), std::uint64_t(0));
+		// each move strictly lowers the busiest context, so this terminates quickly
+		for (std::size_t move = 0; skew > 1.0 && totalLoad > 0 && move < rooms.size(); ++move)
+		{
+			const std::size_t busiest = static_cast<std::size_t>(std::max_element(load.begin(), load.end()) - load.begin());
+			const std::size_t idlest = static_cast<std::size_t>(std::min_element(load.begin(), load.end()) - load.begin());
+			const double average = static_cast<double>(totalLoad) / static_cast<double>(contextCount);
+			if (static_cast<double>(load.at(busiest)) <= skew * average)
+			{
+				break;
+			}
+
+			// the largest room that fits into the gap (moving it never makes idlest busier than busiest was)
+			const std::uint64_t gap = load.at(busiest) - load.at(idlest);
+			std::size_t candidate = rooms.size();
+			for (std::size_t r = 0; r < rooms.size(); ++r)
+			{
+				if (roomContext.at(r) == busiest && roomLoad.at(r) > 0 && roomLoad.at(r) < gap &&
+					(candidate == rooms.size() || roomLoad.at(r) > roomLoad.at(candidate)))
+				{
+					candidate = r;
+				}
+			}
+			if (candidate == rooms.size())
+			{
+				// e.g. one room occupies the whole context
+				break;
+			}
+
+			const std::shared_ptr<Room> &room = rooms.at(candidate);
+			room->homeContext_.store(&ioContextPool_.at(idlest));
+			DOPPELGANGER_LOG(room, SYSTEM, "Room is moved from io_context " << busiest << " to " << idlest << " (load " << load.at(busiest) << "ns / " << load.at(idlest) << "ns).");
+
+			roomContext.at(candidate) = idlest;
+			load.at(busiest) -= roomLoad.at(candidate);
+			load.at(idlest) += roomLoad.at(candidate);
+			roomCount.at(busiest) -= 1;
+			roomCount.at(idlest) += 1;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		load_.swap(load);
+		roomCount_.swap(roomCount);
+	}
+}
+
+#endif
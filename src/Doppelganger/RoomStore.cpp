@@ -0,0 +1,422 @@
+#ifndef ROOMSTORE_CPP
+#define ROOMSTORE_CPP
+
+#include "Doppelganger/RoomStore.h"
+#include "Doppelganger/fs_error_code.h"
+
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const char snapshotMagic[8] = {'D', 'G', 'S', 'N', 'A', 'P', '0', '1'};
+	const char journalMagic[8] = {'D', 'G', 'J', 'R', 'N', 'L', '0', '1'};
+
+	std::uint32_t checksum(const std::uint8_t *data, const std::size_t size)
+	{
+		// FNV-1a
+		std::uint32_t hash = 2166136261u;
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			hash ^= data[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	void putUInt32(std::ofstream &ofs, const std::uint32_t value)
+	{
+		const char bytes[4] = {
+			static_cast<char>(value & 0xff),
+			static_cast<char>((value >> 8) & 0xff),
+			static_cast<char>((value >> 16) & 0xff),
+			static_cast<char>((value >> 24) & 0xff)};
+		ofs.write(bytes, sizeof(bytes));
+	}
+
+	bool getUInt32(std::ifstream &ifs, std::uint32_t &value)
+	{
+		unsigned char bytes[4];
+		if (!ifs.read(reinterpret_cast<char *>(bytes), sizeof(bytes)))
+		{
+			return false;
+		}
+		value = static_cast<std::uint32_t>(bytes[0]) |
+				(static_cast<std::uint32_t>(bytes[1]) << 8) |
+				(static_cast<std::uint32_t>(bytes[2]) << 16) |
+				(static_cast<std::uint32_t>(bytes[3]) << 24);
+		return true;
+	}
+
+	bool readMagic(std::ifstream &ifs, const char (&magic)[8])
+	{
+		char header[sizeof(magic)];
+		return (ifs.read(header, sizeof(header)) && std::memcmp(header, magic, sizeof(magic)) == 0);
+	}
+
+	////
+	// background thread for writes of all RoomStores (FIFO, i.e. writes of a store keep their order)
+	//   started on the first write. queued writes are done before the process exits
+	////
+	class Writer
+	{
+	public:
+		static Writer &getInstance()
+		{
+			static Writer writer;
+			return writer;
+		}
+
+		void submit(std::function<void()> &&write)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!thread_.joinable())
+			{
+				thread_ = std::thread(&Writer::loop, this);
+			}
+			writes_.push_back(std::move(write));
+			wake_.notify_one();
+		}
+
+	private:
+		Writer()
+			: stop_(false)
+		{
+		}
+
+		~Writer()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			wake_.notify_one();
+			if (thread_.joinable())
+			{
+				thread_.join();
+			}
+		}
+
+		void loop()
+		{
+			while (true)
+			{
+				std::function<void()> write;
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					wake_.wait(
+						lock,
+						[this]()
+						{ return stop_ || !writes_.empty(); });
+					if (writes_.empty())
+					{
+						return;
+					}
+					write = std::move(writes_.front());
+					writes_.pop_front();
+				}
+				write();
+			}
+		}
+
+		std::mutex mutex_;
+		std::condition_variable wake_;
+		std::deque<std::function<void()>> writes_;
+		bool stop_;
+		std::thread thread_;
+	};
+}
+
+namespace Doppelganger
+{
+	RoomStore::RoomStore()
+		: state_(std::make_shared<state>()), open_(false)
+	{
+	}
+
+	void RoomStore::open(const fs::path &dir)
+	{
+		close();
+		dir_ = dir;
+		open_.store(true);
+		const std::shared_ptr<state> s = state_;
+		submit(
+			[s, dir]()
+			{
+				fs::create_directories(dir);
+				openJournal(*s, dir, false);
+			});
+	}
+
+	void RoomStore::close()
+	{
+		if (!open_.exchange(false))
+		{
+			return;
+		}
+		const std::shared_ptr<state> s = state_;
+		submit(
+			[s]()
+			{
+				if (s->journal.is_open())
+				{
+					s->journal.close();
+				}
+			});
+	}
+
+	void RoomStore::append(const json &patch)
+	{
+		append(
+			[patch]()
+			{
+				return patch;
+			});
+	}
+
+	void RoomStore::append(const std::function<json()> &makePatch)
+	{
+		if (!isOpen())
+		{
+			return;
+		}
+		const std::shared_ptr<state> s = state_;
+		const std::uint64_t generation = s->generation.load();
+		submit(
+			[s, makePatch, generation]()
+			{
+				if (!s->journal.is_open())
+				{
+					return;
+				}
+				const std::vector<std::uint8_t> cbor = json::to_cbor(makePatch());
+				putUInt32(s->journal, static_cast<std::uint32_t>(cbor.size()));
+				putUInt32(s->journal, checksum(cbor.data(), cbor.size()));
+				s->journal.write(reinterpret_cast<const char *>(cbor.data()), cbor.size());
+				// we don't fsync. records are safe once they reach the OS (i.e. survive a crash of this process)
+				s->journal.flush();
+				if (generation == s->generation.load())
+				{
+					s->journalSize.fetch_add(2 * sizeof(std::uint32_t) + cbor.size());
+				}
+			});
+	}
+
+	bool RoomStore::compact(const std::function<json()> &makeConfig, const std::function<void(bool)> &done)
+	{
+		if (dir_.empty())
+		{
+			return false;
+		}
+
+		// records queued so far are in the snapshot
+		state_->generation.fetch_add(1);
+		state_->journalSize.store(0);
+		const std::shared_ptr<state> s = state_;
+		const fs::path dir = dir_;
+		submit(
+			[s, dir, makeConfig, done]()
+			{
+				fs::path snapshotPath(dir);
+				snapshotPath.append("snapshot.cbor");
+				fs::path tmpPath(snapshotPath);
+				tmpPath += ".tmp";
+				bool written = false;
+				try
+				{
+					const std::vector<std::uint8_t> cbor = json::to_cbor(makeConfig());
+					std::ofstream ofs(tmpPath.string(), std::ios::out | std::ios::binary | std::ios::trunc);
+					ofs.write(snapshotMagic, sizeof(snapshotMagic));
+					ofs.write(reinterpret_cast<const char *>(cbor.data()), cbor.size());
+					ofs.close();
+					written = static_cast<bool>(ofs);
+				}
+				catch (...)
+				{
+					// e.g. std::bad_alloc
+				}
+				if (!written)
+				{
+					fs_error_code ec;
+					fs::remove(tmpPath, ec);
+				}
+				else
+				{
+					// snapshot is replaced atomically, then the journal is truncated
+					//   (if we crash in between, patches in the journal are applied twice. merge patch is idempotent.)
+					fs_error_code ec;
+					fs::rename(tmpPath, snapshotPath, ec);
+					written = !ec;
+					if (written && s->journal.is_open())
+					{
+						s->journal.close();
+						openJournal(*s, dir, true);
+					}
+				}
+				if (done)
+				{
+					done(written);
+				}
+			});
+		return true;
+	}
+
+	void RoomStore::remove()
+	{
+		close();
+		flush();
+		if (!dir_.empty())
+		{
+			fs_error_code ec;
+			fs::remove_all(dir_, ec);
+		}
+		state_->journalSize.store(0);
+	}
+
+	void RoomStore::flush()
+	{
+		std::unique_lock<std::mutex> lock(state_->mutex);
+		state_->idle.wait(
+			lock,
+			[this]()
+			{ return state_->pending == 0; });
+	}
+
+	void RoomStore::submit(std::function<void()> &&write)
+	{
+		const std::shared_ptr<state> s = state_;
+		{
+			std::lock_guard<std::mutex> lock(s->mutex);
+			++(s->pending);
+		}
+		Writer::getInstance().submit(
+			[s, write = std::move(write)]()
+			{
+				try
+				{
+					write();
+				}
+				catch (...)
+				{
+					// e.g. fs::filesystem_error. following writes are still processed
+				}
+				std::lock_guard<std::mutex> lock(s->mutex);
+				if (--(s->pending) == 0)
+				{
+					s->idle.notify_all();
+				}
+			});
+	}
+
+	bool RoomStore::load(const fs::path &dir, json &config)
+	{
+		fs::path snapshotPath(dir);
+		snapshotPath.append("snapshot.cbor");
+		std::ifstream snapshot(snapshotPath.string(), std::ios::in | std::ios::binary);
+		if (!snapshot || !readMagic(snapshot, snapshotMagic))
+		{
+			return false;
+		}
+		{
+			const std::vector<std::uint8_t> cbor((std::istreambuf_iterator<char>(snapshot)), std::istreambuf_iterator<char>());
+			json loaded = json::from_cbor(cbor, true, false);
+			if (loaded.is_discarded())
+			{
+				return false;
+			}
+			config = std::move(loaded);
+		}
+
+		fs::path journalPath(dir);
+		journalPath.append("journal.bin");
+		std::ifstream journal(journalPath.string(), std::ios::in | std::ios::binary);
+		if (journal && readMagic(journal, journalMagic))
+		{
+			fs_error_code ec;
+			const std::uintmax_t journalSize = fs::file_size(journalPath, ec);
+			if (ec)
+			{
+				return true;
+			}
+			std::uint32_t length, sum;
+			std::vector<std::uint8_t> cbor;
+			while (getUInt32(journal, length) && getUInt32(journal, sum))
+			{
+				// length is not trusted. a record longer than the rest of the file is a torn tail
+				const std::streamoff pos = journal.tellg();
+				if (pos < 0 || static_cast<std::uintmax_t>(length) > journalSize - static_cast<std::uintmax_t>(pos))
+				{
+					break;
+				}
+				cbor.resize(length);
+				if (!journal.read(reinterpret_cast<char *>(cbor.data()), length) || checksum(cbor.data(), cbor.size()) != sum)
+				{
+					// torn write
+					break;
+				}
+				const json patch = json::from_cbor(cbor, true, false);
+				if (patch.is_discarded())
+				{
+					break;
+				}
+				config.merge_patch(patch);
+			}
+		}
+		return true;
+	}
+
+	fs::path RoomStore::findLatest(const fs::path &dataRootDir, const std::string &UUID)
+	{
+		fs::path latest;
+		fs_error_code ec;
+		if (!fs::is_directory(dataRootDir, ec))
+		{
+			return latest;
+		}
+		const std::string suffix = "-" + UUID;
+		std::string latestName;
+		for (const auto &entry : fs::directory_iterator(dataRootDir, ec))
+		{
+			// YYYYMMDDTHHMMSS-room-XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX
+			const std::string name = entry.path().filename().string();
+			if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+			{
+				continue;
+			}
+			fs::path stateDir(entry.path());
+			stateDir.append("state");
+			fs::path snapshotPath(stateDir);
+			snapshotPath.append("snapshot.cbor");
+			if (fs::exists(snapshotPath, ec) && name > latestName)
+			{
+				latestName = name;
+				latest = stateDir;
+			}
+		}
+		return latest;
+	}
+
+	void RoomStore::openJournal(state &s, const fs::path &dir, const bool truncate)
+	{
+		fs::path journalPath(dir);
+		journalPath.append("journal.bin");
+		fs_error_code ec;
+		const bool exists = fs::exists(journalPath, ec) && fs::file_size(journalPath, ec) > 0;
+		if (truncate || !exists)
+		{
+			s.journal.open(journalPath.string(), std::ios::out | std::ios::binary | std::ios::trunc);
+			s.journal.write(journalMagic, sizeof(journalMagic));
+			s.journal.flush();
+		}
+		else
+		{
+			s.journal.open(journalPath.string(), std::ios::out | std::ios::binary | std::ios::app);
+			s.journalSize.fetch_add(static_cast<std::uint64_t>(fs::file_size(journalPath, ec)) - sizeof(journalMagic));
+		}
+	}
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef SSLHTTPSESSION_CPP
 #define SSLHTTPSESSION_CPP
 
+#include <chrono>
+#include <cstring>
 #include <memory>
 
 #include <boost/beast/core.hpp>
@@ -8,6 +10,11 @@
 #include <boost/asio/bind_executor.hpp>
 
 #include "Doppelganger/HTTPSession.h"
+#if defined(DOPPELGANGER_HTTP2)
+#include "Doppelganger/HTTP2Session.h"
+#endif
+#include "Doppelganger/Tracing.h"
+#include "Doppelganger/Metrics.h"
 
 namespace Doppelganger
 {
@@ -20,12 +27,13 @@ namespace Doppelganger
 	SSLHTTPSession::SSLHTTPSession(
 		const std::weak_ptr<Core> &core,
 		beast::tcp_stream &&stream,
-		ssl::context &ctx,
+		const std::shared_ptr<ssl::context> &ctx,
 		beast::flat_buffer &&buffer)
 		: HTTPSession<SSLHTTPSession>(
 			  core,
 			  std::move(buffer)),
-		  stream_(std::move(stream), ctx)
+		  ctx_(ctx),
+		  stream_(std::move(stream), *ctx_)
 	{
 	}
 
@@ -33,6 +41,7 @@ namespace Doppelganger
 	{
 		// Set the timeout.
 		beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(30));
+		handshakeStart_ = std::chrono::steady_clock::now();
 
 		// Perform the SSL handshake
 		// Note, this is the buffered version of the handshake.
@@ -70,14 +79,36 @@ namespace Doppelganger
 		beast::error_code ec,
 		std::size_t bytes_used)
 	{
+		DOPPELGANGER_TRACE_SPAN("SSLHTTPSession::onHandshake");
+		Metrics::TLSMetrics &metrics = Metrics::getInstance().tls();
 		if (ec)
 		{
+			metrics.errors.fetch_add(1, std::memory_order_relaxed);
 			return fail(ec, "handshake (HTTP)");
 		}
+		metrics.handshakeDuration.record(Metrics::elapsedNs(handshakeStart_, std::chrono::steady_clock::now()));
+		metrics.handshakes.fetch_add(1, std::memory_order_relaxed);
+		// session cache or session ticket
+		if (SSL_session_reused(stream_.native_handle()))
+		{
+			metrics.resumed.fetch_add(1, std::memory_order_relaxed);
+		}
 
 		// Consume the portion of the buffer used by the handshake
 		buffer_.consume(bytes_used);
 
+#if defined(DOPPELGANGER_HTTP2)
+		// "h2" is selected with ALPN (see enableHTTP2)
+		const unsigned char *protocol = nullptr;
+		unsigned int length = 0;
+		SSL_get0_alpn_selected(stream_.native_handle(), &protocol, &length);
+		if (length == 2 && std::memcmp(protocol, "h2", 2) == 0)
+		{
+			beast::get_lowest_layer(stream_).expires_never();
+			return makeHTTP2Session(core_, std::move(stream_), std::move(buffer_));
+		}
+#endif
+
 		doRead();
 	}
 
@@ -0,0 +1,185 @@
+#ifndef TLSSESSIONCACHE_CPP
+#define TLSSESSIONCACHE_CPP
+
+#include "Doppelganger/TLSSessionCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+namespace
+{
+	bool generateKey(Doppelganger::TLSSessionCache::TicketKey &key)
+	{
+		key.createdAt = std::chrono::steady_clock::now();
+		return (RAND_bytes(key.name.data(), static_cast<int>(key.name.size())) == 1 &&
+				RAND_bytes(key.AESKey.data(), static_cast<int>(key.AESKey.size())) == 1 &&
+				RAND_bytes(key.HMACKey.data(), static_cast<int>(key.HMACKey.size())) == 1);
+	}
+
+	////
+	// see SSL_CTX_set_tlsext_ticket_key_cb(3)
+	//   return value (encrypt): 1 success, -1 failure
+	//   return value (decrypt): 1 success, 2 success (issue a new ticket), 0 unknown key (full handshake), -1 failure
+	////
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	bool setHMACKey(EVP_MAC_CTX *macCtx, const Doppelganger::TLSSessionCache::TicketKey &key)
+	{
+		char digest[] = "SHA256";
+		OSSL_PARAM params[3];
+		params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char *>(key.HMACKey.data()), key.HMACKey.size());
+		params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0);
+		params[2] = OSSL_PARAM_construct_end();
+		return (EVP_MAC_CTX_set_params(macCtx, params) == 1);
+	}
+
+	int ticketKeyCallback(SSL *ssl, unsigned char keyName[16], unsigned char iv[EVP_MAX_IV_LENGTH], EVP_CIPHER_CTX *cipherCtx, EVP_MAC_CTX *macCtx, int encrypt)
+#else
+	bool setHMACKey(HMAC_CTX *macCtx, const Doppelganger::TLSSessionCache::TicketKey &key)
+	{
+		return (HMAC_Init_ex(macCtx, key.HMACKey.data(), static_cast<int>(key.HMACKey.size()), EVP_sha256(), nullptr) == 1);
+	}
+
+	int ticketKeyCallback(SSL *ssl, unsigned char keyName[16], unsigned char iv[EVP_MAX_IV_LENGTH], EVP_CIPHER_CTX *cipherCtx, HMAC_CTX *macCtx, int encrypt)
+#endif
+	{
+		(void)ssl;
+		Doppelganger::TLSSessionCache &cache = Doppelganger::TLSSessionCache::getInstance();
+		Doppelganger::TLSSessionCache::TicketKey key;
+
+		if (encrypt)
+		{
+			if (!cache.currentKey(key) || RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+			{
+				return -1;
+			}
+			std::memcpy(keyName, key.name.data(), key.name.size());
+			if (EVP_EncryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key.AESKey.data(), iv) != 1 || !setHMACKey(macCtx, key))
+			{
+				return -1;
+			}
+			return 1;
+		}
+
+		bool isCurrent;
+		if (!cache.findKey(keyName, key, isCurrent))
+		{
+			return 0;
+		}
+		if (!setHMACKey(macCtx, key) || EVP_DecryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key.AESKey.data(), iv) != 1)
+		{
+			return -1;
+		}
+		// tickets with the previous key are renewed
+		return isCurrent ? 1 : 2;
+	}
+}
+
+namespace Doppelganger
+{
+	TLSSessionCache &TLSSessionCache::getInstance()
+	{
+		static TLSSessionCache cache;
+		return cache;
+	}
+
+	TLSSessionCache::TLSSessionCache()
+		: keyLifetime_(3600)
+	{
+	}
+
+	void TLSSessionCache::configure(boost::asio::ssl::context &ctx, const json &tlsConfig)
+	{
+		SSL_CTX *nativeCtx = ctx.native_handle();
+
+		// TLS 1.2 and 1.3 (TLS 1.3 is negotiated whenever the client supports it)
+		const std::string minVersion = tlsConfig.at("minVersion").get<std::string>();
+		SSL_CTX_set_min_proto_version(nativeCtx, (minVersion == "1.3") ? TLS1_3_VERSION : TLS1_2_VERSION);
+		SSL_CTX_set_max_proto_version(nativeCtx, 0);
+
+		// lifetime of sessions (both in the cache and in tickets)
+		SSL_CTX_set_timeout(nativeCtx, std::max(1L, tlsConfig.at("sessionTimeout").get<long>()));
+
+		// session cache (session ID in TLS 1.2, stateful PSK in TLS 1.3 without tickets)
+		const long cacheSize = tlsConfig.at("sessionCacheSize").get<long>();
+		if (cacheSize > 0)
+		{
+			static const unsigned char sessionIdContext[] = "Doppelganger";
+			SSL_CTX_set_session_id_context(nativeCtx, sessionIdContext, sizeof(sessionIdContext) - 1);
+			SSL_CTX_set_session_cache_mode(nativeCtx, SSL_SESS_CACHE_SERVER);
+			SSL_CTX_sess_set_cache_size(nativeCtx, cacheSize);
+		}
+		else
+		{
+			SSL_CTX_set_session_cache_mode(nativeCtx, SSL_SESS_CACHE_OFF);
+		}
+
+		// session tickets
+		if (tlsConfig.at("sessionTickets").get<bool>())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				// keys are kept (i.e. tickets survive reloading of the certificate)
+				keyLifetime_ = std::chrono::seconds(std::max(1, tlsConfig.at("ticketKeyLifetime").get<int>()));
+			}
+			SSL_CTX_clear_options(nativeCtx, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			SSL_CTX_set_tlsext_ticket_key_evp_cb(nativeCtx, ticketKeyCallback);
+#else
+			SSL_CTX_set_tlsext_ticket_key_cb(nativeCtx, ticketKeyCallback);
+#endif
+		}
+		else
+		{
+			SSL_CTX_set_options(nativeCtx, SSL_OP_NO_TICKET);
+		}
+	}
+
+	bool TLSSessionCache::currentKey(TicketKey &key)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (keys_.empty() || std::chrono::steady_clock::now() - keys_.front().createdAt >= keyLifetime_)
+		{
+			// rotate (the previous key is kept for decryption)
+			TicketKey newKey;
+			if (!generateKey(newKey))
+			{
+				return false;
+			}
+			keys_.insert(keys_.begin(), newKey);
+			keys_.resize(std::min<std::size_t>(keys_.size(), 2));
+		}
+		key = keys_.front();
+		return true;
+	}
+
+	bool TLSSessionCache::findKey(const unsigned char name[16], TicketKey &key, bool &isCurrent)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		for (std::size_t k = 0; k < keys_.size(); ++k)
+		{
+			// keys older than 2 lifetimes are not accepted (even if no ticket has been issued since then)
+			if (std::memcmp(keys_.at(k).name.data(), name, keys_.at(k).name.size()) == 0 &&
+				now - keys_.at(k).createdAt < 2 * keyLifetime_)
+			{
+				key = keys_.at(k);
+				isCurrent = (k == 0 && now - key.createdAt < keyLifetime_);
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+#endif
@@ -0,0 +1,373 @@
+#ifndef TRACERECORDER_CPP
+#define TRACERECORDER_CPP
+
+#include "Doppelganger/TraceRecorder.h"
+
+#include "Doppelganger/Logger.h"
+#include "Doppelganger/fs_error_code.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	template <typename T>
+	void putUInt(std::string &out, const T value)
+	{
+		for (std::size_t b = 0; b < sizeof(T); ++b)
+		{
+			out.push_back(static_cast<char>((static_cast<std::uint64_t>(value) >> (8 * b)) & 0xff));
+		}
+	}
+
+	template <typename T>
+	bool getUInt(const std::string &in, std::size_t &pos, T &value)
+	{
+		if (pos + sizeof(T) > in.size())
+		{
+			return false;
+		}
+		std::uint64_t v = 0;
+		for (std::size_t b = 0; b < sizeof(T); ++b)
+		{
+			v |= (static_cast<std::uint64_t>(static_cast<unsigned char>(in[pos + b])) << (8 * b));
+		}
+		value = static_cast<T>(v);
+		pos += sizeof(T);
+		return true;
+	}
+
+	template <typename LengthT>
+	void putBytes(std::string &out, const std::string &bytes)
+	{
+		const std::size_t maxLength = static_cast<std::size_t>(static_cast<LengthT>(-1));
+		const std::size_t length = std::min(bytes.size(), maxLength);
+		putUInt<LengthT>(out, static_cast<LengthT>(length));
+		out.append(bytes.data(), length);
+	}
+
+	template <typename LengthT>
+	bool getBytes(const std::string &in, std::size_t &pos, std::string &bytes)
+	{
+		LengthT length;
+		if (!getUInt<LengthT>(in, pos, length) || pos + length > in.size())
+		{
+			return false;
+		}
+		bytes.assign(in.data() + pos, length);
+		pos += length;
+		return true;
+	}
+
+	// bytes between the current position and the end of the stream (-1 if the stream is not seekable, e.g. pipe)
+	std::streamoff remainingBytes(std::istream &is)
+	{
+		const std::istream::pos_type current = is.tellg();
+		if (current == std::istream::pos_type(-1))
+		{
+			return -1;
+		}
+		is.seekg(0, std::ios::end);
+		const std::istream::pos_type end = is.tellg();
+		is.clear();
+		is.seekg(current);
+		if (end == std::istream::pos_type(-1) || !is)
+		{
+			return -1;
+		}
+		return static_cast<std::streamoff>(end - current);
+	}
+}
+
+namespace Doppelganger
+{
+	////
+	// TraceRecord
+	////
+	const char TraceRecord::magic[8] = {'D', 'G', 'T', 'R', 'A', 'C', 'E', '2'};
+
+	void TraceRecord::encode(std::string &out) const
+	{
+		const std::size_t head = out.size();
+		// placeholder for length
+		putUInt<std::uint32_t>(out, 0);
+		putUInt<std::uint64_t>(out, timestamp);
+		putUInt<std::uint8_t>(out, transport);
+		putBytes<std::uint16_t>(out, roomUUID);
+		putBytes<std::uint16_t>(out, sessionUUID);
+		putBytes<std::uint16_t>(out, APIName);
+		putBytes<std::uint32_t>(out, parameters);
+		putUInt<std::uint64_t>(out, duration);
+		putUInt<std::uint32_t>(out, responseSize);
+		putUInt<std::uint8_t>(out, failed);
+
+		std::string length;
+		putUInt<std::uint32_t>(length, static_cast<std::uint32_t>(out.size() - head - sizeof(std::uint32_t)));
+		out.replace(head, length.size(), length);
+	}
+
+	bool TraceRecord::readHeader(std::istream &is)
+	{
+		char header[sizeof(magic)];
+		return (is.read(header, sizeof(magic)) && std::memcmp(header, magic, sizeof(magic)) == 0);
+	}
+
+	bool TraceRecord::decode(std::istream &is)
+	{
+		char lengthBytes[sizeof(std::uint32_t)];
+		if (!is.read(lengthBytes, sizeof(lengthBytes)))
+		{
+			return false;
+		}
+		std::size_t pos = 0;
+		std::uint32_t length;
+		getUInt<std::uint32_t>(std::string(lengthBytes, sizeof(lengthBytes)), pos, length);
+
+		// length is not trusted (e.g. truncated or corrupted trace). we never allocate more than the stream has
+		const std::streamoff remaining = remainingBytes(is);
+		if (remaining >= 0 && static_cast<std::uint64_t>(length) > static_cast<std::uint64_t>(remaining))
+		{
+			return false;
+		}
+		std::string body;
+		while (body.size() < length)
+		{
+			// for streams without size, the body grows with the bytes actually read
+			const std::size_t offset = body.size();
+			const std::size_t chunk = std::min<std::size_t>(length - offset, 64 * 1024);
+			body.resize(offset + chunk);
+			if (!is.read(&body[offset], chunk))
+			{
+				return false;
+			}
+		}
+
+		pos = 0;
+		return getUInt<std::uint64_t>(body, pos, timestamp) &&
+			   getUInt<std::uint8_t>(body, pos, transport) &&
+			   getBytes<std::uint16_t>(body, pos, roomUUID) &&
+			   getBytes<std::uint16_t>(body, pos, sessionUUID) &&
+			   getBytes<std::uint16_t>(body, pos, APIName) &&
+			   getBytes<std::uint32_t>(body, pos, parameters) &&
+			   getUInt<std::uint64_t>(body, pos, duration) &&
+			   getUInt<std::uint32_t>(body, pos, responseSize) &&
+			   getUInt<std::uint8_t>(body, pos, failed) &&
+			   pos == body.size();
+	}
+
+	////
+	// TraceRecorder
+	////
+	TraceRecorder &TraceRecorder::getInstance()
+	{
+		static TraceRecorder recorder;
+		return recorder;
+	}
+
+	TraceRecorder::TraceRecorder()
+		: enabled_(false), queuedBytes_(0), dropped_(0), running_(false), maxFileSize_(64ull * 1024ull * 1024ull), maxFiles_(4), currentSize_(0), logLevels_(Logger::LEVEL_ALL | Logger::TYPE_STDOUT)
+	{
+	}
+
+	TraceRecorder::~TraceRecorder()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutexQueue_);
+			running_ = false;
+		}
+		wake_.notify_one();
+		// queued records are written before writer_ exits
+		if (writer_.joinable())
+		{
+			writer_.join();
+		}
+	}
+
+	void TraceRecorder::configure(const json &configCore)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		bool enabled = false;
+		if (configCore.contains("trace") && configCore.contains("dataDir"))
+		{
+			const json &traceConfig = configCore.at("trace");
+			enabled = traceConfig.contains("enabled") && traceConfig.at("enabled").get<bool>();
+			if (traceConfig.contains("maxFileSize"))
+			{
+				maxFileSize_ = traceConfig.at("maxFileSize").get<std::uint64_t>();
+			}
+			if (traceConfig.contains("maxFiles"))
+			{
+				maxFiles_ = std::max(1, traceConfig.at("maxFiles").get<int>());
+			}
+
+			logLevels_ = Logger::levelMask(configCore);
+			dataDir_ = configCore.at("dataDir").get<std::string>();
+			fs::path dir(dataDir_);
+			dir.append("trace");
+			if (dir != dir_)
+			{
+				ofs_.close();
+				dir_ = dir;
+			}
+		}
+
+		if (enabled && !ofs_.is_open())
+		{
+			open();
+		}
+		else if (!enabled && ofs_.is_open())
+		{
+			ofs_.close();
+		}
+		enabled_.store(enabled && ofs_.is_open());
+
+		if (enabled_.load())
+		{
+			std::lock_guard<std::mutex> lockQueue(mutexQueue_);
+			if (!running_)
+			{
+				running_ = true;
+				writer_ = std::thread(&TraceRecorder::writerLoop, this);
+			}
+		}
+	}
+
+	void TraceRecorder::record(const TraceRecord &record)
+	{
+		if (!isEnabled())
+		{
+			return;
+		}
+
+		std::string encoded;
+		record.encode(encoded);
+		{
+			std::lock_guard<std::mutex> lock(mutexQueue_);
+			if (queuedBytes_ + encoded.size() > maxQueuedBytes)
+			{
+				++dropped_;
+				return;
+			}
+			queuedBytes_ += encoded.size();
+			queue_.push_back(std::move(encoded));
+		}
+		wake_.notify_one();
+	}
+
+	void TraceRecorder::writerLoop()
+	{
+		std::vector<std::string> batch;
+		while (true)
+		{
+			std::uint64_t dropped = 0;
+			{
+				std::unique_lock<std::mutex> lock(mutexQueue_);
+				wake_.wait(
+					lock,
+					[this]()
+					{ return !queue_.empty() || !running_; });
+				if (queue_.empty())
+				{
+					// every record is written
+					return;
+				}
+				batch.swap(queue_);
+				queuedBytes_ = 0;
+				std::swap(dropped, dropped_);
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			write(batch);
+			batch.clear();
+			if (dropped > 0)
+			{
+				Logger::log(std::to_string(dropped).append(" trace records are dropped (the disk is slower than API calls)"), Logger::LEVEL_ERROR, logLevels_, dataDir_);
+			}
+		}
+	}
+
+	void TraceRecorder::write(const std::vector<std::string> &batch)
+	{
+		for (const auto &encoded : batch)
+		{
+			// e.g. disabled while records are queued
+			if (!ofs_.is_open())
+			{
+				return;
+			}
+			if (currentSize_ + encoded.size() > maxFileSize_ && currentSize_ > sizeof(TraceRecord::magic))
+			{
+				rotate();
+				if (!ofs_.is_open())
+				{
+					return;
+				}
+			}
+			ofs_.write(encoded.data(), encoded.size());
+			currentSize_ += encoded.size();
+		}
+		ofs_.flush();
+	}
+
+	void TraceRecorder::open()
+	{
+		fs_error_code ec;
+		fs::create_directories(dir_, ec);
+		if (ec)
+		{
+			Logger::log(std::string("Failed to create \"").append(dir_.string()).append("\": ").append(ec.message()), Logger::LEVEL_ERROR, logLevels_, dataDir_);
+			return;
+		}
+		fs::path filePath(dir_);
+		filePath.append("trace.0.bin");
+		const std::uintmax_t size = fs::file_size(filePath, ec);
+		currentSize_ = ec ? 0 : static_cast<std::uint64_t>(size);
+		ofs_.open(filePath.string(), std::ios::out | std::ios::binary | std::ios::app);
+		if (!ofs_)
+		{
+			Logger::log(std::string("Failed to open \"").append(filePath.string()).append("\""), Logger::LEVEL_ERROR, logLevels_, dataDir_);
+			return;
+		}
+		if (currentSize_ == 0)
+		{
+			ofs_.write(TraceRecord::magic, sizeof(TraceRecord::magic));
+			currentSize_ += sizeof(TraceRecord::magic);
+		}
+	}
+
+	void TraceRecorder::rotate()
+	{
+		ofs_.close();
+		// trace.<n-2>.bin -> trace.<n-1>.bin, ..., trace.0.bin -> trace.1.bin
+		//   on failure, the remaining files are kept and trace.0.bin is appended (i.e. rotation is retried by the next record)
+		for (int fIdx = maxFiles_ - 1; fIdx >= 0; --fIdx)
+		{
+			fs::path src(dir_);
+			src.append("trace." + std::to_string(fIdx) + ".bin");
+			fs_error_code ec;
+			if (!fs::exists(src, ec))
+			{
+				continue;
+			}
+			if (fIdx == maxFiles_ - 1)
+			{
+				fs::remove(src, ec);
+			}
+			else
+			{
+				fs::path dst(dir_);
+				dst.append("trace." + std::to_string(fIdx + 1) + ".bin");
+				fs::rename(src, dst, ec);
+			}
+			if (ec)
+			{
+				Logger::log(std::string("Failed to rotate \"").append(src.string()).append("\": ").append(ec.message()), Logger::LEVEL_ERROR, logLevels_, dataDir_);
+				break;
+			}
+		}
+		open();
+	}
+}
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef TRACING_CPP
+#define TRACING_CPP
+
+#include "Doppelganger/Tracing.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace Doppelganger
+{
+	std::atomic<bool> Tracer::enabled_(false);
+
+	Tracer &Tracer::getInstance()
+	{
+		static Tracer tracer;
+		return tracer;
+	}
+
+	Tracer::Tracer()
+		: eventsPerThread_(65536)
+	{
+	}
+
+	void Tracer::configure(const json &configCore)
+	{
+		bool enabled = false;
+		if (configCore.contains("spans"))
+		{
+			const json &spansConfig = configCore.at("spans");
+			enabled = spansConfig.contains("enabled") && spansConfig.at("enabled").get<bool>();
+			if (spansConfig.contains("eventsPerThread"))
+			{
+				// applied to buffers created afterwards
+				eventsPerThread_.store(std::max<std::size_t>(1, spansConfig.at("eventsPerThread").get<std::size_t>()));
+			}
+		}
+		enabled_.store(enabled);
+	}
+
+	void Tracer::record(const char *name, const std::uint64_t start, const std::uint64_t end)
+	{
+		ThreadBuffer &buffer = threadBuffer();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		if (buffer.events.size() < eventsPerThread_.load(std::memory_order_relaxed) && buffer.recorded == buffer.events.size())
+		{
+			buffer.events.push_back(Event({name, start, end}));
+		}
+		else
+		{
+			// ring buffer (we keep the latest events)
+			buffer.events.at(buffer.recorded % buffer.events.size()) = Event({name, start, end});
+		}
+		++buffer.recorded;
+	}
+
+	Tracer::ThreadBuffer &Tracer::threadBuffer()
+	{
+		thread_local std::shared_ptr<ThreadBuffer> buffer;
+		if (!buffer)
+		{
+			buffer = std::make_shared<ThreadBuffer>();
+			buffer->recorded = 0;
+			std::lock_guard<std::mutex> lock(mutex_);
+			buffer->threadId = static_cast<std::uint32_t>(buffers_.size() + 1);
+			// buffers_ keeps buffers of finished threads (their events are still exported)
+			buffers_.push_back(buffer);
+		}
+		return *buffer;
+	}
+
+	void Tracer::exportChromeTrace(std::ostream &os)
+	{
+		std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			buffers = buffers_;
+		}
+
+		// "X" (complete) events, ts/dur in microseconds
+		os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		os << std::fixed << std::setprecision(3);
+		bool first = true;
+		std::vector<Event> events;
+		for (const auto &buffer : buffers)
+		{
+			std::uint32_t threadId;
+			{
+				std::lock_guard<std::mutex> lock(buffer->mutex);
+				events = buffer->events;
+				threadId = buffer->threadId;
+			}
+			for (const auto &event : events)
+			{
+				if (!first)
+				{
+					os << ",";
+				}
+				first = false;
+				os << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadId
+				   << ",\"ts\":" << static_cast<double>(event.start) / 1000.0
+				   << ",\"dur\":" << static_cast<double>(event.end - event.start) / 1000.0 << "}";
+			}
+		}
+		os << "]}";
+	}
+}
+
+#endif
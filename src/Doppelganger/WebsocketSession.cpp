@@ -6,19 +6,70 @@
 
 #include "Doppelganger/WebsocketSession.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <sstream>
+#if defined(_WIN64)
+#elif defined(__APPLE__)
+#include <unistd.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
 
 #include "Doppelganger/Room.h"
 #include "Doppelganger/Plugin.h"
-#include "Doppelganger/Util/log.h"
+#include "Doppelganger/TraceRecorder.h"
+#include "Doppelganger/Metrics.h"
+#include "Doppelganger/Logger.h"
+
+namespace
+{
+	// writes smaller than this are not used for estimating bandwidth
+	const std::size_t minBandwidthSample = 16 * 1024;
+}
 
 namespace Doppelganger
 {
 	////
 	// WebsocketSession
 	////
+	beast::tcp_stream moveToHomeContext(beast::tcp_stream &&stream, const std::weak_ptr<Room> &room)
+	{
+		const std::shared_ptr<Room> r = room.lock();
+		net::io_context *homeContext = r ? r->homeContext_.load() : nullptr;
+		if (homeContext == nullptr)
+		{
+			return std::move(stream);
+		}
+		tcp::socket &socket = stream.socket();
+		beast::error_code ec;
+		const tcp::endpoint endpoint = socket.local_endpoint(ec);
+		if (ec)
+		{
+			return std::move(stream);
+		}
+		const tcp::socket::native_handle_type handle = socket.release(ec);
+		if (ec)
+		{
+			return std::move(stream);
+		}
+		tcp::socket moved(net::make_strand(*homeContext));
+		moved.assign(endpoint.protocol(), handle, ec);
+		if (ec)
+		{
+			// the handle is owned by nobody. the connection is dropped (moved is not open)
+#if defined(_WIN64)
+			::closesocket(handle);
+#elif defined(__APPLE__)
+			::close(handle);
+#elif defined(__linux__)
+			::close(handle);
+#endif
+		}
+		return beast::tcp_stream(std::move(moved));
+	}
+
 	template <class Derived>
 	Derived &WebsocketSession<Derived>::derived()
 	{
@@ -38,10 +89,10 @@ namespace Doppelganger
 			}
 
 			room->joinWS(derived().shared_from_this());
-			nlohmann::json broadcast = nlohmann::json(nullptr);
-			nlohmann::json response = nlohmann::json::object();
+			json broadcast = json(nullptr);
+			json response = json::object();
 			response["sessionUUID"] = UUID_;
-			room->broadcastWS("initializeSession", UUID_, broadcast, response);
+			room->broadcastWS("initializeSession", UUID_, broadcast, response, false);
 
 			// Read a message
 			doRead();
@@ -67,9 +118,6 @@ namespace Doppelganger
 
 		if (room)
 		{
-			// API
-			std::lock_guard<std::mutex> lock(room->mutexRoom_);
-
 			boost::ignore_unused(bytes_transferred);
 
 			if (ec == websocket::error::closed)
@@ -82,42 +130,149 @@ namespace Doppelganger
 				return fail(ec, "read (websocket)");
 			}
 
-			try
+			const std::chrono::system_clock::time_point receivedAt = std::chrono::system_clock::now();
+			const std::string payload = boost::beast::buffers_to_string(buffer_.data());
+			buffer_.consume(buffer_.size());
+
+			// the home context may change (see RoomScheduler::rebalance())
+			net::io_context *homeContext = room->homeContext_.load();
+			if (homeContext != nullptr && !homeContext->get_executor().running_in_this_thread())
+			{
+				// we read the next message after the API call (i.e. messages of this session keep their order)
+				net::post(
+					*homeContext,
+					[self = derived().shared_from_this(), room, payload, receivedAt]()
+					{
+						self->process(room, payload, receivedAt);
+						net::post(
+							self->ws().get_executor(),
+							beast::bind_front_handler(
+								&WebsocketSession::doRead,
+								self));
+					});
+				return;
+			}
+
+			process(room, payload, receivedAt);
+			doRead();
+		}
+	}
+
+	template <class Derived>
+	void WebsocketSession<Derived>::process(const std::shared_ptr<Room> &room, const std::string &payload, const std::chrono::system_clock::time_point receivedAt)
+	{
+		std::string APIName;
+		std::string sourceUUID;
+		json requestId;
+		std::uint64_t pluginNs = 0;
+		std::uint32_t responseSize = 0;
+		// failed calls are recorded, too (with "failed")
+		//   clients sending "requestId" (e.g. doppelganger-replay) receive {"API": "completed", "parameters": {"requestId", "API", "failed"}} after the response
+		const auto complete = [this, &room, &payload, &receivedAt, &APIName, &sourceUUID, &requestId, &pluginNs, &responseSize](const bool failed)
+		{
+			if (TraceRecorder::getInstance().isEnabled())
 			{
-				const std::string payload = boost::beast::buffers_to_string(buffer_.data());
-				const nlohmann::json parameters = nlohmann::json::parse(payload);
-				const std::string APIName = parameters.at("API").get<std::string>();
-				const std::string sourceUUID = parameters.at("sessionUUID").get<std::string>();
-
-				nlohmann::json response, broadcast;
-				room->plugin_.at(APIName).pluginProcess(
-					room,
-					parameters.at("parameters"),
-					response,
-					broadcast);
-
-				// broadcast
-				if (!broadcast.is_null() || !response.is_null())
-				{
-					room->broadcastWS(APIName, sourceUUID, broadcast, response);
-				}
+				TraceRecord record;
+				record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(receivedAt.time_since_epoch()).count();
+				record.transport = TraceRecord::WS;
+				record.roomUUID = room->UUID_;
+				record.sessionUUID = sourceUUID;
+				record.APIName = APIName;
+				record.parameters = payload;
+				record.duration = pluginNs;
+				record.responseSize = responseSize;
+				record.failed = failed ? 1 : 0;
+				TraceRecorder::getInstance().record(record);
 			}
-			catch (...)
+			if (!requestId.is_null())
 			{
-				std::stringstream logContent;
-				logContent << "Invalid WS API Call...";
-				Util::log(logContent.str(), "ERROR", room->config);
+				json completed = json::object();
+				completed["API"] = "completed";
+				completed["parameters"] = json::object();
+				completed.at("parameters")["requestId"] = requestId;
+				completed.at("parameters")["API"] = APIName;
+				completed.at("parameters")["failed"] = failed;
+				send(std::make_shared<const std::string>(completed.dump(-1, ' ', true)));
+			}
+		};
+
+		// API
+		const std::chrono::steady_clock::time_point lockStart = std::chrono::steady_clock::now();
+		room->pendingAPICalls_.fetch_add(1, std::memory_order_relaxed);
+		std::lock_guard<std::mutex> lock(room->mutexRoom_);
+		room->pendingAPICalls_.fetch_sub(1, std::memory_order_relaxed);
+		const std::uint64_t lockWait = Metrics::elapsedNs(lockStart, std::chrono::steady_clock::now());
+
+		Metrics::APIMetrics *metrics = nullptr;
+		std::chrono::steady_clock::time_point pluginStart;
+		bool pluginStarted = false;
+		try
+		{
+			const json parameters = json::parse(payload);
+			if (parameters.contains("requestId"))
+			{
+				requestId = parameters.at("requestId");
+			}
+			APIName = parameters.at("API").get<std::string>();
+			sourceUUID = parameters.at("sessionUUID").get<std::string>();
+			// plugins must not see (and persist) config stripped by hibernation
+			if (!room->wakeUp())
+			{
+				DOPPELGANGER_LOG(room, ERROR, "WS API Call is rejected. Room \"" << room->UUID_ << "\" can't be restored.");
+				return complete(true);
+			}
+			// we only create metrics for existing plugins (APIName is given by the client)
+			if (room->plugin_.find(APIName) != room->plugin_.end())
+			{
+				metrics = &(Metrics::getInstance().api(APIName));
+				metrics->duration.at(Metrics::LOCK_WAIT).record(lockWait);
 			}
 
-			buffer_.consume(buffer_.size());
+			json response, broadcast;
+			pluginStart = std::chrono::steady_clock::now();
+			pluginStarted = true;
+			room->plugin_.at(APIName).pluginProcess(
+				room,
+				parameters.at("parameters"),
+				response,
+				broadcast);
+			pluginNs = Metrics::elapsedNs(pluginStart, std::chrono::steady_clock::now());
+			pluginStarted = false;
+			room->busyNs_.fetch_add(pluginNs, std::memory_order_relaxed);
+
+			// for WS, response is serialized in broadcastWS (we only measure it while tracing)
+			if (TraceRecorder::getInstance().isEnabled())
+			{
+				responseSize = response.is_null() ? 0 : static_cast<std::uint32_t>(response.dump().size());
+			}
 
-			doRead();
+			// broadcast
+			if (!broadcast.is_null() || !response.is_null())
+			{
+				room->broadcastWS(APIName, sourceUUID, broadcast, response, true);
+			}
+			complete(false);
+		}
+		catch (...)
+		{
+			if (pluginStarted)
+			{
+				pluginNs = Metrics::elapsedNs(pluginStart, std::chrono::steady_clock::now());
+				room->busyNs_.fetch_add(pluginNs, std::memory_order_relaxed);
+			}
+			if (metrics != nullptr)
+			{
+				metrics->errors.fetch_add(1, std::memory_order_relaxed);
+			}
+			DOPPELGANGER_LOG(room, ERROR, "Invalid WS API Call...");
+			complete(true);
 		}
 	}
 
 	template <class Derived>
 	void WebsocketSession<Derived>::doWrite()
 	{
+		writeStart_ = std::chrono::steady_clock::now();
 		derived().ws().async_write(
 			boost::asio::buffer(*queue_.front()),
 			beast::bind_front_handler(
@@ -130,14 +285,22 @@ namespace Doppelganger
 		beast::error_code ec,
 		std::size_t bytes_transferred)
 	{
-		boost::ignore_unused(bytes_transferred);
-
 		if (ec)
 		{
 			return fail(ec, "write (websocket)");
 		}
 
+		// small messages mostly measure latency
+		if (bytes_transferred >= minBandwidthSample)
+		{
+			const std::int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - writeStart_).count();
+			const std::uint64_t sample = static_cast<std::uint64_t>(bytes_transferred) * 1000000ull / static_cast<std::uint64_t>(std::max<std::int64_t>(elapsed, 1));
+			const std::uint64_t previous = bandwidth_.load(std::memory_order_relaxed);
+			bandwidth_.store((previous == 0) ? sample : (previous * 3 + sample) / 4, std::memory_order_relaxed);
+		}
+
 		queue_.erase(queue_.begin());
+		queueDepth_.fetch_sub(1, std::memory_order_relaxed);
 
 		if (!queue_.empty())
 		{
@@ -152,11 +315,7 @@ namespace Doppelganger
 
 		if (room)
 		{
-			{
-				std::stringstream ss;
-				ss << "WS session \"" << UUID_ << "\" is closed.";
-				Util::log(ss.str(), "SYSTEM", room->config);
-			}
+			DOPPELGANGER_LOG(room, SYSTEM, "WS session \"" << UUID_ << "\" is closed.");
 			// remove mouse cursor
 			//   - update parameter on this server
 			//   - broadcast message for remove
@@ -169,9 +328,7 @@ namespace Doppelganger
 				return;
 			}
 
-			std::stringstream ss;
-			ss << what << ": " << ec.message();
-			Util::log(ss.str(), "ERROR", room->config);
+			DOPPELGANGER_LOG(room, ERROR, what << ": " << ec.message());
 		}
 	}
 
@@ -179,15 +336,30 @@ namespace Doppelganger
 	WebsocketSession<Derived>::WebsocketSession(
 		const std::weak_ptr<Room> &room,
 		const std::string &UUID)
-		: room_(room), UUID_(UUID)
+		: room_(room), queueDepth_(0), bandwidth_(0), UUID_(UUID)
 	{
-		std::stringstream ss;
-		ss << "New WS session \"" << UUID_ << "\" is created.";
-		Util::log(ss.str(), "SYSTEM", room_.lock()->config);
+		const std::shared_ptr<Room> r = room_.lock();
+		if (r)
+		{
+			DOPPELGANGER_LOG(r, SYSTEM, "New WS session \"" << UUID_ << "\" is created.");
+		}
 	}
 
 	template <class Derived>
 	void WebsocketSession<Derived>::send(const std::shared_ptr<const std::string> &ss)
+	{
+		// e.g. broadcast from the home context of the room
+		queueDepth_.fetch_add(1, std::memory_order_relaxed);
+		net::post(
+			derived().ws().get_executor(),
+			beast::bind_front_handler(
+				&WebsocketSession::onSend,
+				derived().shared_from_this(),
+				ss));
+	}
+
+	template <class Derived>
+	void WebsocketSession<Derived>::onSend(const std::shared_ptr<const std::string> &ss)
 	{
 		// Always add to queue
 		queue_.push_back(ss);
@@ -206,6 +378,8 @@ template Doppelganger::PlainWebsocketSession &Doppelganger::WebsocketSession<Dop
 template void Doppelganger::WebsocketSession<Doppelganger::PlainWebsocketSession>::onAccept(beast::error_code);
 template void Doppelganger::WebsocketSession<Doppelganger::PlainWebsocketSession>::doRead();
 template void Doppelganger::WebsocketSession<Doppelganger::PlainWebsocketSession>::onRead(beast::error_code, std::size_t);
+template void Doppelganger::WebsocketSession<Doppelganger::PlainWebsocketSession>::process(const std::shared_ptr<Doppelganger::Room> &, const std::string &, const std::chrono::system_clock::time_point);
+template void Doppelganger::WebsocketSession<Doppelganger::PlainWebsocketSession>::onSend(const std::shared_ptr<const std::string> &);
 template void Doppelganger::WebsocketSession<Doppelganger::PlainWebsocketSession>::doWrite();
 template void Doppelganger::WebsocketSession<Doppelganger::PlainWebsocketSession>::onWrite(beast::error_code, std::size_t);
 template void Doppelganger::WebsocketSession<Doppelganger::PlainWebsocketSession>::fail(boost::system::error_code, char const *);
@@ -216,6 +390,8 @@ template Doppelganger::SSLWebsocketSession &Doppelganger::WebsocketSession<Doppe
 template void Doppelganger::WebsocketSession<Doppelganger::SSLWebsocketSession>::onAccept(beast::error_code);
 template void Doppelganger::WebsocketSession<Doppelganger::SSLWebsocketSession>::doRead();
 template void Doppelganger::WebsocketSession<Doppelganger::SSLWebsocketSession>::onRead(beast::error_code, std::size_t);
+template void Doppelganger::WebsocketSession<Doppelganger::SSLWebsocketSession>::process(const std::shared_ptr<Doppelganger::Room> &, const std::string &, const std::chrono::system_clock::time_point);
+template void Doppelganger::WebsocketSession<Doppelganger::SSLWebsocketSession>::onSend(const std::shared_ptr<const std::string> &);
 template void Doppelganger::WebsocketSession<Doppelganger::SSLWebsocketSession>::doWrite();
 template void Doppelganger::WebsocketSession<Doppelganger::SSLWebsocketSession>::onWrite(beast::error_code, std::size_t);
 template void Doppelganger::WebsocketSession<Doppelganger::SSLWebsocketSession>::fail(boost::system::error_code, char const *);
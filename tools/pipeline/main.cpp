@@ -0,0 +1,215 @@
+// doppelganger-pipeline
+//   measures throughput of pipelined HTTP/1.1 requests (keep-alive) against a (local) server
+//
+// usage:
+//   doppelganger-pipeline [--host 127.0.0.1] [--port 8080] [--target /room-pipeline] [--connections 4] [--depth 16] [--duration 5]
+//     --depth    : requests written at once on each connection before reading their responses
+//                  (should be <= config.at("server").at("pipelineLimit") of the server)
+//     --duration : seconds
+//
+// note: "GET <target>" is requested once before the measurement (i.e. the room is created)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+
+namespace
+{
+	namespace beast = boost::beast;	  // from <boost/beast.hpp>
+	namespace http = beast::http;	  // from <boost/beast/http.hpp>
+	namespace net = boost::asio;	  // from <boost/asio.hpp>
+	using tcp = boost::asio::ip::tcp; // from <boost/asio/ip/tcp.hpp>
+
+	struct Options
+	{
+		std::string host = "127.0.0.1";
+		std::string port = "8080";
+		std::string target = "/room-pipeline";
+		int connections = 4;
+		int depth = 16;
+		double duration = 5.0;
+	};
+
+	struct Stats
+	{
+		std::size_t responses = 0;
+		std::size_t failed = 0;
+		// per batch (write of depth requests -> last response)
+		std::vector<double> latencyMs;
+	};
+
+	// one connection: write depth requests at once, then read depth responses
+	void runConnection(const Options &options, const tcp::resolver::results_type &endpoints, const std::chrono::steady_clock::time_point &deadline, Stats &stats)
+	{
+		net::io_context ioc;
+		beast::tcp_stream stream(ioc);
+		beast::error_code ec;
+		stream.connect(endpoints, ec);
+		if (ec)
+		{
+			std::cerr << "connect: " << ec.message() << std::endl;
+			stats.failed += 1;
+			return;
+		}
+
+		// depth requests serialized back to back
+		std::string batch;
+		{
+			http::request<http::empty_body> req{http::verb::get, options.target, 11};
+			req.set(http::field::host, options.host);
+			req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+			req.keep_alive(true);
+			std::ostringstream oss;
+			oss << req;
+			const std::string one = oss.str();
+			for (int d = 0; d < options.depth; ++d)
+			{
+				batch += one;
+			}
+		}
+
+		// at least one batch (e.g. for creating the room)
+		beast::flat_buffer buffer;
+		do
+		{
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			net::write(stream, net::buffer(batch), ec);
+			if (ec)
+			{
+				std::cerr << "write: " << ec.message() << std::endl;
+				stats.failed += 1;
+				return;
+			}
+			for (int d = 0; d < options.depth; ++d)
+			{
+				http::response<http::string_body> res;
+				http::read(stream, buffer, res, ec);
+				if (ec)
+				{
+					std::cerr << "read: " << ec.message() << std::endl;
+					stats.failed += 1;
+					return;
+				}
+				stats.responses += 1;
+			}
+			stats.latencyMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		} while (std::chrono::steady_clock::now() < deadline);
+
+		stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	Options options;
+	for (int aIdx = 1; aIdx < argc; ++aIdx)
+	{
+		const std::string arg(argv[aIdx]);
+		if (arg == "--host" && aIdx + 1 < argc)
+		{
+			options.host = argv[++aIdx];
+		}
+		else if (arg == "--port" && aIdx + 1 < argc)
+		{
+			options.port = argv[++aIdx];
+		}
+		else if (arg == "--target" && aIdx + 1 < argc)
+		{
+			options.target = argv[++aIdx];
+		}
+		else if (arg == "--connections" && aIdx + 1 < argc)
+		{
+			options.connections = std::max(1, std::atoi(argv[++aIdx]));
+		}
+		else if (arg == "--depth" && aIdx + 1 < argc)
+		{
+			options.depth = std::max(1, std::atoi(argv[++aIdx]));
+		}
+		else if (arg == "--duration" && aIdx + 1 < argc)
+		{
+			options.duration = std::atof(argv[++aIdx]);
+		}
+		else
+		{
+			std::cerr << "usage: " << argv[0] << " [--host 127.0.0.1] [--port 8080] [--target /room-pipeline] [--connections 4] [--depth 16] [--duration 5]" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	net::io_context ioc;
+	tcp::resolver resolver(ioc);
+	beast::error_code ec;
+	const tcp::resolver::results_type endpoints = resolver.resolve(options.host, options.port, ec);
+	if (ec)
+	{
+		std::cerr << "resolve: " << ec.message() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// create the room (not measured)
+	{
+		Stats warmUp;
+		Options once = options;
+		once.depth = 1;
+		runConnection(once, endpoints, std::chrono::steady_clock::now(), warmUp);
+		if (warmUp.failed > 0)
+		{
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<Stats> stats(options.connections);
+	std::vector<std::thread> threads;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const std::chrono::steady_clock::time_point deadline = start + std::chrono::microseconds(static_cast<std::int64_t>(options.duration * 1.0e6));
+	for (int c = 0; c < options.connections; ++c)
+	{
+		threads.emplace_back(
+			[&options, &endpoints, &deadline, &stats, c]()
+			{
+				runConnection(options, endpoints, deadline, stats.at(c));
+			});
+	}
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	Stats total;
+	for (const auto &s : stats)
+	{
+		total.responses += s.responses;
+		total.failed += s.failed;
+		total.latencyMs.insert(total.latencyMs.end(), s.latencyMs.begin(), s.latencyMs.end());
+	}
+	std::sort(total.latencyMs.begin(), total.latencyMs.end());
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "connections : " << options.connections << " (depth: " << options.depth << ")" << std::endl;
+	std::cout << "responses   : " << total.responses << " (failed connections: " << total.failed << ")" << std::endl;
+	std::cout << "elapsed     : " << elapsed << " s" << std::endl;
+	std::cout << "throughput  : " << ((elapsed > 0.0) ? static_cast<double>(total.responses) / elapsed : 0.0) << " requests/s" << std::endl;
+	if (!total.latencyMs.empty())
+	{
+		const auto percentile = [&total](const double p)
+		{
+			return total.latencyMs.at(std::min(total.latencyMs.size() - 1, static_cast<std::size_t>(p * static_cast<double>(total.latencyMs.size()))));
+		};
+		std::cout << "batch latency: p50 " << percentile(0.5) << " ms, p99 " << percentile(0.99) << " ms, max " << total.latencyMs.back() << " ms" << std::endl;
+	}
+
+	return (total.failed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,675 @@
+// doppelganger-replay
+//   replays API calls recorded by Doppelganger::TraceRecorder against a (local) server
+//
+// usage:
+//   doppelganger-replay [--host 127.0.0.1] [--port 8080] [--speed 1.0] trace.1.bin trace.0.bin ...
+//     --speed : 1.0 replays with the original timing, 2.0 replays twice as fast, 0 replays as fast as possible
+//
+// note: rooms are created by "GET /<roomUUID>" before replay.
+//       WS calls are sent through one websocket connection per (room, session) in the trace.
+//       they are sent with "requestId" (and "sessionUUID" given by the server), and completed when the server
+//       sends {"API": "completed"} for them (i.e. after the response), so their latency includes the API call.
+
+#include "Doppelganger/TraceRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <boost/beast/websocket.hpp>
+
+namespace
+{
+	namespace beast = boost::beast;			// from <boost/beast.hpp>
+	namespace http = beast::http;			// from <boost/beast/http.hpp>
+	namespace websocket = beast::websocket; // from <boost/beast/websocket.hpp>
+	namespace net = boost::asio;			// from <boost/asio.hpp>
+	using tcp = boost::asio::ip::tcp;		// from <boost/asio/ip/tcp.hpp>
+
+	struct Options
+	{
+		std::string host = "127.0.0.1";
+		std::string port = "8080";
+		double speed = 1.0;
+		std::vector<std::string> files;
+	};
+
+	struct Stats
+	{
+		std::size_t dispatched = 0;
+		std::size_t completed = 0;
+		std::size_t failed = 0;
+		// per Doppelganger::TraceRecord::Transport
+		std::vector<double> latencyMs[2];
+	};
+
+	class Replayer;
+
+	////
+	// one keep-alive HTTP connection per room (requests are sent one by one)
+	////
+	class HTTPConnection : public std::enable_shared_from_this<HTTPConnection>
+	{
+	public:
+		HTTPConnection(Replayer &replayer, net::io_context &ioc, const tcp::resolver::results_type &endpoints, const std::string &host)
+			: replayer_(replayer), stream_(ioc), endpoints_(endpoints), host_(host), connected_(false), busy_(false)
+		{
+		}
+
+		void send(const std::string &target, const std::string &body);
+
+	private:
+		void next();
+		void onConnect(beast::error_code ec, tcp::resolver::results_type::endpoint_type);
+		void onWrite(beast::error_code ec, std::size_t);
+		void onRead(beast::error_code ec, std::size_t);
+
+		Replayer &replayer_;
+		beast::tcp_stream stream_;
+		tcp::resolver::results_type endpoints_;
+		std::string host_;
+		bool connected_;
+		bool busy_;
+		std::deque<std::pair<std::string, std::string>> pending_;
+		http::request<http::string_body> req_;
+		http::response<http::string_body> res_;
+		beast::flat_buffer buffer_;
+		std::chrono::steady_clock::time_point sentAt_;
+	};
+
+	////
+	// one websocket connection per (room, session)
+	////
+	class WSConnection : public std::enable_shared_from_this<WSConnection>
+	{
+	public:
+		WSConnection(Replayer &replayer, net::io_context &ioc, const tcp::resolver::results_type &endpoints, const std::string &host, const std::string &target)
+			: replayer_(replayer), ws_(ioc), endpoints_(endpoints), host_(host), target_(target), state_(State::IDLE), writing_(false), writingRequestId_(-1), nextRequestId_(0)
+		{
+		}
+
+		void send(const std::string &payload);
+		void close();
+
+	private:
+		enum class State
+		{
+			IDLE,
+			CONNECTING,
+			OPEN,
+			CLOSED
+		};
+
+		void onConnect(beast::error_code ec, tcp::resolver::results_type::endpoint_type);
+		void onHandshake(beast::error_code ec);
+		void doRead();
+		void onRead(beast::error_code ec, std::size_t);
+		void doWrite();
+		void onWrite(beast::error_code ec, std::size_t);
+		// every call not completed yet fails (e.g. the connection is closed)
+		void failAll();
+
+		Replayer &replayer_;
+		websocket::stream<beast::tcp_stream> ws_;
+		tcp::resolver::results_type endpoints_;
+		std::string host_;
+		std::string target_;
+		State state_;
+		bool writing_;
+		// given by the server ("initializeSession"). we send calls after we receive it
+		std::string sessionUUID_;
+		std::deque<std::string> pending_;
+		// the message being written (requestId is -1 for payloads that are not JSON objects)
+		std::string writingPayload_;
+		std::int64_t writingRequestId_;
+		// requestId -> sent at (calls waiting for {"API": "completed"})
+		std::map<std::int64_t, std::chrono::steady_clock::time_point> inflight_;
+		std::int64_t nextRequestId_;
+		beast::flat_buffer buffer_;
+	};
+
+	class Replayer
+	{
+	public:
+		Replayer(const Options &options, std::vector<Doppelganger::TraceRecord> &&records)
+			: options_(options), records_(std::move(records)), timer_(ioc_), next_(0)
+		{
+		}
+
+		int run()
+		{
+			beast::error_code ec;
+			tcp::resolver resolver(ioc_);
+			endpoints_ = resolver.resolve(options_.host, options_.port, ec);
+			if (ec)
+			{
+				std::cerr << "resolve: " << ec.message() << std::endl;
+				return EXIT_FAILURE;
+			}
+			host_ = options_.host + ":" + options_.port;
+
+			if (!createRooms())
+			{
+				return EXIT_FAILURE;
+			}
+
+			start_ = std::chrono::steady_clock::now();
+			schedule();
+			ioc_.run();
+			report();
+			return EXIT_SUCCESS;
+		}
+
+		void onCompleted(const std::uint8_t transport, const bool success, const double latencyMs)
+		{
+			if (success)
+			{
+				++stats_.completed;
+				if (latencyMs >= 0.0)
+				{
+					stats_.latencyMs[transport].push_back(latencyMs);
+				}
+			}
+			else
+			{
+				++stats_.failed;
+			}
+			finishIfDone();
+		}
+
+	private:
+		bool createRooms()
+		{
+			std::set<std::string> rooms;
+			for (const auto &record : records_)
+			{
+				rooms.insert(record.roomUUID);
+			}
+			for (const auto &roomUUID : rooms)
+			{
+				beast::error_code ec;
+				beast::tcp_stream stream(ioc_);
+				stream.connect(endpoints_, ec);
+				if (ec)
+				{
+					std::cerr << "connect: " << ec.message() << std::endl;
+					return false;
+				}
+				http::request<http::empty_body> req{http::verb::get, "/" + roomUUID, 11};
+				req.set(http::field::host, host_);
+				req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+				http::write(stream, req, ec);
+				beast::flat_buffer buffer;
+				http::response<http::string_body> res;
+				http::read(stream, buffer, res, ec);
+				if (ec)
+				{
+					std::cerr << "create room \"" << roomUUID << "\": " << ec.message() << std::endl;
+					return false;
+				}
+				stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+			}
+			return true;
+		}
+
+		void schedule()
+		{
+			if (next_ >= records_.size())
+			{
+				finishIfDone();
+				return;
+			}
+
+			if (options_.speed <= 0.0)
+			{
+				dispatch(records_.at(next_++));
+				// yield to let other handlers progress
+				net::post(ioc_, [this]()
+						  { schedule(); });
+				return;
+			}
+
+			const std::uint64_t offsetNs = records_.at(next_).timestamp - records_.front().timestamp;
+			const auto due = start_ + std::chrono::nanoseconds(static_cast<std::int64_t>(offsetNs / options_.speed));
+			timer_.expires_at(due);
+			timer_.async_wait(
+				[this](beast::error_code ec)
+				{
+					if (ec)
+					{
+						return;
+					}
+					dispatch(records_.at(next_++));
+					schedule();
+				});
+		}
+
+		void dispatch(const Doppelganger::TraceRecord &record)
+		{
+			++stats_.dispatched;
+			if (record.transport == Doppelganger::TraceRecord::HTTP)
+			{
+				std::shared_ptr<HTTPConnection> &connection = http_[record.roomUUID];
+				if (!connection)
+				{
+					connection = std::make_shared<HTTPConnection>(*this, ioc_, endpoints_, host_);
+				}
+				connection->send("/" + record.roomUUID + "/" + record.APIName, record.parameters);
+			}
+			else
+			{
+				std::shared_ptr<WSConnection> &connection = ws_[std::make_pair(record.roomUUID, record.sessionUUID)];
+				if (!connection)
+				{
+					connection = std::make_shared<WSConnection>(*this, ioc_, endpoints_, host_, "/" + record.roomUUID);
+				}
+				connection->send(record.parameters);
+			}
+		}
+
+		void finishIfDone()
+		{
+			if (next_ >= records_.size() && stats_.completed + stats_.failed >= stats_.dispatched)
+			{
+				end_ = std::chrono::steady_clock::now();
+				for (auto &key_connection : ws_)
+				{
+					key_connection.second->close();
+				}
+				timer_.cancel();
+				ioc_.stop();
+			}
+		}
+
+		void report()
+		{
+			const double elapsed = std::chrono::duration<double>(end_ - start_).count();
+			double originalSpan = 0.0;
+			double originalPlugin = 0.0;
+			if (!records_.empty())
+			{
+				originalSpan = static_cast<double>(records_.back().timestamp - records_.front().timestamp) * 1.0e-9;
+			}
+			for (const auto &record : records_)
+			{
+				originalPlugin += static_cast<double>(record.duration) * 1.0e-9;
+			}
+
+			std::cout << std::fixed << std::setprecision(3);
+			std::cout << "records     : " << records_.size() << std::endl;
+			std::cout << "completed   : " << stats_.completed << " (failed: " << stats_.failed << ")" << std::endl;
+			std::cout << "elapsed     : " << elapsed << " s (original: " << originalSpan << " s, plugin time: " << originalPlugin << " s)" << std::endl;
+			std::cout << "throughput  : " << ((elapsed > 0.0) ? static_cast<double>(stats_.completed) / elapsed : 0.0) << " calls/s" << std::endl;
+
+			for (const std::uint8_t transport : {Doppelganger::TraceRecord::HTTP, Doppelganger::TraceRecord::WS})
+			{
+				std::vector<double> &latency = stats_.latencyMs[transport];
+				if (latency.empty())
+				{
+					continue;
+				}
+				std::sort(latency.begin(), latency.end());
+				const auto percentile = [&latency](const double p)
+				{
+					const std::size_t idx = std::min(latency.size() - 1, static_cast<std::size_t>(p * static_cast<double>(latency.size())));
+					return latency.at(idx);
+				};
+				const double mean = std::accumulate(latency.begin(), latency.end(), 0.0) / static_cast<double>(latency.size());
+				std::cout << ((transport == Doppelganger::TraceRecord::HTTP) ? "HTTP" : "WS  ") << " latency: mean " << mean << " ms, p50 " << percentile(0.5) << " ms, p99 " << percentile(0.99) << " ms, max " << latency.back() << " ms" << std::endl;
+			}
+		}
+
+		const Options options_;
+		std::vector<Doppelganger::TraceRecord> records_;
+		net::io_context ioc_;
+		net::steady_timer timer_;
+		tcp::resolver::results_type endpoints_;
+		std::string host_;
+		std::size_t next_;
+		std::chrono::steady_clock::time_point start_;
+		std::chrono::steady_clock::time_point end_;
+		Stats stats_;
+		std::map<std::string, std::shared_ptr<HTTPConnection>> http_;
+		std::map<std::pair<std::string, std::string>, std::shared_ptr<WSConnection>> ws_;
+	};
+
+	////
+	// HTTPConnection
+	////
+	void HTTPConnection::send(const std::string &target, const std::string &body)
+	{
+		pending_.emplace_back(target, body);
+		if (!busy_)
+		{
+			next();
+		}
+	}
+
+	void HTTPConnection::next()
+	{
+		if (pending_.empty())
+		{
+			busy_ = false;
+			return;
+		}
+		busy_ = true;
+
+		if (!connected_)
+		{
+			stream_.async_connect(
+				endpoints_,
+				beast::bind_front_handler(&HTTPConnection::onConnect, shared_from_this()));
+			return;
+		}
+
+		req_ = http::request<http::string_body>{http::verb::post, pending_.front().first, 11};
+		req_.set(http::field::host, host_);
+		req_.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+		req_.set(http::field::content_type, "application/json");
+		req_.keep_alive(true);
+		req_.body() = std::move(pending_.front().second);
+		req_.prepare_payload();
+		pending_.pop_front();
+
+		sentAt_ = std::chrono::steady_clock::now();
+		http::async_write(
+			stream_,
+			req_,
+			beast::bind_front_handler(&HTTPConnection::onWrite, shared_from_this()));
+	}
+
+	void HTTPConnection::onConnect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
+	{
+		if (ec)
+		{
+			std::cerr << "connect (HTTP): " << ec.message() << std::endl;
+			// drop every pending request
+			const std::size_t dropped = pending_.size();
+			pending_.clear();
+			busy_ = false;
+			for (std::size_t i = 0; i < dropped; ++i)
+			{
+				replayer_.onCompleted(Doppelganger::TraceRecord::HTTP, false, -1.0);
+			}
+			return;
+		}
+		connected_ = true;
+		next();
+	}
+
+	void HTTPConnection::onWrite(beast::error_code ec, std::size_t)
+	{
+		if (ec)
+		{
+			// next() reconnects with the same stream (i.e. the socket must be released first)
+			connected_ = false;
+			beast::error_code ignored;
+			stream_.socket().close(ignored);
+			replayer_.onCompleted(Doppelganger::TraceRecord::HTTP, false, -1.0);
+			return next();
+		}
+
+		res_ = {};
+		http::async_read(
+			stream_,
+			buffer_,
+			res_,
+			beast::bind_front_handler(&HTTPConnection::onRead, shared_from_this()));
+	}
+
+	void HTTPConnection::onRead(beast::error_code ec, std::size_t)
+	{
+		const double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sentAt_).count();
+		if (ec)
+		{
+			connected_ = false;
+			beast::error_code ignored;
+			stream_.socket().close(ignored);
+		}
+		else if (!res_.keep_alive())
+		{
+			connected_ = false;
+			beast::error_code ignored;
+			stream_.socket().close(ignored);
+		}
+		replayer_.onCompleted(Doppelganger::TraceRecord::HTTP, !ec && res_.result() == http::status::ok, latencyMs);
+		next();
+	}
+
+	////
+	// WSConnection
+	////
+	void WSConnection::send(const std::string &payload)
+	{
+		pending_.push_back(payload);
+		if (state_ == State::IDLE)
+		{
+			state_ = State::CONNECTING;
+			beast::get_lowest_layer(ws_).async_connect(
+				endpoints_,
+				beast::bind_front_handler(&WSConnection::onConnect, shared_from_this()));
+		}
+		else if (state_ == State::OPEN && !writing_ && !sessionUUID_.empty())
+		{
+			doWrite();
+		}
+		else if (state_ == State::CLOSED)
+		{
+			pending_.pop_back();
+			replayer_.onCompleted(Doppelganger::TraceRecord::WS, false, -1.0);
+		}
+	}
+
+	void WSConnection::close()
+	{
+		if (state_ == State::OPEN)
+		{
+			state_ = State::CLOSED;
+			ws_.async_close(websocket::close_code::normal, [self = shared_from_this()](beast::error_code) {});
+		}
+	}
+
+	void WSConnection::onConnect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
+	{
+		if (ec)
+		{
+			std::cerr << "connect (WS): " << ec.message() << std::endl;
+			return onHandshake(ec);
+		}
+		beast::get_lowest_layer(ws_).expires_never();
+		ws_.set_option(websocket::stream_base::timeout::suggested(beast::role_type::client));
+		ws_.async_handshake(
+			host_,
+			target_,
+			beast::bind_front_handler(&WSConnection::onHandshake, shared_from_this()));
+	}
+
+	void WSConnection::onHandshake(beast::error_code ec)
+	{
+		if (ec)
+		{
+			state_ = State::CLOSED;
+			return failAll();
+		}
+		state_ = State::OPEN;
+		// calls are sent after "initializeSession"
+		doRead();
+	}
+
+	void WSConnection::doRead()
+	{
+		ws_.async_read(
+			buffer_,
+			beast::bind_front_handler(&WSConnection::onRead, shared_from_this()));
+	}
+
+	void WSConnection::onRead(beast::error_code ec, std::size_t)
+	{
+		if (ec)
+		{
+			if (state_ != State::CLOSED)
+			{
+				std::cerr << "read (WS): " << ec.message() << std::endl;
+				state_ = State::CLOSED;
+			}
+			return failAll();
+		}
+		const std::string message = beast::buffers_to_string(buffer_.data());
+		buffer_.consume(buffer_.size());
+
+		// we discard broadcasts and responses (calls are completed by "completed")
+		const Doppelganger::json messageJson = Doppelganger::json::parse(message, nullptr, false);
+		if (messageJson.is_object() && messageJson.contains("API") && messageJson.contains("parameters") && messageJson.at("parameters").is_object())
+		{
+			const Doppelganger::json &parameters = messageJson.at("parameters");
+			if (messageJson.at("API") == "initializeSession" && parameters.contains("sessionUUID") && sessionUUID_.empty())
+			{
+				sessionUUID_ = parameters.at("sessionUUID").get<std::string>();
+				if (!pending_.empty() && !writing_)
+				{
+					doWrite();
+				}
+			}
+			else if (messageJson.at("API") == "completed" && parameters.contains("requestId") && parameters.at("requestId").is_number_integer())
+			{
+				const auto it = inflight_.find(parameters.at("requestId").get<std::int64_t>());
+				if (it != inflight_.end())
+				{
+					const double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - it->second).count();
+					inflight_.erase(it);
+					const bool failed = parameters.contains("failed") && parameters.at("failed").is_boolean() && parameters.at("failed").get<bool>();
+					replayer_.onCompleted(Doppelganger::TraceRecord::WS, !failed, latencyMs);
+				}
+			}
+		}
+		doRead();
+	}
+
+	void WSConnection::doWrite()
+	{
+		writing_ = true;
+		// the call is sent as our session (i.e. the response is sent to this connection)
+		writingPayload_ = std::move(pending_.front());
+		pending_.pop_front();
+		Doppelganger::json payloadJson = Doppelganger::json::parse(writingPayload_, nullptr, false);
+		if (payloadJson.is_object())
+		{
+			writingRequestId_ = nextRequestId_++;
+			payloadJson["sessionUUID"] = sessionUUID_;
+			payloadJson["requestId"] = writingRequestId_;
+			writingPayload_ = payloadJson.dump(-1, ' ', true);
+			// "completed" may be read before onWrite()
+			inflight_[writingRequestId_] = std::chrono::steady_clock::now();
+		}
+		else
+		{
+			// sent as is. the server can't answer it (i.e. it fails once it is written)
+			writingRequestId_ = -1;
+		}
+		ws_.text(true);
+		ws_.async_write(
+			net::buffer(writingPayload_),
+			beast::bind_front_handler(&WSConnection::onWrite, shared_from_this()));
+	}
+
+	void WSConnection::onWrite(beast::error_code ec, std::size_t)
+	{
+		writing_ = false;
+		if (writingRequestId_ < 0 || (ec && inflight_.erase(writingRequestId_) > 0))
+		{
+			replayer_.onCompleted(Doppelganger::TraceRecord::WS, false, -1.0);
+		}
+		if (!ec && !pending_.empty() && state_ == State::OPEN)
+		{
+			doWrite();
+		}
+	}
+
+	void WSConnection::failAll()
+	{
+		const std::size_t dropped = pending_.size() + inflight_.size();
+		pending_.clear();
+		inflight_.clear();
+		for (std::size_t i = 0; i < dropped; ++i)
+		{
+			replayer_.onCompleted(Doppelganger::TraceRecord::WS, false, -1.0);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	Options options;
+	for (int aIdx = 1; aIdx < argc; ++aIdx)
+	{
+		const std::string arg(argv[aIdx]);
+		if (arg == "--host" && aIdx + 1 < argc)
+		{
+			options.host = argv[++aIdx];
+		}
+		else if (arg == "--port" && aIdx + 1 < argc)
+		{
+			options.port = argv[++aIdx];
+		}
+		else if (arg == "--speed" && aIdx + 1 < argc)
+		{
+			options.speed = std::atof(argv[++aIdx]);
+		}
+		else
+		{
+			options.files.push_back(arg);
+		}
+	}
+
+	if (options.files.empty())
+	{
+		std::cerr << "usage: " << argv[0] << " [--host 127.0.0.1] [--port 8080] [--speed 1.0] trace.bin ..." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Doppelganger::TraceRecord> records;
+	for (const auto &file : options.files)
+	{
+		std::ifstream ifs(file, std::ios::binary);
+		if (!ifs || !Doppelganger::TraceRecord::readHeader(ifs))
+		{
+			std::cerr << "\"" << file << "\" is not a trace file." << std::endl;
+			return EXIT_FAILURE;
+		}
+		Doppelganger::TraceRecord record;
+		while (record.decode(ifs))
+		{
+			records.push_back(record);
+		}
+	}
+	// rotated files could be given in any order
+	std::stable_sort(
+		records.begin(),
+		records.end(),
+		[](const Doppelganger::TraceRecord &a, const Doppelganger::TraceRecord &b)
+		{ return a.timestamp < b.timestamp; });
+
+	if (records.empty())
+	{
+		std::cerr << "No record is found." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	Replayer replayer(options, std::move(records));
+	return replayer.run();
+}